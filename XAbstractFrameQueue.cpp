@@ -0,0 +1,29 @@
+//
+//  XAbstractFrameQueue.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XAbstractFrameQueue.h"
+
+XAbstractFrameQueue::XAbstractFrameQueue(int capacity)
+: mCapacity(capacity), mMemoryPolicy(MEMORY_POLICY_BLOCK), mShedCount(0) {
+}
+
+XAbstractFrameQueue::~XAbstractFrameQueue() {
+
+}
+
+int XAbstractFrameQueue::getCapacity() const {
+    return mCapacity;
+}
+
+void XAbstractFrameQueue::setMemoryPolicy(MemoryPolicy policy) {
+    mMemoryPolicy = policy;
+}
+
+long XAbstractFrameQueue::getShedCount() const {
+    return mShedCount.load();
+}
@@ -0,0 +1,93 @@
+//
+//  XAbstractFrameQueue.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XABSTRACTFRAMEQUEUE_H
+#define XEXPORTER_XABSTRACTFRAMEQUEUE_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include "XFFHeader.h"
+#include "XMemoryBudget.h"
+
+/**
+ * @brief 帧队列接口：加锁的XFrameQueue和无锁的XFrameRingQueue共用，
+ * 只持有两者都用到的容量和内存策略，队列本身的存储和同步由子类实现
+ * nullptr可作为结束标记放入，signal()后put丢弃帧、get返回nullptr
+ */
+class XAbstractFrameQueue {
+public:
+    explicit XAbstractFrameQueue(int capacity);
+
+    virtual ~XAbstractFrameQueue();
+
+    /**
+     * 队列满时等待；超出字节上限或全局内存预算时按MemoryPolicy等待或丢弃
+     * @param timeoutMs 所有等待（空位、字节上限、全局预算）合计最多等待的毫秒数，<0表示一直等待
+     * @return 放入队列时返回true，按策略丢弃、超时或中止时返回false
+     */
+    virtual bool put(std::shared_ptr<Frame> frame, int timeoutMs = -1) = 0;
+
+    /**
+     * 依次放入多帧，比逐帧调用put少加锁/唤醒
+     * @return 放入的帧数，中止或按MEMORY_POLICY_SHED丢弃时少于frames.size()
+     */
+    virtual int putBatch(const std::vector<std::shared_ptr<Frame>>& frames) = 0;
+
+    virtual std::shared_ptr<Frame> get(bool wait = true) = 0;
+
+    /**
+     * 等待队列出现空位，最多等待timeoutMs毫秒（0表示只检查一次）
+     * @return 有空位且未超出字节上限和全局内存预算时返回true，超时或中止时返回false
+     * @note 只有一个生产者时，返回true后空位不会被占用，但全局预算可能被其他队列先用掉，
+     * 紧接着的put仍可能等待预算，需要限时的调用方应给put传入超时
+     */
+    virtual bool waitWritable(int timeoutMs) = 0;
+
+    /**
+     * 从队头丢弃一帧，给新帧腾出位置
+     * @return 是否丢弃了一帧，队列为空或不支持时返回false
+     */
+    virtual bool dropOldest() = 0;
+
+    virtual void flush() = 0;
+
+    virtual void signal() = 0;
+
+    virtual int getSize() = 0;
+
+    /**
+     * 队列中帧缓冲的总字节数
+     */
+    virtual long getBytes() = 0;
+
+    /**
+     * 队列中帧缓冲的字节上限，<=0表示只按帧数限制；队列为空时总是可以放入一帧，需在使用前设置
+     */
+    virtual void setByteLimit(long bytes) = 0;
+
+    int getCapacity() const;
+
+    void setMemoryPolicy(MemoryPolicy policy);
+
+    /**
+     * MEMORY_POLICY_SHED下被丢弃的帧数
+     */
+    long getShedCount() const;
+
+protected:
+    static const int FQ_DEFAULT_PARAM_CAPACITY = 5;
+    // 等待全局预算时每隔这么久检查一次自己的队列是否已空，空队列直接记账避免互相等待
+    static const int FQ_BUDGET_RECHECK_MS = 20;
+
+    int mCapacity;
+    MemoryPolicy mMemoryPolicy;
+    std::atomic<long> mShedCount;
+};
+
+#endif //XEXPORTER_XABSTRACTFRAMEQUEUE_H
@@ -0,0 +1,409 @@
+//
+//  XAsyncFileWriter.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XAsyncFileWriter.h"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include "XThreadUtils.h"
+
+#if XEXPORTER_HAVE_LIBURING
+#include <liburing.h>
+#else
+struct io_uring {
+};
+#endif
+
+XAsyncFileWriter::XAsyncFileWriter(int blockSize, int blockCount)
+: mBlockSize(std::max(blockSize, AW_IO_BUFFER_SIZE)), mBlockCount(std::max(blockCount, 2)), mFd(-1),
+  mIOContext(nullptr), mCurrent(nullptr), mSubmittedEnd(0), mPosition(0), mFileSize(0), mFinished(false),
+  mError(0), mWrittenBytes(0) {
+}
+
+XAsyncFileWriter::~XAsyncFileWriter() {
+    close();
+}
+
+int XAsyncFileWriter::open(const std::string& path) {
+    mFd = ::open(path.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (mFd < 0) {
+        int ret = AVERROR(errno);
+        av_log(nullptr, AV_LOG_FATAL, "[XAsyncFileWriter] open %s failed: %s\n", path.data(), av_err2str(ret));
+        return ret;
+    }
+
+    mBlocks.resize(mBlockCount);
+    for (auto& block : mBlocks) {
+        void* data = nullptr;
+        if (posix_memalign(&data, AW_BUFFER_ALIGN, mBlockSize) != 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XAsyncFileWriter] alloc block failed: Out of memory\n");
+            return AVERROR(ENOMEM);
+        }
+        block.data = reinterpret_cast<uint8_t*>(data);
+        mFreeBlocks.push(&block);
+    }
+
+    auto buffer = reinterpret_cast<uint8_t*>(av_malloc(AW_IO_BUFFER_SIZE));
+    if (!buffer) {
+        return AVERROR(ENOMEM);
+    }
+    mIOContext = avio_alloc_context(buffer, AW_IO_BUFFER_SIZE, 1, this, nullptr, writePacket, seekPacket);
+    if (!mIOContext) {
+        av_free(buffer);
+        av_log(nullptr, AV_LOG_FATAL, "[XAsyncFileWriter] avio_alloc_context failed!\n");
+        return AVERROR(ENOMEM);
+    }
+
+    if (!initUring()) {
+        mRing.reset();
+    }
+    mFlushTid = std::make_unique<std::thread>([this] { flushWorkThread(this); });
+    av_log(nullptr, AV_LOG_INFO, "[XAsyncFileWriter] open %s, block: %d x %d bytes, backend: %s\n", path.data(),
+           mBlockCount, mBlockSize, getBackendName());
+    return 0;
+}
+
+AVIOContext* XAsyncFileWriter::getIOContext() const {
+    return mIOContext;
+}
+
+int XAsyncFileWriter::close() {
+    if (mIOContext) {
+        // 把AVIOContext中剩余的数据交给write，再提交最后一块
+        avio_flush(mIOContext);
+        if (mIOContext->error < 0 && mError == 0) {
+            mError = mIOContext->error;
+        }
+        av_freep(&mIOContext->buffer);
+        avio_context_free(&mIOContext);
+    }
+
+    if (mFlushTid) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            submitBlock();
+            mFinished = true;
+            mCond.notify_all();
+        }
+        if (mFlushTid->joinable()) {
+            mFlushTid->join();
+        }
+        mFlushTid.reset();
+    }
+
+#if XEXPORTER_HAVE_LIBURING
+    if (mRing) {
+        io_uring_queue_exit(mRing.get());
+        mRing.reset();
+    }
+#endif
+
+    if (mFd >= 0) {
+        if (::close(mFd) < 0 && mError == 0) {
+            mError = AVERROR(errno);
+        }
+        mFd = -1;
+    }
+
+    for (auto& block : mBlocks) {
+        free(block.data);
+    }
+    mBlocks.clear();
+    std::queue<Block*>().swap(mFreeBlocks);
+    std::queue<Block*>().swap(mPendingBlocks);
+    mCurrent = nullptr;
+
+    return mError;
+}
+
+long XAsyncFileWriter::getWrittenBytes() const {
+    return mWrittenBytes;
+}
+
+const char* XAsyncFileWriter::getBackendName() const {
+    return mRing ? "io_uring" : "pwrite";
+}
+
+int XAsyncFileWriter::writePacket(void* opaque, uint8_t* buf, int bufSize) {
+    return reinterpret_cast<XAsyncFileWriter*>(opaque)->write(buf, bufSize);
+}
+
+int64_t XAsyncFileWriter::seekPacket(void* opaque, int64_t offset, int whence) {
+    return reinterpret_cast<XAsyncFileWriter*>(opaque)->seek(offset, whence);
+}
+
+int XAsyncFileWriter::write(const uint8_t* buf, int size) {
+    int error = mError;
+    if (error < 0) {
+        return error;
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    // seek之后的数据与当前块不连续，需要另起一块
+    if (mCurrent && mCurrent->offset + mCurrent->size != mPosition) {
+        submitBlock();
+    }
+
+    int written = 0;
+    while (written < size) {
+        if (!mCurrent) {
+            lock.unlock();
+            Block* block = acquireBlock();
+            lock.lock();
+            if (!block) {
+                return mError;
+            }
+            block->offset = mPosition;
+            block->size = 0;
+            block->barrier = (block->offset != mSubmittedEnd);
+            mCurrent = block;
+        }
+
+        int count = std::min(size - written, mBlockSize - mCurrent->size);
+        memcpy(mCurrent->data + mCurrent->size, buf + written, count);
+        mCurrent->size += count;
+        mPosition += count;
+        written += count;
+        if (mCurrent->size == mBlockSize) {
+            submitBlock();
+        }
+    }
+    mFileSize = std::max(mFileSize, mPosition);
+    return size;
+}
+
+int64_t XAsyncFileWriter::seek(int64_t offset, int whence) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (whence & AVSEEK_SIZE) {
+        return mFileSize;
+    }
+
+    int64_t position;
+    switch (whence & ~AVSEEK_FORCE) {
+        case SEEK_SET:
+            position = offset;
+            break;
+        case SEEK_CUR:
+            position = mPosition + offset;
+            break;
+        case SEEK_END:
+            position = mFileSize + offset;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+
+    if (position < 0) {
+        return AVERROR(EINVAL);
+    }
+    mPosition = position;
+    return position;
+}
+
+XAsyncFileWriter::Block* XAsyncFileWriter::acquireBlock() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCond.wait(lock, [=] {
+        return mError < 0 || !mFreeBlocks.empty();
+    });
+
+    if (mError < 0) {
+        return nullptr;
+    }
+
+    Block* block = mFreeBlocks.front();
+    mFreeBlocks.pop();
+    return block;
+}
+
+void XAsyncFileWriter::submitBlock() {
+    // 需持有mMutex
+    if (!mCurrent) {
+        return;
+    }
+
+    if (mCurrent->size > 0) {
+        mSubmittedEnd = mCurrent->offset + mCurrent->size;
+        mPendingBlocks.push(mCurrent);
+    } else {
+        mFreeBlocks.push(mCurrent);
+    }
+    mCurrent = nullptr;
+    mCond.notify_all();
+}
+
+void XAsyncFileWriter::releaseBlock(Block* block, int result) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (result < 0) {
+        if (mError == 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XAsyncFileWriter] write failed: %s\n", av_err2str(result));
+            mError = result;
+        }
+    } else {
+        mWrittenBytes += block->size;
+    }
+    mFreeBlocks.push(block);
+    mCond.notify_all();
+}
+
+int XAsyncFileWriter::writeFully(const Block* block) {
+    int written = 0;
+    while (written < block->size) {
+        ssize_t ret = pwrite(mFd, block->data + written, block->size - written, block->offset + written);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return AVERROR(errno);
+        }
+        written += static_cast<int>(ret);
+    }
+    return 0;
+}
+
+void XAsyncFileWriter::flushWorkThread(void* opaque) {
+    XThreadUtils::configThreadName("flushWorkThread");
+    auto writer = reinterpret_cast<XAsyncFileWriter*>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XAsyncFileWriter] flushWorkThread ++++\n");
+    if (writer->mRing) {
+        writer->flushWithUring();
+    } else {
+        writer->flushWithPwrite();
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XAsyncFileWriter] flushWorkThread ----\n");
+}
+
+void XAsyncFileWriter::flushWithPwrite() {
+    // 单线程按提交顺序写，覆盖写天然有序
+    for (;;) {
+        Block* block = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [=] {
+                return mFinished || !mPendingBlocks.empty();
+            });
+            if (mPendingBlocks.empty()) {
+                break;
+            }
+            block = mPendingBlocks.front();
+            mPendingBlocks.pop();
+        }
+
+        int ret = mError < 0 ? static_cast<int>(mError) : writeFully(block);
+        releaseBlock(block, ret);
+    }
+}
+
+#if XEXPORTER_HAVE_LIBURING
+
+bool XAsyncFileWriter::initUring() {
+    io_uring_probe* probe = io_uring_get_probe();
+    if (!probe) {
+        return false;
+    }
+    bool supported = io_uring_opcode_supported(probe, IORING_OP_WRITE);
+    io_uring_free_probe(probe);
+    if (!supported) {
+        return false;
+    }
+
+    mRing = std::make_unique<io_uring>();
+    if (io_uring_queue_init(mBlockCount, mRing.get(), 0) < 0) {
+        return false;
+    }
+    return true;
+}
+
+void XAsyncFileWriter::flushWithUring() {
+    io_uring* ring = mRing.get();
+    int inflight = 0;
+    std::vector<Block*> batch;
+    for (;;) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            if (inflight == 0) {
+                mCond.wait(lock, [=] {
+                    return mFinished || !mPendingBlocks.empty();
+                });
+            }
+            while (!mPendingBlocks.empty() && inflight + static_cast<int>(batch.size()) < mBlockCount) {
+                batch.emplace_back(mPendingBlocks.front());
+                mPendingBlocks.pop();
+            }
+            if (batch.empty() && inflight == 0 && mFinished) {
+                break;
+            }
+        }
+
+        for (Block* block : batch) {
+            if (mError < 0) {
+                releaseBlock(block, mError);
+                continue;
+            }
+            io_uring_sqe* sqe = io_uring_get_sqe(ring);
+            io_uring_prep_write(sqe, mFd, block->data, block->size, block->offset);
+            if (block->barrier) {
+                // 覆盖写必须在之前的写完成后才开始
+                sqe->flags |= IOSQE_IO_DRAIN;
+            }
+            io_uring_sqe_set_data(sqe, block);
+            inflight++;
+        }
+        if (!batch.empty()) {
+            io_uring_submit(ring);
+        }
+
+        if (inflight == 0) {
+            continue;
+        }
+
+        io_uring_cqe* cqe = nullptr;
+        int ret = io_uring_wait_cqe(ring, &cqe);
+        while (ret == 0 && cqe) {
+            auto block = reinterpret_cast<Block*>(io_uring_cqe_get_data(cqe));
+            int result = cqe->res;
+            io_uring_cqe_seen(ring, cqe);
+            inflight--;
+
+            if (result >= 0 && result < block->size) {
+                // 普通文件很少出现短写，剩余部分同步补写
+                Block rest = *block;
+                rest.data += result;
+                rest.offset += result;
+                rest.size -= result;
+                result = writeFully(&rest);
+            }
+            releaseBlock(block, result < 0 ? result : 0);
+
+            cqe = nullptr;
+            ret = io_uring_peek_cqe(ring, &cqe);
+        }
+        if (ret < 0 && ret != -EAGAIN && ret != -EINTR) {
+            av_log(nullptr, AV_LOG_FATAL, "[XAsyncFileWriter] io_uring_wait_cqe failed: %s\n", av_err2str(ret));
+            std::lock_guard<std::mutex> lock(mMutex);
+            mError = ret;
+            mCond.notify_all();
+            break;
+        }
+    }
+}
+
+#else
+
+bool XAsyncFileWriter::initUring() {
+    return false;
+}
+
+void XAsyncFileWriter::flushWithUring() {
+    flushWithPwrite();
+}
+
+#endif
@@ -0,0 +1,143 @@
+//
+//  XAsyncFileWriter.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XASYNCFILEWRITER_H
+#define XEXPORTER_XASYNCFILEWRITER_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include "XFFHeader.h"
+
+struct io_uring;
+
+/**
+ * @brief 带大块缓冲的异步文件输出，作为自定义AVIOContext交给复用器使用
+ * 复用器写入的数据先拷贝到按页对齐的大块缓冲，写满（或发生seek）后交给后台线程按文件偏移写盘；
+ * 编译时找到liburing且内核支持IORING_OP_WRITE时使用io_uring，否则使用pwrite
+ * @note 写盘是异步的，关闭之前不能从文件读回刚写入的数据（例如mp4的faststart）
+ */
+class XAsyncFileWriter {
+public:
+    /**
+     * @param blockSize 每块缓冲的字节数
+     * @param blockCount 缓冲块数量，全部在写盘时write阻塞
+     */
+    explicit XAsyncFileWriter(int blockSize = AW_DEFAULT_BLOCK_SIZE, int blockCount = AW_DEFAULT_BLOCK_COUNT);
+
+    ~XAsyncFileWriter();
+
+    /**
+     * @brief 创建文件和AVIOContext，启动写盘线程
+     * @return 0表示成功，其他表示失败
+     */
+    int open(const std::string& path);
+
+    /**
+     * @brief 获取交给AVFormatContext::pb的AVIOContext，所有权仍归XAsyncFileWriter
+     */
+    AVIOContext* getIOContext() const;
+
+    /**
+     * @brief 写出所有缓冲的数据并关闭文件，释放AVIOContext
+     * @return 写盘过程中的第一个错误，0表示成功
+     */
+    int close();
+
+    long getWrittenBytes() const;
+
+    /**
+     * @brief 实际使用的写盘方式：io_uring / pwrite
+     */
+    const char* getBackendName() const;
+
+private:
+    struct Block {
+        uint8_t* data = nullptr;
+        int64_t offset = 0;
+        int size = 0;
+        // 与上一块不连续，前面的写盘完成后才能开始，保证覆盖写的先后顺序
+        bool barrier = false;
+    };
+
+    static int writePacket(void* opaque, uint8_t* buf, int bufSize);
+
+    static int64_t seekPacket(void* opaque, int64_t offset, int whence);
+
+    int write(const uint8_t* buf, int size);
+
+    int64_t seek(int64_t offset, int whence);
+
+    Block* acquireBlock();
+
+    void submitBlock();
+
+    void releaseBlock(Block* block, int result);
+
+    int writeFully(const Block* block);
+
+    void flushWorkThread(void* opaque);
+
+    void flushWithPwrite();
+
+    bool initUring();
+
+    void flushWithUring();
+
+private:
+    static const int AW_DEFAULT_BLOCK_SIZE = 4 * 1024 * 1024;
+    static const int AW_DEFAULT_BLOCK_COUNT = 4;
+    static const int AW_BUFFER_ALIGN = 4096;
+    static const int AW_IO_BUFFER_SIZE = 256 * 1024;
+
+private:
+    int mBlockSize;
+
+    int mBlockCount;
+
+    int mFd;
+
+    AVIOContext* mIOContext;
+
+    std::vector<Block> mBlocks;
+
+    std::queue<Block*> mFreeBlocks;
+
+    std::queue<Block*> mPendingBlocks;
+
+    // 正在由复用线程填充的块
+    Block* mCurrent;
+
+    // 上一个提交的块的结束位置
+    int64_t mSubmittedEnd;
+
+    int64_t mPosition;
+
+    int64_t mFileSize;
+
+    std::mutex mMutex;
+
+    std::condition_variable mCond;
+
+    bool mFinished;
+
+    std::atomic<int> mError;
+
+    std::atomic<long> mWrittenBytes;
+
+    std::unique_ptr<std::thread> mFlushTid;
+
+    std::unique_ptr<io_uring> mRing;
+};
+
+#endif //XEXPORTER_XASYNCFILEWRITER_H
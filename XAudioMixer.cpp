@@ -0,0 +1,493 @@
+//
+//  XAudioMixer.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XAudioMixer.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include "XExporter.h"
+#include "XSimd.h"
+#include "XThreadUtils.h"
+#include "XTrace.h"
+
+namespace {
+
+/**
+ * dst += src * g，g从gain开始每个采样点增加step，同一采样点的各声道使用相同的增益
+ * @return 已处理的采样点数，剩余部分由accumulateC完成
+ */
+using AccumulateFunc = int (*)(float* dst, const float* src, int frames, int channels, float gain, float step);
+
+/**
+ * 限幅到[-1, 1]，clipped累加被限幅的采样数
+ * @return 已处理的采样数（按声道计），剩余部分由limitC完成
+ */
+using LimitFunc = int (*)(float* data, int count, long& clipped);
+
+void accumulateC(float* dst, const float* src, int from, int frames, int channels, float gain, float step) {
+    for (int f = from; f < frames; ++f) {
+        float g = gain + step * f;
+        for (int c = 0; c < channels; ++c) {
+            dst[f * channels + c] += src[f * channels + c] * g;
+        }
+    }
+}
+
+void limitC(float* data, int from, int count, long& clipped) {
+    for (int i = from; i < count; ++i) {
+        float x = data[i];
+        if (x > 1.0f) {
+            data[i] = 1.0f;
+            clipped++;
+        } else if (x < -1.0f) {
+            data[i] = -1.0f;
+            clipped++;
+        }
+    }
+}
+
+int accumulateScalar(float*, const float*, int, int, float, float) {
+    return 0;
+}
+
+int limitScalar(float*, int, long&) {
+    return 0;
+}
+
+#if X_SIMD_X86
+
+X_TARGET_SSE2
+int accumulateSSE2(float* dst, const float* src, int frames, int channels, float gain, float step) {
+    // 一个向量内必须是整数个采样点，才能让同一采样点的各声道使用相同的增益
+    if (4 % channels != 0) {
+        return 0;
+    }
+    float lanes[4];
+    for (int i = 0; i < 4; ++i) {
+        lanes[i] = static_cast<float>(i / channels);
+    }
+    __m128 g = _mm_add_ps(_mm_set1_ps(gain), _mm_mul_ps(_mm_loadu_ps(lanes), _mm_set1_ps(step)));
+    const __m128 inc = _mm_set1_ps(step * (4 / channels));
+
+    int count = frames * channels;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 d = _mm_loadu_ps(dst + i);
+        __m128 s = _mm_loadu_ps(src + i);
+        _mm_storeu_ps(dst + i, _mm_add_ps(d, _mm_mul_ps(s, g)));
+        g = _mm_add_ps(g, inc);
+    }
+    return i / channels;
+}
+
+X_TARGET_SSE2
+int limitSSE2(float* data, int count, long& clipped) {
+    const __m128 hi = _mm_set1_ps(1.0f);
+    const __m128 lo = _mm_set1_ps(-1.0f);
+    int n = 0;
+    int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 x = _mm_loadu_ps(data + i);
+        __m128 y = _mm_min_ps(_mm_max_ps(x, lo), hi);
+        n += __builtin_popcount(_mm_movemask_ps(_mm_cmpneq_ps(x, y)));
+        _mm_storeu_ps(data + i, y);
+    }
+    clipped += n;
+    return i;
+}
+
+X_TARGET_AVX
+int accumulateAVX(float* dst, const float* src, int frames, int channels, float gain, float step) {
+    if (8 % channels != 0) {
+        return 0;
+    }
+    float lanes[8];
+    for (int i = 0; i < 8; ++i) {
+        lanes[i] = static_cast<float>(i / channels);
+    }
+    __m256 g = _mm256_add_ps(_mm256_set1_ps(gain), _mm256_mul_ps(_mm256_loadu_ps(lanes), _mm256_set1_ps(step)));
+    const __m256 inc = _mm256_set1_ps(step * (8 / channels));
+
+    int count = frames * channels;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 d = _mm256_loadu_ps(dst + i);
+        __m256 s = _mm256_loadu_ps(src + i);
+        _mm256_storeu_ps(dst + i, _mm256_add_ps(d, _mm256_mul_ps(s, g)));
+        g = _mm256_add_ps(g, inc);
+    }
+    return i / channels;
+}
+
+X_TARGET_AVX
+int limitAVX(float* data, int count, long& clipped) {
+    const __m256 hi = _mm256_set1_ps(1.0f);
+    const __m256 lo = _mm256_set1_ps(-1.0f);
+    int n = 0;
+    int i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 x = _mm256_loadu_ps(data + i);
+        __m256 y = _mm256_min_ps(_mm256_max_ps(x, lo), hi);
+        n += __builtin_popcount(_mm256_movemask_ps(_mm256_cmp_ps(x, y, _CMP_NEQ_UQ)));
+        _mm256_storeu_ps(data + i, y);
+    }
+    clipped += n;
+    return i;
+}
+
+#endif
+
+struct Kernel {
+    AccumulateFunc accumulate;
+    LimitFunc limit;
+    const char* name;
+};
+
+const Kernel& getKernel() {
+    static const Kernel kernel = XSimd::select<Kernel>({
+#if X_SIMD_X86
+        {SIMD_FEATURE_AVX, {accumulateAVX, limitAVX, "avx"}},
+        {SIMD_FEATURE_SSE2, {accumulateSSE2, limitSSE2, "sse2"}},
+#endif
+    }, {accumulateScalar, limitScalar, "c"});
+    return kernel;
+}
+
+void accumulate(float* dst, const float* src, int frames, int channels, float gain, float step) {
+    int done = getKernel().accumulate(dst, src, frames, channels, gain, step);
+    accumulateC(dst, src, done, frames, channels, gain, step);
+}
+
+}
+
+XAudioMixer::XAudioMixer(int sampleRate, int channels, int blockSize)
+        : mSampleRate(sampleRate), mChannels(std::max(1, channels)), mBlockSize(std::max(1, blockSize)),
+          mMixedFrames(0), mClipped(0), mError(0), mAborted(false) {
+    mMixBuffer.resize(static_cast<size_t>(mBlockSize) * mChannels);
+}
+
+XAudioMixer::~XAudioMixer() {
+    abort();
+}
+
+int XAudioMixer::addSource(const XAudioSourceOptions &options) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mMixTid) {
+        av_log(nullptr, AV_LOG_ERROR, "[XAudioMixer] addSource must be called before start()\n");
+        return -1;
+    }
+
+    auto toFrames = [this](long ms) {
+        return std::max(0L, static_cast<long>(av_rescale(ms, mSampleRate, 1000)));
+    };
+    auto source = std::make_unique<Source>();
+    source->start = toFrames(options.startTime);
+    source->duration = toFrames(options.duration);
+    source->fadeIn = toFrames(options.fadeIn);
+    source->fadeOut = source->duration > 0 ? std::min(toFrames(options.fadeOut), source->duration) : 0;
+    // 至少能放下一块，否则混音线程永远等不到一整块的数据
+    source->capacity = std::max(mBlockSize, static_cast<int>(toFrames(AM_SOURCE_DURATION)));
+    source->ring.resize(static_cast<size_t>(source->capacity) * mChannels);
+    source->targetGain = options.gain;
+    source->gain = options.gain;
+    mSources.emplace_back(std::move(source));
+    return static_cast<int>(mSources.size()) - 1;
+}
+
+void XAudioMixer::setGain(int source, float gain) {
+    if (source < 0 || source >= static_cast<int>(mSources.size())) {
+        return;
+    }
+    mSources[source]->targetGain = gain;
+}
+
+void XAudioMixer::setOutput(XExporter &exporter) {
+    exporter.setAudioInputFormat(mSampleRate, mChannels, SAMPLE_TYPE_FLT);
+    XExporter *output = &exporter;
+    mOutput = [output](const float *samples, int nbSamples) {
+        return output->encodeSample(reinterpret_cast<uint8_t *>(const_cast<float *>(samples)), nbSamples);
+    };
+}
+
+void XAudioMixer::setOutput(OutputCallback callback) {
+    mOutput = std::move(callback);
+}
+
+void XAudioMixer::start() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mMixTid) {
+        return;
+    }
+    mMixTid = std::make_unique<std::thread>([this] { mixWorkThread(this); });
+}
+
+int XAudioMixer::write(int source, const XSample &sample) {
+    if (source < 0 || source >= static_cast<int>(mSources.size()) || !sample.samples || sample.nbSamples < 0) {
+        return AVERROR(EINVAL);
+    }
+    int sampleSize = XSample::getSampleSize(sample.channels, sample.format);
+    if (sampleSize <= 0 || sample.sampleRate != mSampleRate ||
+        (sample.channels != mChannels && sample.channels != 1)) {
+        av_log(nullptr, AV_LOG_ERROR, "[XAudioMixer] unsupported sample: %d Hz, %d channels, format %d\n",
+               sample.sampleRate, sample.channels, sample.format);
+        return AVERROR(EINVAL);
+    }
+
+    Source &s = *mSources[source];
+    const uint8_t *src = sample.samples;
+    int remaining = sample.nbSamples;
+    while (remaining > 0) {
+        long pos;
+        int count;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [this, &s] {
+                return mAborted || s.finished || s.written - s.read < s.capacity;
+            });
+            if (mAborted) {
+                return -1;
+            }
+            if (s.finished) {
+                return 0;
+            }
+            long limit = s.duration > 0 ? s.duration - s.written : LONG_MAX;
+            pos = s.written;
+            count = static_cast<int>(std::min<long>({remaining, s.capacity - (s.written - s.read), limit}));
+        }
+
+        // 写入的区域混音线程不会读取，转换时不持有锁；环形缓冲在末尾折返时分两次写
+        int offset = static_cast<int>(pos % s.capacity);
+        int first = std::min(count, s.capacity - offset);
+        convertSamples(s.ring.data() + static_cast<size_t>(offset) * mChannels, src, first, sample.channels,
+                       sample.format);
+        convertSamples(s.ring.data(), src + first * sampleSize, count - first, sample.channels, sample.format);
+        src += count * sampleSize;
+        remaining -= count;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        s.written += count;
+        if (s.duration > 0 && s.written >= s.duration) {
+            s.finished = true;
+            remaining = 0;
+        }
+        mCond.notify_all();
+    }
+    return 0;
+}
+
+void XAudioMixer::finish(int source) {
+    if (source < 0 || source >= static_cast<int>(mSources.size())) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    mSources[source]->finished = true;
+    mCond.notify_all();
+}
+
+int XAudioMixer::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto &source : mSources) {
+            source->finished = true;
+        }
+        mCond.notify_all();
+    }
+    if (mMixTid && mMixTid->joinable()) {
+        mMixTid->join();
+    }
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mError;
+}
+
+void XAudioMixer::abort() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAborted = true;
+        mCond.notify_all();
+    }
+    if (mMixTid && mMixTid->joinable()) {
+        mMixTid->join();
+    }
+}
+
+int XAudioMixer::getSampleRate() const {
+    return mSampleRate;
+}
+
+int XAudioMixer::getChannels() const {
+    return mChannels;
+}
+
+long XAudioMixer::getMixedSamples() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mMixedFrames;
+}
+
+long XAudioMixer::getClippedSamples() const {
+    return mClipped.load();
+}
+
+const char *XAudioMixer::getKernelName() {
+    return getKernel().name;
+}
+
+long XAudioMixer::getSourceEnd(const Source &source) const {
+    if (source.finished) {
+        return source.start + source.written;
+    }
+    return source.duration > 0 ? source.start + source.duration : LONG_MAX;
+}
+
+bool XAudioMixer::isBlockReady(long blockStart, int &frames) const {
+    long end = 0;
+    for (const auto &source : mSources) {
+        end = std::max(end, getSourceEnd(*source));
+    }
+    if (end <= blockStart) {
+        frames = 0;
+        return true;
+    }
+
+    // 所有源都已结束时最后一块只混到最长的源的结尾
+    long blockEnd = blockStart + std::min<long>(mBlockSize, end - blockStart);
+    for (const auto &source : mSources) {
+        long from = std::max(blockStart, source->start);
+        long to = std::min(blockEnd, getSourceEnd(*source));
+        if (from < to && source->start + source->written < to) {
+            return false;
+        }
+    }
+    frames = static_cast<int>(blockEnd - blockStart);
+    return true;
+}
+
+float XAudioMixer::getGainAt(const Source &source, long frame, long blockStart, float target) const {
+    float gain = source.gain + (target - source.gain) * static_cast<float>(frame - blockStart) / mBlockSize;
+    long t = frame - source.start;
+    if (source.fadeIn > 0 && t < source.fadeIn) {
+        gain *= static_cast<float>(t) / source.fadeIn;
+    }
+    if (source.fadeOut > 0 && t > source.duration - source.fadeOut) {
+        gain *= static_cast<float>(std::max(0L, source.duration - t)) / source.fadeOut;
+    }
+    return gain;
+}
+
+void XAudioMixer::mixSource(Source &source, long blockStart) {
+    float target = source.targetGain.load();
+    // 在淡入结束、淡出开始处切开，每段内增益线性变化，用增益斜坡的内核累加
+    const long points[] = {source.start + source.fadeIn,
+                           source.duration > 0 ? source.start + source.duration - source.fadeOut : LONG_MAX,
+                           source.mixTo};
+    long from = source.mixFrom;
+    for (long point : points) {
+        long to = std::min(std::max(point, from), source.mixTo);
+        while (from < to) {
+            // 环形缓冲折返处再切开
+            long pos = from - source.start;
+            int offset = static_cast<int>(pos % source.capacity);
+            int count = static_cast<int>(std::min<long>(to - from, source.capacity - offset));
+            float g0 = getGainAt(source, from, blockStart, target);
+            float g1 = getGainAt(source, from + count, blockStart, target);
+            accumulate(mMixBuffer.data() + (from - blockStart) * mChannels,
+                       source.ring.data() + static_cast<size_t>(offset) * mChannels, count, mChannels,
+                       g0, (g1 - g0) / count);
+            from += count;
+        }
+    }
+    source.gain = target;
+}
+
+void XAudioMixer::convertSamples(float *dst, const uint8_t *src, int nbSamples, int channels, int format) const {
+    int count = nbSamples * channels;
+    if (format == SAMPLE_TYPE_FLT && channels == mChannels) {
+        memcpy(dst, src, count * sizeof(float));
+        return;
+    }
+
+    // 单声道复制到所有声道
+    int repeat = mChannels / channels;
+    for (int i = 0; i < count; ++i) {
+        float value;
+        if (format == SAMPLE_TYPE_S16) {
+            value = reinterpret_cast<const int16_t *>(src)[i] * (1.0f / 32768.0f);
+        } else if (format == SAMPLE_TYPE_S32) {
+            value = reinterpret_cast<const int32_t *>(src)[i] * (1.0f / 2147483648.0f);
+        } else {
+            value = reinterpret_cast<const float *>(src)[i];
+        }
+        for (int c = 0; c < repeat; ++c) {
+            dst[i * repeat + c] = value;
+        }
+    }
+}
+
+void XAudioMixer::mixWorkThread(void *opaque) {
+    XThreadUtils::configThreadName("mixWorkThread");
+    auto mixer = reinterpret_cast<XAudioMixer *>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XAudioMixer] mixWorkThread ++++, kernel: %s\n", getKernelName());
+    for (;;) {
+        long blockStart;
+        int frames = 0;
+        {
+            std::unique_lock<std::mutex> lock(mixer->mMutex);
+            blockStart = mixer->mMixedFrames;
+            mixer->mCond.wait(lock, [mixer, blockStart, &frames] {
+                return mixer->mAborted || mixer->isBlockReady(blockStart, frames);
+            });
+            if (mixer->mAborted || frames == 0) {
+                break;
+            }
+
+            // 记下本块内各源的范围，之后写入方只会追加，混音时不持有锁
+            long blockEnd = blockStart + frames;
+            for (auto &source : mixer->mSources) {
+                source->mixFrom = std::max(blockStart, source->start);
+                source->mixTo = std::max(source->mixFrom, std::min(blockEnd, mixer->getSourceEnd(*source)));
+            }
+        }
+
+        {
+            XTraceSpan span("mixBlock");
+            float *mix = mixer->mMixBuffer.data();
+            int count = frames * mixer->mChannels;
+            memset(mix, 0, count * sizeof(float));
+            for (auto &source : mixer->mSources) {
+                if (source->mixFrom < source->mixTo) {
+                    mixer->mixSource(*source, blockStart);
+                } else {
+                    source->gain = source->targetGain.load();
+                }
+            }
+
+            long clipped = 0;
+            int done = getKernel().limit(mix, count, clipped);
+            limitC(mix, done, count, clipped);
+            mixer->mClipped += clipped;
+        }
+
+        int ret = mixer->mOutput ? mixer->mOutput(mixer->mMixBuffer.data(), frames) : 0;
+
+        std::lock_guard<std::mutex> lock(mixer->mMutex);
+        for (auto &source : mixer->mSources) {
+            if (source->mixFrom < source->mixTo) {
+                source->read = source->mixTo - source->start;
+            }
+        }
+        mixer->mMixedFrames = blockStart + frames;
+        mixer->mCond.notify_all();
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_ERROR, "[XAudioMixer] output failed: %d\n", ret);
+            mixer->mError = ret;
+            // 不再消费源的缓冲，让等待中的写入方返回
+            mixer->mAborted = true;
+            break;
+        }
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XAudioMixer] mixWorkThread ----\n");
+}
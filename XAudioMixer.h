@@ -0,0 +1,184 @@
+//
+//  XAudioMixer.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XAUDIOMIXER_H
+#define XEXPORTER_XAUDIOMIXER_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "XSample.h"
+
+class XExporter;
+
+struct XAudioSourceOptions {
+    float gain = 1.0f;
+    long startTime = 0; // 在时间线上的开始时间，单位ms
+    long duration = 0;  // 单位ms，<=0表示直到finish；超出的采样被丢弃
+    long fadeIn = 0;    // 单位ms
+    long fadeOut = 0;   // 单位ms，需要duration>0
+};
+
+/**
+ * @brief 多路音频混音：每路源按自己在时间线上的位置、增益和淡入淡出，以固定大小的块在float上累加，
+ * 硬限幅到[-1, 1]后以交错FLT送给输出（通常是XExporter，由它唯一的swr转换成编码格式）
+ * 源的缓冲、混音缓冲在start()之前一次分配好，混音过程中不再分配内存；
+ * 累加和限幅使用运行时选择的SIMD内核（avx / sse2 / c）
+ * @note 所有源的采样率必须与混音器相同，声道数与混音器相同或为单声道（写入时复制到各声道）；
+ * 每路源的缓冲有上限，单线程依次写入多路源时每次写入的时长不要超过缓冲时长，否则会互相等待
+ */
+class XAudioMixer {
+    using OutputCallback = std::function<int(const float* samples, int nbSamples)>;
+
+public:
+    /**
+     * @param blockSize 每次混音的采样点数（每声道）
+     */
+    XAudioMixer(int sampleRate = AM_DEFAULT_SAMPLE_RATE, int channels = AM_DEFAULT_CHANNELS,
+                int blockSize = AM_DEFAULT_BLOCK_SIZE);
+
+    /**
+     * @brief 中止并等待混音线程退出
+     */
+    ~XAudioMixer();
+
+    /**
+     * @brief 添加一路源，需在start()之前调用
+     * @return 源序号，失败时返回负值
+     */
+    int addSource(const XAudioSourceOptions& options);
+
+    /**
+     * @brief 修改源的增益，可在任意线程调用，在下一块内线性过渡，避免突变产生爆音
+     */
+    void setGain(int source, float gain);
+
+    /**
+     * @brief 混音结果送入exporter.encodeSample，同时把exporter的音频输入格式设为混音器的格式；
+     * 需在exporter.start()和本对象的start()之前调用
+     */
+    void setOutput(XExporter& exporter);
+
+    /**
+     * @brief 混音结果的回调，在混音线程中调用，samples为nbSamples个交错的float采样点；返回<0时停止混音
+     */
+    void setOutput(OutputCallback callback);
+
+    void start();
+
+    /**
+     * @brief 写入一路源的下一段PCM（按顺序接在上一段之后，忽略sample.pts），缓冲满时阻塞；
+     * 同一路源只能由一个线程写入
+     * @return 0表示成功，-1表示已中止，AVERROR(EINVAL)表示格式不支持
+     */
+    int write(int source, const XSample& sample);
+
+    /**
+     * @brief 标记源结束，之后的时间线上该源不再有采样
+     */
+    void finish(int source);
+
+    /**
+     * @brief 结束所有源，等待剩余的块混完并送出
+     * @return 混音或输出过程中的第一个错误，0表示成功
+     */
+    int stop();
+
+    /**
+     * @brief 丢弃未混音的数据，唤醒所有等待的写入方
+     */
+    void abort();
+
+    int getSampleRate() const;
+
+    int getChannels() const;
+
+    /**
+     * @brief 已送出的采样点数（每声道）
+     */
+    long getMixedSamples() const;
+
+    /**
+     * @brief 被限幅的采样数（按声道计）
+     */
+    long getClippedSamples() const;
+
+    /**
+     * @brief 运行时根据CPU特性选中的实现：avx / sse2 / c
+     */
+    static const char* getKernelName();
+
+private:
+    struct Source {
+        long start = 0;    // 以下单位均为采样点
+        long duration = 0; // 0表示未知
+        long fadeIn = 0;
+        long fadeOut = 0;
+        int capacity = 0;
+        std::vector<float> ring;
+        // 源自身时间线上的读写位置，单调递增
+        long read = 0;
+        long written = 0;
+        bool finished = false;
+        std::atomic<float> targetGain{1.0f};
+        // 以下只由混音线程访问
+        float gain = 1.0f;
+        long mixFrom = 0;
+        long mixTo = 0;
+    };
+
+    long getSourceEnd(const Source& source) const;
+
+    /**
+     * @brief 时间线上从blockStart开始的块所需的数据是否都已写入
+     * @param frames 本块的采样点数，0表示所有源都已结束
+     */
+    bool isBlockReady(long blockStart, int& frames) const;
+
+    /**
+     * @brief 时间线上第frame个采样点处的增益（用户增益 * 淡入淡出），用户增益在块内从gain线性过渡到target
+     */
+    float getGainAt(const Source& source, long frame, long blockStart, float target) const;
+
+    void mixSource(Source& source, long blockStart);
+
+    void convertSamples(float* dst, const uint8_t* src, int nbSamples, int channels, int format) const;
+
+    void mixWorkThread(void* opaque);
+
+private:
+    static const int AM_DEFAULT_SAMPLE_RATE = 44100;
+    static const int AM_DEFAULT_CHANNELS = 2;
+    static const int AM_DEFAULT_BLOCK_SIZE = 1024;
+    // 每路源可缓冲的时长，单位ms
+    static const int AM_SOURCE_DURATION = 1000;
+
+    int mSampleRate;
+    int mChannels;
+    int mBlockSize;
+
+    std::vector<std::unique_ptr<Source>> mSources;
+    std::vector<float> mMixBuffer;
+    OutputCallback mOutput;
+
+    // 时间线上已混完的采样点数
+    long mMixedFrames;
+    std::atomic<long> mClipped;
+    int mError;
+    bool mAborted;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCond;
+    std::unique_ptr<std::thread> mMixTid;
+};
+
+#endif //XEXPORTER_XAUDIOMIXER_H
@@ -0,0 +1,507 @@
+//
+//  XCheckpointWriter.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XCheckpointWriter.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "XMuxer.h"
+
+XCheckpointWriter::XCheckpointWriter(const std::string &dir, long segmentDuration)
+        : mDir(dir), mSegmentDuration(std::max(1L, segmentDuration)), mTemplateCtx(nullptr), mNextIndex(0),
+          mWrittenBytes(0), mError(0) {
+}
+
+XCheckpointWriter::~XCheckpointWriter() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &it : mOpenSegments) {
+        Segment &segment = *it.second;
+        // 未提交的段不在清单中，下次导出时会被覆盖
+        if (segment.muxer) {
+            segment.muxer->abort();
+            segment.muxer.reset();
+        }
+        if (segment.formatCtx) {
+            avio_closep(&segment.formatCtx->pb);
+        }
+    }
+    mOpenSegments.clear();
+}
+
+int XCheckpointWriter::load(const std::string &params) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mParams = params;
+    mSegments.clear();
+    mNextIndex = 0;
+
+    if (mkdir(mDir.data(), 0755) < 0 && errno != EEXIST) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] create directory failed: %s\n", mDir.data());
+        return AVERROR(errno);
+    }
+
+    std::ifstream stream(getManifestPath());
+    if (stream.fail()) {
+        return 0;
+    }
+
+    std::string line;
+    std::string tag;
+    int version = 0;
+    bool matched = false;
+    if (std::getline(stream, line)) {
+        std::istringstream fields(line);
+        fields >> tag >> version;
+    }
+    if (tag == "xcheckpoint" && version == CK_MANIFEST_VERSION && std::getline(stream, line)) {
+        matched = line == "params " + params;
+    }
+
+    while (std::getline(stream, line)) {
+        std::istringstream fields(line);
+        XCheckpointSegment segment;
+        if (!(fields >> tag >> segment.index >> segment.start >> segment.end >> segment.file) || tag != "segment") {
+            break;
+        }
+        int64_t streamEnd;
+        while (fields >> streamEnd) {
+            segment.streamEnds.emplace_back(streamEnd);
+        }
+        // 清单先于段文件被删除时只保留连续存在的部分
+        struct stat st;
+        if (matched && stat(getSegmentPath(segment.file).data(), &st) < 0) {
+            av_log(nullptr, AV_LOG_WARNING, "[XCheckpointWriter] segment missing: %s\n", segment.file.data());
+            break;
+        }
+        mSegments.emplace_back(segment);
+    }
+    stream.close();
+
+    if (!matched) {
+        av_log(nullptr, AV_LOG_WARNING, "[XCheckpointWriter] export params changed, discard checkpoint: %s\n",
+               mDir.data());
+        removeFiles();
+        mSegments.clear();
+        return 0;
+    }
+
+    if (!mSegments.empty()) {
+        mNextIndex = mSegments.back().index + 1;
+        av_log(nullptr, AV_LOG_INFO, "[XCheckpointWriter] resume from %ld ms, segments: %d\n",
+               mSegments.back().end, static_cast<int>(mSegments.size()));
+    }
+    return 0;
+}
+
+long XCheckpointWriter::getCommittedPts() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSegments.empty() ? 0 : mSegments.back().end;
+}
+
+std::vector<XCheckpointSegment> XCheckpointWriter::getSegments() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mSegments;
+}
+
+int64_t XCheckpointWriter::getCommittedEnd(int streamIndex, AVRational timeBase) const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto it = mSegments.rbegin(); it != mSegments.rend(); ++it) {
+        if (streamIndex >= 0 && streamIndex < static_cast<int>(it->streamEnds.size()) &&
+            it->streamEnds[streamIndex] != AV_NOPTS_VALUE) {
+            return av_rescale_q(it->streamEnds[streamIndex], {1, AV_TIME_BASE}, timeBase);
+        }
+    }
+    return AV_NOPTS_VALUE;
+}
+
+long XCheckpointWriter::getSegmentDuration() const {
+    return mSegmentDuration;
+}
+
+int XCheckpointWriter::getSegmentIndex(long ptsMs) const {
+    return static_cast<int>(std::max(0L, ptsMs) / mSegmentDuration);
+}
+
+int XCheckpointWriter::open(const AVFormatContext *ic) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (!ic || ic->nb_streams == 0) {
+        return AVERROR(EINVAL);
+    }
+    mTemplateCtx = ic;
+    mStreamDts.clear();
+    for (unsigned int i = 0; i < ic->nb_streams; ++i) {
+        mStreamDts[static_cast<int>(i)] = LONG_MIN;
+    }
+    return 0;
+}
+
+int XCheckpointWriter::put(const std::shared_ptr<Packet> &pkt, AVRational timeBase, int streamIndex) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mError < 0) {
+        return mError;
+    }
+    if (!mTemplateCtx || mStreamDts.find(streamIndex) == mStreamDts.end()) {
+        return AVERROR(EINVAL);
+    }
+
+    AVPacket *avpkt = pkt->avpkt;
+    long pts = avpkt->pts != AV_NOPTS_VALUE ? avpkt->pts : avpkt->dts;
+    long dts = avpkt->dts != AV_NOPTS_VALUE ? avpkt->dts : pts;
+    long ptsMs = static_cast<long>(av_rescale_q(pts, timeBase, {1, 1000}));
+    long dtsMs = static_cast<long>(av_rescale_q(dts, timeBase, {1, 1000}));
+    long endMs = static_cast<long>(av_rescale_q(pts + avpkt->duration, timeBase, {1, 1000}));
+
+    // 续传后编码器的首个Packet可能略早于已提交的结尾，同样放入第一个新段，拼接时去掉重叠
+    int index = std::max(getSegmentIndex(ptsMs), mNextIndex);
+    auto it = mOpenSegments.find(index);
+    if (it == mOpenSegments.end()) {
+        auto segment = std::make_unique<Segment>();
+        segment->index = index;
+        segment->streamEnds.assign(mTemplateCtx->nb_streams, AV_NOPTS_VALUE);
+        int ret = openSegment(*segment);
+        if (ret < 0) {
+            mError = ret;
+            return ret;
+        }
+        it = mOpenSegments.emplace(index, std::move(segment)).first;
+    }
+
+    Segment &segment = *it->second;
+    segment.end = std::max(segment.end, std::max(ptsMs, endMs));
+    int64_t &streamEnd = segment.streamEnds[streamIndex];
+    streamEnd = std::max(streamEnd == AV_NOPTS_VALUE ? INT64_MIN : streamEnd,
+                         av_rescale_q(pts + avpkt->duration, timeBase, {1, AV_TIME_BASE}));
+    av_packet_rescale_ts(avpkt, timeBase, segment.formatCtx->streams[streamIndex]->time_base);
+    avpkt->stream_index = streamIndex;
+    int ret = segment.muxer->put(pkt);
+    if (ret < 0) {
+        mError = ret;
+        return ret;
+    }
+
+    long &streamDts = mStreamDts[streamIndex];
+    streamDts = std::max(streamDts, dtsMs);
+    return commitReady();
+}
+
+int XCheckpointWriter::finish(int streamIndex) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    auto it = mStreamDts.find(streamIndex);
+    if (it == mStreamDts.end()) {
+        return AVERROR(EINVAL);
+    }
+    it->second = LONG_MAX;
+    return mError < 0 ? mError : commitReady();
+}
+
+int XCheckpointWriter::close() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &it : mStreamDts) {
+        it.second = LONG_MAX;
+    }
+    return mError < 0 ? mError : commitReady();
+}
+
+int XCheckpointWriter::commitReady() {
+    while (!mOpenSegments.empty()) {
+        auto it = mOpenSegments.begin();
+        Segment &segment = *it->second;
+        long boundary = (segment.index + 1L) * mSegmentDuration;
+
+        bool passed = true;
+        bool finished = true;
+        for (const auto &stream : mStreamDts) {
+            passed = passed && stream.second >= boundary;
+            finished = finished && stream.second == LONG_MAX;
+        }
+        if (!passed) {
+            if (static_cast<int>(mOpenSegments.size()) <= CK_MAX_OPEN_SEGMENTS) {
+                break;
+            }
+            av_log(nullptr, AV_LOG_WARNING, "[XCheckpointWriter] a stream lags behind segment %d, commit anyway\n",
+                   segment.index);
+        }
+
+        int ret = closeSegment(segment);
+        if (ret < 0) {
+            mError = ret;
+            return ret;
+        }
+
+        XCheckpointSegment committed;
+        committed.index = segment.index;
+        committed.start = mSegments.empty() ? segment.index * mSegmentDuration : mSegments.back().end;
+        // 最后一段只到内容的结尾，其余段到段尾，续传时从段尾开始
+        committed.end = (finished && mOpenSegments.size() == 1) ? std::min(segment.end, boundary) : boundary;
+        committed.end = std::max(committed.end, committed.start);
+        committed.file = segment.file;
+        committed.streamEnds = segment.streamEnds;
+        mSegments.emplace_back(committed);
+        mNextIndex = segment.index + 1;
+        mOpenSegments.erase(it);
+
+        ret = writeManifest();
+        if (ret < 0) {
+            mError = ret;
+            return ret;
+        }
+        av_log(nullptr, AV_LOG_INFO, "[XCheckpointWriter] commit segment %d: %ld ~ %ld ms\n", committed.index,
+               committed.start, committed.end);
+    }
+    return 0;
+}
+
+int XCheckpointWriter::openSegment(Segment &segment) {
+    char name[32];
+    snprintf(name, sizeof(name), "segment_%05d.nut", segment.index);
+    segment.file = name;
+    std::string path = getSegmentPath(segment.file);
+
+    AVFormatContext *ic = nullptr;
+    int ret = avformat_alloc_output_context2(&ic, nullptr, "nut", path.data());
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] avformat_alloc_output_context2 failed: %s\n",
+               av_err2str(ret));
+        return ret;
+    }
+    segment.formatCtx = std::unique_ptr<AVFormatContext, OutputFormatDeleter>(ic);
+
+    for (unsigned int i = 0; i < mTemplateCtx->nb_streams; ++i) {
+        const AVStream *src = mTemplateCtx->streams[i];
+        AVStream *stream = avformat_new_stream(ic, nullptr);
+        if (!stream) {
+            return AVERROR(ENOMEM);
+        }
+        ret = avcodec_parameters_copy(stream->codecpar, src->codecpar);
+        if (ret < 0) {
+            return ret;
+        }
+        stream->codecpar->codec_tag = 0;
+        stream->time_base = src->time_base;
+    }
+
+    // 覆盖上次导出中途退出时留下的未提交的同名段
+    ret = avio_open(&ic->pb, path.data(), AVIO_FLAG_WRITE);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] avio_open failed: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    ret = avformat_write_header(ic, nullptr);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] avformat_write_header failed: %s\n", av_err2str(ret));
+        avio_closep(&ic->pb);
+        return ret;
+    }
+
+    segment.muxer = std::make_unique<XMuxer>(ic, CK_MUX_CAPACITY);
+    for (unsigned int i = 0; i < ic->nb_streams; ++i) {
+        segment.muxer->addStream(static_cast<int>(i));
+    }
+    segment.muxer->start();
+    return 0;
+}
+
+int XCheckpointWriter::closeSegment(Segment &segment) {
+    AVFormatContext *ic = segment.formatCtx.get();
+    for (unsigned int i = 0; i < ic->nb_streams; ++i) {
+        segment.muxer->finish(static_cast<int>(i));
+    }
+    int ret = segment.muxer->stop();
+    mWrittenBytes += segment.muxer->getWrittenBytes();
+    segment.muxer.reset();
+    if (ret >= 0) {
+        ret = av_write_trailer(ic);
+    }
+    if (ret >= 0) {
+        // 段文件落盘后才写入清单
+        avio_flush(ic->pb);
+    }
+    int closeRet = avio_closep(&ic->pb);
+    segment.formatCtx.reset();
+    if (ret < 0 || closeRet < 0) {
+        ret = ret < 0 ? ret : closeRet;
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] close segment %d failed: %s\n", segment.index,
+               av_err2str(ret));
+        return ret;
+    }
+    return 0;
+}
+
+int XCheckpointWriter::writeManifest() {
+    std::string path = getManifestPath();
+    std::string tempPath = path + ".tmp";
+    FILE *file = fopen(tempPath.data(), "w");
+    if (!file) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] open manifest failed: %s\n", tempPath.data());
+        return AVERROR(errno);
+    }
+
+    fprintf(file, "xcheckpoint %d\n", CK_MANIFEST_VERSION);
+    fprintf(file, "params %s\n", mParams.data());
+    for (const auto &segment : mSegments) {
+        fprintf(file, "segment %d %ld %ld %s", segment.index, segment.start, segment.end, segment.file.data());
+        for (int64_t streamEnd : segment.streamEnds) {
+            fprintf(file, " %lld", static_cast<long long>(streamEnd));
+        }
+        fprintf(file, "\n");
+    }
+
+    // rename之前先落盘，替换之后清单不会是半截的
+    bool failed = fflush(file) != 0 || fsync(fileno(file)) != 0;
+    failed = fclose(file) != 0 || failed;
+    if (failed || rename(tempPath.data(), path.data()) < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] write manifest failed: %s\n", path.data());
+        return AVERROR(EIO);
+    }
+    return 0;
+}
+
+int XCheckpointWriter::finalize(const std::string &outputPath) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (mSegments.empty() || !mOpenSegments.empty()) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] finalize: no committed segments or export not closed\n");
+        return AVERROR(EINVAL);
+    }
+
+    // 先写到临时文件，完整写完才替换输出路径
+    AVOutputFormat *oformat = av_guess_format(nullptr, outputPath.data(), nullptr);
+    std::string tempPath = outputPath + ".part";
+    AVFormatContext *oc = nullptr;
+    int ret = avformat_alloc_output_context2(&oc, oformat, nullptr, tempPath.data());
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] avformat_alloc_output_context2 failed: %s\n",
+               av_err2str(ret));
+        return ret;
+    }
+    std::unique_ptr<AVFormatContext, OutputFormatDeleter> output(oc);
+
+    std::vector<long> lastDts;
+    AVPacket *pkt = av_packet_alloc();
+    for (size_t i = 0; i < mSegments.size() && ret >= 0; ++i) {
+        AVFormatContext *input = nullptr;
+        std::string path = getSegmentPath(mSegments[i].file);
+        ret = avformat_open_input(&input, path.data(), nullptr, nullptr);
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] open segment failed: %s, %s\n", path.data(),
+                   av_err2str(ret));
+            break;
+        }
+        std::unique_ptr<AVFormatContext, InputFormatDeleter> ic(input);
+
+        if (i == 0) {
+            // 流参数取自第一段，各段的流参数相同
+            for (unsigned int s = 0; s < ic->nb_streams; ++s) {
+                AVStream *stream = avformat_new_stream(oc, nullptr);
+                if (!stream) {
+                    ret = AVERROR(ENOMEM);
+                    break;
+                }
+                ret = avcodec_parameters_copy(stream->codecpar, ic->streams[s]->codecpar);
+                if (ret < 0) {
+                    break;
+                }
+                stream->codecpar->codec_tag = 0;
+                stream->time_base = ic->streams[s]->time_base;
+            }
+            if (ret < 0) {
+                break;
+            }
+            lastDts.assign(ic->nb_streams, AV_NOPTS_VALUE);
+
+            if (!(oc->oformat->flags & AVFMT_NOFILE)) {
+                ret = avio_open(&oc->pb, tempPath.data(), AVIO_FLAG_WRITE);
+                if (ret < 0) {
+                    av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] avio_open failed: %s\n", av_err2str(ret));
+                    break;
+                }
+            }
+            ret = avformat_write_header(oc, nullptr);
+            if (ret < 0) {
+                av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] avformat_write_header failed: %s\n",
+                       av_err2str(ret));
+                break;
+            }
+        } else if (ic->nb_streams != oc->nb_streams) {
+            av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] segment %s has different streams\n", path.data());
+            ret = AVERROR_INVALIDDATA;
+            break;
+        }
+
+        while ((ret = av_read_frame(ic.get(), pkt)) >= 0) {
+            int index = pkt->stream_index;
+            av_packet_rescale_ts(pkt, ic->streams[index]->time_base, oc->streams[index]->time_base);
+            // 续传后编码器的首个Packet可能与已提交的最后一个Packet重叠：视频是续传点前重复编码的帧，
+            // AAC是编码器延迟产生的priming Packet（时间戳为续传点前一帧）；音频从已提交的结尾继续编码，
+            // 去掉重叠的Packet后新旧Packet首尾相接
+            if (pkt->dts != AV_NOPTS_VALUE && lastDts[index] != AV_NOPTS_VALUE && pkt->dts <= lastDts[index]) {
+                av_packet_unref(pkt);
+                continue;
+            }
+            if (pkt->dts != AV_NOPTS_VALUE) {
+                lastDts[index] = pkt->dts;
+            }
+            ret = av_interleaved_write_frame(oc, pkt);
+            if (ret < 0) {
+                av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] write packet failed: %s\n", av_err2str(ret));
+                break;
+            }
+        }
+        if (ret == AVERROR_EOF) {
+            ret = 0;
+        }
+    }
+    av_packet_free(&pkt);
+
+    if (ret >= 0) {
+        ret = av_write_trailer(oc);
+    }
+    if (oc->pb) {
+        avio_closep(&oc->pb);
+    }
+    if (ret >= 0 && rename(tempPath.data(), outputPath.data()) < 0) {
+        ret = AVERROR(errno);
+    }
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XCheckpointWriter] finalize failed: %s\n", av_err2str(ret));
+        remove(tempPath.data());
+        return ret;
+    }
+
+    av_log(nullptr, AV_LOG_INFO, "[XCheckpointWriter] finalize: %s, segments: %d, duration: %ld ms\n",
+           outputPath.data(), static_cast<int>(mSegments.size()), mSegments.back().end);
+    removeFiles();
+    mSegments.clear();
+    mNextIndex = 0;
+    return 0;
+}
+
+long XCheckpointWriter::getWrittenBytes() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mWrittenBytes;
+}
+
+void XCheckpointWriter::removeFiles() {
+    // 先删清单，中途退出时剩下的段文件不会被当成检查点
+    remove(getManifestPath().data());
+    for (const auto &segment : mSegments) {
+        remove(getSegmentPath(segment.file).data());
+    }
+}
+
+std::string XCheckpointWriter::getSegmentPath(const std::string &file) const {
+    return mDir + "/" + file;
+}
+
+std::string XCheckpointWriter::getManifestPath() const {
+    return mDir + "/checkpoint.txt";
+}
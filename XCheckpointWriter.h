@@ -0,0 +1,162 @@
+//
+//  XCheckpointWriter.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XCHECKPOINTWRITER_H
+#define XEXPORTER_XCHECKPOINTWRITER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include "XFFHeader.h"
+
+class XMuxer;
+
+struct XCheckpointSegment {
+    int index = -1;
+    long start = 0; // 单位ms
+    long end = 0;   // 单位ms，不含
+    std::string file;
+    // 各路流在本段中最后一个Packet的结尾，单位us，没有Packet时为AV_NOPTS_VALUE；
+    // Packet按起始时间归入段，音频在整帧处切开，结尾可能略晚于end
+    std::vector<int64_t> streamEnds;
+};
+
+/**
+ * @brief 可续传导出的检查点：时间线按segmentDuration切成段，每段写成目录下独立的NUT文件，
+ * 所有流都越过段尾后关闭该段并追加到清单（先写临时文件再rename，进程随时退出清单都是完整的）；
+ * 重新导出时从清单中最后一段的结尾继续，结束后把各段按原时间戳拷贝拼接成最终文件，不重新编码
+ * @note 段的切分依赖视频在每个段首强制关键帧且GOP闭合，由调用方保证；
+ * NUT保留各路流的时间基和绝对时间戳，拼接时不需要改写时间戳
+ */
+class XCheckpointWriter {
+public:
+    /**
+     * @param dir 存放段文件和清单的目录，不存在时创建
+     * @param segmentDuration 段时长，单位ms
+     */
+    XCheckpointWriter(const std::string& dir, long segmentDuration);
+
+    /**
+     * @brief 中止并关闭未提交的段，已提交的段和清单保留
+     */
+    ~XCheckpointWriter();
+
+    /**
+     * @brief 读取清单，params与记录的不一致（输出参数变化）时丢弃已有的段重新开始
+     * @param params 影响编码结果的导出参数，原样记录在清单中
+     * @return 0表示成功，目录不可用时返回负值
+     */
+    int load(const std::string& params);
+
+    /**
+     * @brief 已提交部分的结尾，单位ms，重新导出时从这里继续；没有检查点时为0
+     */
+    long getCommittedPts() const;
+
+    std::vector<XCheckpointSegment> getSegments() const;
+
+    /**
+     * @brief streamIndex已提交部分的结尾，即最后一个已提交Packet的pts + duration；
+     * 续传时该流的编码器从这里继续，新旧Packet首尾相接
+     * @return 换算到timeBase的时间戳，没有已提交的Packet时返回AV_NOPTS_VALUE
+     */
+    int64_t getCommittedEnd(int streamIndex, AVRational timeBase) const;
+
+    long getSegmentDuration() const;
+
+    /**
+     * @brief ptsMs所在段的序号，视频帧的段序号变化时需要强制关键帧
+     */
+    int getSegmentIndex(long ptsMs) const;
+
+    /**
+     * @brief 以ic中的流作为每段的流参数，需在put之前调用
+     * @param ic 已添加全部流的输出上下文，只读取流参数
+     */
+    int open(const AVFormatContext* ic);
+
+    /**
+     * @brief 按pts把Packet放入所属的段，可在多个编码线程中调用；所有流都越过段尾后提交该段
+     * @param timeBase pkt当前的时间基
+     */
+    int put(const std::shared_ptr<Packet>& pkt, AVRational timeBase, int streamIndex);
+
+    /**
+     * @brief streamIndex已结束，不再等待它越过段尾
+     */
+    int finish(int streamIndex);
+
+    /**
+     * @brief 所有流结束后调用，提交剩余的段
+     */
+    int close();
+
+    /**
+     * @brief 把已提交的段拼接成outputPath，成功后删除段文件和清单
+     */
+    int finalize(const std::string& outputPath);
+
+    /**
+     * @brief 已写入段文件的字节数，不含本次导出之前提交的段
+     */
+    long getWrittenBytes() const;
+
+private:
+    struct Segment {
+        int index = -1;
+        long end = 0; // 段内内容的结尾，单位ms
+        std::string file;
+        std::vector<int64_t> streamEnds; // 单位us
+        std::unique_ptr<AVFormatContext, OutputFormatDeleter> formatCtx;
+        std::unique_ptr<XMuxer> muxer;
+    };
+
+    int openSegment(Segment& segment);
+
+    int closeSegment(Segment& segment);
+
+    /**
+     * @brief 按顺序提交所有流都已越过段尾的段；未提交的段过多时不再等待落后的流
+     */
+    int commitReady();
+
+    int writeManifest();
+
+    void removeFiles();
+
+    std::string getSegmentPath(const std::string& file) const;
+
+    std::string getManifestPath() const;
+
+private:
+    static const int CK_MANIFEST_VERSION = 2;
+    // 某一路流一直没有Packet（例如只送视频）时，最多同时打开的段数
+    static const int CK_MAX_OPEN_SEGMENTS = 3;
+    static const int CK_MUX_CAPACITY = 32;
+
+    std::string mDir;
+    long mSegmentDuration;
+    std::string mParams;
+
+    const AVFormatContext* mTemplateCtx;
+
+    // 流序号 -> 最新的dts（单位ms），流结束后为LONG_MAX
+    std::map<int, long> mStreamDts;
+    std::map<int, std::unique_ptr<Segment>> mOpenSegments;
+    std::vector<XCheckpointSegment> mSegments;
+    // 小于这个序号的段已提交，不再打开
+    int mNextIndex;
+    long mWrittenBytes;
+    int mError;
+
+    mutable std::mutex mMutex;
+};
+
+#endif //XEXPORTER_XCHECKPOINTWRITER_H
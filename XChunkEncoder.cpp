@@ -0,0 +1,128 @@
+//
+//  XChunkEncoder.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XChunkEncoder.h"
+#include "XFrameQueue.h"
+#include "XThreadUtils.h"
+#include "XHistogram.h"
+#include "XTrace.h"
+
+XChunkEncoder::XChunkEncoder(int index, long startPts, std::unique_ptr<AVCodecContext, CodecDeleter> avctx)
+: mIndex(index), mStartPts(startPts), mFrameCount(0), mResult(0), mCodecCtx(std::move(avctx)),
+  mSendHistogram(nullptr), mReceiveHistogram(nullptr) {
+    // 不限容量：整段的帧要尽快交给本段，调度线程才能去填下一段，内存由并行段数限制
+    mFrameQueue = std::make_unique<XFrameQueue>(0);
+}
+
+XChunkEncoder::~XChunkEncoder() {
+    mFrameQueue->signal();
+    wait();
+}
+
+void XChunkEncoder::setHistograms(XHistogram* sendHistogram, XHistogram* receiveHistogram) {
+    mSendHistogram = sendHistogram;
+    mReceiveHistogram = receiveHistogram;
+}
+
+void XChunkEncoder::start() {
+    if (!mEncodeTid) {
+        mEncodeTid = std::make_unique<std::thread>([this] { encodeWorkThread(this); });
+    }
+}
+
+void XChunkEncoder::put(std::shared_ptr<Frame> frame) {
+    if (frame) {
+        // 帧上已是时间线上的时间戳，段内从0开始编码，输出时再整体平移回去
+        frame->avframe->pts -= mStartPts;
+        mFrameCount++;
+    }
+    mFrameQueue->put(frame);
+}
+
+int XChunkEncoder::wait() {
+    if (mEncodeTid && mEncodeTid->joinable()) {
+        mEncodeTid->join();
+    }
+    return mResult;
+}
+
+const std::vector<std::shared_ptr<Packet>>& XChunkEncoder::getPackets() const {
+    return mPackets;
+}
+
+AVCodecContext* XChunkEncoder::getCodecContext() const {
+    return mCodecCtx.get();
+}
+
+int XChunkEncoder::getIndex() const {
+    return mIndex;
+}
+
+long XChunkEncoder::getStartPts() const {
+    return mStartPts;
+}
+
+int XChunkEncoder::getFrameCount() const {
+    return mFrameCount;
+}
+
+int XChunkEncoder::encode(AVFrame* frame) {
+    XTraceSpan span("chunkEncode");
+    long start = XHistogram::now();
+    int ret = avcodec_send_frame(mCodecCtx.get(), frame);
+    if (mSendHistogram) {
+        mSendHistogram->record(XHistogram::now() - start);
+    }
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XChunkEncoder] chunk %d avcodec_send_frame failed: %s\n", mIndex,
+               av_err2str(ret));
+        return ret;
+    }
+
+    for (;;) {
+        auto pkt = std::make_shared<Packet>();
+        start = XHistogram::now();
+        ret = avcodec_receive_packet(mCodecCtx.get(), pkt->avpkt);
+        if (mReceiveHistogram && ret >= 0) {
+            mReceiveHistogram->record(XHistogram::now() - start);
+        }
+        if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+            return 0;
+        }
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XChunkEncoder] chunk %d avcodec_receive_packet failed: %s\n", mIndex,
+                   av_err2str(ret));
+            return ret;
+        }
+
+        // 每段的编码器配置相同，B帧引入的dts延迟也相同，整体平移后段与段之间的dts仍然连续
+        pkt->avpkt->pts += mStartPts;
+        pkt->avpkt->dts += mStartPts;
+        mPackets.emplace_back(pkt);
+    }
+}
+
+void XChunkEncoder::encodeWorkThread(void* opaque) {
+    XThreadUtils::configThreadName("chunkEncodeWorkThread");
+    auto encoder = reinterpret_cast<XChunkEncoder*>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XChunkEncoder] chunk %d encodeWorkThread ++++\n", encoder->mIndex);
+    for (;;) {
+        auto frame = encoder->mFrameQueue->get();
+        // nullptr为结束标记，中止时同样返回nullptr
+        int ret = encoder->encode(frame ? frame->avframe : nullptr);
+        if (ret < 0) {
+            encoder->mResult = ret;
+            break;
+        }
+        if (!frame) {
+            break;
+        }
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XChunkEncoder] chunk %d encodeWorkThread ---- packets: %d\n", encoder->mIndex,
+           static_cast<int>(encoder->mPackets.size()));
+}
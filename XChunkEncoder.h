@@ -0,0 +1,96 @@
+//
+//  XChunkEncoder.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XCHUNKENCODER_H
+#define XEXPORTER_XCHUNKENCODER_H
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include "XFFHeader.h"
+
+class XFrameQueue;
+class XHistogram;
+
+/**
+ * @brief 分段编码中的一段：持有独立的编码器和编码线程，
+ * 第一帧为IDR且GOP闭合，编出的Packet缓存在内存中，按段的先后顺序交给复用器
+ */
+class XChunkEncoder {
+public:
+    /**
+     * @param index 段序号
+     * @param startPts 段内第一帧在整条时间线上的pts，编码器内部从0开始计数
+     * @param avctx 已打开的编码器
+     */
+    XChunkEncoder(int index, long startPts, std::unique_ptr<AVCodecContext, CodecDeleter> avctx);
+
+    /**
+     * @brief 中止并等待编码线程退出
+     */
+    ~XChunkEncoder();
+
+    /**
+     * @brief 记录send_frame/receive_packet耗时的直方图，可为nullptr，需在start()之前设置
+     */
+    void setHistograms(XHistogram* sendHistogram, XHistogram* receiveHistogram);
+
+    void start();
+
+    /**
+     * @brief 送入一帧，nullptr表示本段结束，编码线程flush编码器后退出
+     */
+    void put(std::shared_ptr<Frame> frame);
+
+    /**
+     * @brief 等待编码线程退出
+     * @return 0表示成功，其他表示失败
+     */
+    int wait();
+
+    /**
+     * @brief 本段的全部Packet，pts/dts已偏移到整条时间线，时间基为编码器的time_base；需在wait()之后调用
+     */
+    const std::vector<std::shared_ptr<Packet>>& getPackets() const;
+
+    AVCodecContext* getCodecContext() const;
+
+    int getIndex() const;
+
+    long getStartPts() const;
+
+    int getFrameCount() const;
+
+private:
+    int encode(AVFrame* frame);
+
+    void encodeWorkThread(void* opaque);
+
+private:
+    int mIndex;
+
+    long mStartPts;
+
+    int mFrameCount;
+
+    int mResult;
+
+    std::unique_ptr<AVCodecContext, CodecDeleter> mCodecCtx;
+
+    std::unique_ptr<XFrameQueue> mFrameQueue;
+
+    std::unique_ptr<std::thread> mEncodeTid;
+
+    std::vector<std::shared_ptr<Packet>> mPackets;
+
+    XHistogram* mSendHistogram;
+
+    XHistogram* mReceiveHistogram;
+};
+
+#endif //XEXPORTER_XCHUNKENCODER_H
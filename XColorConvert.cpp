@@ -0,0 +1,240 @@
+//
+//  XColorConvert.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XColorConvert.h"
+#include <cstring>
+#include "XSimd.h"
+
+namespace {
+
+// 15位定点系数，与swscale的RGB2YUV_SHIFT一致；U/V三个系数之和为0
+struct ConvertCoeffs {
+    int16_t yr, yg, yb;
+    int16_t ur, ug, ub;
+    int16_t vr, vg, vb;
+};
+
+const ConvertCoeffs COEFFS_BT601 = {8414, 16519, 3208, -4857, -9535, 14392, 14392, -12052, -2340};
+const ConvertCoeffs COEFFS_BT709 = {5983, 20127, 2032, -3298, -11094, 14392, 14392, -13073, -1319};
+
+const int Y_SHIFT = 15;
+const int Y_OFFSET = (16 << Y_SHIFT) + (1 << (Y_SHIFT - 1));
+// 色度由4个像素求和得到，多移2位
+const int C_SHIFT = Y_SHIFT + 2;
+const int C_OFFSET = (128 << C_SHIFT) + (1 << (C_SHIFT - 1));
+
+/**
+ * 处理一对行中[x, width)的像素，row1为nullptr时表示奇数高度的最后一行
+ */
+using RowPairFunc = int (*)(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+                            uint8_t* u, uint8_t* v, int width, const ConvertCoeffs& c);
+
+inline uint8_t lumaC(const uint8_t* p, const ConvertCoeffs& c) {
+    return static_cast<uint8_t>((c.yr * p[0] + c.yg * p[1] + c.yb * p[2] + Y_OFFSET) >> Y_SHIFT);
+}
+
+void rowPairC(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+              uint8_t* u, uint8_t* v, int x, int width, const ConvertCoeffs& c) {
+    for (; x < width; x += 2) {
+        // 奇数宽度时最后一列与自身配对
+        int x1 = (x + 1 < width) ? x + 1 : x;
+        const uint8_t* a0 = s0 + x * 4;
+        const uint8_t* a1 = s0 + x1 * 4;
+        const uint8_t* b0 = s1 + x * 4;
+        const uint8_t* b1 = s1 + x1 * 4;
+
+        y0[x] = lumaC(a0, c);
+        if (x1 != x) {
+            y0[x1] = lumaC(a1, c);
+        }
+        if (y1) {
+            y1[x] = lumaC(b0, c);
+            if (x1 != x) {
+                y1[x1] = lumaC(b1, c);
+            }
+        }
+
+        int r = a0[0] + a1[0] + b0[0] + b1[0];
+        int g = a0[1] + a1[1] + b0[1] + b1[1];
+        int b = a0[2] + a1[2] + b0[2] + b1[2];
+        u[x >> 1] = static_cast<uint8_t>((c.ur * r + c.ug * g + c.ub * b + C_OFFSET) >> C_SHIFT);
+        v[x >> 1] = static_cast<uint8_t>((c.vr * r + c.vg * g + c.vb * b + C_OFFSET) >> C_SHIFT);
+    }
+}
+
+int rowPairScalar(const uint8_t*, const uint8_t*, uint8_t*, uint8_t*, uint8_t*, uint8_t*, int,
+                  const ConvertCoeffs&) {
+    return 0;
+}
+
+#if X_SIMD_X86
+
+struct CoeffsSSE41 {
+    __m128i y, u, v;
+};
+
+X_TARGET_SSE41 inline __m128i luma4SSE41(__m128i px, __m128i coef) {
+    __m128i lo = _mm_madd_epi16(_mm_cvtepu8_epi16(px), coef);
+    __m128i hi = _mm_madd_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(px, 8)), coef);
+    return _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(lo, hi), _mm_set1_epi32(Y_OFFSET)), Y_SHIFT);
+}
+
+X_TARGET_SSE41 inline void storeLuma8SSE41(uint8_t* dst, __m128i px0, __m128i px1, __m128i coef) {
+    __m128i y = _mm_packus_epi32(luma4SSE41(px0, coef), luma4SSE41(px1, coef));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packus_epi16(y, y));
+}
+
+// 两行各4个像素，得到[U01 U23 V01 V23]
+X_TARGET_SSE41 inline __m128i chroma4SSE41(__m128i a, __m128i b, const CoeffsSSE41& c) {
+    __m128i s01 = _mm_add_epi16(_mm_cvtepu8_epi16(a), _mm_cvtepu8_epi16(b));
+    __m128i s23 = _mm_add_epi16(_mm_cvtepu8_epi16(_mm_srli_si128(a, 8)), _mm_cvtepu8_epi16(_mm_srli_si128(b, 8)));
+    __m128i us = _mm_hadd_epi32(_mm_madd_epi16(s01, c.u), _mm_madd_epi16(s23, c.u));
+    __m128i vs = _mm_hadd_epi32(_mm_madd_epi16(s01, c.v), _mm_madd_epi16(s23, c.v));
+    return _mm_srai_epi32(_mm_add_epi32(_mm_hadd_epi32(us, vs), _mm_set1_epi32(C_OFFSET)), C_SHIFT);
+}
+
+X_TARGET_SSE41
+int rowPairSSE41(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+                 uint8_t* u, uint8_t* v, int width, const ConvertCoeffs& c) {
+    CoeffsSSE41 coeffs;
+    coeffs.y = _mm_setr_epi16(c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0);
+    coeffs.u = _mm_setr_epi16(c.ur, c.ug, c.ub, 0, c.ur, c.ug, c.ub, 0);
+    coeffs.v = _mm_setr_epi16(c.vr, c.vg, c.vb, 0, c.vr, c.vg, c.vb, 0);
+    // [U01 U23 V01 V23 U45 U67 V45 V67] -> [U01 U23 U45 U67 V01 V23 V45 V67]
+    const __m128i uvOrder = _mm_setr_epi8(0, 1, 4, 5, 2, 3, 6, 7, 8, 9, 12, 13, 10, 11, 14, 15);
+
+    int x = 0;
+    for (; x + 8 <= width; x += 8) {
+        __m128i a0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + x * 4));
+        __m128i a1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s0 + x * 4 + 16));
+        __m128i b0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + x * 4));
+        __m128i b1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1 + x * 4 + 16));
+
+        storeLuma8SSE41(y0 + x, a0, a1, coeffs.y);
+        if (y1) {
+            storeLuma8SSE41(y1 + x, b0, b1, coeffs.y);
+        }
+
+        __m128i uv = _mm_packus_epi32(chroma4SSE41(a0, b0, coeffs), chroma4SSE41(a1, b1, coeffs));
+        uv = _mm_shuffle_epi8(_mm_packus_epi16(uv, uv), uvOrder);
+        int32_t uBytes = _mm_cvtsi128_si32(uv);
+        int32_t vBytes = _mm_extract_epi32(uv, 1);
+        memcpy(u + (x >> 1), &uBytes, 4);
+        memcpy(v + (x >> 1), &vBytes, 4);
+    }
+    return x;
+}
+
+struct CoeffsAVX2 {
+    __m256i y, u, v;
+};
+
+X_TARGET_AVX2 inline __m256i load4AVX2(const uint8_t* p) {
+    return _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+// hadd/pack都在128位通道内进行，最后用shuffle把结果排回像素顺序
+X_TARGET_AVX2 inline void storeLuma16AVX2(uint8_t* dst, const __m256i px[4], __m256i coef) {
+    const __m128i yOrder = _mm_setr_epi8(0, 1, 8, 9, 2, 3, 10, 11, 4, 5, 12, 13, 6, 7, 14, 15);
+    const __m256i offset = _mm256_set1_epi32(Y_OFFSET);
+    __m256i y01 = _mm256_hadd_epi32(_mm256_madd_epi16(px[0], coef), _mm256_madd_epi16(px[1], coef));
+    __m256i y23 = _mm256_hadd_epi32(_mm256_madd_epi16(px[2], coef), _mm256_madd_epi16(px[3], coef));
+    y01 = _mm256_srai_epi32(_mm256_add_epi32(y01, offset), Y_SHIFT);
+    y23 = _mm256_srai_epi32(_mm256_add_epi32(y23, offset), Y_SHIFT);
+    __m256i y = _mm256_packus_epi32(y01, y23);
+    y = _mm256_permute4x64_epi64(_mm256_packus_epi16(y, y), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm_shuffle_epi8(_mm256_castsi256_si128(y), yOrder));
+}
+
+// 两行纵向求和后的8个像素列，得到[U01 U45 V01 V45 | U23 U67 V23 V67]
+X_TARGET_AVX2 inline __m256i chroma8AVX2(__m256i sa, __m256i sb, const CoeffsAVX2& c) {
+    __m256i us = _mm256_hadd_epi32(_mm256_madd_epi16(sa, c.u), _mm256_madd_epi16(sb, c.u));
+    __m256i vs = _mm256_hadd_epi32(_mm256_madd_epi16(sa, c.v), _mm256_madd_epi16(sb, c.v));
+    return _mm256_srai_epi32(_mm256_add_epi32(_mm256_hadd_epi32(us, vs), _mm256_set1_epi32(C_OFFSET)), C_SHIFT);
+}
+
+X_TARGET_AVX2
+int rowPairAVX2(const uint8_t* s0, const uint8_t* s1, uint8_t* y0, uint8_t* y1,
+                uint8_t* u, uint8_t* v, int width, const ConvertCoeffs& c) {
+    CoeffsAVX2 coeffs;
+    coeffs.y = _mm256_setr_epi16(c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0,
+                                 c.yr, c.yg, c.yb, 0, c.yr, c.yg, c.yb, 0);
+    coeffs.u = _mm256_setr_epi16(c.ur, c.ug, c.ub, 0, c.ur, c.ug, c.ub, 0,
+                                 c.ur, c.ug, c.ub, 0, c.ur, c.ug, c.ub, 0);
+    coeffs.v = _mm256_setr_epi16(c.vr, c.vg, c.vb, 0, c.vr, c.vg, c.vb, 0,
+                                 c.vr, c.vg, c.vb, 0, c.vr, c.vg, c.vb, 0);
+    const __m128i uvOrder = _mm_setr_epi8(0, 8, 1, 9, 4, 12, 5, 13, 2, 10, 3, 11, 6, 14, 7, 15);
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i a[4];
+        __m256i b[4];
+        for (int i = 0; i < 4; ++i) {
+            a[i] = load4AVX2(s0 + x * 4 + i * 16);
+            b[i] = load4AVX2(s1 + x * 4 + i * 16);
+        }
+
+        storeLuma16AVX2(y0 + x, a, coeffs.y);
+        if (y1) {
+            storeLuma16AVX2(y1 + x, b, coeffs.y);
+        }
+
+        __m256i uv = _mm256_packus_epi32(
+                chroma8AVX2(_mm256_add_epi16(a[0], b[0]), _mm256_add_epi16(a[1], b[1]), coeffs),
+                chroma8AVX2(_mm256_add_epi16(a[2], b[2]), _mm256_add_epi16(a[3], b[3]), coeffs));
+        uv = _mm256_permute4x64_epi64(_mm256_packus_epi16(uv, uv), 0x08);
+        __m128i ordered = _mm_shuffle_epi8(_mm256_castsi256_si128(uv), uvOrder);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(u + (x >> 1)), ordered);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(v + (x >> 1)), _mm_unpackhi_epi64(ordered, ordered));
+    }
+    return x;
+}
+
+#endif
+
+struct Kernel {
+    RowPairFunc func;
+    const char* name;
+};
+
+const Kernel& getKernel() {
+    static const Kernel kernel = XSimd::select<Kernel>({
+#if X_SIMD_X86
+        {SIMD_FEATURE_AVX2, {rowPairAVX2, "avx2"}},
+        {SIMD_FEATURE_SSE41, {rowPairSSE41, "sse4.1"}},
+#endif
+    }, {rowPairScalar, "c"});
+    return kernel;
+}
+
+}
+
+void XColorConvert::rgbaToYUV420P(const uint8_t* src, int srcStride,
+                                  uint8_t* const dst[3], const int dstStride[3],
+                                  int width, int height, ColorMatrix matrix) {
+    const ConvertCoeffs& c = (matrix == COLOR_MATRIX_BT709) ? COEFFS_BT709 : COEFFS_BT601;
+    RowPairFunc func = getKernel().func;
+
+    for (int y = 0; y < height; y += 2) {
+        const uint8_t* s0 = src + y * srcStride;
+        uint8_t* y0 = dst[0] + y * dstStride[0];
+        // 奇数高度时最后一行与自身配对，且只写一行亮度
+        bool last = (y + 1 >= height);
+        const uint8_t* s1 = last ? s0 : s0 + srcStride;
+        uint8_t* y1 = last ? nullptr : y0 + dstStride[0];
+        uint8_t* u = dst[1] + (y >> 1) * dstStride[1];
+        uint8_t* v = dst[2] + (y >> 1) * dstStride[2];
+
+        int x = func(s0, s1, y0, y1, u, v, width, c);
+        rowPairC(s0, s1, y0, y1, u, v, x, width, c);
+    }
+}
+
+const char* XColorConvert::getKernelName() {
+    return getKernel().name;
+}
@@ -0,0 +1,37 @@
+//
+//  XColorConvert.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XCOLORCONVERT_H
+#define XEXPORTER_XCOLORCONVERT_H
+
+#include <cstdint>
+
+enum ColorMatrix {
+    COLOR_MATRIX_BT601 = 0,
+    COLOR_MATRIX_BT709,
+};
+
+class XColorConvert {
+public:
+    /**
+     * @brief 同尺寸RGBA转YUV420P（limited range），色度取2x2像素块的平均值
+     * @param src RGBA像素，srcStride为每行字节数
+     * @param dst Y/U/V三个平面，dstStride为各平面每行字节数
+     * @note 按行对处理，从偶数行开始的条带可以独立并行转换
+     */
+    static void rgbaToYUV420P(const uint8_t* src, int srcStride,
+                              uint8_t* const dst[3], const int dstStride[3],
+                              int width, int height, ColorMatrix matrix = COLOR_MATRIX_BT601);
+
+    /**
+     * @brief 运行时根据CPU特性选中的实现：avx2 / sse4.1 / c
+     */
+    static const char* getKernelName();
+};
+
+#endif //XEXPORTER_XCOLORCONVERT_H
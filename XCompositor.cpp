@@ -0,0 +1,435 @@
+//
+//  XCompositor.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XCompositor.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include "XFFHeader.h"
+#include "XThreadPool.h"
+#include "XSimd.h"
+#include "XTrace.h"
+
+namespace {
+
+/**
+ * 把src的[0, count)个像素以src-over混合到dst，opacity为图层不透明度（0-256）；返回已处理的像素数
+ * 结果通道 = (src * a + dst * (255 - a)) / 255，a = srcAlpha * opacity / 256；
+ * 计算alpha通道时src的alpha按255参与，得到a + dstAlpha * (1 - a)
+ */
+using BlendFunc = int (*)(uint8_t* dst, const uint8_t* src, int count, int opacity);
+
+// 精确的x / 255（四舍五入），x <= 255 * 255
+inline int div255(int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+void blendRowC(uint8_t* dst, const uint8_t* src, int x, int count, int opacity) {
+    for (; x < count; ++x) {
+        const uint8_t* s = src + x * 4;
+        uint8_t* d = dst + x * 4;
+        int a = (s[3] * opacity) >> 8;
+        if (a == 0) {
+            continue;
+        }
+        int ia = 255 - a;
+        d[0] = static_cast<uint8_t>(div255(s[0] * a + d[0] * ia));
+        d[1] = static_cast<uint8_t>(div255(s[1] * a + d[1] * ia));
+        d[2] = static_cast<uint8_t>(div255(s[2] * a + d[2] * ia));
+        d[3] = static_cast<uint8_t>(div255(255 * a + d[3] * ia));
+    }
+}
+
+int blendRowScalar(uint8_t*, const uint8_t*, int, int) {
+    return 0;
+}
+
+#if X_SIMD_X86
+
+// s为alpha置255后的源、d为目标、a为原始源，均为两个像素展开成的16位通道
+X_TARGET_SSE2 inline __m128i blend2SSE2(__m128i s, __m128i d, __m128i a, __m128i opacity) {
+    a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(a, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_srli_epi16(_mm_mullo_epi16(a, opacity), 8);
+    __m128i ia = _mm_sub_epi16(_mm_set1_epi16(255), a);
+    __m128i x = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(s, a), _mm_mullo_epi16(d, ia)), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(x, _mm_srli_epi16(x, 8)), 8);
+}
+
+X_TARGET_SSE2
+int blendRowSSE2(uint8_t* dst, const uint8_t* src, int count, int opacity) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set1_epi32(static_cast<int>(0xFF000000));
+    const __m128i op = _mm_set1_epi16(static_cast<short>(opacity));
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x * 4));
+        __m128i alpha = _mm_and_si128(s, alphaMask);
+        // 4个像素全透明时目标不变，全不透明且图层不透明时直接覆盖
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(alpha, zero)) == 0xFFFF) {
+            continue;
+        }
+        if (opacity == 256 && _mm_movemask_epi8(_mm_cmpeq_epi8(alpha, alphaMask)) == 0xFFFF) {
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), s);
+            continue;
+        }
+
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + x * 4));
+        __m128i so = _mm_or_si128(s, alphaMask);
+        __m128i lo = blend2SSE2(_mm_unpacklo_epi8(so, zero), _mm_unpacklo_epi8(d, zero),
+                                _mm_unpacklo_epi8(s, zero), op);
+        __m128i hi = blend2SSE2(_mm_unpackhi_epi8(so, zero), _mm_unpackhi_epi8(d, zero),
+                                _mm_unpackhi_epi8(s, zero), op);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x * 4), _mm_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+X_TARGET_AVX2 inline __m256i blend4AVX2(__m256i s, __m256i d, __m256i a, __m256i opacity) {
+    a = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(a, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm256_srli_epi16(_mm256_mullo_epi16(a, opacity), 8);
+    __m256i ia = _mm256_sub_epi16(_mm256_set1_epi16(255), a);
+    __m256i x = _mm256_add_epi16(_mm256_add_epi16(_mm256_mullo_epi16(s, a), _mm256_mullo_epi16(d, ia)),
+                                 _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(x, _mm256_srli_epi16(x, 8)), 8);
+}
+
+X_TARGET_AVX2
+int blendRowAVX2(uint8_t* dst, const uint8_t* src, int count, int opacity) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaMask = _mm256_set1_epi32(static_cast<int>(0xFF000000));
+    const __m256i op = _mm256_set1_epi16(static_cast<short>(opacity));
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + x * 4));
+        __m256i alpha = _mm256_and_si256(s, alphaMask);
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(alpha, zero)) == -1) {
+            continue;
+        }
+        if (opacity == 256 && _mm256_movemask_epi8(_mm256_cmpeq_epi8(alpha, alphaMask)) == -1) {
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), s);
+            continue;
+        }
+
+        // unpack/pack都在128位通道内进行，像素顺序保持不变
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + x * 4));
+        __m256i so = _mm256_or_si256(s, alphaMask);
+        __m256i lo = blend4AVX2(_mm256_unpacklo_epi8(so, zero), _mm256_unpacklo_epi8(d, zero),
+                                _mm256_unpacklo_epi8(s, zero), op);
+        __m256i hi = blend4AVX2(_mm256_unpackhi_epi8(so, zero), _mm256_unpackhi_epi8(d, zero),
+                                _mm256_unpackhi_epi8(s, zero), op);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x * 4), _mm256_packus_epi16(lo, hi));
+    }
+    return x;
+}
+
+#endif
+
+struct Kernel {
+    BlendFunc func;
+    const char* name;
+};
+
+const Kernel& getKernel() {
+    static const Kernel kernel = XSimd::select<Kernel>({
+#if X_SIMD_X86
+        {SIMD_FEATURE_AVX2, {blendRowAVX2, "avx2"}},
+        {SIMD_FEATURE_SSE2, {blendRowSSE2, "sse2"}},
+#endif
+    }, {blendRowScalar, "c"});
+    return kernel;
+}
+
+void blendRow(uint8_t* dst, const uint8_t* src, int count, int opacity) {
+    int done = getKernel().func(dst, src, count, opacity);
+    blendRowC(dst, src, done, count, opacity);
+}
+
+}
+
+XCompositor::XCompositor(int width, int height, int threadCount)
+        : mWidth(std::max(0, width)), mHeight(std::max(0, height)) {
+    mTilesX = (mWidth + CP_TILE_WIDTH - 1) / CP_TILE_WIDTH;
+    mTileCount = mTilesX * ((mHeight + CP_TILE_HEIGHT - 1) / CP_TILE_HEIGHT);
+
+    if (threadCount < 0) {
+        threadCount = std::max(0, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+    }
+    threadCount = std::min(threadCount, std::max(0, mTileCount - 1));
+    if (threadCount > 0) {
+        mPool = std::make_unique<XThreadPool>(threadCount, "compositeWorker");
+    }
+
+    // 每个参与合成的线程（含调用线程）一份块缓冲，合成过程中不再分配内存
+    mSlots.resize(threadCount + 1);
+    for (auto& slot : mSlots) {
+        slot.tile.resize(CP_TILE_WIDTH * CP_TILE_HEIGHT * 4);
+        slot.row.resize(CP_TILE_WIDTH * 4);
+    }
+    mBackgroundRow.resize(CP_TILE_WIDTH * 4);
+    setBackgroundColor(0, 0, 0, 255);
+}
+
+XCompositor::~XCompositor() = default;
+
+void XCompositor::setBackgroundColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    for (int x = 0; x < CP_TILE_WIDTH; ++x) {
+        uint8_t* p = mBackgroundRow.data() + x * 4;
+        p[0] = r;
+        p[1] = g;
+        p[2] = b;
+        p[3] = a;
+    }
+}
+
+int XCompositor::composite(const std::vector<XCompositeLayer>& layers, uint8_t* dst, int stride) {
+    XTraceSpan span("composite");
+    if (!dst || stride < mWidth * 4) {
+        return -1;
+    }
+    if (prepareLayers(layers) < 0) {
+        return -1;
+    }
+
+    forEachTile([&](int tile, Slot& slot) {
+        int tx, ty, tw, th;
+        getTileRect(tile, tx, ty, tw, th);
+        compositeTile(tx, ty, tw, th, dst + static_cast<size_t>(ty) * stride + tx * 4, stride, slot);
+    });
+    return 0;
+}
+
+int XCompositor::composite(const std::vector<XCompositeLayer>& layers, uint8_t* const dst[3],
+                           const int dstStride[3], ColorMatrix matrix) {
+    XTraceSpan span("composite");
+    if (!dst || !dst[0] || !dst[1] || !dst[2] || !dstStride) {
+        return -1;
+    }
+    if (prepareLayers(layers) < 0) {
+        return -1;
+    }
+
+    forEachTile([&](int tile, Slot& slot) {
+        int tx, ty, tw, th;
+        getTileRect(tile, tx, ty, tw, th);
+        compositeTile(tx, ty, tw, th, slot.tile.data(), CP_TILE_WIDTH * 4, slot);
+
+        // 块的起点都是偶数行、偶数列，色度平面按一半偏移
+        uint8_t* planes[3] = {
+                dst[0] + static_cast<size_t>(ty) * dstStride[0] + tx,
+                dst[1] + static_cast<size_t>(ty >> 1) * dstStride[1] + (tx >> 1),
+                dst[2] + static_cast<size_t>(ty >> 1) * dstStride[2] + (tx >> 1),
+        };
+        XColorConvert::rgbaToYUV420P(slot.tile.data(), CP_TILE_WIDTH * 4, planes, dstStride, tw, th, matrix);
+    });
+    return 0;
+}
+
+int XCompositor::getWidth() const {
+    return mWidth;
+}
+
+int XCompositor::getHeight() const {
+    return mHeight;
+}
+
+const char* XCompositor::getKernelName() {
+    return getKernel().name;
+}
+
+int XCompositor::prepareLayers(const std::vector<XCompositeLayer>& layers) {
+    mLayers.clear();
+    for (const auto& source : layers) {
+        const XImage* image = source.image.get();
+        if (!image || !image->pixels || image->width <= 0 || image->height <= 0) {
+            continue;
+        }
+        if (image->format != IMG_TYPE_RGBA && image->format != IMG_TYPE_BGRA) {
+            av_log(nullptr, AV_LOG_ERROR, "[XCompositor] composite: unsupported layer format %d\n", image->format);
+            return -1;
+        }
+
+        float opacity = std::min(1.0f, std::max(0.0f, source.opacity));
+        Layer layer;
+        layer.image = image;
+        layer.bgra = (image->format == IMG_TYPE_BGRA);
+        layer.opacity = static_cast<int>(std::lround(opacity * 256.0f));
+        if (layer.opacity == 0 || source.scaleX == 0.0f || source.scaleY == 0.0f) {
+            continue;
+        }
+
+        double left, top, right, bottom;
+        if (!layer.bgra && source.rotation == 0.0f && source.scaleX == 1.0f && source.scaleY == 1.0f &&
+            source.x == std::floor(source.x) && source.y == std::floor(source.y)) {
+            layer.direct = true;
+            left = source.x;
+            top = source.y;
+            right = left + image->width;
+            bottom = top + image->height;
+        } else {
+            double w = std::fabs(image->width * static_cast<double>(source.scaleX));
+            double h = std::fabs(image->height * static_cast<double>(source.scaleY));
+            double cx = source.x + w / 2;
+            double cy = source.y + h / 2;
+            double radians = source.rotation * M_PI / 180.0;
+            double cs = std::cos(radians);
+            double sn = std::sin(radians);
+
+            // 四个角绕中心旋转后的包围盒
+            left = top = HUGE_VAL;
+            right = bottom = -HUGE_VAL;
+            for (int i = 0; i < 4; ++i) {
+                double px = ((i & 1) ? w : 0) - w / 2;
+                double py = ((i & 2) ? h : 0) - h / 2;
+                double qx = cx + cs * px - sn * py;
+                double qy = cy + sn * px + cs * py;
+                left = std::min(left, qx);
+                right = std::max(right, qx);
+                top = std::min(top, qy);
+                bottom = std::max(bottom, qy);
+            }
+            left = std::floor(left);
+            top = std::floor(top);
+            right = std::ceil(right);
+            bottom = std::ceil(bottom);
+
+            // 逆变换：先绕中心反向旋转，再按缩放映射回源图，源图中心对齐图层中心
+            double sx = source.scaleX;
+            double sy = source.scaleY;
+            layer.ux = static_cast<float>(cs / sx);
+            layer.uy = static_cast<float>(sn / sx);
+            layer.u0 = static_cast<float>((-cs * cx - sn * cy) / sx + image->width / 2.0);
+            layer.vx = static_cast<float>(-sn / sy);
+            layer.vy = static_cast<float>(cs / sy);
+            layer.v0 = static_cast<float>((sn * cx - cs * cy) / sy + image->height / 2.0);
+        }
+
+        layer.left = static_cast<int>(std::max(0.0, left));
+        layer.top = static_cast<int>(std::max(0.0, top));
+        layer.right = static_cast<int>(std::min(static_cast<double>(mWidth), right));
+        layer.bottom = static_cast<int>(std::min(static_cast<double>(mHeight), bottom));
+        if (layer.left >= layer.right || layer.top >= layer.bottom) {
+            continue;
+        }
+        layer.offsetX = static_cast<int>(left);
+        layer.offsetY = static_cast<int>(top);
+        mLayers.push_back(layer);
+    }
+    return 0;
+}
+
+void XCompositor::forEachTile(const std::function<void(int tile, Slot& slot)>& task) {
+    if (!mPool) {
+        for (int tile = 0; tile < mTileCount; ++tile) {
+            task(tile, mSlots[0]);
+        }
+        return;
+    }
+
+    // 每个slot由一个线程执行，按原子计数领取下一块，各线程的负载随图层覆盖范围自动均衡
+    std::atomic<int> next(0);
+    mPool->parallelFor(static_cast<int>(mSlots.size()), [&](int index) {
+        Slot& slot = mSlots[index];
+        for (int tile = next++; tile < mTileCount; tile = next++) {
+            task(tile, slot);
+        }
+    });
+}
+
+void XCompositor::getTileRect(int tile, int& x, int& y, int& w, int& h) const {
+    x = (tile % mTilesX) * CP_TILE_WIDTH;
+    y = (tile / mTilesX) * CP_TILE_HEIGHT;
+    w = (mWidth - x < CP_TILE_WIDTH) ? mWidth - x : CP_TILE_WIDTH;
+    h = (mHeight - y < CP_TILE_HEIGHT) ? mHeight - y : CP_TILE_HEIGHT;
+}
+
+void XCompositor::compositeTile(int tx, int ty, int tw, int th, uint8_t* dst, int stride, Slot& slot) const {
+    for (int y = 0; y < th; ++y) {
+        memcpy(dst + static_cast<size_t>(y) * stride, mBackgroundRow.data(), tw * 4);
+    }
+
+    for (const auto& layer : mLayers) {
+        int x0 = std::max(tx, layer.left);
+        int x1 = std::min(tx + tw, layer.right);
+        int y0 = std::max(ty, layer.top);
+        int y1 = std::min(ty + th, layer.bottom);
+        if (x0 >= x1 || y0 >= y1) {
+            continue;
+        }
+
+        const XImage* image = layer.image;
+        for (int y = y0; y < y1; ++y) {
+            uint8_t* row = dst + static_cast<size_t>(y - ty) * stride + (x0 - tx) * 4;
+            const uint8_t* src;
+            if (layer.direct) {
+                src = image->pixels + (static_cast<size_t>(y - layer.offsetY) * image->width + (x0 - layer.offsetX)) * 4;
+            } else {
+                sampleRow(layer, y, x0, x1, slot.row.data());
+                src = slot.row.data();
+            }
+            blendRow(row, src, x1 - x0, layer.opacity);
+        }
+    }
+}
+
+void XCompositor::sampleRow(const Layer& layer, int y, int x0, int x1, uint8_t* out) const {
+    const XImage* image = layer.image;
+    const int width = image->width;
+    const int height = image->height;
+    const uint8_t* pixels = image->pixels;
+    const int r = layer.bgra ? 2 : 0;
+    const int b = 2 - r;
+
+    // 以像素中心采样，u/v换算成以源像素中心为整数的坐标
+    float px = x0 + 0.5f;
+    float py = y + 0.5f;
+    float u = layer.ux * px + layer.uy * py + layer.u0 - 0.5f;
+    float v = layer.vx * px + layer.vy * py + layer.v0 - 0.5f;
+    for (int x = x0; x < x1; ++x, out += 4, u += layer.ux, v += layer.vx) {
+        if (!(u > -1.0f && v > -1.0f && u < width && v < height)) {
+            memset(out, 0, 4);
+            continue;
+        }
+
+        int ix = static_cast<int>(std::floor(u));
+        int iy = static_cast<int>(std::floor(v));
+        int fx = static_cast<int>((u - ix) * 256.0f);
+        int fy = static_cast<int>((v - iy) * 256.0f);
+
+        // 双线性权重之和为65536，按alpha加权插值颜色，避免透明像素的颜色渗进边缘；越界的像素视为透明
+        uint32_t alpha = 0;
+        uint32_t color[3] = {0, 0, 0};
+        for (int i = 0; i < 4; ++i) {
+            int sx = ix + (i & 1);
+            int sy = iy + (i >> 1);
+            if (sx < 0 || sy < 0 || sx >= width || sy >= height) {
+                continue;
+            }
+            const uint8_t* p = pixels + (static_cast<size_t>(sy) * width + sx) * 4;
+            uint32_t weight = ((i & 1) ? fx : 256 - fx) * ((i >> 1) ? fy : 256 - fy);
+            uint32_t aw = weight * p[3];
+            alpha += aw;
+            color[0] += aw * p[r];
+            color[1] += aw * p[1];
+            color[2] += aw * p[b];
+        }
+
+        if (alpha == 0) {
+            memset(out, 0, 4);
+            continue;
+        }
+        out[0] = static_cast<uint8_t>((color[0] + alpha / 2) / alpha);
+        out[1] = static_cast<uint8_t>((color[1] + alpha / 2) / alpha);
+        out[2] = static_cast<uint8_t>((color[2] + alpha / 2) / alpha);
+        out[3] = static_cast<uint8_t>((alpha + 32768) >> 16);
+    }
+}
@@ -0,0 +1,132 @@
+//
+//  XCompositor.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XCOMPOSITOR_H
+#define XEXPORTER_XCOMPOSITOR_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "XImage.h"
+#include "XColorConvert.h"
+
+class XThreadPool;
+
+struct XCompositeLayer {
+    std::shared_ptr<XImage> image; // RGBA或BGRA，非预乘alpha
+    float x = 0.0f;        // 缩放后、旋转前图层左上角在画布上的位置，单位像素
+    float y = 0.0f;
+    float scaleX = 1.0f;   // 负值表示翻转，0表示不绘制
+    float scaleY = 1.0f;
+    float rotation = 0.0f; // 绕图层中心顺时针旋转，单位度
+    float opacity = 1.0f;  // [0, 1]
+};
+
+/**
+ * @brief 多图层合成：图层按顺序以src-over叠加在背景色上，画布切成固定大小的块，由线程池按块并行合成；
+ * 整数平移且不缩放、不旋转的RGBA图层直接按行混合，其他图层按块内每行反向映射、双线性采样后再混合；
+ * 混合使用运行时选择的SIMD内核（avx2 / sse2 / c），整块不透明或全透明的像素跳过乘法
+ * 输出YUV420P时每块先合成到线程自己的RGBA块缓冲（常驻缓存），再转换进目标平面，不需要整帧的RGBA中间缓冲
+ * @note 同一对象同时只能有一个线程调用composite；合成期间不能修改图层的像素
+ */
+class XCompositor {
+public:
+    /**
+     * @param threadCount 工作线程数，<0表示CPU核数-1，0表示只在调用线程合成
+     */
+    XCompositor(int width, int height, int threadCount = -1);
+
+    ~XCompositor();
+
+    /**
+     * @brief 图层之下的背景色，默认不透明黑色
+     */
+    void setBackgroundColor(uint8_t r, uint8_t g, uint8_t b, uint8_t a = 255);
+
+    /**
+     * @brief 合成到RGBA画布
+     * @param stride 画布每行字节数
+     * @return 0表示成功，-1表示参数错误或图层格式不支持
+     */
+    int composite(const std::vector<XCompositeLayer>& layers, uint8_t* dst, int stride);
+
+    /**
+     * @brief 合成到YUV420P（limited range），转换结果与先合成整帧RGBA再调用XColorConvert::rgbaToYUV420P一致
+     * @param dst Y/U/V三个平面，dstStride为各平面每行字节数
+     */
+    int composite(const std::vector<XCompositeLayer>& layers, uint8_t* const dst[3], const int dstStride[3],
+                  ColorMatrix matrix = COLOR_MATRIX_BT601);
+
+    int getWidth() const;
+
+    int getHeight() const;
+
+    /**
+     * @brief 运行时根据CPU特性选中的混合实现：avx2 / sse2 / c
+     */
+    static const char* getKernelName();
+
+private:
+    struct Layer {
+        const XImage* image = nullptr;
+        bool bgra = false;
+        // 整数平移的RGBA图层，按行直接读取源像素
+        bool direct = false;
+        int offsetX = 0;
+        int offsetY = 0;
+        // 画布上的包围盒，已裁剪到画布，不含right/bottom
+        int left = 0;
+        int top = 0;
+        int right = 0;
+        int bottom = 0;
+        // 0-256
+        int opacity = 0;
+        // 画布坐标 -> 源图坐标：u = ux * x + uy * y + u0，v = vx * x + vy * y + v0
+        float ux = 0.0f, uy = 0.0f, u0 = 0.0f;
+        float vx = 0.0f, vy = 0.0f, v0 = 0.0f;
+    };
+
+    struct Slot {
+        std::vector<uint8_t> tile; // YUV输出时的RGBA块缓冲
+        std::vector<uint8_t> row;  // 变换图层的采样行
+    };
+
+    int prepareLayers(const std::vector<XCompositeLayer>& layers);
+
+    /**
+     * @brief 按块并行执行task(tile, slot)，slot为当前线程独占的缓冲
+     */
+    void forEachTile(const std::function<void(int tile, Slot& slot)>& task);
+
+    void getTileRect(int tile, int& x, int& y, int& w, int& h) const;
+
+    /**
+     * @brief 把块(tx, ty, tw, th)合成到dst，dst指向块左上角
+     */
+    void compositeTile(int tx, int ty, int tw, int th, uint8_t* dst, int stride, Slot& slot) const;
+
+    void sampleRow(const Layer& layer, int y, int x0, int x1, uint8_t* out) const;
+
+private:
+    // 块宽度为偶数，块高度为偶数，保证每块的4:2:0色度与整帧转换对齐；128x32的RGBA块为16KB
+    static const int CP_TILE_WIDTH = 128;
+    static const int CP_TILE_HEIGHT = 32;
+
+    int mWidth;
+    int mHeight;
+    int mTilesX;
+    int mTileCount;
+
+    std::vector<uint8_t> mBackgroundRow;
+    std::vector<Layer> mLayers;
+    std::vector<Slot> mSlots;
+    std::unique_ptr<XThreadPool> mPool;
+};
+
+#endif //XEXPORTER_XCOMPOSITOR_H
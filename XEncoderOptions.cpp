@@ -0,0 +1,112 @@
+//
+//  XEncoderOptions.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XEncoderOptions.h"
+#include <cstdlib>
+#include <sstream>
+
+static std::string getOption(void* obj, const char* name) {
+    uint8_t* value = nullptr;
+    if (!obj || av_opt_get(obj, name, 0, &value) < 0 || !value) {
+        return "";
+    }
+    std::string result(reinterpret_cast<char*>(value));
+    av_free(value);
+    return result;
+}
+
+XEncoderOptions XEncoderOptions::fromProfile(const std::string& profile) {
+    XEncoderOptions options;
+    if (profile == "throughput") {
+        options.threadType = FF_THREAD_FRAME;
+        options.preset = "slow";
+    } else if (profile == "low-latency") {
+        options.threadType = FF_THREAD_SLICE;
+        options.tune = "zerolatency";
+        options.maxBFrames = 0;
+    } else if (profile == "low-memory") {
+        options.lookahead = 10;
+        options.refs = 1;
+    }
+    return options;
+}
+
+void XEncoderOptions::apply(AVCodecContext* avctx, AVDictionary** dict) const {
+    if (threadCount > 0) {
+        avctx->thread_count = threadCount;
+    }
+    if (threadType > 0) {
+        avctx->thread_type = threadType;
+    }
+    if (maxBFrames >= 0) {
+        avctx->max_b_frames = maxBFrames;
+    }
+    if (refs >= 0) {
+        avctx->refs = refs;
+    }
+
+    if (!preset.empty()) {
+        av_dict_set(dict, "preset", preset.data(), 0);
+    }
+    if (!tune.empty()) {
+        av_dict_set(dict, "tune", tune.data(), 0);
+    }
+    if (lookahead >= 0) {
+        av_dict_set_int(dict, "rc-lookahead", lookahead, 0);
+    }
+    if (crf >= 0) {
+        av_dict_set(dict, "crf", std::to_string(crf).data(), 0);
+    }
+    for (const auto& option : extra) {
+        av_dict_set(dict, option.first.data(), option.second.data(), 0);
+    }
+}
+
+XEncoderOptions XEncoderOptions::fromContext(AVCodecContext* avctx) {
+    XEncoderOptions options;
+    // libx264自己管理线程，按thread_count（0为自动）和thread_type是否含FF_THREAD_SLICE开启帧/片线程，
+    // 不经过FFmpeg的线程框架，active_thread_type为0
+    options.threadCount = avctx->thread_count;
+    options.threadType = avctx->active_thread_type ? avctx->active_thread_type : avctx->thread_type;
+    // max_b_frames为-1时libx264按预设决定B帧数，打开后却把max_b_frames改写为0；
+    // has_b_frames是打开后回写的实际重排序深度，据此区分"没有B帧"和"B帧数由编码器决定"
+    if (avctx->has_b_frames == 0) {
+        options.maxBFrames = 0;
+    } else {
+        options.maxBFrames = avctx->max_b_frames > 0 ? avctx->max_b_frames : -1;
+    }
+    options.refs = avctx->refs;
+    options.preset = getOption(avctx->priv_data, "preset");
+    options.tune = getOption(avctx->priv_data, "tune");
+
+    std::string lookahead = getOption(avctx->priv_data, "rc-lookahead");
+    if (!lookahead.empty()) {
+        options.lookahead = atoi(lookahead.data());
+    }
+    std::string crf = getOption(avctx->priv_data, "crf");
+    if (!crf.empty()) {
+        options.crf = static_cast<float>(atof(crf.data()));
+    }
+    return options;
+}
+
+std::string XEncoderOptions::toString() const {
+    std::ostringstream oss;
+    oss << "threads: " << threadCount
+        << " (" << (threadType == FF_THREAD_SLICE ? "slice" : threadType == FF_THREAD_FRAME ? "frame" : "default") << ")"
+        << ", preset: " << (preset.empty() ? "default" : preset)
+        << ", tune: " << (tune.empty() ? "none" : tune)
+        << ", lookahead: " << lookahead
+        << ", crf: " << crf
+        << ", bframes: " << maxBFrames
+        << ", refs: " << refs;
+    for (const auto& option : extra) {
+        oss << ", " << option.first << ": " << option.second;
+    }
+    return oss.str();
+}
@@ -0,0 +1,66 @@
+//
+//  XEncoderOptions.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XENCODEROPTIONS_H
+#define XEXPORTER_XENCODEROPTIONS_H
+
+#include <map>
+#include <string>
+#include "XFFHeader.h"
+
+/**
+ * @brief 视频编码器（libx264）选项，数值为-1或空字符串的项保持编码器默认值
+ */
+struct XEncoderOptions {
+    // 编码线程数，0表示由编码器决定
+    int threadCount = 0;
+
+    // FF_THREAD_FRAME / FF_THREAD_SLICE，0表示编码器默认
+    int threadType = 0;
+
+    std::string preset;
+
+    std::string tune;
+
+    // rc-lookahead的帧数
+    int lookahead = -1;
+
+    // 设置后优先于码率
+    float crf = -1;
+
+    int maxBFrames = -1;
+
+    int refs = -1;
+
+    // 其他编码器私有选项，原样传给avcodec_open2
+    std::map<std::string, std::string> extra;
+
+    /**
+     * @brief 预设的配置：
+     * throughput  帧级多线程 + slow预设，适合离线导出
+     * low-latency 片级多线程 + zerolatency，无B帧
+     * low-memory  短lookahead + 少参考帧
+     * 未知的名称返回默认配置
+     */
+    static XEncoderOptions fromProfile(const std::string& profile);
+
+    /**
+     * @brief 把通过AVCodecContext字段设置的选项写入avctx，其余选项写入dict
+     */
+    void apply(AVCodecContext* avctx, AVDictionary** dict) const;
+
+    /**
+     * @brief 读取avcodec_open2之后实际生效的配置；线程数为0时由编码器按CPU核数决定，
+     * maxBFrames为-1表示开启了B帧但帧数由预设决定（libx264不回写实际值）
+     */
+    static XEncoderOptions fromContext(AVCodecContext* avctx);
+
+    std::string toString() const;
+};
+
+#endif //XEXPORTER_XENCODEROPTIONS_H
@@ -0,0 +1,310 @@
+//
+//  XExportScheduler.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XExportScheduler.h"
+#include <algorithm>
+#include <chrono>
+#include "XThreadUtils.h"
+
+XExportScheduler::XExportScheduler(int workers)
+        : mNextId(0), mProgressInterval(1000), mStopped(false) {
+    if (workers <= 0) {
+        workers = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    mWorkers = std::max(SC_MIN_GRANT, workers);
+    mFreeWorkers = mWorkers;
+}
+
+XExportScheduler::~XExportScheduler() {
+    std::vector<std::shared_ptr<JobEntry>> canceled;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        for (auto &entry : mJobs) {
+            if (entry->state == EXPORT_JOB_PENDING) {
+                entry->state = EXPORT_JOB_CANCELED;
+                canceled.emplace_back(entry);
+            }
+        }
+        mCond.notify_all();
+    }
+    for (auto &entry : canceled) {
+        if (entry->job.finished) {
+            entry->job.finished(EXPORT_JOB_CANCELED);
+        }
+    }
+
+    waitAll();
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mStopped = true;
+        mCond.notify_all();
+    }
+    if (mProgressTid && mProgressTid->joinable()) {
+        mProgressTid->join();
+    }
+}
+
+void XExportScheduler::setProgressCallback(ProgressCallback callback, int intervalMs) {
+    mProgressCallback = std::move(callback);
+    mProgressInterval = std::max(1, intervalMs);
+}
+
+int XExportScheduler::submit(XExportJob job) {
+    std::vector<XExportJob> jobs;
+    jobs.emplace_back(std::move(job));
+    return submit(std::move(jobs)).front();
+}
+
+std::vector<int> XExportScheduler::submit(std::vector<XExportJob> jobs) {
+    std::vector<int> ids;
+    std::lock_guard<std::mutex> lock(mMutex);
+    for (auto &job : jobs) {
+        ids.emplace_back(addJobLocked(std::move(job))->id);
+    }
+
+    if (mProgressCallback && !mProgressTid) {
+        mProgressTid = std::make_unique<std::thread>([this] { progressWorkThread(this); });
+    }
+    dispatchLocked();
+    return ids;
+}
+
+bool XExportScheduler::cancel(int jobId) {
+    std::shared_ptr<JobEntry> canceled;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        auto it = std::find_if(mJobs.begin(), mJobs.end(), [jobId](const std::shared_ptr<JobEntry> &entry) {
+            return entry->id == jobId;
+        });
+        if (it == mJobs.end()) {
+            return false;
+        }
+
+        auto &entry = *it;
+        if (entry->state == EXPORT_JOB_RUNNING) {
+            entry->canceled = true;
+            return true;
+        }
+        if (entry->state != EXPORT_JOB_PENDING) {
+            return false;
+        }
+        entry->state = EXPORT_JOB_CANCELED;
+        canceled = entry;
+        mCond.notify_all();
+    }
+
+    if (canceled->job.finished) {
+        canceled->job.finished(EXPORT_JOB_CANCELED);
+    }
+    return true;
+}
+
+void XExportScheduler::waitAll() {
+    std::vector<std::unique_ptr<std::thread>> tids;
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait(lock, [this] {
+            return std::none_of(mJobs.begin(), mJobs.end(), [](const std::shared_ptr<JobEntry> &entry) {
+                return entry->state == EXPORT_JOB_PENDING || entry->state == EXPORT_JOB_RUNNING;
+            });
+        });
+        for (auto &entry : mJobs) {
+            if (entry->tid) {
+                tids.emplace_back(std::move(entry->tid));
+            }
+        }
+    }
+
+    // 作业线程在finishJob之后就会退出，这里只回收线程
+    for (auto &tid : tids) {
+        if (tid->joinable()) {
+            tid->join();
+        }
+    }
+}
+
+std::vector<XExportJobProgress> XExportScheduler::getProgress() const {
+    std::vector<XExportJobProgress> result;
+    std::lock_guard<std::mutex> lock(mMutex);
+    result.reserve(mJobs.size());
+    for (const auto &entry : mJobs) {
+        result.emplace_back(makeProgress(*entry));
+    }
+    return result;
+}
+
+int XExportScheduler::getWorkers() const {
+    return mWorkers;
+}
+
+std::shared_ptr<XExportScheduler::JobEntry> XExportScheduler::addJobLocked(XExportJob job) {
+    auto entry = std::make_shared<JobEntry>();
+    entry->id = mNextId++;
+    entry->job = std::move(job);
+    mJobs.emplace_back(entry);
+    return entry;
+}
+
+void XExportScheduler::dispatchLocked() {
+    while (!mStopped) {
+        // 优先级高的先开始，同优先级按提交顺序
+        std::shared_ptr<JobEntry> next;
+        for (auto &entry : mJobs) {
+            if (entry->state == EXPORT_JOB_PENDING && (!next || entry->job.priority > next->job.priority)) {
+                next = entry;
+            }
+        }
+        if (!next) {
+            break;
+        }
+
+        int grant = getGrantLocked(*next);
+        if (grant > mFreeWorkers) {
+            break;
+        }
+
+        mFreeWorkers -= grant;
+        next->threads = grant;
+        next->state = EXPORT_JOB_RUNNING;
+        next->startTime = XHistogram::now() / 1000;
+        next->tid = std::make_unique<std::thread>([this, next] { runJob(next); });
+        av_log(nullptr, AV_LOG_INFO, "[XExportScheduler] job %d start: %s, priority: %d, threads: %d, free: %d\n",
+               next->id, next->job.outputPath.data(), next->job.priority, grant, mFreeWorkers);
+    }
+}
+
+int XExportScheduler::getGrantLocked(const JobEntry &entry) const {
+    // 按等待和运行中作业的优先级权重分配预算，运行中的作业已占用的线程不会收回
+    int totalWeight = 0;
+    for (const auto &job : mJobs) {
+        if (job->state == EXPORT_JOB_PENDING || job->state == EXPORT_JOB_RUNNING) {
+            totalWeight += getWeight(job->job.priority);
+        }
+    }
+    int share = mWorkers * getWeight(entry.job.priority) / std::max(1, totalWeight);
+    return std::max(SC_MIN_GRANT, std::min({share, SC_MAX_GRANT, mFreeWorkers}));
+}
+
+void XExportScheduler::runJob(std::shared_ptr<JobEntry> entry) {
+    XThreadUtils::configThreadName("exportJobWorkThread");
+    av_log(nullptr, AV_LOG_INFO, "[XExportScheduler] exportJobWorkThread %d ++++\n", entry->id);
+    const XExportJob &job = entry->job;
+    auto exporter = std::make_shared<XExporter>(job.outputPath, job.width, job.height, job.fps, job.duration);
+    if (job.configure) {
+        job.configure(*exporter);
+    }
+
+    // 送帧线程占1个，条带转换的辅助线程占bands - 1个，其余给编码器
+    int bands = entry->threads >= SC_BAND_GRANT ? 2 : 1;
+    XEncoderOptions options = exporter->getVideoEncoderOptions();
+    options.threadCount = std::max(1, entry->threads - bands);
+    exporter->setVideoEncoderOptions(options);
+    exporter->setConvertThreads(0);
+    exporter->setConvertBands(bands);
+    exporter->setChunkedEncoding(0);
+    exporter->setExportResultCallback([entry](ExportResult result) {
+        if (result == EXPORT_RESULT_FAILED) {
+            entry->failed = true;
+        }
+    });
+
+    exporter->start();
+    // start()返回后输出文件和队列都已创建，进度线程此时再读取getStats()不会与openOutFile()竞争
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        entry->exporter = exporter;
+    }
+    int ret = 0;
+    if (!entry->failed && job.produce) {
+        ret = job.produce(*exporter, entry->canceled);
+    }
+    exporter->stop();
+
+    ExportJobState state = EXPORT_JOB_SUCCEED;
+    if (entry->canceled) {
+        state = EXPORT_JOB_CANCELED;
+    } else if (ret < 0 || entry->failed) {
+        state = EXPORT_JOB_FAILED;
+    }
+    finishJob(entry, state);
+    av_log(nullptr, AV_LOG_INFO, "[XExportScheduler] exportJobWorkThread %d ----\n", entry->id);
+}
+
+void XExportScheduler::finishJob(std::shared_ptr<JobEntry> entry, ExportJobState state) {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        entry->progress = makeProgress(*entry).progress;
+        entry->exporter.reset();
+        entry->state = state;
+        entry->endTime = XHistogram::now() / 1000;
+        mFreeWorkers += entry->threads;
+        av_log(nullptr, AV_LOG_INFO, "[XExportScheduler] job %d finish: %d, elapsed: %ld ms, free: %d\n",
+               entry->id, state, entry->endTime - entry->startTime, mFreeWorkers);
+        dispatchLocked();
+        mCond.notify_all();
+    }
+
+    if (entry->job.finished) {
+        entry->job.finished(state);
+    }
+}
+
+void XExportScheduler::progressWorkThread(void *opaque) {
+    XThreadUtils::configThreadName("progressWorkThread");
+    auto scheduler = reinterpret_cast<XExportScheduler *>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XExportScheduler] progressWorkThread ++++\n");
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(scheduler->mMutex);
+            scheduler->mCond.wait_for(lock, std::chrono::milliseconds(scheduler->mProgressInterval), [scheduler] {
+                return scheduler->mStopped;
+            });
+            if (scheduler->mStopped) {
+                break;
+            }
+        }
+        scheduler->mProgressCallback(scheduler->getProgress());
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XExportScheduler] progressWorkThread ----\n");
+}
+
+int XExportScheduler::getWeight(ExportPriority priority) {
+    switch (priority) {
+        case EXPORT_PRIORITY_LOW:
+            return 1;
+        case EXPORT_PRIORITY_HIGH:
+            return 4;
+        default:
+            return 2;
+    }
+}
+
+XExportJobProgress XExportScheduler::makeProgress(const JobEntry &entry) {
+    XExportJobProgress progress;
+    progress.id = entry.id;
+    progress.outputPath = entry.job.outputPath;
+    progress.priority = entry.job.priority;
+    progress.state = entry.state;
+    progress.threads = entry.threads;
+    progress.progress = entry.progress;
+
+    if (entry.state == EXPORT_JOB_RUNNING) {
+        progress.elapsed = XHistogram::now() / 1000 - entry.startTime;
+        if (entry.exporter && entry.job.duration > 0) {
+            XExportStats stats = entry.exporter->getStats();
+            progress.progress = std::min(1.0f, static_cast<float>(stats.videoDuration) / entry.job.duration);
+        }
+    } else if (entry.endTime > 0) {
+        progress.elapsed = entry.endTime - entry.startTime;
+    }
+    if (entry.state == EXPORT_JOB_SUCCEED) {
+        progress.progress = 1.0f;
+    }
+    return progress;
+}
@@ -0,0 +1,171 @@
+//
+//  XExportScheduler.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XEXPORTSCHEDULER_H
+#define XEXPORTER_XEXPORTSCHEDULER_H
+
+#include <string>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <atomic>
+#include "XExporter.h"
+
+enum ExportPriority {
+    EXPORT_PRIORITY_LOW = 0,
+    EXPORT_PRIORITY_NORMAL,
+    EXPORT_PRIORITY_HIGH,
+};
+
+enum ExportJobState {
+    EXPORT_JOB_PENDING = 0,
+    EXPORT_JOB_RUNNING,
+    EXPORT_JOB_SUCCEED,
+    EXPORT_JOB_FAILED,
+    EXPORT_JOB_CANCELED,
+};
+
+struct XExportJob {
+    std::string outputPath;
+    int width = 540;
+    int height = 960;
+    int fps = 25;
+    long duration = 10000; // 单位ms，用于计算进度
+    ExportPriority priority = EXPORT_PRIORITY_NORMAL;
+
+    /**
+     * start()之前调用，用于设置码率、编码器预设、音频等；线程相关的设置会被调度器分配的值覆盖
+     */
+    std::function<void(XExporter& exporter)> configure;
+
+    /**
+     * 在作业线程中送入全部帧和采样后返回，返回<0表示失败；canceled变为true时应尽快返回。
+     * 调用前exporter已start()，返回后由调度器stop()
+     */
+    std::function<int(XExporter& exporter, const std::atomic<bool>& canceled)> produce;
+
+    std::function<void(ExportJobState state)> finished;
+};
+
+struct XExportJobProgress {
+    int id = -1;
+    std::string outputPath;
+    ExportPriority priority = EXPORT_PRIORITY_NORMAL;
+    ExportJobState state = EXPORT_JOB_PENDING;
+    int threads = 0;      // 分配到的线程数，未开始时为0
+    float progress = 0;   // 已编码时长 / 作业时长，0 ~ 1
+    long elapsed = 0;     // 开始后经过的时长，单位ms
+};
+
+/**
+ * 多个导出作业共享固定的线程预算：每个作业开始时按优先级权重分到若干线程，
+ * 其中一个用于送帧和颜色转换，其余分给编码器（libx264的线程数）和条带转换；
+ * 剩余预算不够一个作业的最小份额时，作业按优先级排队等待
+ * @note 已开始的作业不会被抢占，高优先级作业只在有线程归还时优先开始
+ */
+class XExportScheduler {
+    using ProgressCallback = std::function<void(const std::vector<XExportJobProgress>& progress)>;
+
+public:
+    /**
+     * @param workers 线程预算，<=0表示CPU核数
+     */
+    explicit XExportScheduler(int workers = 0);
+
+    /**
+     * 取消还未开始的作业，等待正在运行的作业结束
+     */
+    ~XExportScheduler();
+
+    /**
+     * 每intervalMs毫秒在进度线程中回调一次所有作业的进度，需在submit之前设置
+     */
+    void setProgressCallback(ProgressCallback callback, int intervalMs = 1000);
+
+    /**
+     * @return 作业id
+     */
+    int submit(XExportJob job);
+
+    /**
+     * 一次提交多个作业，全部加入队列后才开始分配，避免先提交的作业占满预算
+     */
+    std::vector<int> submit(std::vector<XExportJob> jobs);
+
+    /**
+     * 未开始的作业直接移除，正在运行的作业通知produce尽快返回
+     * @return false表示作业不存在或已结束
+     */
+    bool cancel(int jobId);
+
+    /**
+     * 等待所有已提交的作业结束
+     */
+    void waitAll();
+
+    std::vector<XExportJobProgress> getProgress() const;
+
+    int getWorkers() const;
+
+private:
+    struct JobEntry {
+        int id = -1;
+        XExportJob job;
+        ExportJobState state = EXPORT_JOB_PENDING;
+        int threads = 0;
+        long startTime = 0;
+        long endTime = 0;
+        float progress = 0;
+        bool failed = false;
+        std::atomic<bool> canceled{false};
+        std::shared_ptr<XExporter> exporter;
+        std::unique_ptr<std::thread> tid;
+    };
+
+    void dispatchLocked();
+
+    int getGrantLocked(const JobEntry& entry) const;
+
+    std::shared_ptr<JobEntry> addJobLocked(XExportJob job);
+
+    void runJob(std::shared_ptr<JobEntry> entry);
+
+    void finishJob(std::shared_ptr<JobEntry> entry, ExportJobState state);
+
+    void progressWorkThread(void* opaque);
+
+    static int getWeight(ExportPriority priority);
+
+    static XExportJobProgress makeProgress(const JobEntry& entry);
+
+private:
+    // 每个作业至少需要送帧线程 + 编码线程
+    const int SC_MIN_GRANT = 2;
+    // 单个作业超过这个线程数后编码器的收益很小
+    const int SC_MAX_GRANT = 16;
+    // 分到这么多线程时把送帧线程的转换拆成2个条带
+    const int SC_BAND_GRANT = 6;
+
+    int mWorkers;
+    int mFreeWorkers;
+    int mNextId;
+    std::vector<std::shared_ptr<JobEntry>> mJobs;
+
+    mutable std::mutex mMutex;
+    std::condition_variable mCond;
+
+    ProgressCallback mProgressCallback;
+    int mProgressInterval;
+    bool mStopped;
+    std::unique_ptr<std::thread> mProgressTid;
+};
+
+#endif //XEXPORTER_XEXPORTSCHEDULER_H
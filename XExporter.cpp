@@ -7,8 +7,58 @@
 //
 
 #include "XExporter.h"
+#include <algorithm>
 #include "XThreadUtils.h"
 #include "XFrameQueue.h"
+#include "XFrameRingQueue.h"
+#include "XFramePool.h"
+#include "XThreadPool.h"
+#include "XImage.h"
+#include "XSampleQueue.h"
+#include "XMuxer.h"
+#include "XAsyncFileWriter.h"
+#include "XChunkEncoder.h"
+#include "XCheckpointWriter.h"
+#include "XTrace.h"
+#include <deque>
+#include <chrono>
+#include <sstream>
+
+/**
+ * @return encodeFrame支持的输入格式对应的AVPixelFormat，不支持时返回AV_PIX_FMT_NONE
+ */
+static AVPixelFormat toPixelFormat(int format) {
+    switch (format) {
+        case IMG_TYPE_YUV420P:
+        case IMG_TYPE_RGB24:
+        case IMG_TYPE_NV12:
+        case IMG_TYPE_RGBA:
+        case IMG_TYPE_BGRA:
+            return static_cast<AVPixelFormat>(format);
+        default:
+            return AV_PIX_FMT_NONE;
+    }
+}
+
+/**
+ * @brief 格式要求的每个平面都要有数据和行宽，否则转换时会读空指针
+ */
+static bool checkPlanes(uint8_t *const data[4], const int linesize[4], AVPixelFormat format) {
+    int planes = av_pix_fmt_count_planes(format);
+    if (planes <= 0 || planes > 4) {
+        return false;
+    }
+    for (int i = 0; i < planes; ++i) {
+        if (!data[i] || linesize[i] == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool isPackedRGB(AVPixelFormat format) {
+    return format == AV_PIX_FMT_RGBA || format == AV_PIX_FMT_BGRA || format == AV_PIX_FMT_RGB24;
+}
 
 void dumpPacket(const AVFormatContext *ic, const AVPacket *pkt) {
     AVRational *time_base = &ic->streams[pkt->stream_index]->time_base;
@@ -23,7 +73,19 @@ void dumpPacket(const AVFormatContext *ic, const AVPacket *pkt) {
 
 XExporter::XExporter(const std::string &outputPath, int width, int height, int fps, long duration)
         : mOutputPath(outputPath), mWidth(width), mHeight(height), mFPS(fps), mDuration(duration),
-          mDisableAudio(false), mDisableVideo(false), mAborted(false), mSendFrameCount(0), mReceivePacketCount(0) {
+          mVideoBitrate(0), mDisableAudio(false), mDisableVideo(false),
+          mInputSampleRate(EXPORT_PARAM_SAMPLE_RATE), mInputChannels(2), mInputSampleFormat(SAMPLE_TYPE_S16),
+          mChunkFrames(0), mParallelChunks(0), mFragmentedOutput(false), mFragmentDuration(0),
+          mAsyncOutput(false), mOutputBlockSize(0), mCheckpointSegmentDuration(0), mResumePts(0),
+          mSkipInputSamples(0), mKeyframeSegment(-1), mConvertBands(1),
+          mConvertMethod(CONVERT_METHOD_SWSCALE), mColorMatrix(COLOR_MATRIX_BT601), mLockFreeQueue(false),
+          mConvertThreads(0), mQueueByteLimit(0),
+          mMemoryPolicy(MEMORY_POLICY_BLOCK), mBandFormat(AV_PIX_FMT_NONE), mVariableFrameRate(false), mVideoTimeBase({1, fps}), mFrameDuration(1), mLastPts(-1),
+          mOverloadPolicy(OVERLOAD_POLICY_BLOCK), mStatsInterval(1000), mPendingConvert(0),
+          mSourceSequence(0), mOutputSequence(0), mAborted(false),
+          mStatsStopped(false), mStartTime(0), mVideoBytes(0), mVideoDuration(0), mSendFrameCount(0),
+          mReceivePacketCount(0), mSendSampleCount(0), mReceiveAudioPacketCount(0), mConvertError(0),
+          mVideoEncodeExited(false) {
 
 }
 
@@ -45,6 +107,174 @@ void XExporter::setExportResultCallback(ExportResultCallback resultCallback) {
     mResultCallback = resultCallback;
 }
 
+void XExporter::setExportStatsCallback(ExportStatsCallback statsCallback, int intervalMs) {
+    mStatsCallback = statsCallback;
+    mStatsInterval = intervalMs > 0 ? intervalMs : 1000;
+}
+
+XExportStats XExporter::getStats() const {
+    XExportStats stats;
+    stats.convert = mConvertHistogram.getSummary();
+    stats.queueWait = mQueueWaitHistogram.getSummary();
+    stats.encodeSend = mSendHistogram.getSummary();
+    stats.encodeReceive = mReceiveHistogram.getSummary();
+    stats.queueDepth = mQueueDepthHistogram.getSummary();
+    if (mMuxer) {
+        stats.muxWrite = mMuxer->getWriteLatency();
+        stats.muxQueueDepth = mMuxer->getQueuedPackets();
+    }
+    if (mFrameQueue) {
+        stats.frameQueueDepth = mFrameQueue->getSize();
+        stats.frameQueueBytes = mFrameQueue->getBytes();
+        stats.shedFrames = mFrameQueue->getShedCount();
+    }
+    if (mSourceQueue) {
+        stats.shedFrames += mSourceQueue->getShedCount();
+    }
+    if (mSampleQueue) {
+        stats.sampleQueueDepth = mSampleQueue->getAvailableCount();
+    }
+    stats.sendFrames = mSendFrameCount;
+    stats.receivePackets = mReceivePacketCount;
+    stats.videoBytes = mVideoBytes;
+    stats.videoDuration = mVideoDuration;
+    stats.videoBitrate = stats.videoDuration > 0 ? stats.videoBytes * 8 * 1000 / stats.videoDuration : 0;
+    stats.elapsed = mStartTime > 0 ? (XHistogram::now() - mStartTime) / 1000 : 0;
+    stats.memoryUsed = XMemoryBudget::getInstance().getUsed();
+    stats.memoryPeak = XMemoryBudget::getInstance().getPeak();
+    return stats;
+}
+
+void XExporter::setVideoBitrate(long bitrate) {
+    mVideoBitrate = bitrate;
+}
+
+void XExporter::setVideoEncoderOptions(const XEncoderOptions &options) {
+    mVideoEncoderOptions = options;
+    mEffectiveVideoOptions = options;
+}
+
+void XExporter::setVideoEncoderProfile(const std::string &profile) {
+    setVideoEncoderOptions(XEncoderOptions::fromProfile(profile));
+}
+
+XEncoderOptions XExporter::getVideoEncoderOptions() const {
+    return mEffectiveVideoOptions;
+}
+
+void XExporter::setConvertBands(int bands) {
+    mConvertBands = bands > 1 ? bands : 1;
+}
+
+void XExporter::setConvertMethod(ConvertMethod method) {
+    mConvertMethod = method;
+}
+
+void XExporter::setColorMatrix(ColorMatrix matrix) {
+    mColorMatrix = matrix;
+}
+
+void XExporter::setLockFreeQueue(bool enable) {
+    mLockFreeQueue = enable;
+}
+
+void XExporter::setConvertThreads(int threads) {
+    mConvertThreads = std::max(0, threads);
+}
+
+void XExporter::setQueueByteLimit(long bytes) {
+    mQueueByteLimit = bytes;
+}
+
+void XExporter::setMemoryPolicy(MemoryPolicy policy) {
+    mMemoryPolicy = policy;
+}
+
+void XExporter::setAsyncOutput(bool enable, int blockSize) {
+    mAsyncOutput = enable;
+    mOutputBlockSize = blockSize;
+}
+
+void XExporter::setChunkedEncoding(long chunkDuration, int parallelChunks) {
+    if (chunkDuration <= 0) {
+        mChunkFrames = 0;
+        return;
+    }
+
+    int chunkFrames = std::max(1, static_cast<int>(chunkDuration * mFPS / 1000));
+    long totalFrames = mDuration * mFPS / 1000;
+    if (totalFrames > chunkFrames) {
+        // 总时长已知时均分，避免最后剩下一个很短的段
+        long chunks = (totalFrames + chunkFrames - 1) / chunkFrames;
+        chunkFrames = static_cast<int>((totalFrames + chunks - 1) / chunks);
+    }
+    mChunkFrames = chunkFrames;
+
+    if (parallelChunks <= 0) {
+        // 每段编码器再开2个线程，按核数估算并行段数
+        parallelChunks = std::max(2, static_cast<int>(std::thread::hardware_concurrency()) / 2);
+    }
+    mParallelChunks = parallelChunks;
+}
+
+void XExporter::setFragmentedOutput(bool enable, long fragmentDuration) {
+    mFragmentedOutput = enable;
+    mFragmentDuration = fragmentDuration;
+}
+
+void XExporter::setAudioInputFormat(int sampleRate, int channels, SampleType format) {
+    mInputSampleRate = sampleRate;
+    mInputChannels = channels;
+    mInputSampleFormat = format;
+}
+
+void XExporter::setCheckpoint(const std::string &dir, long segmentDuration) {
+    mCheckpoint.reset();
+    mResumePts = 0;
+    mCheckpointDir = segmentDuration > 0 ? dir : "";
+    mCheckpointSegmentDuration = segmentDuration;
+}
+
+void XExporter::openCheckpoint() {
+    mCheckpoint.reset();
+    mResumePts = 0;
+    if (mCheckpointDir.empty()) {
+        return;
+    }
+
+    // 影响编码结果的参数，任何一项变化都不能接着上次的段继续；在start()时记录，与setter的调用顺序无关
+    std::ostringstream params;
+    params << mWidth << "x" << mHeight << " fps: " << mFPS << " vfr: " << mVariableFrameRate
+           << " segment: " << mCheckpointSegmentDuration << " video: " << !mDisableVideo
+           << " audio: " << !mDisableAudio << " bitrate: " << mVideoBitrate << " matrix: " << mColorMatrix
+           << " " << mVideoEncoderOptions.toString();
+
+    auto checkpoint = std::make_unique<XCheckpointWriter>(mCheckpointDir, mCheckpointSegmentDuration);
+    if (checkpoint->load(params.str()) < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] checkpoint disabled: %s\n", mCheckpointDir.data());
+        return;
+    }
+    mResumePts = checkpoint->getCommittedPts();
+    mCheckpoint = std::move(checkpoint);
+}
+
+long XExporter::getResumePts() const {
+    return mResumePts;
+}
+
+void XExporter::setVariableFrameRate(bool enable) {
+    mVariableFrameRate = enable;
+}
+
+void XExporter::setOverloadPolicy(OverloadPolicy policy) {
+    mOverloadPolicy = policy;
+}
+
+XOverloadStats XExporter::getOverloadStats() const {
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    return mOverloadStats;
+}
+
 void XExporter::start() {
     int ret = openOutFile();
     if (ret < 0) {
@@ -54,49 +284,436 @@ void XExporter::start() {
         return;
     }
 
+    if (mMuxer) {
+        mMuxer->start();
+    }
+    mStartTime = XHistogram::now();
+
+    if (mStatsCallback) {
+        mStatsTid = std::make_unique<std::thread>([this] { statsWorkThread(this); });
+    }
+
     if (!mDisableAudio) {
         mEncodeAudioTid = std::make_unique<std::thread>([this] { encodeAudioWorkThread(this); });
     }
 
     if (!mDisableVideo) {
         mEncodeVideoTid = std::make_unique<std::thread>([this] { encodeVideoWorkThread(this); });
+        for (int i = 0; i < std::max(1, mConvertThreads); ++i) {
+            mConvertTids.emplace_back(std::make_unique<std::thread>([this, i] { convertWorkThread(this, i); }));
+        }
     }
 }
 
 
-int XExporter::encodeFrame(uint8_t *pixels, int width, int height) {
-    if (!pixels || width < 0 || height < 0) {
+int XExporter::encodeFrame(uint8_t *pixels, int width, int height, long pts) {
+    uint8_t *data[4] = {pixels, nullptr};
+    int linesize[4] = {width * 4, 0};
+    return encodeFrame(data, linesize, width, height, IMG_TYPE_RGBA, pts);
+}
+
+int XExporter::encodeFrame(uint8_t *pixels, int width, int height, PixelsReleaseCallback release, long pts) {
+    uint8_t *data[4] = {pixels, nullptr};
+    int linesize[4] = {width * 4, 0};
+    return encodeFrame(data, linesize, width, height, IMG_TYPE_RGBA, std::move(release), pts);
+}
+
+int XExporter::encodeFrame(uint8_t *const data[4], const int linesize[4], int width, int height, ImageType format,
+                           long pts) {
+    XTraceSpan span("encodeFrame");
+    AVPixelFormat pixFmt = toPixelFormat(format);
+    if (!data || !data[0] || !linesize || width <= 0 || height <= 0 || !mFrameQueue) {
+        return -1;
+    }
+    if (pixFmt == AV_PIX_FMT_NONE) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeFrame: unsupported format %d\n", format);
+        return AVERROR(EINVAL);
+    }
+    if (!checkPlanes(data, linesize, pixFmt)) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeFrame: missing planes for format %d\n", format);
+        return AVERROR(EINVAL);
+    }
+    if (isCommitted(pts)) {
+        return 0;
+    }
+
+    return submitVideoFrame(pts, [&] {
+        return stagePixels(data, linesize, width, height, pixFmt);
+    }, [&]() -> std::shared_ptr<Frame> {
+        auto frame = allocVideoFrame();
+        if (!frame || frameConvert(frame, data, linesize, width, height, pixFmt) < 0) {
+            return nullptr;
+        }
+        return frame;
+    });
+}
+
+int XExporter::encodeVideoFrame(const std::shared_ptr<Frame> &frame, long pts) {
+    XTraceSpan span("encodeVideoFrame");
+    if (!frame || !frame->avframe || !mFrameQueue) {
         return -1;
     }
+    AVFrame *src = frame->avframe;
+    if (!isPassthrough(static_cast<AVPixelFormat>(src->format), src->width, src->height)) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeVideoFrame: frame %dx%d format %d does not match output\n",
+               src->width, src->height, src->format);
+        return AVERROR(EINVAL);
+    }
+    if (isCommitted(pts)) {
+        return 0;
+    }
 
-    auto frame = allocVideoFrame();
+    // 只增加缓冲的引用计数，调用方的帧和时间戳不受影响
+    auto ref = [&]() -> std::shared_ptr<Frame> {
+        auto dst = std::make_shared<Frame>();
+        if (!dst->avframe || av_frame_ref(dst->avframe, src) < 0) {
+            av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeVideoFrame failed: Out of memory\n");
+            return nullptr;
+        }
+        return dst;
+    };
+    return submitVideoFrame(pts, ref, ref);
+}
+
+int XExporter::submitVideoFrame(long pts, const std::function<std::shared_ptr<Frame>()> &stage,
+                                const std::function<std::shared_ptr<Frame>()> &convert) {
+    if (mConvertThreads > 0 && mSourceQueue) {
+        int ret = takeConvertError();
+        if (ret < 0) {
+            return ret;
+        }
+        if (!mPendingDuplicates.empty()) {
+            // 待补的重复帧排在新帧之前，等转换线程送完已接收的帧再补
+            waitConvertIdle();
+            while (!mPendingDuplicates.empty()) {
+                putDuplicateFrame();
+            }
+        }
+
+        long framePts = makeVideoPts(pts);
+        if (framePts < 0) {
+            return AVERROR(EINVAL);
+        }
+        auto source = stage();
+        if (!source) {
+            return -1;
+        }
+        source->avframe->pts = framePts;
+        if (!queueSource(source)) {
+            return getPutError();
+        }
+        mLastPts = framePts;
+        return 0;
+    }
+
+    // 零拷贝送入的帧还没转换完时先等待，保证帧的先后顺序
+    waitConvertIdle();
+    int ret = takeConvertError();
+    if (ret < 0) {
+        return ret;
+    }
+
+    long framePts = makeVideoPts(pts);
+    if (framePts < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    auto frame = convert();
     if (!frame) {
         return -1;
     }
+    frame->avframe->pts = framePts;
+
+    while (!mPendingDuplicates.empty()) {
+        putDuplicateFrame();
+    }
+    if (!putVideoFrame(frame)) {
+        // 没有送到编码器的帧不占用时间戳，也不作为重复帧的来源
+        return getPutError();
+    }
+    mLastPts = framePts;
+    if (mOverloadPolicy == OVERLOAD_POLICY_DUPLICATE_LAST) {
+        mLastFrame = frame;
+    }
+
+    return 0;
+}
+
+int XExporter::encodeFrame(uint8_t *const data[4], const int linesize[4], int width, int height, ImageType format,
+                           PixelsReleaseCallback release, long pts) {
+    XTraceSpan span("encodeFrame");
+    AVPixelFormat pixFmt = toPixelFormat(format);
+    if (!data || !data[0] || !linesize || width <= 0 || height <= 0 || !mSourceQueue) {
+        return -1;
+    }
+    if (pixFmt == AV_PIX_FMT_NONE) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeFrame: unsupported format %d\n", format);
+        return AVERROR(EINVAL);
+    }
+    if (!checkPlanes(data, linesize, pixFmt)) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeFrame: missing planes for format %d\n", format);
+        return AVERROR(EINVAL);
+    }
+    if (isCommitted(pts)) {
+        // 返回成功即接管了缓冲，跳过的帧直接归还
+        if (release) {
+            release(data[0]);
+        }
+        return 0;
+    }
+    int ret = takeConvertError();
+    if (ret < 0) {
+        return ret;
+    }
 
-    frameConvert(frame, pixels, width, height);
+    long framePts = makeVideoPts(pts);
+    if (framePts < 0) {
+        return AVERROR(EINVAL);
+    }
 
-    mFrameQueue->put(frame);
+    auto source = wrapPixels(data, linesize, width, height, pixFmt, std::move(release));
+    if (!source) {
+        return -1;
+    }
+    // 转换线程把时间戳带到转换后的帧上
+    source->avframe->pts = framePts;
+    if (!queueSource(source)) {
+        // source释放时已通过release归还缓冲
+        return getPutError();
+    }
+    mLastPts = framePts;
 
     return 0;
 }
 
-int XExporter::encodeSample(uint8_t *samples) {
-    if (!samples) {
+int XExporter::tryEncodeFrame(uint8_t *pixels, int width, int height, long pts, int timeoutMs) {
+    XTraceSpan span("tryEncodeFrame");
+    if (!pixels || width <= 0 || height <= 0 || !mFrameQueue) {
+        return -1;
+    }
+    if (isCommitted(pts)) {
+        return 0;
+    }
+
+    waitConvertIdle();
+    int ret = takeConvertError();
+    if (ret < 0) {
+        return ret;
+    }
+
+    long framePts = makeVideoPts(pts);
+    if (framePts < 0) {
+        return AVERROR(EINVAL);
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    if (!waitVideoQueue(timeoutMs)) {
+        ret = handleOverload(framePts);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+
+    auto frame = allocVideoFrame();
+    if (!frame || frameConvert(frame, pixels, width, height) < 0) {
         return -1;
     }
+    frame->avframe->pts = framePts;
+    mLastPts = framePts;
+
+    // 只有一个生产者，等到的空位不会被占用，但全局预算可能已被其他导出占用：
+    // put只等到截止时间，预算不足或按MEMORY_POLICY_SHED丢弃时同样按过载处理；
+    // DROP_OLDEST每次腾出一帧的预算后重试，队列为空时put总能成功
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+    int putTimeout = static_cast<int>(std::max<decltype(remaining)>(0, remaining));
+    while (!putVideoFrame(frame, putTimeout)) {
+        ret = handleOverload(framePts);
+        if (ret < 0) {
+            return ret;
+        }
+        putTimeout = 0;
+    }
 
+    if (mOverloadPolicy == OVERLOAD_POLICY_DUPLICATE_LAST) {
+        mLastFrame = frame;
+    }
     return 0;
 }
 
+int XExporter::encodeFrames(const std::vector<std::shared_ptr<XImage>> &images) {
+    XTraceSpan span("encodeFrames");
+    if (images.empty() || !mFrameQueue) {
+        return 0;
+    }
+
+    waitConvertIdle();
+
+    int count = static_cast<int>(images.size());
+    std::vector<std::shared_ptr<Frame>> frames(count);
+
+    // 时间戳按送入顺序分配，转换失败的帧同样占用时间戳
+    std::vector<long> ptsList(count, -1);
+    for (int i = 0; i < count; ++i) {
+        const auto &image = images[i];
+        if (!image || !image->pixels || image->width <= 0 || image->height <= 0 || isCommitted(image->pts)) {
+            continue;
+        }
+        ptsList[i] = makeVideoPts(image->pts);
+        if (ptsList[i] >= 0) {
+            mLastPts = ptsList[i];
+        }
+    }
+
+    // 按帧并行：槽位i依次转换第i, i + slots, ...帧
+    XThreadPool *pool = getConvertPool();
+    int slots = std::min(count, pool->getThreadCount() + 1);
+    if (static_cast<int>(mSwsSlots.size()) < slots) {
+        mSwsSlots.resize(slots);
+    }
+    pool->parallelFor(slots, [&](int slot) {
+        for (int i = slot; i < count; i += slots) {
+            if (ptsList[i] < 0) {
+                continue;
+            }
+
+            auto frame = allocVideoFrame();
+            if (frame && slotConvert(frame, *images[i], slot) >= 0) {
+                frame->avframe->pts = ptsList[i];
+                frames[i] = frame;
+            }
+        }
+    });
+
+    frames.erase(std::remove(frames.begin(), frames.end(), nullptr), frames.end());
+    while (!mPendingDuplicates.empty()) {
+        putDuplicateFrame();
+    }
+    if (mOverloadPolicy == OVERLOAD_POLICY_DUPLICATE_LAST && !frames.empty()) {
+        mLastFrame = frames.back();
+    }
+    long queueTime = XHistogram::now();
+    for (auto &frame : frames) {
+        frame->queueTime = queueTime;
+    }
+    return mFrameQueue->putBatch(frames);
+}
+
+int XExporter::encodeLayers(XCompositor &compositor, const std::vector<XCompositeLayer> &layers, long pts) {
+    XTraceSpan span("encodeLayers");
+    if (!mFrameQueue) {
+        return -1;
+    }
+    if (compositor.getWidth() != mWidth || compositor.getHeight() != mHeight) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeLayers: compositor size %dx%d does not match output %dx%d\n",
+               compositor.getWidth(), compositor.getHeight(), mWidth, mHeight);
+        return AVERROR(EINVAL);
+    }
+    if (isCommitted(pts)) {
+        return 0;
+    }
+
+    return submitVideoFrame(pts, [&]() -> std::shared_ptr<Frame> {
+        // 直接合成进暂存缓冲，省去一次整帧拷贝，颜色转换仍由转换线程完成
+        auto source = allocStagingFrame(mWidth, mHeight, AV_PIX_FMT_RGBA);
+        if (!source || compositor.composite(layers, source->avframe->data[0], source->avframe->linesize[0]) < 0) {
+            return nullptr;
+        }
+        return source;
+    }, [&]() -> std::shared_ptr<Frame> {
+        auto frame = allocVideoFrame();
+        if (!frame) {
+            return nullptr;
+        }
+        AVFrame *avframe = frame->avframe;
+        int ret;
+        if (mConvertMethod == CONVERT_METHOD_BUILTIN) {
+            // 按块合成后直接转换进编码帧，合成时间计入转换耗时
+            long start = XHistogram::now();
+            ret = compositor.composite(layers, avframe->data, avframe->linesize, mColorMatrix);
+            mConvertHistogram.record(XHistogram::now() - start);
+        } else {
+            mCompositeCanvas.resize(static_cast<size_t>(mWidth) * mHeight * 4);
+            ret = compositor.composite(layers, mCompositeCanvas.data(), mWidth * 4);
+            if (ret >= 0) {
+                ret = frameConvert(frame, mCompositeCanvas.data(), mWidth, mHeight);
+            }
+        }
+        return ret < 0 ? nullptr : frame;
+    });
+}
+
+int XExporter::encodeSample(uint8_t *samples, int nbSamples) {
+    if (!samples || nbSamples < 0 || !mSampleQueue) {
+        return -1;
+    }
+
+    if (mSkipInputSamples > 0) {
+        int skip = static_cast<int>(std::min<long>(mSkipInputSamples, nbSamples));
+        mSkipInputSamples -= skip;
+        samples += static_cast<size_t>(skip) * XSample::getSampleSize(mInputChannels, mInputSampleFormat);
+        nbSamples -= skip;
+        if (nbSamples == 0) {
+            return 0;
+        }
+    }
+
+    int ret = mSampleQueue->write(samples, nbSamples);
+    return ret < 0 ? ret : 0;
+}
+
+int XExporter::encodeSample(const XSample &sample) {
+    if (sample.channels != mInputChannels || sample.sampleRate != mInputSampleRate ||
+        sample.format != mInputSampleFormat) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] encodeSample failed: sample format mismatch!\n");
+        return -1;
+    }
+
+    return encodeSample(sample.samples, sample.nbSamples);
+}
+
 void XExporter::stop() {
+    if (mStatsTid && mStatsTid->joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mStatsMutex);
+            mStatsStopped = true;
+        }
+        mStatsCond.notify_all();
+        mStatsTid->join();
+    }
+
+    // 先让转换线程处理完已接管的帧，再放入结束标记，编码线程编完队列中剩余的帧后flush编码器
+    if (mSourceQueue) {
+        mSourceQueue->put(nullptr);
+    }
+    for (auto &tid : mConvertTids) {
+        if (tid && tid->joinable()) {
+            tid->join();
+        }
+    }
+    mConvertTids.clear();
+    if (mFrameQueue) {
+        // 补上最后积压的时间戳，保证结尾的时长完整
+        while (!mPendingDuplicates.empty()) {
+            putDuplicateFrame();
+        }
+        mLastFrame.reset();
+        mFrameQueue->put(nullptr);
+    }
+    // 音频编码线程读完队列中剩余的采样后flush编码器
+    if (mSampleQueue) {
+        mSampleQueue->finish();
+    }
+
     {
         std::lock_guard<std::mutex> lock(mMutex);
         mAborted = true;
-        mFrameQueue->signal();
     }
 
     int ret = closeOutFile();
+    if (mStatsCallback) {
+        mStatsCallback(getStats());
+    }
     if (ret < 0) {
         if (mResultCallback) {
             mResultCallback(EXPORT_RESULT_FAILED);
@@ -110,6 +727,12 @@ void XExporter::stop() {
 }
 
 int XExporter::openOutFile() {
+    openCheckpoint();
+    if (mCheckpoint && (mChunkFrames > 0 || mFragmentedOutput || mAsyncOutput)) {
+        av_log(nullptr, AV_LOG_WARNING, "[XExporter] checkpoint enabled, chunked/fragmented/async output ignored\n");
+        mChunkFrames = 0;
+    }
+
     AVFormatContext *ic = nullptr;
     int ret = avformat_alloc_output_context2(&ic, nullptr, nullptr, mOutputPath.data());
     if (ret < 0) {
@@ -124,6 +747,11 @@ int XExporter::openOutFile() {
         if (ret < 0) {
             return ret;
         }
+        int sampleSize = XSample::getSampleSize(mInputChannels, mInputSampleFormat);
+        int capacity = static_cast<int>(av_rescale(EXPORT_PARAM_SAMPLE_QUEUE_DURATION, mInputSampleRate, 1000));
+        mSampleQueue = std::make_unique<XSampleQueue>(capacity, sampleSize);
+        // 每次从队列中读取约一帧时长的输入
+        mSampleBuffer.resize(static_cast<size_t>(EXPORT_PARAM_FRAME_SIZE) * sampleSize);
     }
 
     if (!mDisableVideo) {
@@ -131,21 +759,108 @@ int XExporter::openOutFile() {
         if (ret < 0) {
             return ret;
         }
-        mFrameQueue = std::make_unique<XFrameQueue>();
+        // 多个转换线程同时从源队列取帧，不能使用单消费者的无锁队列
+        if (mLockFreeQueue) {
+            mFrameQueue = std::make_unique<XFrameRingQueue>();
+        } else {
+            mFrameQueue = std::make_unique<XFrameQueue>();
+        }
+        if (mLockFreeQueue && mConvertThreads <= 1) {
+            mSourceQueue = std::make_unique<XFrameRingQueue>();
+        } else {
+            mSourceQueue = std::make_unique<XFrameQueue>();
+        }
+        mFrameQueue->setByteLimit(mQueueByteLimit);
+        mSourceQueue->setByteLimit(mQueueByteLimit);
+        mFrameQueue->setMemoryPolicy(mMemoryPolicy);
+        mSourceQueue->setMemoryPolicy(mMemoryPolicy);
+        // 队列中的帧 + 每个转换线程正在转换的一帧 + 正在送入编码器的一帧 + DUPLICATE_LAST策略保留的上一帧
+        int converters = std::max(1, mConvertThreads);
+        mFramePool = std::make_unique<XFramePool>(mWidth, mHeight, EXPORT_PARAM_PIX_FMT,
+                                                  mFrameQueue->getCapacity() + converters + 2);
+        if (mConvertThreads > 1) {
+            mSwsSlots.resize(mConvertThreads);
+        }
+        if (mConvertBands > 1) {
+            // 调用线程负责其中一个条带
+            mConvertPool = std::make_unique<XThreadPool>(mConvertBands - 1, "convertWorker");
+        }
     }
 
-    ret = avio_open(&ic->pb, mOutputPath.data(), AVIO_FLAG_WRITE);
-    if (ret < 0) {
-        av_log(nullptr, AV_LOG_FATAL, "[XExporter] avio_open failed: %s\n", av_err2str(ret));
-        return ret;
+    if (mCheckpoint) {
+        // 输出文件在stop()时由各段拼接生成，这里的上下文只提供流参数
+        ret = mCheckpoint->open(ic);
+        if (ret < 0) {
+            return ret;
+        }
+        if (mResumePts > 0) {
+            // 从已提交部分的结尾继续，自动递增的时间戳也从这里开始
+            mLastPts = static_cast<long>(av_rescale_q(mResumePts, {1, 1000}, mVideoTimeBase)) - mFrameDuration;
+            mSendSampleCount = static_cast<long>(av_rescale(mResumePts, EXPORT_PARAM_SAMPLE_RATE, 1000));
+            mSkipInputSamples = 0;
+            if (!mDisableAudio) {
+                // 音频按整帧提交，已提交部分通常略超过mResumePts；编码器从已提交的结尾继续，
+                // 否则新旧Packet会重叠，重叠部分对应的输入采样丢弃
+                int64_t audioEnd = mCheckpoint->getCommittedEnd(mAudioIndex, {1, EXPORT_PARAM_SAMPLE_RATE});
+                if (audioEnd != AV_NOPTS_VALUE && audioEnd > mSendSampleCount) {
+                    mSkipInputSamples = static_cast<long>(av_rescale(audioEnd - mSendSampleCount, mInputSampleRate,
+                                                                     EXPORT_PARAM_SAMPLE_RATE));
+                    mSendSampleCount = static_cast<long>(audioEnd);
+                }
+            }
+            av_log(nullptr, AV_LOG_INFO, "[XExporter] resume from checkpoint: %ld ms, audio from sample %ld\n",
+                   mResumePts, mSendSampleCount);
+        }
+        return 0;
+    }
+
+    if (mAsyncOutput) {
+        mFileWriter = mOutputBlockSize > 0 ? std::make_unique<XAsyncFileWriter>(mOutputBlockSize)
+                                           : std::make_unique<XAsyncFileWriter>();
+        ret = mFileWriter->open(mOutputPath);
+        if (ret < 0) {
+            mFileWriter.reset();
+            return ret;
+        }
+        ic->pb = mFileWriter->getIOContext();
+        ic->flags |= AVFMT_FLAG_CUSTOM_IO;
+    } else {
+        ret = avio_open(&ic->pb, mOutputPath.data(), AVIO_FLAG_WRITE);
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XExporter] avio_open failed: %s\n", av_err2str(ret));
+            return ret;
+        }
+    }
+
+    AVDictionary *options = nullptr;
+    if (mFragmentedOutput) {
+        if (strcmp(ic->oformat->name, "mp4") == 0 || strcmp(ic->oformat->name, "mov") == 0) {
+            // moov中不含样本，之后每个关键帧开始一个新的moof/mdat分片
+            av_dict_set(&options, "movflags", "frag_keyframe+empty_moov+default_base_moof", 0);
+            if (mFragmentDuration > 0) {
+                av_dict_set_int(&options, "frag_duration", mFragmentDuration * 1000, 0);
+            }
+        } else {
+            av_log(nullptr, AV_LOG_WARNING, "[XExporter] fragmented output is not supported by %s, ignored\n",
+                   ic->oformat->name);
+        }
     }
 
-    ret = avformat_write_header(ic, nullptr);
+    ret = avformat_write_header(ic, &options);
+    av_dict_free(&options);
     if (ret < 0) {
         av_log(nullptr, AV_LOG_FATAL, "[XExporter] avformat_write_header failed: %s\n", av_err2str(ret));
         return ret;
     }
 
+    mMuxer = std::make_unique<XMuxer>(ic);
+    if (!mDisableAudio) {
+        mMuxer->addStream(mAudioIndex);
+    }
+    if (!mDisableVideo) {
+        mMuxer->addStream(mVideoIndex);
+    }
+
     return 0;
 }
 
@@ -155,47 +870,102 @@ int XExporter::addVideoStream() {
         return -1;
     }
 
-    AVCodec *codec = avcodec_find_encoder_by_name("libx264");
-    if (!codec) {
-        av_log(nullptr, AV_LOG_FATAL, "[XExporter] cannot find encoder: libx264\n");
-        return AVERROR_ENCODER_NOT_FOUND;
-    }
-
-    AVStream *stream = avformat_new_stream(mFormatCtx.get(), codec);
+    AVStream *stream = avformat_new_stream(mFormatCtx.get(), nullptr);
     if (!stream) {
         av_log(nullptr, AV_LOG_FATAL, "[XExporter] avformat new video stream failed!\n");
         return AVERROR(ENOMEM);
     }
     mVideoIndex = stream->index;
-    stream->time_base = {1, mFPS};
+    mVideoTimeBase = mVariableFrameRate ? AVRational{1, 1000} : AVRational{1, mFPS};
+    mFrameDuration = std::max(1L, static_cast<long>(av_rescale_q(1, {1, mFPS}, mVideoTimeBase)));
+    stream->time_base = mVideoTimeBase;
 
-    AVCodecContext *avctx = avcodec_alloc_context3(codec);
-    if (!avctx) {
-        av_log(nullptr, AV_LOG_FATAL, "[XExporter] video codec alloc context failed!\n");
-        return AVERROR(ENOMEM);
+    // 分段编码时这个编码器只用于生成流参数（SPS/PPS），各段使用配置完全相同的编码器
+    int ret = openVideoEncoder(mVideoCodecCtx, mChunkFrames > 0 ? getChunkThreadCount() : 0);
+    if (ret < 0) {
+        return ret;
     }
-    mVideoCodecCtx = std::unique_ptr<AVCodecContext, CodecDeleter>(avctx);
+
+    mEffectiveVideoOptions = XEncoderOptions::fromContext(mVideoCodecCtx.get());
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] video encoder: %s\n", mEffectiveVideoOptions.toString().data());
+
+    ret = avcodec_parameters_from_context(stream->codecpar, mVideoCodecCtx.get());
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] avcodec_parameters_from_context failed: %s\n", av_err2str(ret));
+        return ret;
+    }
+
+    return 0;
+}
+
+int XExporter::openVideoEncoder(std::unique_ptr<AVCodecContext, CodecDeleter> &encoder, int threadCount) {
+    AVCodec *codec = avcodec_find_encoder_by_name("libx264");
+    if (!codec) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] cannot find encoder: libx264\n");
+        return AVERROR_ENCODER_NOT_FOUND;
+    }
+
+    AVCodecContext *avctx = avcodec_alloc_context3(codec);
+    if (!avctx) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] video codec alloc context failed!\n");
+        return AVERROR(ENOMEM);
+    }
+    encoder = std::unique_ptr<AVCodecContext, CodecDeleter>(avctx);
 
     avctx->width = mWidth;
     avctx->height = mHeight;
     avctx->pix_fmt = EXPORT_PARAM_PIX_FMT;
-    avctx->time_base = {1, mFPS};
+    avctx->time_base = mVideoTimeBase;
+    // 可变帧率时码控仍按标称帧率估算每帧的码率
+    avctx->framerate = {mFPS, 1};
+    avctx->colorspace = (mColorMatrix == COLOR_MATRIX_BT709) ? AVCOL_SPC_BT709 : AVCOL_SPC_SMPTE170M;
+    avctx->color_range = AVCOL_RANGE_MPEG;
+    if (mVideoBitrate > 0) {
+        avctx->bit_rate = mVideoBitrate;
+    }
 
     if (mFormatCtx->oformat->flags & AVFMT_GLOBALHEADER) {
         avctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
     }
 
-    int ret = avcodec_open2(avctx, nullptr, nullptr);
+    bool forcedIdr = false;
+    if (mCheckpoint) {
+        // 段首由writeVideoFrame强制关键帧，GOP不超过一段
+        long segmentDuration = mCheckpoint->getSegmentDuration();
+        avctx->gop_size = std::max(1, static_cast<int>(segmentDuration * mFPS / 1000));
+        avctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+        forcedIdr = true;
+    } else if (mChunkFrames > 0) {
+        // 段内GOP闭合且不跨段，段首帧是编码器输出的第一帧，必然是IDR
+        avctx->gop_size = mChunkFrames;
+        avctx->flags |= AV_CODEC_FLAG_CLOSED_GOP;
+    } else if (mFragmentedOutput && mFragmentDuration > 0) {
+        // 按关键帧分片，GOP长度决定分片大小
+        avctx->gop_size = std::max(1, static_cast<int>(mFragmentDuration * mFPS / 1000));
+    }
+    AVDictionary *options = nullptr;
+    mVideoEncoderOptions.apply(avctx, &options);
+    if (forcedIdr) {
+        av_dict_set(&options, "forced-idr", "1", 0);
+    }
+    if (threadCount > 0) {
+        avctx->thread_count = threadCount;
+    }
+
+    int ret = avcodec_open2(avctx, nullptr, &options);
     if (ret < 0) {
         av_log(nullptr, AV_LOG_FATAL, "[XExporter] avcodec_open2 failed: %s\n", av_err2str(ret));
+        av_dict_free(&options);
         return ret;
     }
 
-    ret = avcodec_parameters_from_context(stream->codecpar, avctx);
-    if (ret < 0) {
-        av_log(nullptr, AV_LOG_FATAL, "[XExporter] avcodec_parameters_from_context failed: %s\n", av_err2str(ret));
-        return ret;
+    // avcodec_open2会取走已识别的选项，剩下的是编码器不支持的
+    AVDictionaryEntry *entry = nullptr;
+    while ((entry = av_dict_get(options, "", entry, AV_DICT_IGNORE_SUFFIX))) {
+        av_log(nullptr, AV_LOG_WARNING, "[XExporter] video encoder option not found: %s=%s\n", entry->key,
+               entry->value);
     }
+    av_dict_free(&options);
 
     return 0;
 }
@@ -207,6 +977,11 @@ int XExporter::addAudioStream() {
         return -1;
     }
 
+    if (mInputChannels <= 0 || mInputSampleRate <= 0 || XSample::getSampleSize(mInputChannels, mInputSampleFormat) <= 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] unsupported audio input format!\n");
+        return AVERROR(EINVAL);
+    }
+
     AVCodec *codec = avcodec_find_encoder_by_name("libfdk_aac");
     if (!codec) {
         av_log(nullptr, AV_LOG_FATAL, "[XExporter] cannot find encoder: libfdk-aac\n");
@@ -229,7 +1004,7 @@ int XExporter::addAudioStream() {
 
     mAudioCodecCtx = std::unique_ptr<AVCodecContext, CodecDeleter>(avctx);
 
-    avctx->frame_size = 1024;
+    avctx->frame_size = EXPORT_PARAM_FRAME_SIZE;
     avctx->sample_fmt = EXPORT_PARAM_SAMPLE_FMT;
     avctx->sample_rate = EXPORT_PARAM_SAMPLE_RATE;
     avctx->channel_layout = EXPORT_PARAM_CHANNEL_LAYOUT;
@@ -252,6 +1027,22 @@ int XExporter::addAudioStream() {
         return ret;
     }
 
+    SwrContext *swr = swr_alloc_set_opts(nullptr, avctx->channel_layout, avctx->sample_fmt, avctx->sample_rate,
+                                         av_get_default_channel_layout(mInputChannels),
+                                         static_cast<AVSampleFormat>(mInputSampleFormat), mInputSampleRate,
+                                         0, nullptr);
+    if (!swr) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] swr_alloc_set_opts failed!\n");
+        return AVERROR(ENOMEM);
+    }
+    mSwrContext = std::unique_ptr<SwrContext, SwrContextDeleter>(swr);
+
+    ret = swr_init(swr);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] swr_init failed: %s\n", av_err2str(ret));
+        return ret;
+    }
+
     return 0;
 }
 
@@ -261,18 +1052,15 @@ int XExporter::writeVideoFrame() {
     for (;;) {
         // receive packet
         do {
-            auto pkt = std::make_unique<Packet>();
+            auto pkt = std::make_shared<Packet>();
+            XTraceSpan receiveSpan("receivePacket");
+            long start = XHistogram::now();
             ret = avcodec_receive_packet(mVideoCodecCtx.get(), pkt->avpkt);
             if (ret >= 0) {
+                mReceiveHistogram.record(XHistogram::now() - start);
                 mReceivePacketCount++;
-                av_packet_rescale_ts(pkt->avpkt, mVideoCodecCtx->time_base,
-                                     mFormatCtx->streams[mVideoIndex]->time_base);
-                pkt->avpkt->stream_index = mVideoIndex;
-                // dumpPacket(mFormatCtx.get(), pkt->avpkt);
-                int tempRet = av_interleaved_write_frame(mFormatCtx.get(), pkt->avpkt);
+                int tempRet = muxPacket(pkt, mVideoCodecCtx.get(), mVideoIndex);
                 if (tempRet < 0) {
-                    av_log(nullptr, AV_LOG_FATAL, "[XExporter] av_interleaved_write_frame failed: %s\n",
-                           av_err2str(ret));
                     return tempRet;
                 }
             }
@@ -284,7 +1072,11 @@ int XExporter::writeVideoFrame() {
         } while (ret != AVERROR(EAGAIN));
 
         // get frame
-        auto frame = mFrameQueue->get();
+        std::shared_ptr<Frame> frame;
+        {
+            XTraceSpan waitSpan("waitFrame");
+            frame = mFrameQueue->get();
+        }
         if (!frame) {
             if (!flushed) {
                 ret = avcodec_send_frame(mVideoCodecCtx.get(), nullptr);
@@ -293,10 +1085,21 @@ int XExporter::writeVideoFrame() {
             }
             return -1;
         }
-        frame->avframe->pts = mSendFrameCount;
+        recordQueueWait(frame);
+
+        if (mCheckpoint) {
+            // 每个段首强制IDR，段之间没有帧间参考，提交的段可以单独解码和拼接
+            long ptsMs = static_cast<long>(av_rescale_q(frame->avframe->pts, mVideoTimeBase, {1, 1000}));
+            int segment = mCheckpoint->getSegmentIndex(ptsMs);
+            frame->avframe->pict_type = segment != mKeyframeSegment ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+            mKeyframeSegment = segment;
+        }
 
         // send frame
+        XTraceSpan sendSpan("sendFrame");
+        long start = XHistogram::now();
         ret = avcodec_send_frame(mVideoCodecCtx.get(), frame->avframe);
+        mSendHistogram.record(XHistogram::now() - start);
         if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
             return ret;
         }
@@ -305,29 +1108,355 @@ int XExporter::writeVideoFrame() {
     return 0;
 }
 
-int XExporter::writeAudioFrame() {
+int XExporter::getChunkThreadCount() const {
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()) / std::max(1, mParallelChunks));
+}
+
+int XExporter::writeVideoChunks() {
+    int threads = getChunkThreadCount();
+    std::deque<std::unique_ptr<XChunkEncoder>> chunks;
+    XChunkEncoder *current = nullptr;
+    int chunkIndex = 0;
+    int ret = 0;
+    for (;;) {
+        auto frame = mFrameQueue->get();
+        if (!frame) {
+            break;
+        }
+        recordQueueWait(frame);
+
+        if (!current || current->getFrameCount() >= mChunkFrames) {
+            if (current) {
+                current->put(nullptr);
+                current = nullptr;
+            }
+
+            // 并行段数达到上限时，先等最早的一段编完并写入复用器
+            while (!chunks.empty() && static_cast<int>(chunks.size()) >= mParallelChunks) {
+                ret = commitChunk(chunks.front().get());
+                chunks.pop_front();
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+
+            std::unique_ptr<AVCodecContext, CodecDeleter> encoder;
+            ret = openVideoEncoder(encoder, threads);
+            if (ret < 0) {
+                return ret;
+            }
+            chunks.emplace_back(std::make_unique<XChunkEncoder>(chunkIndex++, frame->avframe->pts,
+                                                                std::move(encoder)));
+            current = chunks.back().get();
+            current->setHistograms(&mSendHistogram, &mReceiveHistogram);
+            current->start();
+        }
+
+        current->put(frame);
+        mSendFrameCount++;
+    }
+
+    if (current) {
+        current->put(nullptr);
+    }
+    while (!chunks.empty()) {
+        ret = commitChunk(chunks.front().get());
+        chunks.pop_front();
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    return AVERROR_EOF;
+}
+
+int XExporter::commitChunk(XChunkEncoder *chunk) {
+    int ret = chunk->wait();
+    if (ret < 0) {
+        return ret;
+    }
+
+    AVCodecContext *avctx = chunk->getCodecContext();
+    for (const auto &pkt : chunk->getPackets()) {
+        mReceivePacketCount++;
+        ret = muxPacket(pkt, avctx, mVideoIndex);
+        if (ret < 0) {
+            return ret;
+        }
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] commit chunk %d: start: %ld, frames: %d, packets: %d\n",
+           chunk->getIndex(), chunk->getStartPts(), chunk->getFrameCount(),
+           static_cast<int>(chunk->getPackets().size()));
     return 0;
 }
 
+int XExporter::writeAudioFrame() {
+    AVCodecContext *avctx = mAudioCodecCtx.get();
+    int frameSize = avctx->frame_size > 0 ? avctx->frame_size : EXPORT_PARAM_FRAME_SIZE;
+    int chunkSamples = static_cast<int>(mSampleBuffer.size() / XSample::getSampleSize(mInputChannels,
+                                                                                        mInputSampleFormat));
+    int ret;
+    bool inputEnded = false;
+    bool flushed = false;
+    for (;;) {
+        // receive packet
+        for (;;) {
+            auto pkt = std::make_shared<Packet>();
+            ret = avcodec_receive_packet(avctx, pkt->avpkt);
+            if (ret == AVERROR(EAGAIN)) {
+                break;
+            }
+            if (ret < 0) {
+                if (ret == AVERROR_EOF) {
+                    avcodec_flush_buffers(avctx);
+                }
+                return ret;
+            }
+            mReceiveAudioPacketCount++;
+            int tempRet = muxPacket(pkt, avctx, mAudioIndex);
+            if (tempRet < 0) {
+                return tempRet;
+            }
+        }
+
+        if (flushed) {
+            return AVERROR_EOF;
+        }
+
+        // 凑满一帧：先取重采样器中已缓存的输出，不够再从采样队列读取，队列为空时阻塞
+        auto frame = allocAudioFrame(frameSize);
+        if (!frame) {
+            return AVERROR(ENOMEM);
+        }
+        int filled = 0;
+        while (filled < frameSize) {
+            int count;
+            if (inputEnded) {
+                count = sampleCovert(frame, filled, nullptr, 0);
+                if (count <= 0) {
+                    break;
+                }
+            } else {
+                count = sampleCovert(frame, filled, mSampleBuffer.data(), 0);
+                if (count == 0) {
+                    int nbSamples = mSampleQueue->read(mSampleBuffer.data(), chunkSamples);
+                    if (nbSamples < 0) {
+                        return nbSamples;
+                    }
+                    if (nbSamples == 0) {
+                        inputEnded = true;
+                        continue;
+                    }
+                    count = sampleCovert(frame, filled, mSampleBuffer.data(), nbSamples);
+                }
+            }
+            if (count < 0) {
+                return count;
+            }
+            filled += count;
+        }
+
+        if (filled == 0) {
+            ret = avcodec_send_frame(avctx, nullptr);
+            flushed = true;
+            continue;
+        }
+
+        if (filled < frameSize) {
+            // 最后一帧：编码器不支持短帧时补静音
+            if (avctx->codec->capabilities & AV_CODEC_CAP_SMALL_LAST_FRAME) {
+                frame->avframe->nb_samples = filled;
+            } else {
+                av_samples_set_silence(frame->avframe->data, filled, frameSize - filled, avctx->channels,
+                                       avctx->sample_fmt);
+            }
+        }
+        frame->avframe->pts = mSendSampleCount;
+
+        // send frame
+        ret = avcodec_send_frame(avctx, frame->avframe);
+        if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
+            return ret;
+        }
+        mSendSampleCount += frame->avframe->nb_samples;
+    }
+}
+
+long XExporter::makeVideoPts(long ptsMs) {
+    long pts;
+    if (ptsMs < 0) {
+        pts = mLastPts < 0 ? 0 : mLastPts + mFrameDuration;
+    } else {
+        pts = static_cast<long>(av_rescale_q(ptsMs, {1, 1000}, mVideoTimeBase));
+    }
+
+    if (pts <= mLastPts) {
+        av_log(nullptr, AV_LOG_WARNING, "[XExporter] reject frame: pts %ld ms is not increasing\n", ptsMs);
+        std::lock_guard<std::mutex> lock(mStatsMutex);
+        mOverloadStats.rejectedPts++;
+        return -1;
+    }
+    return pts;
+}
+
+bool XExporter::waitVideoQueue(int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    for (;;) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+        if (!mFrameQueue->waitWritable(static_cast<int>(std::max<decltype(remaining)>(0, remaining)))) {
+            return false;
+        }
+        if (mPendingDuplicates.empty()) {
+            return true;
+        }
+        putDuplicateFrame();
+    }
+}
+
+void XExporter::putDuplicateFrame() {
+    long pts = mPendingDuplicates.front();
+    mPendingDuplicates.pop_front();
+
+    // 只增加缓冲的引用计数，不拷贝像素也不做转换
+    auto frame = std::make_shared<Frame>();
+    if (!frame->avframe || av_frame_ref(frame->avframe, mLastFrame->avframe) < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] duplicate frame failed: Out of memory\n");
+        return;
+    }
+    frame->avframe->pts = pts;
+    if (!putVideoFrame(frame)) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    mOverloadStats.duplicated++;
+}
+
+bool XExporter::putVideoFrame(std::shared_ptr<Frame> frame, int timeoutMs) {
+    frame->queueTime = XHistogram::now();
+    return mFrameQueue->put(std::move(frame), timeoutMs);
+}
+
+int XExporter::getPutError() const {
+    // 编码线程退出后不再消费，之后的送帧都会失败；否则是按MEMORY_POLICY_SHED丢弃了这一帧
+    return mVideoEncodeExited ? AVERROR_EOF : AVERROR(EAGAIN);
+}
+
+void XExporter::recordConvertError(int error) {
+    // 只保留第一个错误，由调用方下一次送帧时返回
+    int expected = 0;
+    mConvertError.compare_exchange_strong(expected, error);
+}
+
+int XExporter::takeConvertError() {
+    int ret = mConvertError.exchange(0);
+    return mVideoEncodeExited ? AVERROR_EOF : ret;
+}
+
+void XExporter::recordQueueWait(const std::shared_ptr<Frame> &frame) {
+    if (frame->queueTime > 0) {
+        mQueueWaitHistogram.record(XHistogram::now() - frame->queueTime);
+    }
+    mQueueDepthHistogram.record(mFrameQueue->getSize());
+}
+
+bool XExporter::isCommitted(long ptsMs) const {
+    return ptsMs >= 0 && ptsMs < mResumePts;
+}
+
+int XExporter::handleOverload(long pts) {
+    std::lock_guard<std::mutex> lock(mStatsMutex);
+    switch (mOverloadPolicy) {
+        case OVERLOAD_POLICY_BLOCK:
+            mOverloadStats.timeoutCount++;
+            return AVERROR(EAGAIN);
+        case OVERLOAD_POLICY_DROP_OLDEST:
+            if (mFrameQueue->dropOldest()) {
+                mOverloadStats.droppedOldest++;
+                // 腾出的空位留给本帧，由调用方重新进入正常送帧流程
+                return 0;
+            }
+            break;
+        case OVERLOAD_POLICY_DUPLICATE_LAST:
+            if (mLastFrame) {
+                mLastPts = pts;
+                if (static_cast<int>(mPendingDuplicates.size()) < EXPORT_PARAM_MAX_PENDING_DUPLICATES) {
+                    mPendingDuplicates.emplace_back(pts);
+                } else {
+                    // 积压过多时放弃这个时间戳，上一帧在输出中显示得更久
+                    mOverloadStats.droppedDuplicates++;
+                }
+                return AVERROR(EAGAIN);
+            }
+            break;
+        default:
+            break;
+    }
+
+    // 丢掉新帧也占用它的时间戳，后续帧的时间线不受影响
+    mLastPts = pts;
+    mOverloadStats.droppedNewest++;
+    return AVERROR(EAGAIN);
+}
+
+int XExporter::muxPacket(const std::shared_ptr<Packet> &pkt, AVCodecContext *avctx, int streamIndex) {
+    if (streamIndex == mVideoIndex && !mDisableVideo) {
+        // 按已编码的时长估算码率，libx264不填Packet的duration，按一帧计
+        AVPacket *avpkt = pkt->avpkt;
+        long end = avpkt->pts + (avpkt->duration > 0 ? avpkt->duration : mFrameDuration);
+        long duration = static_cast<long>(av_rescale_q(end, avctx->time_base, {1, 1000}));
+        mVideoBytes += avpkt->size;
+        if (duration > mVideoDuration) {
+            mVideoDuration = duration;
+        }
+    }
+    av_packet_rescale_ts(pkt->avpkt, avctx->time_base, mFormatCtx->streams[streamIndex]->time_base);
+    pkt->avpkt->stream_index = streamIndex;
+    // dumpPacket(mFormatCtx.get(), pkt->avpkt);
+
+    // 交织和写文件在复用线程中完成，这里只在队列满时阻塞
+    int ret = mCheckpoint ? mCheckpoint->put(pkt, mFormatCtx->streams[streamIndex]->time_base, streamIndex)
+                          : mMuxer->put(pkt);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] mux packet failed: %s\n", av_err2str(ret));
+    }
+    return ret;
+}
+
 int XExporter::closeOutFile() {
     if (!mFormatCtx) {
         av_log(nullptr, AV_LOG_FATAL, "[XExporter] Output File has not open!\n");
     }
 
-    if (mEncodeAudioTid) {
+    if (mEncodeAudioTid && mEncodeAudioTid->joinable()) {
         mEncodeAudioTid->join();
-        return -1;
     }
 
-    if (mEncodeVideoTid) {
-        mFrameQueue->signal();
+    if (mEncodeVideoTid && mEncodeVideoTid->joinable()) {
         mEncodeVideoTid->join();
     }
 
-    int ret = av_write_trailer(mFormatCtx.get());
-    if (ret < 0) {
-        av_log(nullptr, AV_LOG_FATAL, "[XExporter] av_write_trailer failed: %s\n", av_err2str(ret));
-        return ret;
+    // 编码线程都已退出，放入结束标记后等待复用线程写完队列中剩余的Packet
+    int ret = 0;
+    if (mMuxer) {
+        if (!mDisableAudio) {
+            mMuxer->finish(mAudioIndex);
+        }
+        if (!mDisableVideo) {
+            mMuxer->finish(mVideoIndex);
+        }
+        ret = mMuxer->stop();
+    }
+
+    if (ret >= 0) {
+        if (mCheckpoint) {
+            ret = finishCheckpoint();
+        } else {
+            ret = av_write_trailer(mFormatCtx.get());
+            if (ret < 0) {
+                av_log(nullptr, AV_LOG_FATAL, "[XExporter] av_write_trailer failed: %s\n", av_err2str(ret));
+            }
+        }
     }
 
     if (!mDisableAudio) {
@@ -337,71 +1466,399 @@ int XExporter::closeOutFile() {
         if (mSwrContext) {
             mSwrContext.reset();
         }
+        std::vector<uint8_t>().swap(mSampleBuffer);
     }
 
     if (!mDisableVideo) {
         if (mVideoCodecCtx) {
             mVideoCodecCtx.reset();
         }
-        if (mSwsContext) {
-            mSwsContext.reset();
+        mSwsContexts.clear();
+        mSwsSlots.clear();
+        mBandSwsContexts.clear();
+        mBandRows.clear();
+        mBandFormat = AV_PIX_FMT_NONE;
+    }
+
+    // 前面失败时同样要关闭输出，否则pb和文件描述符泄漏
+    int closeRet = 0;
+    if (mFileWriter) {
+        // 等待后台写盘完成，AVIOContext由XAsyncFileWriter释放
+        closeRet = mFileWriter->close();
+        if (mFormatCtx) {
+            mFormatCtx->pb = nullptr;
+        }
+        if (closeRet < 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XExporter] close output failed: %s\n", av_err2str(closeRet));
+        }
+    } else if (mFormatCtx) {
+        closeRet = avio_closep(&mFormatCtx->pb);
+        if (closeRet < 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XExporter] avio_closep failed: %s\n", av_err2str(closeRet));
         }
     }
 
-    ret = avio_closep(&mFormatCtx->pb);
+    mFormatCtx.reset();
+
+    return ret < 0 ? ret : closeRet;
+}
+
+int XExporter::finishCheckpoint() {
+    int ret = mCheckpoint->close();
     if (ret < 0) {
-        av_log(nullptr, AV_LOG_FATAL, "[XExporter] avio_closep failed: %s\n", av_err2str(ret));
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] commit checkpoint failed: %s\n", av_err2str(ret));
         return ret;
     }
 
-    mFormatCtx.reset();
-
+    // 拼接失败时段文件和清单保留，可以用相同的参数重新导出来重试
+    ret = mCheckpoint->finalize(mOutputPath);
+    if (ret < 0) {
+        return ret;
+    }
+    mResumePts = 0;
     return 0;
 }
 
 std::shared_ptr<Frame> XExporter::allocVideoFrame() {
-    auto frame = std::make_shared<Frame>();
+    if (!mFramePool) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] allocVideoFrame failed: frame pool has not created!\n");
+        return nullptr;
+    }
+
+    auto frame = mFramePool->get();
     if (!frame) {
-        av_log(nullptr, AV_LOG_FATAL, "[XEncoder] allocVideoFrame failed: Out of memory\n");
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] allocVideoFrame failed: Out of memory\n");
+        return nullptr;
+    }
+
+    return frame;
+}
+
+std::shared_ptr<Frame> XExporter::allocAudioFrame(int nbSamples) {
+    auto frame = std::make_shared<Frame>();
+    AVFrame *avframe = frame->avframe;
+    if (!avframe) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] allocAudioFrame failed: Out of memory\n");
         return nullptr;
     }
-    frame->avframe->width = mWidth;
-    frame->avframe->height = mHeight;
-    frame->avframe->format = EXPORT_PARAM_PIX_FMT;
 
-    int ret = av_frame_get_buffer(frame->avframe, 0);
+    avframe->nb_samples = nbSamples;
+    avframe->format = mAudioCodecCtx->sample_fmt;
+    avframe->channel_layout = mAudioCodecCtx->channel_layout;
+    avframe->channels = mAudioCodecCtx->channels;
+    avframe->sample_rate = mAudioCodecCtx->sample_rate;
+    int ret = av_frame_get_buffer(avframe, 0);
     if (ret < 0) {
-        av_log(nullptr, AV_LOG_FATAL, "[XEncoder] allocVideoFrame failed: %s\n", av_err2str(ret));
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] av_frame_get_buffer failed: %s\n", av_err2str(ret));
         return nullptr;
     }
 
     return frame;
 }
 
-std::shared_ptr<Frame> XExporter::allocAudioFrame() {
-    return std::shared_ptr<Frame>();
+int XExporter::frameConvert(std::shared_ptr<Frame> dst, uint8_t *src, int srcWidth, int srcHeight, int srcStride) {
+    const uint8_t *data[4] = {src, nullptr};
+    int linesize[4] = {0};
+    av_image_fill_linesizes(linesize, AV_PIX_FMT_RGBA, srcWidth);
+    if (srcStride > 0) {
+        linesize[0] = srcStride;
+    }
+    return frameConvert(dst, data, linesize, srcWidth, srcHeight, AV_PIX_FMT_RGBA);
 }
 
-int XExporter::frameConvert(std::shared_ptr<Frame> dst, uint8_t *src, int srcWidth, int srcHeight) {
-    if (!mSwsContext) {
-        SwsContext *sws = sws_getCachedContext(nullptr, srcWidth, srcHeight, AV_PIX_FMT_RGBA,
-                                               mWidth, mHeight, EXPORT_PARAM_PIX_FMT,
-                                               0, nullptr, nullptr, nullptr);
+int XExporter::frameConvert(std::shared_ptr<Frame> dst, const uint8_t *const src[4], const int srcLinesize[4],
+                            int srcWidth, int srcHeight, AVPixelFormat srcFormat) {
+    XTraceSpan span("frameConvert");
+    long start = XHistogram::now();
+    AVFrame *frame = dst->avframe;
+    int ret;
+    // 条带之间没有垂直缩放时才能独立转换
+    bool sameSize = (srcWidth == mWidth && srcHeight == mHeight);
+    if (isPassthrough(srcFormat, srcWidth, srcHeight)) {
+        av_image_copy(frame->data, frame->linesize, const_cast<const uint8_t **>(src), srcLinesize,
+                      srcFormat, mWidth, mHeight);
+        ret = mHeight;
+    } else if (mConvertBands > 1 && mConvertPool && sameSize && isPackedRGB(srcFormat)) {
+        ret = bandConvert(dst, src, srcLinesize, srcFormat);
+    } else if (mConvertMethod == CONVERT_METHOD_BUILTIN && sameSize && srcFormat == AV_PIX_FMT_RGBA) {
+        XColorConvert::rgbaToYUV420P(src[0], srcLinesize[0], frame->data, frame->linesize,
+                                     mWidth, mHeight, mColorMatrix);
+        ret = mHeight;
+    } else {
+        SwsContext *sws = getSwsContext(srcFormat, srcWidth, srcHeight);
         if (!sws) {
-            av_log(nullptr, AV_LOG_ERROR, "[XExporter] sws_getCachedContext failed!\n");
             return -1;
         }
-        mSwsContext = std::unique_ptr<SwsContext, SwsContextDeleter>(sws);
+        ret = sws_scale(sws, src, srcLinesize, 0, srcHeight, frame->data, frame->linesize);
     }
+    mConvertHistogram.record(XHistogram::now() - start);
+    return ret;
+}
 
-    uint8_t *data[4] = {src, nullptr};
+int XExporter::bandConvert(std::shared_ptr<Frame> dst, const uint8_t *const src[4], const int srcLinesize[4],
+                           AVPixelFormat srcFormat) {
+    if (mBandRows.empty()) {
+        // 条带起始行必须是偶数，保证每个条带的4:2:0色度行与整帧转换对齐
+        int bands = std::max(1, std::min(mConvertBands, mHeight / 2));
+        int rows = (mHeight / bands) & ~1;
+        for (int i = 0; i < bands; ++i) {
+            mBandRows.emplace_back((i == bands - 1) ? mHeight - rows * i : rows);
+        }
+    }
+
+    // 内置转换只支持RGBA，其他格式按条带使用swscale
+    bool builtin = mConvertMethod == CONVERT_METHOD_BUILTIN && srcFormat == AV_PIX_FMT_RGBA;
+    if (mBandFormat != srcFormat) {
+        mBandSwsContexts.clear();
+        mBandFormat = srcFormat;
+    }
+
+    int bands = static_cast<int>(mBandRows.size());
+    if (!builtin && mBandSwsContexts.empty()) {
+        for (int i = 0; i < bands; ++i) {
+            SwsContext *sws = createSwsContext(srcFormat, mWidth, mBandRows[i], mWidth, mBandRows[i]);
+            if (!sws) {
+                mBandSwsContexts.clear();
+                return -1;
+            }
+            mBandSwsContexts.emplace_back(sws);
+        }
+    }
+
+    AVFrame *frame = dst->avframe;
+    std::vector<int> results(bands, 0);
+    mConvertPool->parallelFor(bands, [&](int index) {
+        int y = mBandRows.front() * index;
+        const uint8_t *bandSrc[4] = {src[0] + y * srcLinesize[0], nullptr};
+        uint8_t *bandDst[4] = {
+                frame->data[0] + y * frame->linesize[0],
+                frame->data[1] + (y >> 1) * frame->linesize[1],
+                frame->data[2] + (y >> 1) * frame->linesize[2],
+                nullptr
+        };
+        if (builtin) {
+            XColorConvert::rgbaToYUV420P(bandSrc[0], srcLinesize[0], bandDst, frame->linesize,
+                                         mWidth, mBandRows[index], mColorMatrix);
+            results[index] = mBandRows[index];
+        } else {
+            results[index] = sws_scale(mBandSwsContexts[index].get(), bandSrc, srcLinesize, 0, mBandRows[index],
+                                       bandDst, frame->linesize);
+        }
+    });
+
+    for (int i = 0; i < bands; ++i) {
+        if (results[i] != mBandRows[i]) {
+            av_log(nullptr, AV_LOG_ERROR, "[XExporter] sws_scale failed for band %d!\n", i);
+            return -1;
+        }
+    }
+    return mHeight;
+}
+
+SwsContext *XExporter::createSwsContext(AVPixelFormat srcFormat, int srcWidth, int srcHeight,
+                                        int dstWidth, int dstHeight) {
+    SwsContext *sws = sws_getContext(srcWidth, srcHeight, srcFormat,
+                                     dstWidth, dstHeight, EXPORT_PARAM_PIX_FMT,
+                                     EXPORT_PARAM_SWS_FLAGS, nullptr, nullptr, nullptr);
+    if (!sws) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] sws_getContext failed!\n");
+        return nullptr;
+    }
+
+    if (mColorMatrix == COLOR_MATRIX_BT709) {
+        // YUV输入认为已经是BT.709，只做缩放和平面重排，不改变色彩
+        const int *table = sws_getCoefficients(SWS_CS_ITU709);
+        const int *invTable = isPackedRGB(srcFormat) ? sws_getCoefficients(SWS_CS_DEFAULT) : table;
+        sws_setColorspaceDetails(sws, invTable, 0, table, 0, 0, 1 << 16, 1 << 16);
+    }
+    return sws;
+}
+
+SwsContext *XExporter::getSwsContext(AVPixelFormat srcFormat, int srcWidth, int srcHeight) {
+    auto key = std::make_tuple(static_cast<int>(srcFormat), srcWidth, srcHeight);
+    auto it = mSwsContexts.find(key);
+    if (it != mSwsContexts.end()) {
+        return it->second.get();
+    }
+
+    if (mSwsContexts.size() >= EXPORT_PARAM_MAX_SWS_CONTEXTS) {
+        mSwsContexts.clear();
+    }
+    SwsContext *sws = createSwsContext(srcFormat, srcWidth, srcHeight, mWidth, mHeight);
+    if (!sws) {
+        return nullptr;
+    }
+    mSwsContexts.emplace(key, std::unique_ptr<SwsContext, SwsContextDeleter>(sws));
+    return sws;
+}
+
+int XExporter::slotConvert(std::shared_ptr<Frame> dst, const XImage &image, int slot) {
+    AVPixelFormat format = image.format < 0 ? AV_PIX_FMT_RGBA : toPixelFormat(image.format);
+    if (format == AV_PIX_FMT_NONE) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] slotConvert: unsupported format %d\n", image.format);
+        return AVERROR(EINVAL);
+    }
+
+    uint8_t *data[4] = {nullptr};
     int linesize[4] = {0};
-    av_image_fill_linesizes(linesize, AV_PIX_FMT_RGBA, srcWidth);
-    return sws_scale(mSwsContext.get(), data, linesize, 0, srcHeight, dst->avframe->data, dst->avframe->linesize);
+    if (av_image_fill_arrays(data, linesize, image.pixels, format, image.width, image.height, 1) < 0) {
+        return -1;
+    }
+    return slotConvert(dst, data, linesize, image.width, image.height, format, slot);
+}
+
+int XExporter::slotConvert(std::shared_ptr<Frame> dst, const uint8_t *const src[4], const int srcLinesize[4],
+                           int srcWidth, int srcHeight, AVPixelFormat srcFormat, int slot) {
+    XTraceSpan span("frameConvert");
+    long start = XHistogram::now();
+    AVFrame *frame = dst->avframe;
+    int ret;
+    if (isPassthrough(srcFormat, srcWidth, srcHeight)) {
+        av_image_copy(frame->data, frame->linesize, const_cast<const uint8_t **>(src), srcLinesize,
+                      srcFormat, mWidth, mHeight);
+        ret = mHeight;
+    } else if (mConvertMethod == CONVERT_METHOD_BUILTIN && srcFormat == AV_PIX_FMT_RGBA &&
+               srcWidth == mWidth && srcHeight == mHeight) {
+        XColorConvert::rgbaToYUV420P(src[0], srcLinesize[0], frame->data, frame->linesize,
+                                     mWidth, mHeight, mColorMatrix);
+        ret = mHeight;
+    } else {
+        SwsSlot &swsSlot = mSwsSlots[slot];
+        if (!swsSlot.context || swsSlot.srcFormat != srcFormat ||
+            swsSlot.srcWidth != srcWidth || swsSlot.srcHeight != srcHeight) {
+            SwsContext *sws = createSwsContext(srcFormat, srcWidth, srcHeight, mWidth, mHeight);
+            if (!sws) {
+                return -1;
+            }
+            swsSlot.context = std::unique_ptr<SwsContext, SwsContextDeleter>(sws);
+            swsSlot.srcFormat = srcFormat;
+            swsSlot.srcWidth = srcWidth;
+            swsSlot.srcHeight = srcHeight;
+        }
+        ret = sws_scale(swsSlot.context.get(), src, srcLinesize, 0, srcHeight, frame->data, frame->linesize);
+    }
+    mConvertHistogram.record(XHistogram::now() - start);
+    return ret;
+}
+
+bool XExporter::isPassthrough(AVPixelFormat srcFormat, int srcWidth, int srcHeight) const {
+    return srcFormat == EXPORT_PARAM_PIX_FMT && srcWidth == mWidth && srcHeight == mHeight;
+}
+
+XThreadPool *XExporter::getConvertPool() {
+    if (!mConvertPool) {
+        int threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()) - 1);
+        mConvertPool = std::make_unique<XThreadPool>(threads, "convertWorker");
+    }
+    return mConvertPool.get();
 }
 
-void XExporter::sampleCovert(std::shared_ptr<Frame> dst, uint8_t *src) {
+int XExporter::sampleCovert(std::shared_ptr<Frame> dst, int offset, const uint8_t *src, int nbSamples) {
+    AVFrame *frame = dst->avframe;
+    auto format = static_cast<AVSampleFormat>(frame->format);
+    bool planar = av_sample_fmt_is_planar(format);
+    int planes = planar ? frame->channels : 1;
+    int step = av_get_bytes_per_sample(format) * (planar ? 1 : frame->channels);
+
+    uint8_t *out[AV_NUM_DATA_POINTERS] = {nullptr};
+    for (int i = 0; i < planes && i < AV_NUM_DATA_POINTERS; ++i) {
+        out[i] = frame->data[i] + offset * step;
+    }
 
+    const uint8_t *in[1] = {src};
+    int ret = swr_convert(mSwrContext.get(), out, frame->nb_samples - offset, src ? in : nullptr, nbSamples);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] swr_convert failed: %s\n", av_err2str(ret));
+    }
+    return ret;
+}
+
+std::shared_ptr<Frame> XExporter::wrapPixels(uint8_t *const data[4], const int linesize[4], int width, int height,
+                                             AVPixelFormat format, PixelsReleaseCallback release) {
+    auto frame = std::make_shared<Frame>();
+    if (!frame->avframe) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] wrapPixels failed: Out of memory\n");
+        return nullptr;
+    }
+
+    // 各平面的缓冲随data[0]一起归还，只需要一个AVBufferRef持有
+    auto callback = new PixelsReleaseCallback(std::move(release));
+    AVBufferRef *buf = av_buffer_create(data[0], linesize[0] * height, releasePixels, callback, 0);
+    if (!buf) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] av_buffer_create failed!\n");
+        delete callback;
+        return nullptr;
+    }
+
+    AVFrame *avframe = frame->avframe;
+    avframe->buf[0] = buf;
+    for (int i = 0; i < 4; ++i) {
+        avframe->data[i] = data[i];
+        avframe->linesize[i] = data[i] ? linesize[i] : 0;
+    }
+    avframe->width = width;
+    avframe->height = height;
+    avframe->format = format;
+    return frame;
+}
+
+void XExporter::releasePixels(void *opaque, uint8_t *data) {
+    auto callback = reinterpret_cast<PixelsReleaseCallback *>(opaque);
+    if (*callback) {
+        (*callback)(data);
+    }
+    delete callback;
+}
+
+std::shared_ptr<Frame> XExporter::allocStagingFrame(int width, int height, AVPixelFormat format) {
+    if (!mStagingPool || mStagingPool->getWidth() != width || mStagingPool->getHeight() != height ||
+        mStagingPool->getFormat() != format) {
+        // 源队列中的帧 + 每个转换线程正在转换的一帧；尺寸或格式变化时旧池中的缓冲在释放后回收
+        int capacity = mSourceQueue->getCapacity() + std::max(1, mConvertThreads);
+        mStagingPool = std::make_unique<XFramePool>(width, height, format, capacity);
+    }
+
+    auto frame = mStagingPool->get();
+    if (!frame) {
+        av_log(nullptr, AV_LOG_FATAL, "[XExporter] allocStagingFrame failed: Out of memory\n");
+        return nullptr;
+    }
+    return frame;
+}
+
+std::shared_ptr<Frame> XExporter::stagePixels(uint8_t *const data[4], const int linesize[4], int width, int height,
+                                              AVPixelFormat format) {
+    auto frame = allocStagingFrame(width, height, format);
+    if (!frame) {
+        return nullptr;
+    }
+    AVFrame *avframe = frame->avframe;
+    av_image_copy(avframe->data, avframe->linesize, const_cast<const uint8_t **>(data), linesize,
+                  format, width, height);
+    return frame;
+}
+
+bool XExporter::queueSource(std::shared_ptr<Frame> source) {
+    {
+        std::lock_guard<std::mutex> lock(mConvertMutex);
+        mPendingConvert++;
+    }
+    if (mSourceQueue->put(std::move(source))) {
+        return true;
+    }
+
+    // 按MEMORY_POLICY_SHED丢弃的帧不会被转换线程取到，不计入待转换的帧数
+    std::lock_guard<std::mutex> lock(mConvertMutex);
+    mPendingConvert--;
+    mConvertCond.notify_all();
+    return false;
+}
+
+void XExporter::waitConvertIdle() {
+    std::unique_lock<std::mutex> lock(mConvertMutex);
+    mConvertCond.wait(lock, [this] {
+        return mPendingConvert == 0;
+    });
 }
 
 void XExporter::encodeVideoWorkThread(void *opaque) {
@@ -414,11 +1871,14 @@ void XExporter::encodeVideoWorkThread(void *opaque) {
             break;
         }
 
-        ret = exporter->writeVideoFrame();
+        ret = exporter->mChunkFrames > 0 ? exporter->writeVideoChunks() : exporter->writeVideoFrame();
         if (ret < 0) {
             break;
         }
     }
+    // 编码线程退出后不再消费，唤醒可能阻塞在put上的生产者
+    exporter->mVideoEncodeExited = true;
+    exporter->mFrameQueue->signal();
     av_log(nullptr, AV_LOG_INFO, "[XExporter] encodeVideoWorkThread ----\n");
 }
 
@@ -426,16 +1886,155 @@ void XExporter::encodeAudioWorkThread(void *opaque) {
     XThreadUtils::configThreadName("encodeAudioWorkThread");
     auto exporter = reinterpret_cast<XExporter *>(opaque);
     av_log(nullptr, AV_LOG_INFO, "[XExporter] encodeAudioWorkThread ++++\n");
+    // 阻塞在采样队列上等待数据，输入结束并flush编码器后返回
+    int ret = exporter->writeAudioFrame();
+    if (ret < 0 && ret != AVERROR_EOF) {
+        av_log(nullptr, AV_LOG_ERROR, "[XExporter] writeAudioFrame failed: %s\n", av_err2str(ret));
+    }
+    // 编码线程退出后不再消费，唤醒可能阻塞在write上的生产者
+    exporter->mSampleQueue->abort();
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] encodeAudioWorkThread ----\n");
+}
+
+void XExporter::convertWorkThread(void *opaque, int index) {
+    XThreadUtils::configThreadName("convertWorkThread");
+    auto exporter = reinterpret_cast<XExporter *>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] convertWorkThread %d ++++\n", index);
+    bool multiple = exporter->mConvertThreads > 1;
     for (;;) {
-        if (exporter->mAborted) {
+        // 取帧和编号在同一把锁内完成，编号与送入顺序一致
+        std::shared_ptr<Frame> source;
+        long sequence;
+        {
+            std::lock_guard<std::mutex> lock(exporter->mSourceMutex);
+            source = exporter->mSourceQueue->get();
+            sequence = exporter->mSourceSequence++;
+        }
+        // nullptr为结束标记，放回队列让其他转换线程也能退出
+        if (!source) {
+            if (multiple) {
+                exporter->mSourceQueue->put(nullptr);
+            }
             break;
         }
 
+        AVFrame *src = source->avframe;
+        auto format = static_cast<AVPixelFormat>(src->format);
+        std::shared_ptr<Frame> frame;
+        if (exporter->isPassthrough(format, src->width, src->height)) {
+            // 已是编码器需要的格式和尺寸，源帧直接交给编码线程
+            frame = source;
+        } else {
+            frame = exporter->allocVideoFrame();
+        }
+        if (frame && frame != source) {
+            // 单个转换线程时仍可按条带并行，多个转换线程各自使用独立的SwsContext
+            int ret = multiple ? exporter->slotConvert(frame, src->data, src->linesize, src->width, src->height,
+                                                       format, index)
+                               : exporter->frameConvert(frame, src->data, src->linesize, src->width, src->height,
+                                                        format);
+            if (ret < 0) {
+                frame.reset();
+            } else {
+                frame->avframe->pts = src->pts;
+            }
+        }
+        if (!frame) {
+            exporter->recordConvertError(-1);
+        }
+
+        // 转换完成后立即把缓冲还给调用方
+        source.reset();
+
+        // 轮到自己的编号时才放入编码队列，编码队列始终只有一个生产者在写
+        {
+            std::unique_lock<std::mutex> lock(exporter->mConvertMutex);
+            exporter->mConvertCond.wait(lock, [exporter, sequence] {
+                return exporter->mOutputSequence == sequence;
+            });
+        }
+        if (frame) {
+            if (!exporter->putVideoFrame(frame)) {
+                exporter->recordConvertError(exporter->getPutError());
+            } else if (exporter->mOverloadPolicy == OVERLOAD_POLICY_DUPLICATE_LAST) {
+                exporter->mLastFrame = frame;
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(exporter->mConvertMutex);
+            exporter->mOutputSequence++;
+            exporter->mPendingConvert--;
+            exporter->mConvertCond.notify_all();
+        }
     }
-    av_log(nullptr, AV_LOG_INFO, "[XExporter] encodeAudioWorkThread ----\n");
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] convertWorkThread %d ----\n", index);
+}
+
+void XExporter::statsWorkThread(void *opaque) {
+    XThreadUtils::configThreadName("statsWorkThread");
+    auto exporter = reinterpret_cast<XExporter *>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] statsWorkThread ++++\n");
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(exporter->mStatsMutex);
+            exporter->mStatsCond.wait_for(lock, std::chrono::milliseconds(exporter->mStatsInterval), [exporter] {
+                return exporter->mStatsStopped;
+            });
+            if (exporter->mStatsStopped) {
+                break;
+            }
+        }
+        // 回调不持有任何锁，耗时的回调只会推迟下一次统计
+        exporter->mStatsCallback(exporter->getStats());
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] statsWorkThread ----\n");
 }
 
 void XExporter::debug() {
-    av_log(nullptr, AV_LOG_INFO, "[XExporter] sendFrame: %d, receivePacket: %d\n", mSendFrameCount,
-           mReceivePacketCount);
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] sendFrame: %d, receivePacket: %d\n", mSendFrameCount.load(),
+           mReceivePacketCount.load());
+    av_log(nullptr, AV_LOG_INFO, "[XExporter] sendSample: %ld, receiveAudioPacket: %d\n", mSendSampleCount,
+           mReceiveAudioPacketCount);
+    if (mMuxer) {
+        av_log(nullptr, AV_LOG_INFO,
+               "[XExporter] muxer written: %ld packets / %ld bytes in %ld us, blocked: %ld times / %ld us\n",
+               mMuxer->getWrittenPackets(), mMuxer->getWrittenBytes(), mMuxer->getWriteDuration(),
+               mMuxer->getBlockedCount(), mMuxer->getBlockedDuration());
+    }
+    if (mCheckpoint) {
+        av_log(nullptr, AV_LOG_INFO, "[XExporter] checkpoint written: %ld bytes, resume: %ld ms\n",
+               mCheckpoint->getWrittenBytes(), mResumePts);
+    }
+    if (mFileWriter) {
+        av_log(nullptr, AV_LOG_INFO, "[XExporter] output written: %ld bytes, backend: %s\n",
+               mFileWriter->getWrittenBytes(), mFileWriter->getBackendName());
+    }
+    {
+        XExportStats stats = getStats();
+        const std::pair<const char *, XHistogramSummary> stages[] = {
+                {"convert", stats.convert}, {"queueWait", stats.queueWait}, {"encodeSend", stats.encodeSend},
+                {"encodeReceive", stats.encodeReceive}, {"muxWrite", stats.muxWrite},
+        };
+        for (const auto &stage : stages) {
+            av_log(nullptr, AV_LOG_INFO, "[XExporter] %s: count: %ld, p50: %ld us, p99: %ld us, max: %ld us\n",
+                   stage.first, stage.second.count, stage.second.p50, stage.second.p99, stage.second.max);
+        }
+        av_log(nullptr, AV_LOG_INFO, "[XExporter] queueDepth p50: %ld, max: %ld, video: %ld bytes / %ld ms, %ld bps\n",
+               stats.queueDepth.p50, stats.queueDepth.max, stats.videoBytes, stats.videoDuration, stats.videoBitrate);
+        av_log(nullptr, AV_LOG_INFO, "[XExporter] memoryBudget used: %ld, peak: %ld, limit: %ld bytes, waits: %ld\n",
+               stats.memoryUsed, stats.memoryPeak, XMemoryBudget::getInstance().getLimit(),
+               XMemoryBudget::getInstance().getWaitCount());
+    }
+    {
+        XOverloadStats stats = getOverloadStats();
+        av_log(nullptr, AV_LOG_INFO,
+               "[XExporter] overload timeout: %ld, droppedNewest: %ld, droppedOldest: %ld, duplicated: %ld, "
+               "droppedDuplicates: %ld, rejectedPts: %ld\n", stats.timeoutCount, stats.droppedNewest,
+               stats.droppedOldest, stats.duplicated, stats.droppedDuplicates, stats.rejectedPts);
+    }
+    if (mFramePool) {
+        av_log(nullptr, AV_LOG_INFO, "[XExporter] framePool capacity: %d, hit: %ld, miss: %ld\n",
+               mFramePool->getCapacity(), mFramePool->getHitCount(), mFramePool->getMissCount());
+    }
 }
@@ -14,9 +14,29 @@
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <map>
+#include <tuple>
 #include "XFFHeader.h"
-
-class XFrameQueue;
+#include "XColorConvert.h"
+#include "XSample.h"
+#include "XEncoderOptions.h"
+#include "XHistogram.h"
+#include "XImage.h"
+#include "XCompositor.h"
+#include "XMemoryBudget.h"
+
+class XAbstractFrameQueue;
+class XFramePool;
+class XThreadPool;
+class XSampleQueue;
+class XMuxer;
+class XAsyncFileWriter;
+class XChunkEncoder;
+class XCheckpointWriter;
 
 enum ExportResult {
     EXPORT_RESULT_FAILED = -1,
@@ -24,8 +44,59 @@ enum ExportResult {
     EXPORT_RESULT_SUCCEED,
 };
 
+enum ConvertMethod {
+    CONVERT_METHOD_SWSCALE = 0,
+    CONVERT_METHOD_BUILTIN, // 内置SIMD内核，仅用于与输出同尺寸的RGBA输入
+};
+
+/**
+ * 编码跟不上送帧速度（编码队列满）时tryEncodeFrame的处理方式
+ */
+enum OverloadPolicy {
+    OVERLOAD_POLICY_BLOCK = 0,      // 等待超时后返回，不丢帧，时间戳不占用，可用同一时间戳重试
+    OVERLOAD_POLICY_DROP_NEWEST,    // 丢弃本次送入的帧
+    OVERLOAD_POLICY_DROP_OLDEST,    // 丢弃编码队列中最早的帧，放入本次送入的帧；无锁队列不支持，退化为DROP_NEWEST
+    OVERLOAD_POLICY_DUPLICATE_LAST, // 丢弃本次送入的帧，队列有空位后用上一帧的引用补上它的时间戳，保持恒定帧率
+};
+
+struct XOverloadStats {
+    long timeoutCount = 0;      // BLOCK策略下等待超时的次数
+    long droppedNewest = 0;     // 丢弃的新帧数
+    long droppedOldest = 0;     // 从编码队列中丢弃的旧帧数
+    long duplicated = 0;        // 补进编码队列的重复帧数
+    long droppedDuplicates = 0; // 待补的时间戳超过上限而放弃的次数
+    long rejectedPts = 0;       // 时间戳不递增而被拒绝的帧数
+};
+
+/**
+ * 各阶段耗时的分布（单位us）和当前的队列深度、码率
+ */
+struct XExportStats {
+    XHistogramSummary convert;       // 每帧颜色转换
+    XHistogramSummary queueWait;     // 帧在编码队列中的排队时长
+    XHistogramSummary encodeSend;    // avcodec_send_frame
+    XHistogramSummary encodeReceive; // 每次取到Packet的avcodec_receive_packet
+    XHistogramSummary muxWrite;      // 每个Packet的av_interleaved_write_frame
+    XHistogramSummary queueDepth;    // 编码线程每次取帧后编码队列中剩余的帧数
+    int frameQueueDepth = 0;         // 当前编码队列中的帧数
+    int sampleQueueDepth = 0;        // 当前采样队列中的采样点数
+    int muxQueueDepth = 0;           // 当前复用队列中的Packet数
+    long frameQueueBytes = 0;        // 当前编码队列中帧缓冲的字节数
+    long shedFrames = 0;             // 编码队列和转换源队列按MEMORY_POLICY_SHED丢弃的帧数
+    long memoryUsed = 0;             // 进程内所有队列向XMemoryBudget记账的字节数
+    long memoryPeak = 0;
+    long sendFrames = 0;
+    long receivePackets = 0;
+    long videoBytes = 0;             // 已编码的视频字节数
+    long videoDuration = 0;          // 已编码的视频时长，单位ms
+    long videoBitrate = 0;           // 已编码部分的平均码率，单位bps
+    long elapsed = 0;                // start()之后经过的时长，单位ms
+};
+
 class XExporter {
     using ExportResultCallback = std::function<void(ExportResult result)>;
+    using PixelsReleaseCallback = std::function<void(uint8_t* pixels)>;
+    using ExportStatsCallback = std::function<void(const XExportStats& stats)>;
 
 public:
     XExporter(const std::string& outputPath,
@@ -42,11 +113,197 @@ public:
 
     void setExportResultCallback(ExportResultCallback resultCallback = nullptr);
 
-    void start();
+    /**
+     * 导出过程中每intervalMs毫秒在统计线程中回调一次，stop()时再回调一次最终结果；需在start()之前设置
+     */
+    void setExportStatsCallback(ExportStatsCallback statsCallback = nullptr, int intervalMs = 1000);
+
+    /**
+     * 可在任意线程调用
+     */
+    XExportStats getStats() const;
+
+    /**
+     * 视频码率，单位bps，<=0表示使用编码器默认的码控方式
+     */
+    void setVideoBitrate(long bitrate);
+
+    /**
+     * 视频编码器选项，需在start()之前设置
+     */
+    void setVideoEncoderOptions(const XEncoderOptions& options);
+
+    /**
+     * 使用预设的编码器选项：throughput / low-latency / low-memory，见XEncoderOptions::fromProfile
+     */
+    void setVideoEncoderProfile(const std::string& profile);
+
+    /**
+     * 编码器打开后实际生效的选项，start()之前返回设置的选项
+     */
+    XEncoderOptions getVideoEncoderOptions() const;
+
+    /**
+     * 按水平条带并行做RGBA->YUV420P转换，bands为条带数（1表示单线程），需在start()之前设置
+     */
+    void setConvertBands(int bands);
+
+    void setConvertMethod(ConvertMethod method);
+
+    void setColorMatrix(ColorMatrix matrix);
+
+    /**
+     * 送帧和编码之间使用无锁的单生产者单消费者队列（XFrameRingQueue），需在start()之前设置；
+     * 开启后encodeFrame系列接口同一时刻只能由一个线程调用
+     */
+    void setLockFreeQueue(bool enable);
+
+    /**
+     * 流水线转换：threads>0时encodeFrame只把像素拷贝到暂存缓冲后返回，由threads个转换线程并行转换，
+     * 按送入顺序交给编码线程；0表示在调用线程中转换（默认）。零拷贝送帧同样使用这些转换线程；需在start()之前设置
+     * @note 多个转换线程各自使用独立的SwsContext，不再按条带拆分单帧
+     */
+    void setConvertThreads(int threads);
+
+    /**
+     * 编码队列和转换源队列各自的字节上限，<=0表示只按帧数限制（默认）；
+     * 进程内的总量由XMemoryBudget::getInstance().setLimit设置，需在start()之前设置
+     */
+    void setQueueByteLimit(long bytes);
+
+    /**
+     * 编码队列和转换源队列超出字节上限或全局内存预算时的处理方式，默认MEMORY_POLICY_BLOCK，需在start()之前设置；
+     * MEMORY_POLICY_SHED时放不下的帧被丢弃，送帧接口返回AVERROR(EAGAIN)，丢弃的帧数见XExportStats::shedFrames
+     */
+    void setMemoryPolicy(MemoryPolicy policy);
+
+    /**
+     * 使用大块缓冲+后台写盘的输出（XAsyncFileWriter）代替avio_open，需在start()之前设置
+     * @param blockSize 每块缓冲的字节数，0表示使用默认值
+     */
+    void setAsyncOutput(bool enable, int blockSize = 0);
+
+    /**
+     * 分段并行编码（离线导出）：时间线按chunkDuration切成GOP闭合的段，每段由独立的编码器和线程编码，
+     * 按顺序拼接进同一路视频流，需在start()之前设置
+     * @param chunkDuration 每段时长，单位ms，<=0表示关闭；时长已知时会把各段调整为近似等长
+     * @param parallelChunks 同时编码的段数，<=0表示按CPU核数决定；缓存的帧数最多约为chunk帧数 * parallelChunks
+     */
+    void setChunkedEncoding(long chunkDuration, int parallelChunks = 0);
+
+    /**
+     * 分片MP4输出（empty_moov + 按关键帧分片）：每个GOP写完即落盘为一个moof/mdat分片，
+     * 导出过程中文件可读，复用器内存不随时长增长，av_write_trailer只需写很小的索引；需在start()之前设置
+     * @param fragmentDuration 分片时长，单位ms，>0时同时把GOP长度设为该时长；分段编码时GOP由段长决定
+     */
+    void setFragmentedOutput(bool enable, long fragmentDuration = 0);
+
+    /**
+     * 送入encodeSample的PCM格式（交错存储），默认44100Hz双声道S16，需在start()之前设置
+     */
+    void setAudioInputFormat(int sampleRate, int channels, SampleType format);
+
+    /**
+     * 可续传导出：已编码的部分按段提交到dir下的段文件并记录清单，进程中途退出后用相同的参数重新导出，
+     * 从getResumePts()继续送帧即可，已提交的部分不再转换和编码；stop()时把各段拼接成输出文件（只拷贝Packet）。
+     * 需在start()之前调用，导出参数在start()时与清单记录的比较，不一致时丢弃已有的段
+     * @param segmentDuration 段时长，单位ms，<=0表示关闭；每个段首强制IDR且GOP闭合，
+     * 开启后分段编码、分片输出和异步输出不生效
+     */
+    void setCheckpoint(const std::string& dir, long segmentDuration);
+
+    /**
+     * 已提交部分的结尾，单位ms，没有检查点时为0，start()之后才有效；调用方从这个时间开始送帧和采样，
+     * 时间戳更早的帧被跳过（encodeFrame返回0），采样不带时间戳，需由调用方跳过；
+     * 音频按整帧提交，从这里开始送入的采样中已经编码过的部分由导出器丢弃
+     */
+    long getResumePts() const;
+
+    /**
+     * 可变帧率输出：视频时间基改为1/1000，调用方传入的时间戳原样保留；
+     * 关闭时时间基为1/fps，时间戳取整到帧，取整后不递增的帧会被拒绝；需在start()之前设置
+     */
+    void setVariableFrameRate(bool enable);
+
+    /**
+     * tryEncodeFrame在编码队列满时的处理方式，见OverloadPolicy，需在start()之前设置
+     */
+    void setOverloadPolicy(OverloadPolicy policy);
+
+    XOverloadStats getOverloadStats() const;
 
-    int encodeFrame(uint8_t* pixels, int width, int height);
+    void start();
 
-    int encodeSample(uint8_t* samples);
+    /**
+     * @param pts 显示时间戳，单位ms，必须递增；<0表示接着上一帧按帧率递增
+     * @return 0表示成功；编码线程已退出时返回AVERROR_EOF，帧按MEMORY_POLICY_SHED被丢弃时返回AVERROR(EAGAIN)，
+     * 两种情况下时间戳都不占用。有转换线程时转换或放入编码队列在送帧返回之后才完成，失败由下一次送帧返回，
+     * 该次送入的帧不会被接收
+     */
+    int encodeFrame(uint8_t* pixels, int width, int height, long pts = -1);
+
+    /**
+     * 零拷贝送帧：接管pixels的所有权后立即返回，转换在转换线程中完成，完成后通过release归还缓冲；
+     * 返回失败时所有权仍归调用方，只有按MEMORY_POLICY_SHED丢弃（返回AVERROR(EAGAIN)）时缓冲已通过release归还
+     */
+    int encodeFrame(uint8_t* pixels, int width, int height, PixelsReleaseCallback release, long pts = -1);
+
+    /**
+     * 按指定格式送帧，支持RGBA/BGRA/RGB24/NV12/YUV420P，linesize为各平面每行字节数；
+     * 每种(格式, 宽, 高)的转换器单独缓存，YUV420P且与输出同尺寸时不做转换
+     * @return 格式不支持或格式要求的平面缺少数据/行宽时返回AVERROR(EINVAL)
+     */
+    int encodeFrame(uint8_t* const data[4], const int linesize[4], int width, int height, ImageType format,
+                    long pts = -1);
+
+    /**
+     * 零拷贝按指定格式送帧，release(data[0])之后调用方才可复用所有平面的缓冲；
+     * YUV420P且与输出同尺寸时直接交给编码器，缓冲要到编码器用完才归还
+     */
+    int encodeFrame(uint8_t* const data[4], const int linesize[4], int width, int height, ImageType format,
+                    PixelsReleaseCallback release, long pts = -1);
+
+    /**
+     * 送入已是输出格式（YUV420P）和尺寸的帧，按引用交给编码器，不拷贝也不转换；
+     * 编码器用完之前调用方不能改写frame的像素，frame本身的时间戳不被修改
+     * @param pts 同encodeFrame
+     * @return 同encodeFrame，格式或尺寸与输出不一致时返回AVERROR(EINVAL)
+     */
+    int encodeVideoFrame(const std::shared_ptr<Frame>& frame, long pts = -1);
+
+    /**
+     * 非阻塞送帧：等待编码队列空位和全局内存预算合计最多timeoutMs毫秒，仍然放不进去时按OverloadPolicy处理；
+     * 队列有空位时才做颜色转换，被丢弃的帧不消耗转换时间
+     * @param pts 同encodeFrame
+     * @return 0表示已放入编码队列，AVERROR(EAGAIN)表示超时或按策略丢弃/以重复帧代替，其他负值为错误
+     */
+    int tryEncodeFrame(uint8_t* pixels, int width, int height, long pts = -1, int timeoutMs = 0);
+
+    /**
+     * 批量送帧：并行转换后一次加锁放入编码队列，image->pts同encodeFrame的pts，image->format<0时按RGBA处理
+     * @return 被编码队列接收的帧数，续传时跳过的帧不计入
+     */
+    int encodeFrames(const std::vector<std::shared_ptr<XImage>>& images);
+
+    /**
+     * 合成图层后送帧，compositor的尺寸必须与输出一致；续传时跳过的帧不做合成
+     * 有转换线程时合成进暂存池的RGBA缓冲交给转换线程，否则内置转换时直接合成进编码帧的YUV平面，
+     * swscale转换时先合成整帧RGBA再转换
+     * @param pts 同encodeFrame
+     * @return 同encodeFrame，尺寸不一致时返回AVERROR(EINVAL)，合成失败时返回-1
+     */
+    int encodeLayers(XCompositor& compositor, const std::vector<XCompositeLayer>& layers, long pts = -1);
+
+    /**
+     * 送入nbSamples个采样点（每声道），格式由setAudioInputFormat指定；
+     * 数据拷贝进采样队列后返回，队列满时阻塞
+     */
+    int encodeSample(uint8_t* samples, int nbSamples);
+
+    /**
+     * sample的声道数、采样率和格式必须与setAudioInputFormat一致，时间戳按采样数累计，忽略sample.pts
+     */
+    int encodeSample(const XSample& sample);
 
     void stop();
 
@@ -54,33 +311,175 @@ public:
 
 private:
 
+    /**
+     * 按start()时的导出参数读取检查点，得到续传位置
+     */
+    void openCheckpoint();
+
     int openOutFile();
 
     int addVideoStream();
 
+    int openVideoEncoder(std::unique_ptr<AVCodecContext, CodecDeleter>& encoder, int threadCount);
+
     int addAudioStream();
 
     int writeVideoFrame();
 
+    int writeVideoChunks();
+
+    int commitChunk(XChunkEncoder* chunk);
+
+    int getChunkThreadCount() const;
+
     int writeAudioFrame();
 
+    /**
+     * 把调用方的时间戳（ms，<0表示自动递增）换算到视频时间基，不递增时返回-1；
+     * 只计算不提交，帧被接收或按策略占用时间戳后再更新mLastPts
+     */
+    long makeVideoPts(long ptsMs);
+
+    /**
+     * 等待编码队列有空位，待补的重复帧排在新帧之前，先把它们放入队列
+     */
+    bool waitVideoQueue(int timeoutMs);
+
+    void putDuplicateFrame();
+
+    /**
+     * 记录入队时刻后放入编码队列
+     * @return 按内存策略丢弃、超时或中止时返回false
+     */
+    bool putVideoFrame(std::shared_ptr<Frame> frame, int timeoutMs = -1);
+
+    /**
+     * putVideoFrame失败时返回给调用方的错误
+     */
+    int getPutError() const;
+
+    /**
+     * 转换线程中转换或放入编码队列失败时记录，只保留第一个
+     */
+    void recordConvertError(int error);
+
+    /**
+     * 取出并清除转换线程记录的错误，编码线程已退出时总是返回AVERROR_EOF
+     */
+    int takeConvertError();
+
+    void recordQueueWait(const std::shared_ptr<Frame>& frame);
+
+    int handleOverload(long pts);
+
+    /**
+     * 续传时时间戳（ms）早于已提交部分结尾的帧直接跳过
+     */
+    bool isCommitted(long ptsMs) const;
+
+    /**
+     * 提交剩余的段并拼接成输出文件
+     */
+    int finishCheckpoint();
+
+    int muxPacket(const std::shared_ptr<Packet>& pkt, AVCodecContext* avctx, int streamIndex);
+
     int closeOutFile();
 
 private:
 
     std::shared_ptr<Frame> allocVideoFrame();
 
-    std::shared_ptr<Frame> allocAudioFrame();
-
-    int frameConvert(std::shared_ptr<Frame> dst, uint8_t* src, int srcWidth, int srcHeight);
-
-    void sampleCovert(std::shared_ptr<Frame> dst, uint8_t* src);
+    std::shared_ptr<Frame> allocAudioFrame(int nbSamples);
+
+    /**
+     * RGBA输入
+     * @param srcStride 每行字节数，0表示紧密排列
+     */
+    int frameConvert(std::shared_ptr<Frame> dst, uint8_t* src, int srcWidth, int srcHeight, int srcStride = 0);
+
+    int frameConvert(std::shared_ptr<Frame> dst, const uint8_t* const src[4], const int srcLinesize[4],
+                     int srcWidth, int srcHeight, AVPixelFormat srcFormat);
+
+    /**
+     * 只用于与输出同尺寸的packed RGB输入
+     */
+    int bandConvert(std::shared_ptr<Frame> dst, const uint8_t* const src[4], const int srcLinesize[4],
+                    AVPixelFormat srcFormat);
+
+    SwsContext* createSwsContext(AVPixelFormat srcFormat, int srcWidth, int srcHeight, int dstWidth, int dstHeight);
+
+    /**
+     * 按(格式, 宽, 高)取缓存的SwsContext，没有时创建
+     */
+    SwsContext* getSwsContext(AVPixelFormat srcFormat, int srcWidth, int srcHeight);
+
+    int slotConvert(std::shared_ptr<Frame> dst, const XImage& image, int slot);
+
+    /**
+     * 使用第slot个SwsContext转换，不同的slot可在不同线程中同时调用
+     */
+    int slotConvert(std::shared_ptr<Frame> dst, const uint8_t* const src[4], const int srcLinesize[4],
+                    int srcWidth, int srcHeight, AVPixelFormat srcFormat, int slot);
+
+    /**
+     * 与输出格式和尺寸相同，不需要转换
+     */
+    bool isPassthrough(AVPixelFormat srcFormat, int srcWidth, int srcHeight) const;
+
+    XThreadPool* getConvertPool();
+
+    /**
+     * 把src中的nbSamples个输入采样点重采样后写到dst第offset个采样点之后，写不下的部分留在重采样器中
+     * src为nullptr时取出重采样器中剩余的数据；nbSamples为0时只取出已缓存的数据
+     * @return 写入dst的采样点数
+     */
+    int sampleCovert(std::shared_ptr<Frame> dst, int offset, const uint8_t* src, int nbSamples);
+
+    std::shared_ptr<Frame> wrapPixels(uint8_t* const data[4], const int linesize[4], int width, int height,
+                                      AVPixelFormat format, PixelsReleaseCallback release);
+
+    static void releasePixels(void* opaque, uint8_t* data);
+
+    /**
+     * 从暂存池取一帧，尺寸或格式变化时重建暂存池
+     */
+    std::shared_ptr<Frame> allocStagingFrame(int width, int height, AVPixelFormat format);
+
+    /**
+     * 把调用方的像素拷贝到暂存池的缓冲中，调用返回后调用方即可复用自己的缓冲
+     */
+    std::shared_ptr<Frame> stagePixels(uint8_t* const data[4], const int linesize[4], int width, int height,
+                                       AVPixelFormat format);
+
+    /**
+     * encodeFrame、encodeVideoFrame和encodeLayers共用的送帧流程：先补待补的重复帧，再分配时间戳，
+     * 有转换线程时由stage生成源帧交给转换线程，否则由convert在调用线程中生成编码帧后放入编码队列
+     * @param stage 失败时返回nullptr
+     * @param convert 失败时返回nullptr
+     * @return 0表示成功，时间戳不递增时返回AVERROR(EINVAL)，stage/convert失败时返回-1，
+     * 放入编码队列失败时返回getPutError()，转换线程记录了错误时返回该错误且不送帧
+     */
+    int submitVideoFrame(long pts, const std::function<std::shared_ptr<Frame>()>& stage,
+                         const std::function<std::shared_ptr<Frame>()>& convert);
+
+    /**
+     * 交给转换线程，source->avframe->pts为已分配的时间戳
+     * @return 按内存策略丢弃时返回false
+     */
+    bool queueSource(std::shared_ptr<Frame> source);
+
+    void waitConvertIdle();
 
 private:
     void encodeVideoWorkThread(void* opaque);
 
     void encodeAudioWorkThread(void* opaque);
 
+    void convertWorkThread(void* opaque, int index);
+
+    void statsWorkThread(void* opaque);
+
 private:
     static const int DEFAULT_PARAM_WIDTH = 540;
     static const int DEFAULT_PARAM_HEIGHT = 960;
@@ -88,9 +487,18 @@ private:
     static const long DEFAULT_PARAM_DURATION = 10000;
 
     const AVPixelFormat EXPORT_PARAM_PIX_FMT = AV_PIX_FMT_YUV420P;
+    // SWS_AREA的2:1色度垂直滤波只覆盖同一对行，偶数行切分的条带转换结果与整帧转换逐位一致
+    const int EXPORT_PARAM_SWS_FLAGS = SWS_AREA;
+    // 缓存的SwsContext数量上限，源尺寸不断变化时整体清空重建
+    const size_t EXPORT_PARAM_MAX_SWS_CONTEXTS = 8;
     const int EXPORT_PARAM_SAMPLE_RATE = 44100;
     const AVSampleFormat EXPORT_PARAM_SAMPLE_FMT = AV_SAMPLE_FMT_S16;
     const uint64_t EXPORT_PARAM_CHANNEL_LAYOUT = AV_CH_LAYOUT_STEREO;
+    const int EXPORT_PARAM_FRAME_SIZE = 1024;
+    // 采样队列可缓存的输入时长，单位ms
+    const int EXPORT_PARAM_SAMPLE_QUEUE_DURATION = 1000;
+    // DUPLICATE_LAST策略下最多积压的待补时间戳数
+    const int EXPORT_PARAM_MAX_PENDING_DUPLICATES = 50;
 
 private:
     std::string mOutputPath;
@@ -98,6 +506,9 @@ private:
     int mHeight;
     int mFPS;
     long mDuration;
+    long mVideoBitrate;
+    XEncoderOptions mVideoEncoderOptions;
+    XEncoderOptions mEffectiveVideoOptions;
 
     bool mDisableAudio;
     bool mDisableVideo;
@@ -106,23 +517,110 @@ private:
     int mAudioIndex;
     std::unique_ptr<AVCodecContext, CodecDeleter> mAudioCodecCtx;
     std::unique_ptr<SwrContext, SwrContextDeleter> mSwrContext;
+    int mInputSampleRate;
+    int mInputChannels;
+    SampleType mInputSampleFormat;
+    std::unique_ptr<XSampleQueue> mSampleQueue;
+    std::vector<uint8_t> mSampleBuffer;
     int mVideoIndex;
     std::unique_ptr<AVCodecContext, CodecDeleter> mVideoCodecCtx;
-    std::unique_ptr<SwsContext, SwsContextDeleter> mSwsContext;
-
-    std::unique_ptr<XFrameQueue> mFrameQueue;
+    // key为(源格式, 源宽, 源高)
+    std::map<std::tuple<int, int, int>, std::unique_ptr<SwsContext, SwsContextDeleter>> mSwsContexts;
+    std::unique_ptr<XMuxer> mMuxer;
+    int mChunkFrames;
+    int mParallelChunks;
+    bool mFragmentedOutput;
+    long mFragmentDuration;
+    bool mAsyncOutput;
+    int mOutputBlockSize;
+    std::unique_ptr<XAsyncFileWriter> mFileWriter;
+    std::string mCheckpointDir;
+    long mCheckpointSegmentDuration;
+    std::unique_ptr<XCheckpointWriter> mCheckpoint;
+    long mResumePts;
+    // 续传时音频从已提交的结尾继续，调用方从mResumePts开始送入的采样中，这么多个已经编码过，直接丢弃
+    long mSkipInputSamples;
+    // 上一个送入编码器的视频帧所在的段，段序号变化时强制关键帧
+    int mKeyframeSegment;
+
+    int mConvertBands;
+    ConvertMethod mConvertMethod;
+    ColorMatrix mColorMatrix;
+    bool mLockFreeQueue;
+    int mConvertThreads;
+    long mQueueByteLimit;
+    MemoryPolicy mMemoryPolicy;
+    std::vector<std::unique_ptr<SwsContext, SwsContextDeleter>> mBandSwsContexts;
+    std::vector<int> mBandRows;
+    AVPixelFormat mBandFormat;
+    std::unique_ptr<XThreadPool> mConvertPool;
+
+    // 批量转换时每个并行槽位独占一个SwsContext
+    struct SwsSlot {
+        std::unique_ptr<SwsContext, SwsContextDeleter> context;
+        AVPixelFormat srcFormat = AV_PIX_FMT_NONE;
+        int srcWidth = 0;
+        int srcHeight = 0;
+    };
+    std::vector<SwsSlot> mSwsSlots;
+
+    bool mVariableFrameRate;
+    AVRational mVideoTimeBase;
+    long mFrameDuration;
+    long mLastPts;
+    OverloadPolicy mOverloadPolicy;
+    std::shared_ptr<Frame> mLastFrame;
+    std::deque<long> mPendingDuplicates;
+    mutable std::mutex mStatsMutex;
+    XOverloadStats mOverloadStats;
+
+    std::unique_ptr<XAbstractFrameQueue> mFrameQueue;
+    std::unique_ptr<XAbstractFrameQueue> mSourceQueue;
+    std::unique_ptr<XFramePool> mFramePool;
+    std::unique_ptr<XFramePool> mStagingPool;
+    // swscale转换时encodeLayers的整帧RGBA画布
+    std::vector<uint8_t> mCompositeCanvas;
 
     ExportResultCallback mResultCallback;
+    ExportStatsCallback mStatsCallback;
+    int mStatsInterval;
 
     std::unique_ptr<std::thread> mEncodeAudioTid;
     std::unique_ptr<std::thread> mEncodeVideoTid;
+    std::vector<std::unique_ptr<std::thread>> mConvertTids;
+    std::unique_ptr<std::thread> mStatsTid;
 
     std::mutex mMutex;
 
+    std::mutex mConvertMutex;
+    std::condition_variable mConvertCond;
+    int mPendingConvert;
+    // 转换线程取源帧时按顺序编号，按编号依次放入编码队列
+    std::mutex mSourceMutex;
+    long mSourceSequence;
+    long mOutputSequence;
+
     bool mAborted;
 
-    int mSendFrameCount;
-    int mReceivePacketCount;
+    std::condition_variable mStatsCond;
+    bool mStatsStopped;
+    long mStartTime;
+    XHistogram mConvertHistogram;
+    XHistogram mQueueWaitHistogram;
+    XHistogram mSendHistogram;
+    XHistogram mReceiveHistogram;
+    XHistogram mQueueDepthHistogram;
+    std::atomic<long> mVideoBytes;
+    std::atomic<long> mVideoDuration;
+
+    std::atomic<int> mSendFrameCount;
+    std::atomic<int> mReceivePacketCount;
+    long mSendSampleCount;
+    int mReceiveAudioPacketCount;
+
+    // 转换线程中转换或放入编码队列失败时的错误，由下一次送帧返回
+    std::atomic<int> mConvertError;
+    std::atomic<bool> mVideoEncodeExited;
 };
 
 
@@ -71,6 +71,9 @@ struct Packet {
 struct Frame {
     AVFrame* avframe = nullptr;
 
+    // 放入编码队列的时刻，单位us，用于统计排队时长
+    long queueTime = 0;
+
     Frame() {
         avframe = av_frame_alloc();
     }
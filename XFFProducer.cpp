@@ -7,15 +7,20 @@
 //
 
 #include "XFFProducer.h"
+#include <algorithm>
+#include <chrono>
+#include <climits>
 #include "XException.h"
 #include "XThreadUtils.h"
 #include "XPacketQueue.h"
 #include "XFrameQueue.h"
 #include "XSampleQueue.h"
 #include "XImageQueue.h"
+#include "XTrace.h"
 
 XFFProducer::XFFProducer()
-        : mVideoIndex(-1), mAudioIndex(-1), mAborted(false) {
+        : mStatus(0), mVideoIndex(-1), mAudioIndex(-1), mDecodeThreads(0), mDecodeThreadType(0),
+          mPacketByteLimit(0), mImageByteLimit(0), mMemoryPolicy(MEMORY_POLICY_BLOCK), mFrameDuration(DEFAULT_FRAME_DURATION), mNextVideoPts(0), mAborted(false) {
 }
 
 XFFProducer::~XFFProducer() {
@@ -33,6 +38,34 @@ void XFFProducer::setInput(const std::string &filename) {
     closeInFile();
 }
 
+void XFFProducer::setDecodeThreads(int threadCount, int threadType) {
+    mDecodeThreads = std::max(0, threadCount);
+    mDecodeThreadType = threadType;
+}
+
+void XFFProducer::setQueueByteLimit(long packetBytes, long imageBytes) {
+    mPacketByteLimit = packetBytes;
+    mImageByteLimit = imageBytes;
+}
+
+void XFFProducer::setMemoryPolicy(MemoryPolicy policy) {
+    mMemoryPolicy = policy;
+}
+
+long XFFProducer::getShedCount() const {
+    long count = 0;
+    if (mVideoPacketQueue) {
+        count += mVideoPacketQueue->getShedCount();
+    }
+    if (mAudioPacketQueue) {
+        count += mAudioPacketQueue->getShedCount();
+    }
+    if (mImageQueue) {
+        count += mImageQueue->getShedCount();
+    }
+    return count;
+}
+
 void XFFProducer::start() {
 
     if (!mFormatCtx) {
@@ -42,11 +75,47 @@ void XFFProducer::start() {
         }
     }
 
+    // 队列在工作线程启动之前创建，stop()中止队列即可唤醒阻塞在上面的线程
+    // Packet的字节数不会超过int，上限按int截断
+    int packetByteLimit = static_cast<int>(std::min<long>(mPacketByteLimit, INT_MAX));
+    if (!mDisableVideo && mVideoIndex >= 0) {
+        mVideoPacketQueue = std::make_unique<XPacketQueue>();
+        mVideoPacketQueue->setByteLimit(packetByteLimit);
+        mVideoPacketQueue->setMemoryPolicy(mMemoryPolicy);
+        mImageQueue = std::make_unique<XImageQueue>();
+        mImageQueue->setByteLimit(mImageByteLimit);
+        mImageQueue->setMemoryPolicy(mMemoryPolicy);
+        mCurrentImage = std::make_shared<XImage>();
+    }
+    if (!mDisableAudio && mAudioIndex >= 0) {
+        mAudioPacketQueue = std::make_unique<XPacketQueue>();
+        mAudioPacketQueue->setByteLimit(packetByteLimit);
+        mAudioPacketQueue->setMemoryPolicy(mMemoryPolicy);
+    }
+
     mReadTid = std::make_unique<std::thread>([this] { readWorkThread(this); });
 }
 
 std::shared_ptr<XImage> XFFProducer::getImage(long clock) {
-    return XProducable::getImage(clock);
+    if (!mImageQueue || !mCurrentImage) {
+        return XProducable::getImage(clock);
+    }
+
+    XTraceSpan span("getImage");
+    for (;;) {
+        if (mCurrentImage->pixels && clock < mCurrentImage->pts + mCurrentImage->duration) {
+            return mCurrentImage;
+        }
+
+        auto image = mImageQueue->peekReadable();
+        if (!image || !image->pixels) {
+            // 已停止或解码结束：结束标记留在队列中，之后一直返回最后一帧
+            return mCurrentImage->pixels ? mCurrentImage : nullptr;
+        }
+        // 换出的旧缓冲随槽位回到解码线程，下一次转换时直接复用
+        mCurrentImage->swap(*image);
+        mImageQueue->next();
+    }
 }
 
 std::shared_ptr<XSample> XFFProducer::getSample() {
@@ -62,6 +131,16 @@ void XFFProducer::stop() {
         mContinueReadCond.notify_one();
     }
 
+    if (mVideoPacketQueue) {
+        mVideoPacketQueue->abort();
+    }
+    if (mAudioPacketQueue) {
+        mAudioPacketQueue->abort();
+    }
+    if (mImageQueue) {
+        mImageQueue->abort();
+    }
+
     if (mReadTid && mReadTid->joinable()) {
         mReadTid->join();
     }
@@ -91,7 +170,8 @@ int XFFProducer::openInFile() {
         int videoIndex = av_find_best_stream(ic, AVMEDIA_TYPE_VIDEO, -1, -1, nullptr, 0);
         if (videoIndex >= 0) {
             mVideoIndex = videoIndex;
-            ret = openVideoCodec();
+            // 只为确认解码器可用，不启动解码线程
+            ret = openVideoCodec(1);
             if (ret < 0) {
                 return ret;
             }
@@ -114,7 +194,7 @@ int XFFProducer::openInFile() {
     return 0;
 }
 
-int XFFProducer::openVideoCodec() {
+int XFFProducer::openVideoCodec(int threadCount) {
     if (mDisableVideo || mVideoIndex < 0 || !mFormatCtx) {
         return -1;
     }
@@ -140,11 +220,29 @@ int XFFProducer::openVideoCodec() {
         return AVERROR_DECODER_NOT_FOUND;
     }
 
+    avctx->pkt_timebase = stream->time_base;
+    // 0表示按CPU核数自动选择；帧级多线程每多一个线程多缓存一帧，片级多线程需要码流分片
+    avctx->thread_count = threadCount;
+    if (mDecodeThreadType > 0) {
+        avctx->thread_type = mDecodeThreadType;
+    }
+
     ret = avcodec_open2(avctx, codec, nullptr);
     if (ret < 0) {
         av_log(nullptr, AV_LOG_FATAL, "[XFFProducer] avcodec_open2 failed: %s\n", av_err2str(ret));
         return ret;
     }
+
+    AVRational frameRate = av_guess_frame_rate(mFormatCtx.get(), stream, nullptr);
+    if (frameRate.num > 0 && frameRate.den > 0) {
+        mFrameDuration = std::max(1L, static_cast<long>(1000.0 * frameRate.den / frameRate.num));
+    }
+    if (threadCount != 1) {
+        const char *type = (avctx->active_thread_type & FF_THREAD_FRAME) ? "frame" :
+                           (avctx->active_thread_type & FF_THREAD_SLICE) ? "slice" : "none";
+        av_log(nullptr, AV_LOG_INFO, "[XFFProducer] video decoder %s: threads %d, thread type %s\n",
+               codec->name, avctx->thread_count, type);
+    }
     return 0;
 }
 
@@ -212,31 +310,17 @@ void XFFProducer::readWorkThread(void *opaque) {
     }
 
     AVFormatContext *ic = producer->mFormatCtx.get();
-    XPacketQueue *videoQ = nullptr;
-    XPacketQueue *audioQ = nullptr;
+    XPacketQueue *videoQ = producer->mVideoPacketQueue.get();
+    XPacketQueue *audioQ = producer->mAudioPacketQueue.get();
 
     // video work thread
-    if (!producer->mDisableVideo && producer->mVideoIndex >= 0) {
-        if (!producer->mVideoPacketQueue) {
-            producer->mVideoPacketQueue = std::make_unique<XPacketQueue>();
-            videoQ = producer->mVideoPacketQueue.get();
-        }
-
-        if (!producer->mVideoTid) {
-            producer->mVideoTid = std::make_unique<std::thread>([this, producer] { videoWorkThread(producer); });
-        }
+    if (videoQ && !producer->mVideoTid) {
+        producer->mVideoTid = std::make_unique<std::thread>([this, producer] { videoWorkThread(producer); });
     }
 
     // audio work thread
-    if (!producer->mDisableAudio && producer->mAudioIndex >= 0) {
-        if (!producer->mAudioPacketQueue) {
-            producer->mAudioPacketQueue = std::make_unique<XPacketQueue>();
-            audioQ = producer->mAudioPacketQueue.get();
-        }
-
-        if (!producer->mAudioTid) {
-            producer->mAudioTid = std::make_unique<std::thread>([this, producer] { audioWorkThread(producer); });
-        }
+    if (audioQ && !producer->mAudioTid) {
+        producer->mAudioTid = std::make_unique<std::thread>([this, producer] { audioWorkThread(producer); });
     }
 
     int ret;
@@ -248,34 +332,52 @@ void XFFProducer::readWorkThread(void *opaque) {
         }
 
         auto pkt = std::make_shared<Packet>();
-        ret = av_read_frame(ic, pkt->avpkt);
+        {
+            XTraceSpan span("readPacket");
+            ret = av_read_frame(ic, pkt->avpkt);
+        }
+        if (ret == AVERROR(EAGAIN)) {
+            // 数据暂时不可读（网络流等），稍后重试
+            std::unique_lock<std::mutex> lock(producer->mMutex);
+            mContinueReadCond.wait_for(lock, std::chrono::milliseconds(FF_READ_RETRY_MS), [producer] {
+                return producer->mAborted.load();
+            });
+            continue;
+        }
         if (ret < 0) {
-            if (ret == AVERROR_EOF && (producer->mStatus & S_READ_END) != S_READ_END) {
+            // EOF之外的读取错误同样按流结束处理，否则解码线程和getImage会一直等待
+            if (ret != AVERROR_EOF) {
+                av_log(nullptr, AV_LOG_ERROR, "[XFFProducer] av_read_frame failed: %s\n", av_err2str(ret));
+            }
+            if ((producer->mStatus & S_READ_END) != S_READ_END) {
                 if (videoQ) {
                     videoQ->putNullPacket(producer->mVideoIndex);
                 }
                 if (audioQ) {
-                    videoQ->putNullPacket(producer->mAudioIndex);
+                    audioQ->putNullPacket(producer->mAudioIndex);
                 }
                 producer->mStatus |= S_READ_END;
             }
             std::unique_lock<std::mutex> lock(producer->mMutex);
-            mContinueReadCond.wait(lock);
+            mContinueReadCond.wait(lock, [producer] {
+                return producer->mAborted.load();
+            });
             continue;
         }
 
         pts = static_cast<long>(pkt->avpkt->pts * av_q2d(ic->streams[pkt->avpkt->stream_index]->time_base) * 1000);
         duration = static_cast<long>(pkt->avpkt->duration * av_q2d(ic->streams[pkt->avpkt->stream_index]->time_base) *
                                      1000);
+        // 每个Packet一条日志，放在DEBUG级别，避免拖慢解码
         if (pkt->avpkt->stream_index == producer->mVideoIndex) {
             if (videoQ) {
                 videoQ->put(pkt);
-                av_log(nullptr, AV_LOG_INFO, "[XFFProducer] put video packet pts: %ld, duration: %ld\n", pts, duration);
+                av_log(nullptr, AV_LOG_DEBUG, "[XFFProducer] put video packet pts: %ld, duration: %ld\n", pts, duration);
             }
         } else if (pkt->avpkt->stream_index == producer->mAudioIndex) {
             if (audioQ) {
                 audioQ->put(pkt);
-                av_log(nullptr, AV_LOG_INFO, "[XFFProducer] put audio packet pts: %ld, duration: %ld\n", pts, duration);
+                av_log(nullptr, AV_LOG_DEBUG, "[XFFProducer] put audio packet pts: %ld, duration: %ld\n", pts, duration);
             }
         }
     }
@@ -295,28 +397,34 @@ void XFFProducer::videoWorkThread(void *opaque) {
     XThreadUtils::configThreadName("videoWorkThread");
     av_log(nullptr, AV_LOG_INFO, "[XFFProducer] videoWorkThread ++++\n");
     XFFProducer *producer = reinterpret_cast<XFFProducer *>(opaque);
-    if (!producer) {
+    if (!producer || !producer->mImageQueue) {
         return;
     }
 
-    if (!producer->mVideoCodecCtx) {
-        producer->openVideoCodec();
-    }
-
-    if (!producer->mImageQueue) {
-        producer->mImageQueue = std::make_unique<XImageQueue>();
-    }
-
+    int ret;
+    long frames = 0;
     for (;;) {
         if (producer->mAborted) {
             break;
         }
 
-
+        ret = producer->decodeVideoFrame();
+        if (ret == AVERROR_EOF) {
+            break;
+        }
+        if (ret < 0) {
+            if (!producer->mAborted) {
+                av_log(nullptr, AV_LOG_ERROR, "[XFFProducer] decodeVideoFrame failed: %s\n", av_err2str(ret));
+            }
+            break;
+        }
+        frames++;
     }
 
+    producer->mStatus |= S_VIDEO_END;
+    producer->queueEndImage();
 
-    av_log(nullptr, AV_LOG_INFO, "[XFFProducer] videoWorkThread ----\n");
+    av_log(nullptr, AV_LOG_INFO, "[XFFProducer] videoWorkThread ---- frames: %ld\n", frames);
 }
 
 void XFFProducer::audioWorkThread(void *opaque) {
@@ -327,122 +435,139 @@ void XFFProducer::audioWorkThread(void *opaque) {
         return;
     }
 
+    // 音频还没有解码：取走并丢弃音频Packet，避免读线程阻塞在已满的音频队列上，视频也读不到数据
+    XPacketQueue *audioQ = producer->mAudioPacketQueue.get();
+    while (audioQ && !producer->mAborted) {
+        auto pkt = audioQ->get();
+        if (!pkt || !pkt->avpkt->data) {
+            break;
+        }
+    }
+    producer->mStatus |= S_AUDIO_END;
+
     av_log(nullptr, AV_LOG_INFO, "[XFFProducer] audioWorkThread ----\n");
 }
 
 int XFFProducer::decodeVideoFrame() {
+    XTraceSpan span("decodeVideo");
     int ret;
 
     if (!mVideoCodecCtx) {
-        ret = openVideoCodec();
+        ret = openVideoCodec(mDecodeThreads);
         if (ret < 0) {
             return ret;
         }
     }
+    if (!mDecodeFrame) {
+        mDecodeFrame = std::make_unique<Frame>();
+    }
 
-    ret = AVERROR(EAGAIN);
-    long pts = -1;
-    long duration = -1;
+    AVCodecContext *avctx = mVideoCodecCtx.get();
+    AVFrame *frame = mDecodeFrame->avframe;
     for (;;) {
-
         // receive frame
-        do {
-            auto frame = std::make_shared<Frame>();
-            ret = avcodec_receive_frame(mVideoCodecCtx.get(), frame->avframe);
-            if (ret < 0 && ret != AVERROR(EAGAIN) && ret != AVERROR_EOF) {
-                return ret;
-            }
-
-            if (ret == AVERROR_EOF) {
-                avcodec_flush_buffers(mVideoCodecCtx.get());
-                return ret;
+        ret = avcodec_receive_frame(avctx, frame);
+        if (ret >= 0) {
+            AVStream *stream = mFormatCtx->streams[mVideoIndex];
+            int64_t timestamp = frame->best_effort_timestamp;
+            long pts = mNextVideoPts;
+            if (timestamp != AV_NOPTS_VALUE) {
+                // 相对视频流起点，与getImage的clock一致
+                if (stream->start_time != AV_NOPTS_VALUE) {
+                    timestamp -= stream->start_time;
+                }
+                pts = static_cast<long>(av_rescale_q(timestamp, stream->time_base, AVRational{1, 1000}));
             }
-
-            if (ret >= 0) {
-                AVStream* stream = mFormatCtx->streams[mVideoIndex];
-                pts = static_cast<long>(frame->avframe->pts * av_q2d(stream->time_base) * 1000);
-                duration = static_cast<long>(frame->avframe->pkt_duration * av_q2d(stream->time_base) * 1000);
-                queueFrame(frame->avframe, pts, duration);
-                return 1;
+            long duration = mFrameDuration;
+            if (frame->pkt_duration > 0) {
+                duration = static_cast<long>(av_rescale_q(frame->pkt_duration, stream->time_base, AVRational{1, 1000}));
             }
+            mNextVideoPts = pts + duration;
 
-            if (ret < 0 && ret != AVERROR(EAGAIN)) {
-                av_log(nullptr, AV_LOG_FATAL, "[XFFProducer] avcodec_receive_frame failed: %s\n", av_err2str(ret));
-                return ret;
-            }
+            queueFrame(frame, pts, duration);
+            av_frame_unref(frame);
+            return 1;
+        }
 
-        } while (ret != AVERROR(EAGAIN));
+        if (ret == AVERROR_EOF) {
+            avcodec_flush_buffers(avctx);
+            return ret;
+        }
 
-        // get packet
+        if (ret != AVERROR(EAGAIN)) {
+            av_log(nullptr, AV_LOG_FATAL, "[XFFProducer] avcodec_receive_frame failed: %s\n", av_err2str(ret));
+            return ret;
+        }
 
+        // get packet：帧级多线程时要先送入约线程数个Packet才有第一帧输出
         auto pkt = mVideoPacketQueue->get();
         if (!pkt) {
             return -1;
         }
 
-        // send packet
-        ret = avcodec_send_packet(mVideoCodecCtx.get(), pkt->avpkt);
-        if (ret == AVERROR(EAGAIN)) {
-            continue;
+        // send packet：解码器已经没有可取的帧，不会返回EAGAIN；单个Packet出错时跳过，继续解码后面的数据
+        ret = avcodec_send_packet(avctx, pkt->avpkt);
+        if (ret < 0 && ret != AVERROR_EOF) {
+            av_log(nullptr, AV_LOG_WARNING, "[XFFProducer] avcodec_send_packet failed: %s\n", av_err2str(ret));
         }
     }
-    return 0;
 }
 
 void XFFProducer::queueFrame(AVFrame *frame, long pts, long duration) {
-
+    XTraceSpan span("queueFrame");
     auto image = mImageQueue->peekWritable();
     if (!image) {
         return;
     }
 
-    image->width = frame->width;
-    image->height = frame->height;
+    // 槽位中的缓冲尺寸不变时直接复用
+    if (frameConvert(image, frame) < 0) {
+        return;
+    }
     image->pts = pts;
     image->duration = duration;
 
+    // 按MEMORY_POLICY_SHED放弃时槽位留给下一帧
+    mImageQueue->push();
 }
 
-int XFFProducer::frameConvert(std::shared_ptr<XImage> dst, AVFrame *src) {
-    if (!mSwsContext) {
-        SwsContext *sws = sws_getContext(src->width, src->height, static_cast<AVPixelFormat>(src->format),
-                                         dst->width, dst->height, OUT_PIX_FMT,
-                                         SWS_FAST_BILINEAR,
-                                         nullptr, nullptr, nullptr);
-        if (!sws) {
-            av_log(nullptr, AV_LOG_FATAL, "[XFFProducer] sws_getContext failed!\n");
-            return -1;
-        }
-
-        mSwsContext = std::unique_ptr<SwsContext, SwsContextDeleter>(sws);
+void XFFProducer::queueEndImage() {
+    auto image = mImageQueue->peekWritable();
+    if (!image) {
+        return;
     }
 
-
-    dst->allocBuffer(dst->width, dst->height, static_cast<int>(OUT_PIX_FMT));
-
-    return 0;
+    image->freeBuffer();
+    image->pts = -1;
+    image->duration = -1;
+    mImageQueue->push();
 }
 
+int XFFProducer::frameConvert(std::shared_ptr<XImage> dst, AVFrame *src) {
+    XTraceSpan span("frameConvert");
+    // 源尺寸或格式变化时重建，否则复用；输出与源同尺寸
+    SwsContext *sws = sws_getCachedContext(mSwsContext.release(), src->width, src->height,
+                                           static_cast<AVPixelFormat>(src->format),
+                                           src->width, src->height, OUT_PIX_FMT,
+                                           SWS_FAST_BILINEAR,
+                                           nullptr, nullptr, nullptr);
+    mSwsContext.reset(sws);
+    if (!sws) {
+        av_log(nullptr, AV_LOG_FATAL, "[XFFProducer] sws_getCachedContext failed!\n");
+        return -1;
+    }
 
+    dst->allocBuffer(src->width, src->height, static_cast<int>(OUT_PIX_FMT));
+    if (!dst->pixels) {
+        return AVERROR(ENOMEM);
+    }
 
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
-
+    uint8_t *data[4] = {dst->pixels, nullptr, nullptr, nullptr};
+    int linesize[4] = {dst->width * 4, 0, 0, 0};
+    int ret = sws_scale(sws, src->data, src->linesize, 0, src->height, data, linesize);
+    if (ret <= 0) {
+        av_log(nullptr, AV_LOG_ERROR, "[XFFProducer] sws_scale failed: %d\n", ret);
+        return -1;
+    }
+    return 0;
+}
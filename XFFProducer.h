@@ -12,8 +12,10 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include "XProducable.h"
 #include "XFFHeader.h"
+#include "XMemoryBudget.h"
 
 class XPacketQueue;
 class XFrameQueue;
@@ -28,8 +30,37 @@ public:
 
     void setInput(const std::string& filename) override;
 
+    /**
+     * @brief 视频解码线程，需在start()之前设置
+     * @param threadCount 0表示按CPU核数自动选择，1表示单线程解码
+     * @param threadType FF_THREAD_FRAME / FF_THREAD_SLICE，0表示解码器默认（两者都允许，由解码器选择）
+     */
+    void setDecodeThreads(int threadCount, int threadType = 0);
+
+    /**
+     * @brief Packet队列（每路流一个）和图像队列各自的字节上限，<=0表示只按个数限制（默认），需在start()之前设置
+     */
+    void setQueueByteLimit(long packetBytes, long imageBytes);
+
+    /**
+     * @brief 队列超出字节上限或全局内存预算时的处理方式，默认MEMORY_POLICY_BLOCK，需在start()之前设置；
+     * MEMORY_POLICY_SHED时放不下的Packet和解码后的图像被丢弃，丢弃的视频Packet会使之后的画面出错直到下一个关键帧
+     */
+    void setMemoryPolicy(MemoryPolicy policy);
+
+    /**
+     * @brief MEMORY_POLICY_SHED下各队列丢弃的Packet和图像总数
+     */
+    long getShedCount() const;
+
     void start() override;
 
+    /**
+     * @brief 取覆盖clock的那一帧RGBA图像，早于clock的帧被丢弃，解码跟不上时阻塞；
+     * 返回的图像在下一次调用getImage之前有效，解码结束后一直返回最后一帧
+     * @param clock 相对视频流起点的时间，单位ms
+     * @return nullptr表示没有视频或已停止
+     */
     std::shared_ptr<XImage> getImage(long clock) override;
 
     std::shared_ptr<XSample> getSample() override;
@@ -39,7 +70,10 @@ public:
 private:
     int openInFile();
 
-    int openVideoCodec();
+    /**
+     * @param threadCount 解码线程数，只为探测打开时传1
+     */
+    int openVideoCodec(int threadCount);
 
     int openAudioCodec();
 
@@ -61,16 +95,27 @@ private:
 
     void queueFrame(AVFrame* frame, long pts, long duration);
 
+    /**
+     * @brief 与视频Packet队列的空Packet一样，放入一张没有像素的图像表示解码结束
+     */
+    void queueEndImage();
+
     int frameConvert(std::shared_ptr<XImage> dst, AVFrame* src);
 
 private:
-    unsigned int mStatus;
+    std::atomic<unsigned int> mStatus;
     const int S_READ_END = 1 << 0;
     const int S_VIDEO_END = 1 << 1;
     const int S_AUDIO_END = 1 << 2;
 
     const AVPixelFormat OUT_PIX_FMT = AV_PIX_FMT_RGBA;
 
+    // 帧率未知时的帧时长，单位ms
+    const long DEFAULT_FRAME_DURATION = 40;
+
+    // av_read_frame返回EAGAIN时的重试间隔，单位ms
+    const int FF_READ_RETRY_MS = 10;
+
 private:
     std::unique_ptr<AVFormatContext, InputFormatDeleter> mFormatCtx;
 
@@ -80,6 +125,18 @@ private:
     std::unique_ptr<AVCodecContext, CodecDeleter> mVideoCodecCtx;
     std::unique_ptr<AVCodecContext, CodecDeleter> mAudioCodecCtx;
 
+    int mDecodeThreads;
+    int mDecodeThreadType;
+    long mPacketByteLimit;
+    long mImageByteLimit;
+    MemoryPolicy mMemoryPolicy;
+    // 解码帧复用，只由视频线程访问
+    std::unique_ptr<Frame> mDecodeFrame;
+    // 帧没有时长时按帧率推算，单位ms
+    long mFrameDuration;
+    // 帧没有时间戳时接着上一帧
+    long mNextVideoPts;
+
     std::unique_ptr<std::thread> mReadTid;
     std::unique_ptr<std::thread> mVideoTid;
     std::unique_ptr<std::thread> mAudioTid;
@@ -87,12 +144,14 @@ private:
     std::unique_ptr<XPacketQueue> mVideoPacketQueue;
     std::unique_ptr<XPacketQueue> mAudioPacketQueue;
 
-    bool mAborted;
+    std::atomic<bool> mAborted;
 
     std::mutex mMutex;
     std::condition_variable mContinueReadCond;
 
     std::unique_ptr<XImageQueue> mImageQueue;
+    // getImage返回的当前帧，与队列中的槽位交换像素缓冲，不拷贝
+    std::shared_ptr<XImage> mCurrentImage;
     std::unique_ptr<XSampleQueue> mSampleQueue;
 
     std::unique_ptr<SwsContext, SwsContextDeleter> mSwsContext;
@@ -0,0 +1,110 @@
+//
+//  XFramePool.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XFramePool.h"
+#include <vector>
+
+XFramePool::XFramePool(int width, int height, AVPixelFormat format, int capacity)
+        : mWidth(width), mHeight(height), mFormat(format), mCapacity(capacity), mPool(nullptr),
+          mRequestCount(0), mMissCount(0) {
+    int size = av_image_get_buffer_size(format, width, height, FP_BUFFER_ALIGN);
+    if (size < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XFramePool] av_image_get_buffer_size failed: %s\n", av_err2str(size));
+        return;
+    }
+
+    mPool = av_buffer_pool_init2(size, this, allocBuffer, nullptr);
+    if (!mPool) {
+        av_log(nullptr, AV_LOG_FATAL, "[XFramePool] av_buffer_pool_init2 failed!\n");
+        return;
+    }
+
+    // 预热：先取出capacity块缓冲再全部归还，后续get()在稳态下不再触发分配
+    std::vector<AVBufferRef*> buffers;
+    buffers.reserve(capacity);
+    for (int i = 0; i < capacity; ++i) {
+        AVBufferRef* buf = av_buffer_pool_get(mPool);
+        if (!buf) {
+            break;
+        }
+        buffers.emplace_back(buf);
+    }
+    for (auto& buf : buffers) {
+        av_buffer_unref(&buf);
+    }
+    mMissCount = 0;
+}
+
+XFramePool::~XFramePool() {
+    if (mPool) {
+        av_buffer_pool_uninit(&mPool);
+    }
+}
+
+std::shared_ptr<Frame> XFramePool::get() {
+    if (!mPool) {
+        return nullptr;
+    }
+
+    auto frame = std::make_shared<Frame>();
+    if (!frame->avframe) {
+        av_log(nullptr, AV_LOG_FATAL, "[XFramePool] get failed: Out of memory\n");
+        return nullptr;
+    }
+
+    mRequestCount++;
+    AVBufferRef* buf = av_buffer_pool_get(mPool);
+    if (!buf) {
+        av_log(nullptr, AV_LOG_FATAL, "[XFramePool] av_buffer_pool_get failed!\n");
+        return nullptr;
+    }
+
+    AVFrame* avframe = frame->avframe;
+    avframe->buf[0] = buf;
+    avframe->width = mWidth;
+    avframe->height = mHeight;
+    avframe->format = mFormat;
+    int ret = av_image_fill_arrays(avframe->data, avframe->linesize, buf->data, mFormat, mWidth, mHeight,
+                                   FP_BUFFER_ALIGN);
+    if (ret < 0) {
+        av_log(nullptr, AV_LOG_FATAL, "[XFramePool] av_image_fill_arrays failed: %s\n", av_err2str(ret));
+        return nullptr;
+    }
+
+    return frame;
+}
+
+int XFramePool::getCapacity() const {
+    return mCapacity;
+}
+
+int XFramePool::getWidth() const {
+    return mWidth;
+}
+
+int XFramePool::getHeight() const {
+    return mHeight;
+}
+
+AVPixelFormat XFramePool::getFormat() const {
+    return mFormat;
+}
+
+long XFramePool::getHitCount() const {
+    return mRequestCount - mMissCount;
+}
+
+long XFramePool::getMissCount() const {
+    return mMissCount;
+}
+
+AVBufferRef* XFramePool::allocBuffer(void* opaque, int size) {
+    auto pool = reinterpret_cast<XFramePool*>(opaque);
+    pool->mMissCount++;
+    return av_buffer_alloc(size);
+}
@@ -0,0 +1,72 @@
+//
+//  XFramePool.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XFRAMEPOOL_H
+#define XEXPORTER_XFRAMEPOOL_H
+
+#include <memory>
+#include <atomic>
+#include "XFFHeader.h"
+
+class XFramePool {
+public:
+    /**
+     * @brief 构建一个视频帧池，预先分配capacity块对齐的图像缓冲
+     * @param capacity 预分配的帧数量，通常为帧队列容量加上编码/转换中的帧
+     */
+    XFramePool(int width, int height, AVPixelFormat format, int capacity = FP_DEFAULT_CAPACITY);
+
+    /**
+     * @brief 销毁帧池，仍被引用的缓冲会在最后一个引用释放后回收
+     */
+    ~XFramePool();
+
+    /**
+     * @brief 从池中获取一帧，Frame析构时缓冲自动归还到池中
+     * @return nullptr表示失败，其他表示成功
+     */
+    std::shared_ptr<Frame> get();
+
+    int getCapacity() const;
+
+    int getWidth() const;
+
+    int getHeight() const;
+
+    AVPixelFormat getFormat() const;
+
+    /**
+     * @brief 命中次数：直接复用池中缓冲的次数
+     */
+    long getHitCount() const;
+
+    /**
+     * @brief 未命中次数：池中没有空闲缓冲而重新分配的次数
+     */
+    long getMissCount() const;
+
+private:
+    static AVBufferRef* allocBuffer(void* opaque, int size);
+
+private:
+    static const int FP_DEFAULT_CAPACITY = 7;
+    static const int FP_BUFFER_ALIGN = 64;
+
+private:
+    int mWidth;
+    int mHeight;
+    AVPixelFormat mFormat;
+    int mCapacity;
+
+    AVBufferPool* mPool;
+
+    std::atomic<long> mRequestCount;
+    std::atomic<long> mMissCount;
+};
+
+#endif //XEXPORTER_XFRAMEPOOL_H
@@ -7,25 +7,99 @@
 //
 
 #include "XFrameQueue.h"
+#include <algorithm>
+#include <chrono>
 
-XFrameQueue::XFrameQueue(int capacity): mCapacity(capacity), mAborted(false) {
+XFrameQueue::XFrameQueue(int capacity)
+: XAbstractFrameQueue(capacity), mAborted(false), mByteLimit(0), mBytes(0), mBudgetAborted(false) {
 }
 
 XFrameQueue::~XFrameQueue() {
-
+    XMemoryBudget::getInstance().release(mBytes);
 }
 
-void XFrameQueue::put(std::shared_ptr<Frame> frame) {
-    if (mCapacity > 0) {
-        std::unique_lock <std::mutex> lock(mMutex);
-        mCond.wait(lock, [=] {
-            return mFrameQueue.size() < mCapacity;
-        });
+bool XFrameQueue::put(std::shared_ptr<Frame> frame, int timeoutMs) {
+    long bytes = XMemoryBudget::getFrameBytes(frame);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    auto remainingMs = [&] {
+        return timeoutMs < 0 ? -1 : static_cast<int>(std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count()));
+    };
+    std::unique_lock <std::mutex> lock(mMutex);
+    auto waitFor = [&](auto predicate) {
+        if (timeoutMs < 0) {
+            mCond.wait(lock, predicate);
+            return true;
+        }
+        return mCond.wait_until(lock, deadline, predicate);
+    };
+
+    if (mCapacity > 0 && !waitFor([=] {
+        return mAborted || mFrameQueue.size() < static_cast<size_t>(mCapacity);
+    })) {
+        return false;
     }
 
-    std::lock_guard <std::mutex> lock(mMutex);
+    if (mMemoryPolicy == MEMORY_POLICY_BLOCK) {
+        if (!waitFor([=] {
+            return mAborted || !isOverByteLimit(bytes);
+        })) {
+            return false;
+        }
+    } else if (!mAborted && isOverByteLimit(bytes)) {
+        mShedCount++;
+        return false;
+    }
+
+    if (mAborted || !chargeBudget(lock, bytes, remainingMs())) {
+        return false;
+    }
     mFrameQueue.emplace_back(frame);
+    mBytes += bytes;
     mCond.notify_one();
+    return true;
+}
+
+int XFrameQueue::putBatch(const std::vector<std::shared_ptr<Frame>>& frames) {
+    int count = 0;
+    size_t capacity = static_cast<size_t>(std::max(0, mCapacity));
+    std::unique_lock <std::mutex> lock(mMutex);
+    size_t i = 0;
+    while (i < frames.size() && !mAborted) {
+        if (capacity > 0) {
+            // 等到剩余的帧（最多一整队）都放得下再一起放入，不必每放一帧都放锁等一次消费者
+            size_t wanted = std::min(frames.size() - i, capacity);
+            mCond.wait(lock, [&] {
+                return mAborted || mFrameQueue.size() + wanted <= capacity;
+            });
+        }
+
+        bool queued = false;
+        for (; i < frames.size() && !mAborted && (capacity == 0 || mFrameQueue.size() < capacity); ++i) {
+            const auto& frame = frames[i];
+            long bytes = XMemoryBudget::getFrameBytes(frame);
+            // 字节上限和全局预算仍按帧检查，等待时会放开锁
+            if (mMemoryPolicy == MEMORY_POLICY_BLOCK) {
+                mCond.wait(lock, [&] {
+                    return mAborted || !isOverByteLimit(bytes);
+                });
+            } else if (!mAborted && isOverByteLimit(bytes)) {
+                mShedCount++;
+                continue;
+            }
+            if (mAborted || !chargeBudget(lock, bytes)) {
+                continue;
+            }
+            mFrameQueue.emplace_back(frame);
+            mBytes += bytes;
+            count++;
+            queued = true;
+        }
+        if (queued) {
+            mCond.notify_all();
+        }
+    }
+    return count;
 }
 
 std::shared_ptr<Frame> XFrameQueue::get(bool wait) {
@@ -40,21 +114,135 @@ std::shared_ptr<Frame> XFrameQueue::get(bool wait) {
         return nullptr;
     }
     
-    std::lock_guard <std::mutex> lock(mMutex);
-    auto frame = mFrameQueue.front();
-    mFrameQueue.pop_front();
-    mCond.notify_one();
+    std::shared_ptr<Frame> frame;
+    long bytes;
+    {
+        std::lock_guard <std::mutex> lock(mMutex);
+        if (mFrameQueue.empty()) {
+            return nullptr;
+        }
+        frame = mFrameQueue.front();
+        mFrameQueue.pop_front();
+        bytes = XMemoryBudget::getFrameBytes(frame);
+        mBytes -= bytes;
+        // 等待帧数和等待字节数的生产者可能同时存在
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().release(bytes);
     return frame;
 }
 
+bool XFrameQueue::waitWritable(int timeoutMs) {
+    std::unique_lock <std::mutex> lock(mMutex);
+    if (mCapacity <= 0) {
+        return !mAborted;
+    }
+    auto writable = [=] {
+        return mFrameQueue.size() < static_cast<size_t>(mCapacity) && (mByteLimit <= 0 || mBytes < mByteLimit);
+    };
+    mCond.wait_for(lock, std::chrono::milliseconds(std::max(0, timeoutMs)), [=] {
+        return mAborted || writable();
+    });
+    // 全局预算用完时同样视为没有空位，由调用方决定丢帧还是稍后重试
+    return !mAborted && writable() && (mFrameQueue.empty() || XMemoryBudget::getInstance().isAvailable());
+}
+
+bool XFrameQueue::dropOldest() {
+    long bytes;
+    {
+        std::lock_guard <std::mutex> lock(mMutex);
+        // 结束标记不能丢
+        if (mAborted || mFrameQueue.empty() || !mFrameQueue.front()) {
+            return false;
+        }
+        bytes = XMemoryBudget::getFrameBytes(mFrameQueue.front());
+        mFrameQueue.pop_front();
+        mBytes -= bytes;
+        mCond.notify_one();
+    }
+    XMemoryBudget::getInstance().release(bytes);
+    return true;
+}
+
 void XFrameQueue::flush() {
-    std::lock_guard <std::mutex> lock(mMutex);
-    std::list < std::shared_ptr < Frame >> ().swap(mFrameQueue);
-    mCond.notify_one();
+    long bytes;
+    {
+        std::lock_guard <std::mutex> lock(mMutex);
+        std::list < std::shared_ptr < Frame >> ().swap(mFrameQueue);
+        bytes = mBytes;
+        mBytes = 0;
+        mCond.notify_one();
+    }
+    XMemoryBudget::getInstance().release(bytes);
 }
 
 void XFrameQueue::signal() {
-    std::lock_guard <std::mutex>lock(mMutex);
-    mAborted = true;
-    mCond.notify_one();
+    {
+        std::lock_guard <std::mutex>lock(mMutex);
+        mAborted = true;
+        mBudgetAborted = true;
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().wakeAll();
+}
+
+int XFrameQueue::getSize() {
+    std::lock_guard <std::mutex> lock(mMutex);
+    return static_cast<int>(mFrameQueue.size());
+}
+
+void XFrameQueue::setByteLimit(long bytes) {
+    mByteLimit = bytes;
+}
+
+long XFrameQueue::getBytes() {
+    std::lock_guard <std::mutex> lock(mMutex);
+    return mBytes;
+}
+
+bool XFrameQueue::isOverByteLimit(long bytes) const {
+    // 空队列总是可以放入一帧，结束标记不受字节限制
+    return mByteLimit > 0 && bytes > 0 && !mFrameQueue.empty() && mBytes + bytes > mByteLimit;
+}
+
+bool XFrameQueue::chargeBudget(std::unique_lock<std::mutex>& lock, long bytes, int timeoutMs) {
+    XMemoryBudget &budget = XMemoryBudget::getInstance();
+    if (bytes <= 0 || mFrameQueue.empty()) {
+        budget.forceAcquire(bytes);
+        return true;
+    }
+    if (budget.tryAcquire(bytes)) {
+        return true;
+    }
+    if (mMemoryPolicy == MEMORY_POLICY_SHED) {
+        mShedCount++;
+        return false;
+    }
+
+    // 等待时放开队列锁，消费者取走帧后才能归还预算
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    for (;;) {
+        int waitMs = FQ_BUDGET_RECHECK_MS;
+        if (timeoutMs >= 0) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now()).count();
+            if (remaining <= 0) {
+                return false;
+            }
+            waitMs = static_cast<int>(std::min<long>(waitMs, remaining));
+        }
+        lock.unlock();
+        bool acquired = budget.acquire(bytes, mBudgetAborted, waitMs);
+        lock.lock();
+        if (acquired) {
+            return true;
+        }
+        if (mAborted) {
+            return false;
+        }
+        if (mFrameQueue.empty()) {
+            budget.forceAcquire(bytes);
+            return true;
+        }
+    }
 }
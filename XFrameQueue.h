@@ -10,33 +10,62 @@
 #define XEXPORTER_XFRAMEQUEUE_H
 
 #include <list>
+#include <vector>
 #include <mutex>
 #include <condition_variable>
-#include "XFFHeader.h"
+#include <atomic>
+#include "XAbstractFrameQueue.h"
 
-class XFrameQueue {
+/**
+ * @brief 链表 + 互斥锁实现的帧队列，支持多生产者多消费者、字节上限和从队头丢帧
+ */
+class XFrameQueue : public XAbstractFrameQueue {
 public:
     explicit XFrameQueue(int capacity = FQ_DEFAULT_PARAM_CAPACITY);
 
-    ~XFrameQueue();
+    ~XFrameQueue() override;
 
-    void put(std::shared_ptr<Frame> frame);
+    bool put(std::shared_ptr<Frame> frame, int timeoutMs = -1) override;
 
-    std::shared_ptr<Frame> get(bool wait = true);
+    /**
+     * 等到剩余的帧（最多capacity帧）都有空位后一起放入，批量大于容量时分几轮放入；
+     * 字节上限和全局预算仍按帧等待，等待期间会放开锁
+     */
+    int putBatch(const std::vector<std::shared_ptr<Frame>>& frames) override;
 
-    void flush();
+    std::shared_ptr<Frame> get(bool wait = true) override;
 
-    void signal();
+    bool waitWritable(int timeoutMs) override;
 
-private:
-    static const int FQ_DEFAULT_PARAM_CAPACITY = 5;
+    bool dropOldest() override;
+
+    void flush() override;
+
+    void signal() override;
+
+    int getSize() override;
+
+    long getBytes() override;
+
+    void setByteLimit(long bytes) override;
 
 private:
+    bool isOverByteLimit(long bytes) const;
+
+    /**
+     * 向全局预算记账，等待时释放lock
+     * @param timeoutMs 最多等待的毫秒数，<0表示一直等待
+     * @return false表示按策略丢弃、超时或已中止
+     */
+    bool chargeBudget(std::unique_lock<std::mutex>& lock, long bytes, int timeoutMs = -1);
+
     std::list <std::shared_ptr<Frame>> mFrameQueue;
     std::mutex mMutex;
     std::condition_variable mCond;
-    int mCapacity;
     bool mAborted;
+    long mByteLimit;
+    long mBytes;
+    std::atomic<bool> mBudgetAborted;
 };
 
 #endif //XEXPORTER_XFRAMEQUEUE_H
@@ -0,0 +1,245 @@
+//
+//  XFrameRingQueue.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XFrameRingQueue.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+XFrameRingQueue::XFrameRingQueue(int capacity)
+: XAbstractFrameQueue(capacity > 0 ? capacity : FQ_DEFAULT_PARAM_CAPACITY), mWritePos(0), mReadPos(0), mRingAborted(false),
+  mRingBytes(0) {
+    mSlotCount = getCapacity();
+    mSlots.resize(mSlotCount);
+}
+
+XFrameRingQueue::~XFrameRingQueue() {
+    signal();
+    XMemoryBudget::getInstance().release(mRingBytes.load());
+}
+
+bool XFrameRingQueue::put(std::shared_ptr<Frame> frame, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    uint64_t writePos = mWritePos.load(std::memory_order_relaxed);
+    if (!waitSpace(writePos, timeoutMs)) {
+        return false;
+    }
+    int remaining = -1;
+    if (timeoutMs >= 0) {
+        remaining = static_cast<int>(std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count()));
+    }
+    if (!chargeBudget(writePos, XMemoryBudget::getFrameBytes(frame), remaining)) {
+        return false;
+    }
+
+    mSlots[writePos % mSlotCount] = std::move(frame);
+    mWritePos.store(writePos + 1);
+    mNotEmpty.wakeAll();
+    return true;
+}
+
+int XFrameRingQueue::putBatch(const std::vector<std::shared_ptr<Frame>>& frames) {
+    int count = 0;
+    uint64_t writePos = mWritePos.load(std::memory_order_relaxed);
+    for (const auto& frame : frames) {
+        if (isFull(writePos)) {
+            // 休眠前先唤醒消费者，否则双方可能互相等待
+            mNotEmpty.wakeAll();
+        }
+        if (!waitSpace(writePos)) {
+            break;
+        }
+        if (!chargeBudget(writePos, XMemoryBudget::getFrameBytes(frame))) {
+            if (mRingAborted) {
+                break;
+            }
+            continue;
+        }
+
+        mSlots[writePos % mSlotCount] = frame;
+        mWritePos.store(++writePos);
+        count++;
+    }
+    mNotEmpty.wakeAll();
+    return count;
+}
+
+std::shared_ptr<Frame> XFrameRingQueue::get(bool wait) {
+    uint64_t readPos = mReadPos.load(std::memory_order_relaxed);
+    for (;;) {
+        if (mRingAborted) {
+            return nullptr;
+        }
+
+        if (mWritePos.load() != readPos) {
+            break;
+        }
+
+        if (!wait) {
+            return nullptr;
+        }
+
+        if (spin([&] { return mRingAborted || mWritePos.load() != readPos; })) {
+            continue;
+        }
+
+        uint32_t key = mNotEmpty.prepareWait();
+        if (mRingAborted || mWritePos.load() != readPos) {
+            mNotEmpty.cancelWait();
+            continue;
+        }
+        mNotEmpty.wait(key);
+    }
+
+    auto frame = std::move(mSlots[readPos % mSlotCount]);
+    mReadPos.store(readPos + 1);
+    mNotFull.wakeAll();
+    long bytes = XMemoryBudget::getFrameBytes(frame);
+    mRingBytes -= bytes;
+    XMemoryBudget::getInstance().release(bytes);
+    return frame;
+}
+
+void XFrameRingQueue::flush() {
+    uint64_t readPos = mReadPos.load(std::memory_order_relaxed);
+    uint64_t writePos = mWritePos.load();
+    long bytes = 0;
+    for (; readPos != writePos; ++readPos) {
+        bytes += XMemoryBudget::getFrameBytes(mSlots[readPos % mSlotCount]);
+        mSlots[readPos % mSlotCount].reset();
+    }
+    mReadPos.store(readPos);
+    mNotFull.wakeAll();
+    mRingBytes -= bytes;
+    XMemoryBudget::getInstance().release(bytes);
+}
+
+void XFrameRingQueue::signal() {
+    mRingAborted = true;
+    mNotEmpty.forceWakeAll();
+    mNotFull.forceWakeAll();
+    XMemoryBudget::getInstance().wakeAll();
+}
+
+int XFrameRingQueue::getSize() {
+    return static_cast<int>(mWritePos.load() - mReadPos.load());
+}
+
+long XFrameRingQueue::getBytes() {
+    return mRingBytes.load();
+}
+
+void XFrameRingQueue::setByteLimit(long) {
+}
+
+bool XFrameRingQueue::waitWritable(int timeoutMs) {
+    uint64_t writePos = mWritePos.load(std::memory_order_relaxed);
+    if (!waitSpace(writePos, std::max(0, timeoutMs))) {
+        return false;
+    }
+    return writePos == mReadPos.load() || XMemoryBudget::getInstance().isAvailable();
+}
+
+bool XFrameRingQueue::dropOldest() {
+    return false;
+}
+
+bool XFrameRingQueue::waitSpace(uint64_t writePos, int timeoutMs) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    for (;;) {
+        if (mRingAborted) {
+            return false;
+        }
+
+        if (!isFull(writePos)) {
+            return true;
+        }
+
+        int remaining = -1;
+        if (timeoutMs >= 0) {
+            auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) {
+                return false;
+            }
+            remaining = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                    deadline - now).count()) + 1;
+        }
+
+        if (spin([&] { return mRingAborted || !isFull(writePos); })) {
+            continue;
+        }
+
+        uint32_t key = mNotFull.prepareWait();
+        if (mRingAborted || !isFull(writePos)) {
+            mNotFull.cancelWait();
+            continue;
+        }
+        if (remaining < 0) {
+            mNotFull.wait(key);
+        } else {
+            mNotFull.waitFor(key, remaining);
+        }
+    }
+}
+
+bool XFrameRingQueue::chargeBudget(uint64_t writePos, long bytes, int timeoutMs) {
+    XMemoryBudget &budget = XMemoryBudget::getInstance();
+    // 队列为空时直接记账，消费者不会再归还预算
+    auto isEmpty = [&] {
+        return writePos == mReadPos.load();
+    };
+    if (bytes <= 0 || isEmpty()) {
+        budget.forceAcquire(bytes);
+    } else if (!budget.tryAcquire(bytes)) {
+        if (mMemoryPolicy == MEMORY_POLICY_SHED) {
+            mShedCount++;
+            return false;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+        for (;;) {
+            int waitMs = FQ_BUDGET_RECHECK_MS;
+            if (timeoutMs >= 0) {
+                auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        deadline - std::chrono::steady_clock::now()).count();
+                if (remaining <= 0) {
+                    return false;
+                }
+                waitMs = static_cast<int>(std::min<long>(waitMs, remaining));
+            }
+            if (budget.acquire(bytes, mRingAborted, waitMs)) {
+                break;
+            }
+            if (mRingAborted) {
+                return false;
+            }
+            if (isEmpty()) {
+                budget.forceAcquire(bytes);
+                break;
+            }
+        }
+    }
+    mRingBytes += bytes;
+    return true;
+}
+
+bool XFrameRingQueue::isFull(uint64_t writePos) const {
+    return writePos - mReadPos.load() >= static_cast<uint64_t>(mSlotCount);
+}
+
+template <typename Predicate>
+bool XFrameRingQueue::spin(Predicate predicate) {
+    // 对方通常很快就会完成一次读写，短暂自旋可以省掉一次休眠和唤醒的系统调用
+    for (int i = 0; i < FRQ_SPIN_COUNT; ++i) {
+        if (predicate()) {
+            return true;
+        }
+        std::this_thread::yield();
+    }
+    return false;
+}
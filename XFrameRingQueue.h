@@ -0,0 +1,95 @@
+//
+//  XFrameRingQueue.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XFRAMERINGQUEUE_H
+#define XEXPORTER_XFRAMERINGQUEUE_H
+
+#include <atomic>
+#include "XAbstractFrameQueue.h"
+#include "XFutex.h"
+
+/**
+ * @brief 定长的单生产者单消费者帧队列
+ * 槽位预先分配，读写位置用原子变量维护，不满/不空时put/get不加锁也不分配内存；
+ * 需要等待时通过XFutex休眠。语义与XFrameQueue一致：
+ * nullptr可作为结束标记放入，signal()后put丢弃帧、get返回nullptr；槽位数固定，不支持字节上限，只向全局预算记账
+ * @note put/putBatch只能在同一时刻被一个线程调用，get/flush同理
+ */
+class XFrameRingQueue : public XAbstractFrameQueue {
+public:
+    explicit XFrameRingQueue(int capacity = FQ_DEFAULT_PARAM_CAPACITY);
+
+    ~XFrameRingQueue() override;
+
+    bool put(std::shared_ptr<Frame> frame, int timeoutMs = -1) override;
+
+    int putBatch(const std::vector<std::shared_ptr<Frame>>& frames) override;
+
+    std::shared_ptr<Frame> get(bool wait = true) override;
+
+    bool waitWritable(int timeoutMs) override;
+
+    /**
+     * @brief 队头只能由消费者移动，生产者侧不支持丢帧，总是返回false
+     */
+    bool dropOldest() override;
+
+    /**
+     * @brief 丢弃队列中所有帧，需在消费线程调用
+     */
+    void flush() override;
+
+    void signal() override;
+
+    int getSize() override;
+
+    long getBytes() override;
+
+    /**
+     * @brief 不支持字节上限，忽略
+     */
+    void setByteLimit(long bytes) override;
+
+private:
+    /**
+     * @brief 等待队列有空位，中止或超时时返回false，timeoutMs<0表示一直等待
+     */
+    bool waitSpace(uint64_t writePos, int timeoutMs = -1);
+
+    /**
+     * @brief 向全局预算记账，MEMORY_POLICY_SHED下预算不足、超时或中止时返回false，timeoutMs<0表示一直等待
+     */
+    bool chargeBudget(uint64_t writePos, long bytes, int timeoutMs = -1);
+
+    bool isFull(uint64_t writePos) const;
+
+    template <typename Predicate>
+    bool spin(Predicate predicate);
+
+private:
+    static const int FRQ_CACHE_LINE_SIZE = 64;
+    static const int FRQ_SPIN_COUNT = 16;
+
+    std::vector<std::shared_ptr<Frame>> mSlots;
+
+    int mSlotCount;
+
+    alignas(FRQ_CACHE_LINE_SIZE) std::atomic<uint64_t> mWritePos;
+
+    alignas(FRQ_CACHE_LINE_SIZE) std::atomic<uint64_t> mReadPos;
+
+    alignas(FRQ_CACHE_LINE_SIZE) std::atomic<bool> mRingAborted;
+
+    std::atomic<long> mRingBytes;
+
+    XFutex mNotEmpty;
+
+    XFutex mNotFull;
+};
+
+#endif //XEXPORTER_XFRAMERINGQUEUE_H
@@ -0,0 +1,108 @@
+//
+//  XFutex.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XFUTEX_H
+#define XEXPORTER_XFUTEX_H
+
+#include <cstdint>
+#include <atomic>
+#if __linux__
+#include <ctime>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+/**
+ * @brief 基于序号的等待/唤醒原语，Linux上直接使用futex，其他平台退化为互斥锁+条件变量
+ * 用法：等待方prepareWait()登记并取得序号 -> 再次检查条件 -> 不满足时wait(序号)，满足时cancelWait()；
+ * 通知方先发布数据再调用wakeAll()，没有等待者时只有一次原子读
+ */
+class XFutex {
+public:
+    XFutex(): mSequence(0), mWaiters(0) {
+
+    }
+
+    inline uint32_t prepareWait() {
+        mWaiters.fetch_add(1);
+        return mSequence.load();
+    }
+
+    inline void cancelWait() {
+        mWaiters.fetch_sub(1);
+    }
+
+    /**
+     * @brief 序号仍为key时休眠，返回时已注销登记，可能是虚假唤醒
+     */
+    inline void wait(uint32_t key) {
+#if __linux__
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mSequence), FUTEX_WAIT_PRIVATE, key, nullptr, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait(lock, [=] {
+            return mSequence.load() != key;
+        });
+#endif
+        mWaiters.fetch_sub(1);
+    }
+
+    /**
+     * @brief 同wait，最多休眠timeoutMs毫秒
+     */
+    inline void waitFor(uint32_t key, int timeoutMs) {
+#if __linux__
+        struct timespec timeout = {timeoutMs / 1000, (timeoutMs % 1000) * 1000000L};
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mSequence), FUTEX_WAIT_PRIVATE, key, &timeout, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mMutex);
+        mCond.wait_for(lock, std::chrono::milliseconds(timeoutMs), [=] {
+            return mSequence.load() != key;
+        });
+#endif
+        mWaiters.fetch_sub(1);
+    }
+
+    inline void wakeAll() {
+        if (mWaiters.load() > 0) {
+            forceWakeAll();
+        }
+    }
+
+    inline void forceWakeAll() {
+#if __linux__
+        mSequence.fetch_add(1);
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&mSequence), FUTEX_WAKE_PRIVATE, INT32_MAX, nullptr, nullptr, 0);
+#else
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mSequence.fetch_add(1);
+        }
+        mCond.notify_all();
+#endif
+    }
+
+private:
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+
+    std::atomic<uint32_t> mSequence;
+
+    std::atomic<int> mWaiters;
+
+#if !__linux__
+    std::mutex mMutex;
+    std::condition_variable mCond;
+#endif
+};
+
+#endif //XEXPORTER_XFUTEX_H
@@ -0,0 +1,99 @@
+//
+//  XHistogram.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XHistogram.h"
+#include <algorithm>
+#include <cmath>
+
+XHistogram::XHistogram() : mCount(0), mSum(0), mMax(0) {
+    for (auto& bucket : mBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+void XHistogram::record(long value) {
+    value = std::max(0L, value);
+    mBuckets[getBucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    mCount.fetch_add(1, std::memory_order_relaxed);
+    mSum.fetch_add(value, std::memory_order_relaxed);
+
+    long max = mMax.load(std::memory_order_relaxed);
+    while (value > max && !mMax.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+    }
+}
+
+long XHistogram::getCount() const {
+    return mCount.load(std::memory_order_relaxed);
+}
+
+long XHistogram::getMax() const {
+    return mMax.load(std::memory_order_relaxed);
+}
+
+long XHistogram::getPercentile(double percentile) const {
+    long count = getCount();
+    if (count <= 0) {
+        return 0;
+    }
+
+    // 第rank个样本所在的桶，rank从1开始
+    auto rank = static_cast<long>(std::ceil(count * std::min(100.0, std::max(0.0, percentile)) / 100.0));
+    rank = std::max(1L, rank);
+    long seen = 0;
+    for (int i = 0; i < HG_BUCKET_COUNT; ++i) {
+        seen += mBuckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // 桶的上界不会超过实际的最大值
+            return std::min(getBucketUpperBound(i), getMax());
+        }
+    }
+    return getMax();
+}
+
+XHistogramSummary XHistogram::getSummary() const {
+    XHistogramSummary summary;
+    summary.count = getCount();
+    summary.mean = summary.count > 0 ? mSum.load(std::memory_order_relaxed) / summary.count : 0;
+    summary.p50 = getPercentile(50);
+    summary.p99 = getPercentile(99);
+    summary.max = getMax();
+    return summary;
+}
+
+void XHistogram::reset() {
+    for (auto& bucket : mBuckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    mCount = 0;
+    mSum = 0;
+    mMax = 0;
+}
+
+int XHistogram::getBucketIndex(long value) {
+    auto v = static_cast<uint64_t>(value);
+    if (v < HG_SUB_BUCKET_COUNT) {
+        return static_cast<int>(v);
+    }
+
+    // 最高位在第exponent位，取其后的HG_SUB_BUCKET_BITS位作为区间内的子桶
+    int exponent = 63 - __builtin_clzll(v);
+    int sub = static_cast<int>((v >> (exponent - HG_SUB_BUCKET_BITS)) & (HG_SUB_BUCKET_COUNT - 1));
+    return (exponent - HG_SUB_BUCKET_BITS + 1) * HG_SUB_BUCKET_COUNT + sub;
+}
+
+long XHistogram::getBucketUpperBound(int index) {
+    if (index < HG_SUB_BUCKET_COUNT) {
+        return index;
+    }
+
+    int exponent = index / HG_SUB_BUCKET_COUNT + HG_SUB_BUCKET_BITS - 1;
+    int sub = index % HG_SUB_BUCKET_COUNT;
+    int shift = exponent - HG_SUB_BUCKET_BITS;
+    uint64_t lower = (static_cast<uint64_t>(HG_SUB_BUCKET_COUNT + sub)) << shift;
+    return static_cast<long>(lower + (1ULL << shift) - 1);
+}
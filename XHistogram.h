@@ -0,0 +1,78 @@
+//
+//  XHistogram.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XHISTOGRAM_H
+#define XEXPORTER_XHISTOGRAM_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+struct XHistogramSummary {
+    long count = 0;
+    long mean = 0;
+    long p50 = 0;
+    long p99 = 0;
+    long max = 0;
+};
+
+/**
+ * @brief 对数分桶的直方图：每个2的幂区间再均分为8个桶，相对误差不超过12.5%
+ * record()只有几次relaxed原子操作，可在多个线程中同时调用；
+ * 读取时不加锁，得到的是近似一致的快照
+ */
+class XHistogram {
+public:
+    XHistogram();
+
+    ~XHistogram() = default;
+
+    void record(long value);
+
+    long getCount() const;
+
+    long getMax() const;
+
+    /**
+     * @param percentile 0~100
+     * @return 所在桶的上界，没有数据时返回0
+     */
+    long getPercentile(double percentile) const;
+
+    XHistogramSummary getSummary() const;
+
+    void reset();
+
+    /**
+     * @brief 单调时钟，单位us，用于计时
+     */
+    static inline long now() {
+        return static_cast<long>(std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+private:
+    static int getBucketIndex(long value);
+
+    static long getBucketUpperBound(int index);
+
+private:
+    static const int HG_SUB_BUCKET_BITS = 3;
+    static const int HG_SUB_BUCKET_COUNT = 1 << HG_SUB_BUCKET_BITS;
+    static const int HG_BUCKET_COUNT = (64 - HG_SUB_BUCKET_BITS + 1) * HG_SUB_BUCKET_COUNT;
+
+    std::atomic<long> mBuckets[HG_BUCKET_COUNT];
+
+    std::atomic<long> mCount;
+
+    std::atomic<long> mSum;
+
+    std::atomic<long> mMax;
+};
+
+#endif //XEXPORTER_XHISTOGRAM_H
@@ -10,12 +10,16 @@
 #define XEXPORTER_XIMAGE_H
 
 #include <memory>
+#include <cstring>
+#include <utility>
 
 enum ImageType {
     IMG_TYPE_UNKNOWN = -1,
     IMG_TYPE_YUV420P = 0, // AV_PIX_FMT_YUV420P
     IMG_TYPE_RGB24 = 2, // AV_PIX_FMT_RGB24
+    IMG_TYPE_NV12 = 23, // AV_PIX_FMT_NV12
     IMG_TYPE_RGBA = 26, // AV_PIX_FMT_RGBA
+    IMG_TYPE_BGRA = 28, // AV_PIX_FMT_BGRA
 };
 
 struct XImage {
@@ -44,16 +48,14 @@ struct XImage {
     }
 
     void allocBuffer(int w, int h, int fmt) {
-        if (this->width != w || this->height != h || !pixels) {
+        if (this->width != w || this->height != h || this->format != fmt || !pixels) {
             freeBuffer();
             this->width = w;
             this->height = h;
-            if (fmt == IMG_TYPE_YUV420P) {
-                pixels = pixels = new uint8_t[w * h * 3 / 2];
-            } else if (fmt == IMG_TYPE_RGB24) {
-                pixels = pixels = new uint8_t[w * h * 3];
-            } else if (fmt == IMG_TYPE_RGBA) {
-                pixels = new uint8_t[w * h * 4];
+            this->format = fmt;
+            int size = getBufferSize(w, h, fmt);
+            if (size > 0) {
+                pixels = new uint8_t[size];
             }
         }
     }
@@ -63,6 +65,25 @@ struct XImage {
         memcpy(this->pixels, src, w * h * 4);
     }
 
+    /**
+     * 像素缓冲的字节数，format未设置时按RGBA计算
+     */
+    int getByteSize() const {
+        return pixels ? getBufferSize(width, height, format < 0 ? IMG_TYPE_RGBA : format) : 0;
+    }
+
+    /**
+     * 交换两张图像的像素缓冲和属性，不拷贝像素
+     */
+    void swap(XImage& other) {
+        std::swap(this->pixels, other.pixels);
+        std::swap(this->width, other.width);
+        std::swap(this->height, other.height);
+        std::swap(this->pts, other.pts);
+        std::swap(this->duration, other.duration);
+        std::swap(this->format, other.format);
+    }
+
     void freeBuffer() {
         if (this->pixels) {
             delete[] this->pixels;
@@ -71,13 +92,13 @@ struct XImage {
     }
 
 private:
-    int getBufferSize(int w, int h, int fmt) {
+    int getBufferSize(int w, int h, int fmt) const {
         int result = 0;
-        if (fmt == IMG_TYPE_YUV420P) {
+        if (fmt == IMG_TYPE_YUV420P || fmt == IMG_TYPE_NV12) {
             result = w * h * 3 / 2;
         } else if (fmt == IMG_TYPE_RGB24) {
             result = w * h * 3;
-        } else if (fmt == IMG_TYPE_RGBA) {
+        } else if (fmt == IMG_TYPE_RGBA || fmt == IMG_TYPE_BGRA) {
             result = w * h * 4;
         }
         return result;
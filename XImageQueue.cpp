@@ -7,49 +7,155 @@
 //
 
 #include "XImageQueue.h"
+#include <algorithm>
 
 XImageQueue::XImageQueue(int capacity)
-: mCapacity(capacity), mSize(0), mWindex(0), mRindex(0), mAborted(false) {
+: mCapacity(capacity), mSize(0), mWindex(0), mRindex(0), mBytes(0), mByteLimit(0),
+  mMemoryPolicy(MEMORY_POLICY_BLOCK), mShedCount(0), mAborted(false), mBudgetAborted(false) {
     mImageQueue.reserve(capacity);
     for (int i = 0; i < capacity; ++i) {
         auto image = std::make_shared<XImage>();
         mImageQueue.emplace_back(image);
     }
+    mImageBytes.resize(capacity, 0);
 }
 
 XImageQueue::~XImageQueue() {
     std::lock_guard<std::mutex> lock(mMutex);
     std::vector<std::shared_ptr<XImage>>().swap(mImageQueue);
+    XMemoryBudget::getInstance().release(mBytes);
 }
 
 std::shared_ptr<XImage> XImageQueue::peekWritable() {
-    {
-        std::unique_lock<std::mutex> lock(mMutex);
-        mCond.wait(lock, [=] {
-            return mSize > 0;
-        });
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCond.wait(lock, [=] {
+        return mAborted || (mSize < mCapacity && !isOverByteLimit());
+    });
+    if (mAborted) {
+        return nullptr;
     }
 
-    return mImageQueue.at(mWindex % mCapacity);
+    return mImageQueue.at(mWindex);
 }
 
-void XImageQueue::push() {
+bool XImageQueue::push() {
+    std::unique_lock<std::mutex> lock(mMutex);
+    if (mAborted) {
+        return false;
+    }
+
+    long bytes = mImageQueue.at(mWindex)->getByteSize();
+    XMemoryBudget &budget = XMemoryBudget::getInstance();
+    if (mSize == 0 || bytes <= 0) {
+        budget.forceAcquire(bytes);
+    } else if (!budget.tryAcquire(bytes)) {
+        if (mMemoryPolicy == MEMORY_POLICY_SHED) {
+            mShedCount++;
+            return false;
+        }
+        // 等待时放开队列锁，消费者归还槽位后才能归还预算
+        for (;;) {
+            lock.unlock();
+            bool acquired = budget.acquire(bytes, mBudgetAborted, IQ_BUDGET_RECHECK_MS);
+            lock.lock();
+            if (acquired) {
+                break;
+            }
+            if (mAborted) {
+                return false;
+            }
+            if (mSize == 0) {
+                budget.forceAcquire(bytes);
+                break;
+            }
+        }
+    }
 
+    mImageBytes[mWindex] = bytes;
+    mBytes += bytes;
+    mWindex = (mWindex + 1) % mCapacity;
+    mSize++;
+    mCond.notify_all();
+    return true;
 }
 
 std::shared_ptr<XImage> XImageQueue::peekReadable() {
-    return std::shared_ptr<XImage>();
+    std::unique_lock<std::mutex> lock(mMutex);
+    mCond.wait(lock, [=] {
+        return mAborted || mSize > 0;
+    });
+    if (mAborted) {
+        return nullptr;
+    }
+
+    return mImageQueue.at(mRindex);
 }
 
 void XImageQueue::next() {
-
+    long bytes;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        if (mSize <= 0) {
+            return;
+        }
+        bytes = mImageBytes[mRindex];
+        mImageBytes[mRindex] = 0;
+        mBytes -= bytes;
+        mRindex = (mRindex + 1) % mCapacity;
+        mSize--;
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().release(bytes);
 }
 
 void XImageQueue::flush() {
-
+    long bytes;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        bytes = mBytes;
+        std::fill(mImageBytes.begin(), mImageBytes.end(), 0);
+        mBytes = 0;
+        mSize = 0;
+        mWindex = 0;
+        mRindex = 0;
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().release(bytes);
 }
 
 void XImageQueue::abort() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAborted = true;
+        mBudgetAborted = true;
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().wakeAll();
+}
+
+void XImageQueue::setByteLimit(long bytes) {
+    mByteLimit = bytes;
+}
+
+void XImageQueue::setMemoryPolicy(MemoryPolicy policy) {
+    mMemoryPolicy = policy;
+}
+
+int XImageQueue::getSize() {
     std::lock_guard<std::mutex> lock(mMutex);
-    mAborted = true;
+    return mSize;
+}
+
+long XImageQueue::getBytes() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBytes;
+}
+
+long XImageQueue::getShedCount() const {
+    return mShedCount.load();
+}
+
+bool XImageQueue::isOverByteLimit() const {
+    // 空队列总是可以放入一张
+    return mByteLimit > 0 && mSize > 0 && mBytes >= mByteLimit;
 }
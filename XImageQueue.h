@@ -12,18 +12,37 @@
 #include <vector>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include "XImage.h"
+#include "XMemoryBudget.h"
 
+/**
+ * @brief 定长的图像环形队列，槽位中的XImage循环复用
+ * 生产者peekWritable取到空闲槽位并填好像素后push，消费者peekReadable读取后next归还槽位；
+ * push时按图像字节数向全局内存预算记账，next时归还
+ */
 class XImageQueue {
 public:
     explicit XImageQueue(int capacity = IQ_DEFAULT_CAPACITY);
 
     ~XImageQueue();
 
+    /**
+     * @brief 等待空闲槽位，超出字节上限时同样等待
+     * @return nullptr表示已中止
+     */
     std::shared_ptr<XImage> peekWritable();
 
-    void push();
+    /**
+     * @brief 提交peekWritable取到的槽位，全局预算不足时按MemoryPolicy等待或放弃
+     * @return false表示已中止或按策略放弃，槽位留给下一次peekWritable
+     */
+    bool push();
 
+    /**
+     * @brief 等待可读的图像
+     * @return nullptr表示已中止
+     */
     std::shared_ptr<XImage> peekReadable();
 
     void next();
@@ -32,10 +51,28 @@ public:
 
     void abort();
 
+    /**
+     * @brief 队列中图像的字节上限，<=0表示只按槽位数限制；队列为空时总是可以放入一张，需在使用前设置
+     */
+    void setByteLimit(long bytes);
+
+    void setMemoryPolicy(MemoryPolicy policy);
+
+    int getSize();
+
+    long getBytes();
+
+    long getShedCount() const;
+
+private:
+    bool isOverByteLimit() const;
+
 private:
     static const int IQ_DEFAULT_CAPACITY = 3;
+    static const int IQ_BUDGET_RECHECK_MS = 20;
 
     std::vector<std::shared_ptr<XImage>> mImageQueue;
+    std::vector<long> mImageBytes;
     std::mutex mMutex;
     std::condition_variable mCond;
 
@@ -47,8 +84,18 @@ private:
 
     int mRindex;
 
+    long mBytes;
+
+    long mByteLimit;
+
+    MemoryPolicy mMemoryPolicy;
+
+    std::atomic<long> mShedCount;
+
     bool mAborted;
 
+    std::atomic<bool> mBudgetAborted;
+
 };
 
 
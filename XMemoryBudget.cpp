@@ -0,0 +1,138 @@
+//
+//  XMemoryBudget.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XMemoryBudget.h"
+#include <algorithm>
+#include <chrono>
+
+XMemoryBudget &XMemoryBudget::getInstance() {
+    static XMemoryBudget instance;
+    return instance;
+}
+
+XMemoryBudget::XMemoryBudget()
+        : mLimit(0), mUsed(0), mPeak(0), mWaitCount(0), mWaiters(0) {
+}
+
+void XMemoryBudget::setLimit(long bytes) {
+    mLimit = bytes;
+    // 上限调大后等待的队列可以继续
+    wakeAll();
+}
+
+long XMemoryBudget::getLimit() const {
+    return mLimit.load();
+}
+
+long XMemoryBudget::getUsed() const {
+    return mUsed.load();
+}
+
+long XMemoryBudget::getPeak() const {
+    return mPeak.load();
+}
+
+long XMemoryBudget::getWaitCount() const {
+    return mWaitCount.load();
+}
+
+bool XMemoryBudget::isAvailable() const {
+    long limit = mLimit.load();
+    return limit <= 0 || mUsed.load() < limit;
+}
+
+bool XMemoryBudget::tryAcquire(long bytes) {
+    long limit = mLimit.load();
+    long used = mUsed.load();
+    do {
+        if (limit > 0 && used + bytes > limit) {
+            return false;
+        }
+    } while (!mUsed.compare_exchange_weak(used, used + bytes));
+    updatePeak(used + bytes);
+    return true;
+}
+
+void XMemoryBudget::forceAcquire(long bytes) {
+    updatePeak(mUsed.fetch_add(bytes) + bytes);
+}
+
+bool XMemoryBudget::acquire(long bytes, const std::atomic<bool> &aborted, int timeoutMs) {
+    if (tryAcquire(bytes)) {
+        return true;
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(std::max(0, timeoutMs));
+    std::unique_lock<std::mutex> lock(mMutex);
+    // 先登记等待者再重试，release看到等待者时一定会在锁内唤醒，不会丢失唤醒
+    mWaiters++;
+    mWaitCount++;
+    bool acquired = false;
+    for (;;) {
+        if (aborted) {
+            break;
+        }
+        if (tryAcquire(bytes)) {
+            acquired = true;
+            break;
+        }
+        if (timeoutMs < 0) {
+            mCond.wait(lock);
+        } else if (mCond.wait_until(lock, deadline) == std::cv_status::timeout) {
+            acquired = !aborted && tryAcquire(bytes);
+            break;
+        }
+    }
+    mWaiters--;
+    return acquired;
+}
+
+void XMemoryBudget::release(long bytes) {
+    if (bytes <= 0) {
+        return;
+    }
+    mUsed.fetch_sub(bytes);
+    if (mWaiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCond.notify_all();
+    }
+}
+
+void XMemoryBudget::wakeAll() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mCond.notify_all();
+}
+
+long XMemoryBudget::getFrameBytes(const std::shared_ptr<Frame> &frame) {
+    if (!frame || !frame->avframe) {
+        return 0;
+    }
+
+    AVFrame *avframe = frame->avframe;
+    long bytes = 0;
+    for (int i = 0; i < AV_NUM_DATA_POINTERS && avframe->buf[i]; ++i) {
+        bytes += avframe->buf[i]->size;
+    }
+    for (int i = 0; i < avframe->nb_extended_buf; ++i) {
+        bytes += avframe->extended_buf[i]->size;
+    }
+    return bytes;
+}
+
+long XMemoryBudget::getPacketBytes(const std::shared_ptr<Packet> &packet) {
+    if (!packet || !packet->avpkt) {
+        return 0;
+    }
+    return packet->avpkt->buf ? packet->avpkt->buf->size : packet->avpkt->size;
+}
+
+void XMemoryBudget::updatePeak(long used) {
+    long peak = mPeak.load();
+    while (used > peak && !mPeak.compare_exchange_weak(peak, used)) {
+    }
+}
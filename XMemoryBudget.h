@@ -0,0 +1,100 @@
+//
+//  XMemoryBudget.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XMEMORYBUDGET_H
+#define XEXPORTER_XMEMORYBUDGET_H
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include "XFFHeader.h"
+
+/**
+ * 全局预算或队列自身的字节上限用完时队列的处理方式
+ */
+enum MemoryPolicy {
+    MEMORY_POLICY_BLOCK = 0, // 等待其他队列释放
+    MEMORY_POLICY_SHED,      // 不入队，由put返回失败（XFrameQueue直接丢弃并计数）
+};
+
+/**
+ * @brief 进程内所有帧/Packet/图像队列共享的字节预算
+ * 队列在入队时记账、出队时归还，记账只用原子变量，超出上限时才加锁等待；
+ * 空队列总是允许放入一项（forceAcquire），保证流水线上下游不会因为互相等待预算而死锁，
+ * 因此实际用量可能短暂超过上限
+ */
+class XMemoryBudget {
+public:
+    static XMemoryBudget& getInstance();
+
+    /**
+     * @param bytes 字节上限，<=0表示不限制（默认）
+     */
+    void setLimit(long bytes);
+
+    long getLimit() const;
+
+    long getUsed() const;
+
+    long getPeak() const;
+
+    /**
+     * @brief 因预算不足而等待的次数
+     */
+    long getWaitCount() const;
+
+    /**
+     * @brief 用量未达到上限
+     */
+    bool isAvailable() const;
+
+    bool tryAcquire(long bytes);
+
+    /**
+     * @brief 不检查上限直接记账
+     */
+    void forceAcquire(long bytes);
+
+    /**
+     * @brief 预算不足时等待，直到记账成功、aborted为true或超时
+     * @param timeoutMs <0表示一直等待
+     * @return 是否记账成功
+     */
+    bool acquire(long bytes, const std::atomic<bool>& aborted, int timeoutMs = -1);
+
+    void release(long bytes);
+
+    /**
+     * @brief 唤醒所有等待预算的线程，队列中止时调用，等待方随后检查自己的aborted
+     */
+    void wakeAll();
+
+    /**
+     * @brief 帧持有的缓冲大小，共享缓冲的重复帧会被重复计算
+     */
+    static long getFrameBytes(const std::shared_ptr<Frame>& frame);
+
+    static long getPacketBytes(const std::shared_ptr<Packet>& packet);
+
+private:
+    XMemoryBudget();
+
+    void updatePeak(long used);
+
+private:
+    std::atomic<long> mLimit;
+    std::atomic<long> mUsed;
+    std::atomic<long> mPeak;
+    std::atomic<long> mWaitCount;
+    std::atomic<int> mWaiters;
+
+    std::mutex mMutex;
+    std::condition_variable mCond;
+};
+
+#endif //XEXPORTER_XMEMORYBUDGET_H
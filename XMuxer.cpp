@@ -0,0 +1,143 @@
+//
+//  XMuxer.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XMuxer.h"
+#include <chrono>
+#include "XPacketQueue.h"
+#include "XThreadUtils.h"
+#include "XTrace.h"
+
+XMuxer::XMuxer(AVFormatContext* ic, int capacity)
+: mFormatCtx(ic), mCapacity(capacity), mError(0), mWrittenBytes(0), mWrittenPackets(0), mWriteDuration(0) {
+    mPacketQueue = std::make_unique<XPacketQueue>(capacity);
+}
+
+XMuxer::~XMuxer() {
+    abort();
+    stop();
+}
+
+void XMuxer::addStream(int streamIndex) {
+    mActiveStreams.insert(streamIndex);
+}
+
+void XMuxer::start() {
+    if (mMuxTid) {
+        return;
+    }
+    mMuxTid = std::make_unique<std::thread>([this] { muxWorkThread(this); });
+}
+
+int XMuxer::put(const std::shared_ptr<Packet>& pkt) {
+    if (!pkt || !pkt->avpkt->data || pkt->avpkt->size <= 0) {
+        // 空Packet是结束标记，只能通过finish放入
+        return AVERROR(EINVAL);
+    }
+
+    int error = mError;
+    if (error < 0) {
+        return error;
+    }
+
+    int ret = mPacketQueue->put(pkt);
+    if (ret < 0) {
+        error = mError;
+        return error < 0 ? error : AVERROR_EXIT;
+    }
+    return 0;
+}
+
+int XMuxer::finish(int streamIndex) {
+    return mPacketQueue->putNullPacket(streamIndex);
+}
+
+int XMuxer::stop() {
+    if (mMuxTid && mMuxTid->joinable()) {
+        mMuxTid->join();
+    }
+    mMuxTid.reset();
+    return mError;
+}
+
+void XMuxer::abort() {
+    mPacketQueue->abort();
+}
+
+long XMuxer::getWrittenBytes() const {
+    return mWrittenBytes;
+}
+
+long XMuxer::getWrittenPackets() const {
+    return mWrittenPackets;
+}
+
+long XMuxer::getWriteDuration() const {
+    return mWriteDuration;
+}
+
+XHistogramSummary XMuxer::getWriteLatency() const {
+    return mWriteHistogram.getSummary();
+}
+
+long XMuxer::getBlockedCount() const {
+    return mPacketQueue->getBlockedCount();
+}
+
+long XMuxer::getBlockedDuration() const {
+    return mPacketQueue->getBlockedDuration();
+}
+
+int XMuxer::getQueuedPackets() const {
+    return mPacketQueue->getAvailableCount();
+}
+
+int XMuxer::getQueuedBytes() const {
+    return mPacketQueue->getSize();
+}
+
+int XMuxer::getCapacity() const {
+    return mCapacity;
+}
+
+void XMuxer::muxWorkThread(void* opaque) {
+    XThreadUtils::configThreadName("muxWorkThread");
+    auto muxer = reinterpret_cast<XMuxer*>(opaque);
+    av_log(nullptr, AV_LOG_INFO, "[XMuxer] muxWorkThread ++++\n");
+    auto activeStreams = muxer->mActiveStreams;
+    while (!activeStreams.empty()) {
+        auto pkt = muxer->mPacketQueue->get();
+        if (!pkt) {
+            break;
+        }
+
+        AVPacket* avpkt = pkt->avpkt;
+        if (!avpkt->data && avpkt->size == 0) {
+            activeStreams.erase(avpkt->stream_index);
+            continue;
+        }
+
+        int size = avpkt->size;
+        XTraceSpan span("muxWrite");
+        auto start = std::chrono::steady_clock::now();
+        int ret = av_interleaved_write_frame(muxer->mFormatCtx, avpkt);
+        long elapsed = std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+        muxer->mWriteDuration += elapsed;
+        muxer->mWriteHistogram.record(elapsed);
+        if (ret < 0) {
+            av_log(nullptr, AV_LOG_FATAL, "[XMuxer] av_interleaved_write_frame failed: %s\n", av_err2str(ret));
+            // 复用出错后中止队列，让阻塞在put上的编码线程返回
+            muxer->mError = ret;
+            muxer->mPacketQueue->abort();
+            break;
+        }
+        muxer->mWrittenBytes += size;
+        muxer->mWrittenPackets++;
+    }
+    av_log(nullptr, AV_LOG_INFO, "[XMuxer] muxWorkThread ----\n");
+}
@@ -0,0 +1,122 @@
+//
+//  XMuxer.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XMUXER_H
+#define XEXPORTER_XMUXER_H
+
+#include <set>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include "XFFHeader.h"
+#include "XHistogram.h"
+
+class XPacketQueue;
+
+/**
+ * @brief 复用线程：编码线程把Packet放入有界队列，由单独的线程做交织和写文件，
+ * 磁盘卡顿只会在队列满时反压到编码线程
+ */
+class XMuxer {
+public:
+    /**
+     * @param ic 已写入文件头的输出上下文，复用线程运行期间只由复用线程访问
+     * @param capacity 队列可缓存的Packet数量
+     */
+    explicit XMuxer(AVFormatContext* ic, int capacity = MX_DEFAULT_CAPACITY);
+
+    ~XMuxer();
+
+    /**
+     * @brief 登记一路需要等待结束标记的流，需在start()之前调用
+     */
+    void addStream(int streamIndex);
+
+    void start();
+
+    /**
+     * @brief 放入一个时间戳已转换到流时间基的Packet，队列满时阻塞
+     * @return 0表示成功，复用出错或已中止时返回负值
+     */
+    int put(const std::shared_ptr<Packet>& pkt);
+
+    /**
+     * @brief 放入streamIndex的结束标记，所有登记的流都结束后复用线程退出
+     */
+    int finish(int streamIndex);
+
+    /**
+     * @brief 等待复用线程退出
+     * @return 复用过程中的第一个错误，0表示成功
+     */
+    int stop();
+
+    /**
+     * @brief 中止复用，丢弃队列中的Packet
+     */
+    void abort();
+
+    long getWrittenBytes() const;
+
+    long getWrittenPackets() const;
+
+    /**
+     * @brief 写Packet（含交织缓存和I/O）的累计耗时，单位us
+     */
+    long getWriteDuration() const;
+
+    /**
+     * @brief 每个Packet的写入耗时分布，单位us
+     */
+    XHistogramSummary getWriteLatency() const;
+
+    /**
+     * @brief 编码线程因队列已满而等待的次数
+     */
+    long getBlockedCount() const;
+
+    /**
+     * @brief 编码线程因队列已满而等待的累计时长，单位us
+     */
+    long getBlockedDuration() const;
+
+    int getQueuedPackets() const;
+
+    int getQueuedBytes() const;
+
+    int getCapacity() const;
+
+private:
+    void muxWorkThread(void* opaque);
+
+private:
+    static const int MX_DEFAULT_CAPACITY = 64;
+
+private:
+    AVFormatContext* mFormatCtx;
+
+    int mCapacity;
+
+    std::unique_ptr<XPacketQueue> mPacketQueue;
+
+    std::unique_ptr<std::thread> mMuxTid;
+
+    std::set<int> mActiveStreams;
+
+    std::atomic<int> mError;
+
+    std::atomic<long> mWrittenBytes;
+
+    std::atomic<long> mWrittenPackets;
+
+    std::atomic<long> mWriteDuration;
+
+    XHistogram mWriteHistogram;
+};
+
+#endif //XEXPORTER_XMUXER_H
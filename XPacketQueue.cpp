@@ -7,25 +7,20 @@
 //
 
 #include "XPacketQueue.h"
+#include <chrono>
 
 XPacketQueue::XPacketQueue(int capacity)
-: mSize(0), mCapacity(capacity) {
+: mSize(0), mCapacity(capacity), mByteLimit(0), mBudgetBytes(0), mMemoryPolicy(MEMORY_POLICY_BLOCK), mShedCount(0),
+  mAborted(false), mBudgetAborted(false), mBlockedCount(0), mBlockedDuration(0) {
 }
 
 XPacketQueue::~XPacketQueue() {
     std::lock_guard<std::mutex> lock(mMutex);
     std::queue<std::shared_ptr<Packet>>().swap(mPacketQueue);
+    XMemoryBudget::getInstance().release(mBudgetBytes);
 }
 
 int XPacketQueue::put(const std::shared_ptr<Packet> packet) {
-    
-    {
-        std::unique_lock<std::mutex> lock(mMutex);
-        mCond.wait(lock, [=] {
-            return mPacketQueue.size() < mCapacity;
-        });
-    }
-    
     std::shared_ptr<Packet> pkt;
     if (packet->avpkt->data && packet->avpkt->size) {
         pkt = std::make_shared<Packet>();
@@ -37,10 +32,38 @@ int XPacketQueue::put(const std::shared_ptr<Packet> packet) {
            这会造成 avcodec_send_packet 的时候出现 Invaild Argument 错误 */
         pkt = packet;
     }
+    int size = pkt->avpkt->size;
+    long bytes = XMemoryBudget::getPacketBytes(pkt);
 
-    std::lock_guard<std::mutex> lock(mMutex);
+    std::unique_lock<std::mutex> lock(mMutex);
+    bool shed = mMemoryPolicy == MEMORY_POLICY_SHED;
+    auto writable = [=] {
+        return mPacketQueue.size() < mCapacity && (shed || !isOverByteLimit(size));
+    };
+    if (!mAborted && !writable()) {
+        auto start = std::chrono::steady_clock::now();
+        mCond.wait(lock, [=] {
+            return mAborted || writable();
+        });
+        mBlockedCount++;
+        mBlockedDuration += std::chrono::duration_cast<std::chrono::microseconds>(
+                std::chrono::steady_clock::now() - start).count();
+    }
+    if (mAborted) {
+        return -1;
+    }
+    if (shed && isOverByteLimit(size)) {
+        mShedCount++;
+        return AVERROR(EAGAIN);
+    }
+
+    int ret = chargeBudget(lock, bytes);
+    if (ret < 0) {
+        return ret;
+    }
     mPacketQueue.emplace(pkt);
-    mSize += pkt->avpkt->size;
+    mSize += size;
+    mBudgetBytes += bytes;
     mCond.notify_one();
     return 0;
 }
@@ -54,22 +77,115 @@ int XPacketQueue::putNullPacket(int streamIndex) {
 std::shared_ptr<Packet> XPacketQueue::get() {
     std::unique_lock<std::mutex> lock(mMutex);
     mCond.wait(lock, [=] {
-        return !mPacketQueue.empty();
+        return mAborted || !mPacketQueue.empty();
     });
     
+    if (mAborted) {
+        return nullptr;
+    }
+    
     auto pkt = std::move(mPacketQueue.front());
     mPacketQueue.pop();
-    mCond.notify_one();
+    mSize -= pkt->avpkt->size;
+    long bytes = XMemoryBudget::getPacketBytes(pkt);
+    mBudgetBytes -= bytes;
+    // 多个生产者可能同时等在put上
+    mCond.notify_all();
+    lock.unlock();
+
+    XMemoryBudget::getInstance().release(bytes);
     return pkt;
 }
 
 int XPacketQueue::getAvailableCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
     return static_cast<int>(mPacketQueue.size());
 }
 
-void XPacketQueue::flush() {
+int XPacketQueue::getSize() const {
     std::lock_guard<std::mutex> lock(mMutex);
-    std::queue<std::shared_ptr<Packet>>().swap(mPacketQueue);
-    mSize = 0;
-    mCond.notify_one();
+    return mSize;
+}
+
+long XPacketQueue::getBlockedCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBlockedCount;
+}
+
+long XPacketQueue::getBlockedDuration() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mBlockedDuration;
+}
+
+void XPacketQueue::setByteLimit(int bytes) {
+    mByteLimit = bytes;
+}
+
+void XPacketQueue::setMemoryPolicy(MemoryPolicy policy) {
+    mMemoryPolicy = policy;
+}
+
+long XPacketQueue::getShedCount() const {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mShedCount;
+}
+
+void XPacketQueue::abort() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAborted = true;
+        mBudgetAborted = true;
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().wakeAll();
+}
+
+void XPacketQueue::flush() {
+    long bytes;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        std::queue<std::shared_ptr<Packet>>().swap(mPacketQueue);
+        mSize = 0;
+        bytes = mBudgetBytes;
+        mBudgetBytes = 0;
+        mCond.notify_all();
+    }
+    XMemoryBudget::getInstance().release(bytes);
+}
+
+bool XPacketQueue::isOverByteLimit(int bytes) const {
+    // 空队列总是可以放入一个，空Packet不受字节限制
+    return mByteLimit > 0 && bytes > 0 && !mPacketQueue.empty() && mSize + bytes > mByteLimit;
+}
+
+int XPacketQueue::chargeBudget(std::unique_lock<std::mutex> &lock, long bytes) {
+    XMemoryBudget &budget = XMemoryBudget::getInstance();
+    if (bytes <= 0 || mPacketQueue.empty()) {
+        budget.forceAcquire(bytes);
+        return 0;
+    }
+    if (budget.tryAcquire(bytes)) {
+        return 0;
+    }
+    if (mMemoryPolicy == MEMORY_POLICY_SHED) {
+        mShedCount++;
+        return AVERROR(EAGAIN);
+    }
+
+    // 等待时放开队列锁，消费者取走Packet后才能归还预算
+    for (;;) {
+        lock.unlock();
+        bool acquired = budget.acquire(bytes, mBudgetAborted, PQ_BUDGET_RECHECK_MS);
+        lock.lock();
+        if (acquired) {
+            return 0;
+        }
+        if (mAborted) {
+            return -1;
+        }
+        if (mPacketQueue.empty()) {
+            budget.forceAcquire(bytes);
+            return 0;
+        }
+    }
 }
@@ -12,7 +12,9 @@
 #include <queue>
 #include <mutex>
 #include <condition_variable>
+#include <atomic>
 #include "XFFHeader.h"
+#include "XMemoryBudget.h"
 
 class XPacketQueue {
 public:
@@ -28,6 +30,7 @@ public:
     
     /**
      * @brief 向队列中放入一个AVPacket数据
+     * 队列满时等待；超出字节上限或全局内存预算时按MemoryPolicy等待或返回AVERROR(EAGAIN)，空Packet不受字节限制
      * @param pkt AVPacket数据
      * @return 0表示成功，其他表示失败
      */
@@ -51,6 +54,38 @@ public:
      */
     int getAvailableCount() const;
     
+    /**
+     * @brief 获取队列中Packet数据的总字节数
+     */
+    int getSize() const;
+    
+    /**
+     * @brief 设置队列中Packet数据的字节上限，<=0表示只按个数限制；队列为空时总是可以放入一个，需在使用前设置
+     */
+    void setByteLimit(int bytes);
+    
+    void setMemoryPolicy(MemoryPolicy policy);
+    
+    /**
+     * @brief 获取MEMORY_POLICY_SHED下被拒绝的Packet数量
+     */
+    long getShedCount() const;
+    
+    /**
+     * @brief 获取put因队列已满而等待的次数
+     */
+    long getBlockedCount() const;
+    
+    /**
+     * @brief 获取put因队列已满而等待的总时长，单位us
+     */
+    long getBlockedDuration() const;
+    
+    /**
+     * @brief 中止队列，唤醒所有等待的线程，之后put返回失败、get返回nullptr
+     */
+    void abort();
+    
     /**
      * @brief 刷新队列
      */
@@ -59,6 +94,18 @@ public:
 private:
     static const size_t PQ_DEFAULT_CAPACITY = 5;
     
+    // 等待全局预算时每隔这么久检查一次自己的队列是否已空
+    static const int PQ_BUDGET_RECHECK_MS = 20;
+    
+private:
+    bool isOverByteLimit(int bytes) const;
+    
+    /**
+     * @brief 向全局预算记账，等待时释放lock
+     * @return 0表示成功，AVERROR(EAGAIN)表示按策略拒绝，-1表示已中止
+     */
+    int chargeBudget(std::unique_lock<std::mutex>& lock, long bytes);
+    
 private:
     std::queue<std::shared_ptr<Packet>> mPacketQueue;
     
@@ -69,6 +116,23 @@ private:
     int mSize;
     
     int mCapacity;
+    
+    int mByteLimit;
+    
+    // 向全局预算记账的字节数，包含AVBufferRef的填充
+    long mBudgetBytes;
+    
+    MemoryPolicy mMemoryPolicy;
+    
+    long mShedCount;
+    
+    bool mAborted;
+    
+    std::atomic<bool> mBudgetAborted;
+    
+    long mBlockedCount;
+    
+    long mBlockedDuration;
 };
 
 #endif /* XPacketQueue_hpp */
@@ -0,0 +1,208 @@
+//
+//  XRenditionExporter.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XRenditionExporter.h"
+#include <algorithm>
+#include "XThreadPool.h"
+#include "XFramePool.h"
+
+XRenditionExporter::XRenditionExporter(const std::vector<XRendition>& renditions, int fps, long duration)
+: mRenditions(renditions), mTopIndex(0), mConvertMethod(CONVERT_METHOD_SWSCALE), mColorMatrix(COLOR_MATRIX_BT601),
+  mConvertWidth(0), mConvertHeight(0), mStarted(false) {
+    int count = static_cast<int>(mRenditions.size());
+    for (int i = 0; i < count; ++i) {
+        const auto& rendition = mRenditions[i];
+        auto exporter = std::make_unique<XExporter>(rendition.outputPath, rendition.width, rendition.height, fps,
+                                                    duration);
+        exporter->setVideoBitrate(rendition.bitrate);
+        exporter->setExportResultCallback([this, i](ExportResult result) {
+            if (mResultCallback) {
+                mResultCallback(i, result);
+            }
+        });
+        mExporters.emplace_back(std::move(exporter));
+
+        const auto& top = mRenditions[mTopIndex];
+        if (static_cast<long>(rendition.width) * rendition.height > static_cast<long>(top.width) * top.height) {
+            mTopIndex = i;
+        }
+    }
+    mScaleContexts.resize(count);
+}
+
+XRenditionExporter::~XRenditionExporter() {
+    if (mStarted) {
+        stop();
+    }
+}
+
+void XRenditionExporter::setAudioDisable(bool disableAudio) {
+    for (auto& exporter : mExporters) {
+        exporter->setAudioDisable(disableAudio);
+    }
+}
+
+void XRenditionExporter::setAudioInputFormat(int sampleRate, int channels, SampleType format) {
+    for (auto& exporter : mExporters) {
+        exporter->setAudioInputFormat(sampleRate, channels, format);
+    }
+}
+
+void XRenditionExporter::setConvertMethod(ConvertMethod method) {
+    // 各路送入的都是YUV，只有最高分辨率的转换用到
+    mConvertMethod = method;
+}
+
+void XRenditionExporter::setColorMatrix(ColorMatrix matrix) {
+    // 缩放不改变色彩矩阵，各路的色彩信息需保持一致
+    mColorMatrix = matrix;
+    for (auto& exporter : mExporters) {
+        exporter->setColorMatrix(matrix);
+    }
+}
+
+void XRenditionExporter::setResultCallback(RenditionResultCallback resultCallback) {
+    mResultCallback = resultCallback;
+}
+
+void XRenditionExporter::start() {
+    for (size_t i = 0; i < mExporters.size(); ++i) {
+        mExporters[i]->start();
+        mFramePools.emplace_back(std::make_unique<XFramePool>(mRenditions[i].width, mRenditions[i].height,
+                                                              AV_PIX_FMT_YUV420P));
+    }
+
+    // 调用线程负责其中一路缩放
+    int scales = static_cast<int>(mExporters.size()) - 1;
+    mScalePool = std::make_unique<XThreadPool>(std::max(0, scales - 1), "scaleWorker");
+    mStarted = true;
+}
+
+int XRenditionExporter::encodeFrame(uint8_t* pixels, int width, int height) {
+    if (!pixels || width <= 0 || height <= 0 || !mStarted) {
+        return -1;
+    }
+
+    auto top = mFramePools[mTopIndex]->get();
+    if (!top || convertTop(top, pixels, width, height) < 0) {
+        return -1;
+    }
+
+    int count = static_cast<int>(mExporters.size());
+    std::vector<std::shared_ptr<Frame>> frames(count);
+    frames[mTopIndex] = top;
+
+    // 其余各路从最高分辨率的YUV并行缩放，每路独占一个SwsContext
+    std::vector<int> results(count, 0);
+    mScalePool->parallelFor(count, [&](int index) {
+        if (index != mTopIndex) {
+            results[index] = scaleRendition(index, top, frames[index]);
+        }
+    });
+
+    int ret = 0;
+    for (int i = 0; i < count; ++i) {
+        int err = (results[i] < 0 || !frames[i]) ? -1 : mExporters[i]->encodeVideoFrame(frames[i]);
+        if (err < 0) {
+            av_log(nullptr, AV_LOG_WARNING, "[XRenditionExporter] rendition %d encodeFrame failed: %s\n",
+                   i, av_err2str(err));
+            if (ret == 0) {
+                ret = err;
+            }
+        }
+    }
+    return ret;
+}
+
+int XRenditionExporter::encodeSample(uint8_t* samples, int nbSamples) {
+    int ret = 0;
+    for (auto& exporter : mExporters) {
+        if (exporter->encodeSample(samples, nbSamples) < 0) {
+            ret = -1;
+        }
+    }
+    return ret;
+}
+
+void XRenditionExporter::stop() {
+    mStarted = false;
+    for (auto& exporter : mExporters) {
+        exporter->stop();
+    }
+    mScalePool.reset();
+    mConvertContext.reset();
+    mScaleContexts.clear();
+    mFramePools.clear();
+}
+
+void XRenditionExporter::debug() {
+    for (size_t i = 0; i < mExporters.size(); ++i) {
+        av_log(nullptr, AV_LOG_INFO, "[XRenditionExporter] rendition %d: %dx%d %ld bps -> %s\n",
+               static_cast<int>(i), mRenditions[i].width, mRenditions[i].height, mRenditions[i].bitrate,
+               mRenditions[i].outputPath.data());
+        mExporters[i]->debug();
+    }
+}
+
+int XRenditionExporter::getRenditionCount() const {
+    return static_cast<int>(mRenditions.size());
+}
+
+int XRenditionExporter::convertTop(const std::shared_ptr<Frame>& dst, uint8_t* pixels, int width, int height) {
+    const auto& top = mRenditions[mTopIndex];
+    AVFrame* frame = dst->avframe;
+    if (mConvertMethod == CONVERT_METHOD_BUILTIN && width == top.width && height == top.height) {
+        XColorConvert::rgbaToYUV420P(pixels, width * 4, frame->data, frame->linesize, width, height, mColorMatrix);
+        return 0;
+    }
+
+    if (!mConvertContext || mConvertWidth != width || mConvertHeight != height) {
+        SwsContext* sws = sws_getContext(width, height, AV_PIX_FMT_RGBA, top.width, top.height, AV_PIX_FMT_YUV420P,
+                                         SWS_AREA, nullptr, nullptr, nullptr);
+        if (!sws) {
+            av_log(nullptr, AV_LOG_ERROR, "[XRenditionExporter] sws_getContext failed for %dx%d input!\n",
+                   width, height);
+            return -1;
+        }
+        if (mColorMatrix == COLOR_MATRIX_BT709) {
+            sws_setColorspaceDetails(sws, sws_getCoefficients(SWS_CS_DEFAULT), 0, sws_getCoefficients(SWS_CS_ITU709),
+                                     0, 0, 1 << 16, 1 << 16);
+        }
+        mConvertContext.reset(sws);
+        mConvertWidth = width;
+        mConvertHeight = height;
+    }
+
+    const uint8_t* src[4] = {pixels, nullptr, nullptr, nullptr};
+    int srcLinesize[4] = {width * 4, 0, 0, 0};
+    return sws_scale(mConvertContext.get(), src, srcLinesize, 0, height, frame->data, frame->linesize);
+}
+
+int XRenditionExporter::scaleRendition(int index, const std::shared_ptr<Frame>& top, std::shared_ptr<Frame>& dst) {
+    const auto& rendition = mRenditions[index];
+    const auto& topRendition = mRenditions[mTopIndex];
+    auto& sws = mScaleContexts[index];
+    if (!sws) {
+        sws.reset(sws_getContext(topRendition.width, topRendition.height, AV_PIX_FMT_YUV420P,
+                                 rendition.width, rendition.height, AV_PIX_FMT_YUV420P,
+                                 SWS_AREA, nullptr, nullptr, nullptr));
+        if (!sws) {
+            av_log(nullptr, AV_LOG_ERROR, "[XRenditionExporter] sws_getContext failed for rendition %d!\n", index);
+            return -1;
+        }
+    }
+
+    dst = mFramePools[index]->get();
+    if (!dst) {
+        return -1;
+    }
+
+    AVFrame* src = top->avframe;
+    return sws_scale(sws.get(), src->data, src->linesize, 0, topRendition.height,
+                     dst->avframe->data, dst->avframe->linesize);
+}
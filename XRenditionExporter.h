@@ -0,0 +1,115 @@
+//
+//  XRenditionExporter.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XRENDITIONEXPORTER_H
+#define XEXPORTER_XRENDITIONEXPORTER_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include "XExporter.h"
+
+class XThreadPool;
+class XFramePool;
+
+struct XRendition {
+    std::string outputPath;
+
+    int width = 0;
+
+    int height = 0;
+
+    // 单位bps，<=0表示使用编码器默认的码控方式
+    long bitrate = 0;
+};
+
+/**
+ * @brief 一路输入同时导出多个分辨率（码率阶梯）
+ * RGBA只在最高分辨率上转换一次YUV，其余分辨率由它并行缩放得到；
+ * 各路的YUV帧通过XExporter::encodeVideoFrame按引用送入，每个分辨率由一个XExporter在各自的线程中编码并写入各自的文件
+ */
+class XRenditionExporter {
+    using RenditionResultCallback = std::function<void(int index, ExportResult result)>;
+
+public:
+    /**
+     * @param renditions 各路输出，index即回调中的序号
+     */
+    XRenditionExporter(const std::vector<XRendition>& renditions, int fps, long duration);
+
+    ~XRenditionExporter();
+
+    void setAudioDisable(bool disableAudio);
+
+    void setAudioInputFormat(int sampleRate, int channels, SampleType format);
+
+    void setConvertMethod(ConvertMethod method);
+
+    void setColorMatrix(ColorMatrix matrix);
+
+    void setResultCallback(RenditionResultCallback resultCallback = nullptr);
+
+    void start();
+
+    /**
+     * @return 0表示各路都已接收；否则返回第一个失败的那一路的错误（见XExporter::encodeFrame），其余各路照常送帧
+     */
+    int encodeFrame(uint8_t* pixels, int width, int height);
+
+    /**
+     * 音频较小，直接送给每一路各自编码
+     */
+    int encodeSample(uint8_t* samples, int nbSamples);
+
+    void stop();
+
+    void debug();
+
+    int getRenditionCount() const;
+
+private:
+    /**
+     * RGBA转换为最高分辨率的YUV420P
+     */
+    int convertTop(const std::shared_ptr<Frame>& dst, uint8_t* pixels, int width, int height);
+
+    int scaleRendition(int index, const std::shared_ptr<Frame>& top, std::shared_ptr<Frame>& dst);
+
+private:
+    std::vector<XRendition> mRenditions;
+
+    std::vector<std::unique_ptr<XExporter>> mExporters;
+
+    // 分辨率最高的一路，RGBA在这一路上转换
+    int mTopIndex;
+
+    ConvertMethod mConvertMethod;
+
+    ColorMatrix mColorMatrix;
+
+    // RGBA -> 最高分辨率YUV420P，输入尺寸变化时重建
+    std::unique_ptr<SwsContext, SwsContextDeleter> mConvertContext;
+
+    int mConvertWidth;
+
+    int mConvertHeight;
+
+    std::vector<std::unique_ptr<SwsContext, SwsContextDeleter>> mScaleContexts;
+
+    // 各路的YUV420P帧，编码器用完后缓冲归还到池中
+    std::vector<std::unique_ptr<XFramePool>> mFramePools;
+
+    std::unique_ptr<XThreadPool> mScalePool;
+
+    RenditionResultCallback mResultCallback;
+
+    bool mStarted;
+};
+
+#endif //XEXPORTER_XRENDITIONEXPORTER_H
@@ -9,10 +9,88 @@
 #ifndef XEXPORTER_XSAMPLE_H
 #define XEXPORTER_XSAMPLE_H
 
+#include <cstdint>
+#include <cstring>
 
-class XSample {
-
+enum SampleType {
+    SAMPLE_TYPE_UNKNOWN = -1,
+    SAMPLE_TYPE_S16 = 1, // AV_SAMPLE_FMT_S16
+    SAMPLE_TYPE_S32 = 2, // AV_SAMPLE_FMT_S32
+    SAMPLE_TYPE_FLT = 3, // AV_SAMPLE_FMT_FLT
 };
 
+/**
+ * @brief 一段交错存储（packed）的PCM数据
+ */
+struct XSample {
+    uint8_t* samples = nullptr;
+
+    // 每个声道的采样数
+    int nbSamples = 0;
+
+    int channels = 0;
+
+    int sampleRate = 0;
+
+    int format = -1;
+
+    long pts = -1;
+
+    XSample(): samples(nullptr), nbSamples(0), channels(0), sampleRate(0), format(-1), pts(-1) {
+
+    }
+
+    ~XSample() {
+        freeBuffer();
+        this->nbSamples = 0;
+        this->channels = 0;
+        this->pts = -1;
+    }
+
+    void allocBuffer(int nb, int ch, int fmt) {
+        if (getBufferSize(nb, ch, fmt) != getBufferSize(this->nbSamples, this->channels, this->format) || !samples) {
+            freeBuffer();
+            int size = getBufferSize(nb, ch, fmt);
+            if (size > 0) {
+                samples = new uint8_t[size];
+            }
+        }
+        this->nbSamples = nb;
+        this->channels = ch;
+        this->format = fmt;
+    }
+
+    void copySamples(const uint8_t* src, int nb, int ch, int fmt) {
+        allocBuffer(nb, ch, fmt);
+        if (samples) {
+            memcpy(this->samples, src, getBufferSize(nb, ch, fmt));
+        }
+    }
+
+    void freeBuffer() {
+        if (this->samples) {
+            delete[] this->samples;
+            this->samples = nullptr;
+        }
+    }
+
+    /**
+     * @brief 一个采样点（所有声道）占用的字节数，不支持的格式返回0
+     */
+    static int getSampleSize(int ch, int fmt) {
+        int bytes = 0;
+        if (fmt == SAMPLE_TYPE_S16) {
+            bytes = 2;
+        } else if (fmt == SAMPLE_TYPE_S32 || fmt == SAMPLE_TYPE_FLT) {
+            bytes = 4;
+        }
+        return bytes * ch;
+    }
+
+private:
+    static int getBufferSize(int nb, int ch, int fmt) {
+        return nb * getSampleSize(ch, fmt);
+    }
+};
 
 #endif //XEXPORTER_XSAMPLE_H
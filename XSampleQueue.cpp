@@ -7,3 +7,134 @@
 //
 
 #include "XSampleQueue.h"
+#include <algorithm>
+#include <cstring>
+
+XSampleQueue::XSampleQueue(int capacity, int sampleSize)
+: mCapacity(std::max(1, capacity)), mSampleSize(std::max(1, sampleSize)), mWritePos(0), mReadPos(0),
+  mWaiters(0), mFinished(false), mAborted(false) {
+    mBuffer.resize(static_cast<size_t>(mCapacity) * mSampleSize);
+}
+
+XSampleQueue::~XSampleQueue() {
+    abort();
+}
+
+int XSampleQueue::write(const uint8_t* samples, int nbSamples) {
+    if (!samples || nbSamples < 0) {
+        return -1;
+    }
+
+    int written = 0;
+    while (written < nbSamples) {
+        if (mAborted || mFinished) {
+            return -1;
+        }
+
+        uint64_t writePos = mWritePos.load(std::memory_order_relaxed);
+        int space = mCapacity - static_cast<int>(writePos - mReadPos.load());
+        if (space <= 0) {
+            wait([&] {
+                return mAborted || mCapacity - static_cast<int>(writePos - mReadPos.load()) > 0;
+            });
+            continue;
+        }
+
+        int count = std::min(space, nbSamples - written);
+        copyIn(writePos, samples + static_cast<size_t>(written) * mSampleSize, count);
+        mWritePos.store(writePos + count);
+        wakeup();
+        written += count;
+    }
+    return written;
+}
+
+int XSampleQueue::read(uint8_t* samples, int nbSamples) {
+    if (!samples || nbSamples <= 0) {
+        return -1;
+    }
+
+    for (;;) {
+        if (mAborted) {
+            return -1;
+        }
+
+        uint64_t readPos = mReadPos.load(std::memory_order_relaxed);
+        int available = static_cast<int>(mWritePos.load() - readPos);
+        if (available > 0) {
+            int count = std::min(available, nbSamples);
+            copyOut(readPos, samples, count);
+            mReadPos.store(readPos + count);
+            wakeup();
+            return count;
+        }
+
+        if (mFinished) {
+            // finish之前写入的数据可能在上面读取写位置之后才可见
+            if (mWritePos.load() == readPos) {
+                return 0;
+            }
+            continue;
+        }
+
+        wait([&] {
+            return mAborted || mFinished || mWritePos.load() != readPos;
+        });
+    }
+}
+
+int XSampleQueue::getAvailableCount() const {
+    return static_cast<int>(mWritePos.load() - mReadPos.load());
+}
+
+int XSampleQueue::getCapacity() const {
+    return mCapacity;
+}
+
+void XSampleQueue::finish() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mFinished = true;
+    mCond.notify_all();
+}
+
+void XSampleQueue::abort() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mAborted = true;
+    mCond.notify_all();
+}
+
+void XSampleQueue::copyIn(uint64_t pos, const uint8_t* src, int count) {
+    int index = static_cast<int>(pos % mCapacity);
+    int first = std::min(count, mCapacity - index);
+    memcpy(mBuffer.data() + static_cast<size_t>(index) * mSampleSize, src, static_cast<size_t>(first) * mSampleSize);
+    if (first < count) {
+        memcpy(mBuffer.data(), src + static_cast<size_t>(first) * mSampleSize,
+               static_cast<size_t>(count - first) * mSampleSize);
+    }
+}
+
+void XSampleQueue::copyOut(uint64_t pos, uint8_t* dst, int count) {
+    int index = static_cast<int>(pos % mCapacity);
+    int first = std::min(count, mCapacity - index);
+    memcpy(dst, mBuffer.data() + static_cast<size_t>(index) * mSampleSize, static_cast<size_t>(first) * mSampleSize);
+    if (first < count) {
+        memcpy(dst + static_cast<size_t>(first) * mSampleSize, mBuffer.data(),
+               static_cast<size_t>(count - first) * mSampleSize);
+    }
+}
+
+template <typename Predicate>
+void XSampleQueue::wait(Predicate predicate) {
+    // 先登记等待者再检查条件；对方先发布读写位置再检查等待者，两边至少有一方能看到对方
+    std::unique_lock<std::mutex> lock(mMutex);
+    mWaiters++;
+    mCond.wait(lock, predicate);
+    mWaiters--;
+}
+
+void XSampleQueue::wakeup() {
+    if (mWaiters.load() > 0) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCond.notify_all();
+    }
+}
@@ -9,9 +9,88 @@
 #ifndef XEXPORTER_XSAMPLEQUEUE_H
 #define XEXPORTER_XSAMPLEQUEUE_H
 
+#include <cstdint>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
+/**
+ * @brief 单生产者单消费者的PCM环形缓冲区
+ * 读写位置用原子变量维护，有数据/有空间时读写都不加锁；
+ * 只有一方需要等待时才通过互斥锁和条件变量阻塞
+ */
 class XSampleQueue {
+public:
+    /**
+     * @brief 构建一个新的队列
+     * @param capacity 容量，单位为采样点
+     * @param sampleSize 一个采样点（所有声道）占用的字节数
+     */
+    XSampleQueue(int capacity, int sampleSize);
 
+    ~XSampleQueue();
+
+    /**
+     * @brief 写入nbSamples个采样点，空间不足时阻塞直到全部写完
+     * @return 写入的采样点数，-1表示队列已中止或已结束
+     */
+    int write(const uint8_t* samples, int nbSamples);
+
+    /**
+     * @brief 读取最多nbSamples个采样点，队列为空时阻塞
+     * @return 读取的采样点数，0表示输入已结束且数据已读完，-1表示队列已中止
+     */
+    int read(uint8_t* samples, int nbSamples);
+
+    /**
+     * @brief 获取队列中可读的采样点数
+     */
+    int getAvailableCount() const;
+
+    int getCapacity() const;
+
+    /**
+     * @brief 标记输入结束，读完剩余数据后read返回0
+     */
+    void finish();
+
+    /**
+     * @brief 中止队列，唤醒所有等待的读写方
+     */
+    void abort();
+
+private:
+    void copyIn(uint64_t pos, const uint8_t* src, int count);
+
+    void copyOut(uint64_t pos, uint8_t* dst, int count);
+
+    template <typename Predicate>
+    void wait(Predicate predicate);
+
+    void wakeup();
+
+private:
+    std::vector<uint8_t> mBuffer;
+
+    int mCapacity;
+
+    int mSampleSize;
+
+    // 单调递增的读写位置，单位为采样点
+    std::atomic<uint64_t> mWritePos;
+
+    std::atomic<uint64_t> mReadPos;
+
+    std::atomic<int> mWaiters;
+
+    std::atomic<bool> mFinished;
+
+    std::atomic<bool> mAborted;
+
+    std::mutex mMutex;
+
+    std::condition_variable mCond;
 };
 
 
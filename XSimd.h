@@ -0,0 +1,77 @@
+//
+//  XSimd.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XSIMD_H
+#define XEXPORTER_XSIMD_H
+
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define X_SIMD_X86 1
+#include <immintrin.h>
+
+// 单个函数按指定指令集编译，整个工程仍按基础指令集编译，由运行时选择调用哪个版本
+#define X_TARGET_SSE2 __attribute__((target("sse2")))
+#define X_TARGET_SSE41 __attribute__((target("sse4.1")))
+#define X_TARGET_AVX __attribute__((target("avx")))
+#define X_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+enum SimdFeature {
+    SIMD_FEATURE_SSE2 = 0,
+    SIMD_FEATURE_SSE41,
+    SIMD_FEATURE_AVX,
+    SIMD_FEATURE_AVX2,
+};
+
+/**
+ * @brief SIMD内核的运行时选择：各模块把同一功能的几个实现按优先级列出，选中第一个CPU支持的
+ * 用法：static const Kernel kernel = XSimd::select<Kernel>({{SIMD_FEATURE_AVX2, avx2Kernel}, ...}, cKernel);
+ */
+class XSimd {
+public:
+    template <typename Kernel>
+    struct Candidate {
+        SimdFeature feature;
+        Kernel kernel;
+    };
+
+    static inline bool isSupported(SimdFeature feature) {
+#if X_SIMD_X86
+        __builtin_cpu_init();
+        // __builtin_cpu_supports只接受字符串常量
+        switch (feature) {
+            case SIMD_FEATURE_SSE2:
+                return __builtin_cpu_supports("sse2");
+            case SIMD_FEATURE_SSE41:
+                return __builtin_cpu_supports("sse4.1");
+            case SIMD_FEATURE_AVX:
+                return __builtin_cpu_supports("avx");
+            case SIMD_FEATURE_AVX2:
+                return __builtin_cpu_supports("avx2");
+        }
+#endif
+        return false;
+    }
+
+    /**
+     * @param candidates 按优先级从高到低排列，非x86平台为空
+     * @param fallback 都不支持时使用的C实现
+     */
+    template <typename Kernel>
+    static Kernel select(std::initializer_list<Candidate<Kernel>> candidates, const Kernel& fallback) {
+        for (const auto& candidate : candidates) {
+            if (isSupported(candidate.feature)) {
+                return candidate.kernel;
+            }
+        }
+        return fallback;
+    }
+};
+
+#endif //XEXPORTER_XSIMD_H
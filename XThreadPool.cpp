@@ -0,0 +1,123 @@
+//
+//  XThreadPool.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XThreadPool.h"
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include "XThreadUtils.h"
+
+XThreadPool::XThreadPool(int threadCount, const std::string& name)
+        : mName(name), mAborted(false) {
+    mThreads.reserve(threadCount);
+    for (int i = 0; i < threadCount; ++i) {
+        mThreads.emplace_back([this] { workThread(); });
+    }
+}
+
+XThreadPool::~XThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mAborted = true;
+        mCond.notify_all();
+    }
+
+    for (auto& thread : mThreads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+}
+
+void XThreadPool::post(std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(mMutex);
+    mTasks.emplace(std::move(task));
+    mCond.notify_one();
+}
+
+void XThreadPool::parallelFor(int count, const std::function<void(int index)>& task) {
+    if (count <= 0) {
+        return;
+    }
+
+    if (count == 1 || mThreads.empty()) {
+        for (int i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    struct Batch {
+        std::function<void(int)> task;
+        std::atomic<int> next;
+        int count;
+        int done;
+        std::mutex mutex;
+        std::condition_variable cond;
+    };
+
+    // 辅助任务可能在调用线程返回之后才被调度到，所以状态必须由任务共同持有
+    auto batch = std::make_shared<Batch>();
+    batch->task = task;
+    batch->next = 0;
+    batch->count = count;
+    batch->done = 0;
+
+    auto runner = [batch] {
+        int finished = 0;
+        for (int i = batch->next++; i < batch->count; i = batch->next++) {
+            batch->task(i);
+            finished++;
+        }
+        if (finished > 0) {
+            std::lock_guard<std::mutex> lock(batch->mutex);
+            batch->done += finished;
+            if (batch->done == batch->count) {
+                batch->cond.notify_one();
+            }
+        }
+    };
+
+    int helpers = std::min(count - 1, static_cast<int>(mThreads.size()));
+    for (int i = 0; i < helpers; ++i) {
+        post(runner);
+    }
+
+    runner();
+
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->cond.wait(lock, [&] {
+        return batch->done == batch->count;
+    });
+}
+
+int XThreadPool::getThreadCount() const {
+    return static_cast<int>(mThreads.size());
+}
+
+void XThreadPool::workThread() {
+    XThreadUtils::configThreadName(mName.data());
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mCond.wait(lock, [this] {
+                return mAborted || !mTasks.empty();
+            });
+
+            if (mTasks.empty()) {
+                break;
+            }
+
+            task = std::move(mTasks.front());
+            mTasks.pop();
+        }
+
+        task();
+    }
+}
@@ -0,0 +1,58 @@
+//
+//  XThreadPool.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XTHREADPOOL_H
+#define XEXPORTER_XTHREADPOOL_H
+
+#include <string>
+#include <vector>
+#include <queue>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+class XThreadPool {
+public:
+    /**
+     * @brief 构建一个线程池
+     * @param threadCount 工作线程数量
+     * @param name 工作线程名称
+     */
+    explicit XThreadPool(int threadCount, const std::string& name = "XThreadPool");
+
+    /**
+     * @brief 销毁线程池，等待已提交的任务执行完毕
+     */
+    ~XThreadPool();
+
+    /**
+     * @brief 提交一个异步任务
+     */
+    void post(std::function<void()> task);
+
+    /**
+     * @brief 并行执行task(0) ... task(count - 1)，调用线程也参与执行，全部完成后返回
+     */
+    void parallelFor(int count, const std::function<void(int index)>& task);
+
+    int getThreadCount() const;
+
+private:
+    void workThread();
+
+private:
+    std::string mName;
+    std::vector<std::thread> mThreads;
+    std::queue<std::function<void()>> mTasks;
+    std::mutex mMutex;
+    std::condition_variable mCond;
+    bool mAborted;
+};
+
+#endif //XEXPORTER_XTHREADPOOL_H
@@ -10,6 +10,7 @@
 #define XEXPORTER_THREADUTILS_H
 
 #include <pthread.h>
+#include "XTrace.h"
 
 class XThreadUtils {
 public:
@@ -19,6 +20,7 @@ public:
 #else
         pthread_setname_np(pthread_self(), name);
 #endif
+        XTrace::setThreadName(name);
     }
 };
 
@@ -19,21 +19,33 @@ public:
     ~XTimeCounter() = default;
 
     inline void markStart() {
-        mStart = std::chrono::system_clock::now();
+        mStart = std::chrono::steady_clock::now();
     }
 
     inline void markEnd() {
-        mEnd = std::chrono::system_clock::now();
+        mEnd = std::chrono::steady_clock::now();
     }
 
+    /**
+     * 单位ms
+     */
     long getRunDuration() {
         auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(mEnd - mStart);
         return static_cast<long>(duration.count());
     }
 
+    /**
+     * 单位us
+     */
+    long getRunDurationUs() {
+        auto duration = std::chrono::duration_cast<std::chrono::microseconds>(mEnd - mStart);
+        return static_cast<long>(duration.count());
+    }
+
 private:
-    std::chrono::system_clock::time_point mStart;
-    std::chrono::system_clock::time_point mEnd;
+    // 单调时钟，不受系统时间调整影响
+    std::chrono::steady_clock::time_point mStart;
+    std::chrono::steady_clock::time_point mEnd;
 };
 
 #endif //XEXPORTER_XTIMECOUNTER_H
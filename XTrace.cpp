@@ -0,0 +1,242 @@
+//
+//  XTrace.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include "XTrace.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace {
+
+const int TR_BUFFER_CAPACITY = 1 << 16;
+// 已退出线程的缓冲最多保留这么多个，超出后丢弃最早退出的，避免反复创建线程时内存只增不减
+const size_t TR_MAX_RETIRED_BUFFERS = 16;
+
+struct TraceEvent {
+    const char* name;
+    int64_t begin;
+    int64_t end;
+};
+
+/**
+ * 字段用relaxed原子读写，dump读取时所属线程可能正在覆盖同一个槽位
+ */
+struct TraceSlot {
+    std::atomic<const char*> name;
+    std::atomic<int64_t> begin;
+    std::atomic<int64_t> end;
+};
+
+/**
+ * 单写者环形缓冲：只有所属线程写入，写完一条后再发布计数
+ */
+struct ThreadBuffer {
+    int tid = 0;
+    std::string name;
+    std::unique_ptr<TraceSlot[]> events{new TraceSlot[TR_BUFFER_CAPACITY]};
+    std::atomic<uint64_t> count{0};
+    std::atomic<bool> retired{false};
+
+    /**
+     * @brief 读取第index条记录，读取期间被所属线程覆盖时返回false
+     */
+    bool read(uint64_t index, TraceEvent& event) const {
+        const TraceSlot& slot = events[index % TR_BUFFER_CAPACITY];
+        event.name = slot.name.load(std::memory_order_relaxed);
+        event.begin = slot.begin.load(std::memory_order_relaxed);
+        event.end = slot.end.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return count.load(std::memory_order_relaxed) - index <= TR_BUFFER_CAPACITY;
+    }
+};
+
+std::mutex &getRegistryMutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+// 线程退出后缓冲仍保留在这里，dump时还能看到它的记录；dump写出后或超过TR_MAX_RETIRED_BUFFERS时移除
+std::vector<std::shared_ptr<ThreadBuffer>> &getRegistry() {
+    static std::vector<std::shared_ptr<ThreadBuffer>> registry;
+    return registry;
+}
+
+/**
+ * 持有当前线程的缓冲，线程退出时把缓冲标记为已退出
+ */
+struct ThreadBufferOwner {
+    std::shared_ptr<ThreadBuffer> buffer;
+
+    ~ThreadBufferOwner() {
+        if (buffer) {
+            buffer->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+thread_local ThreadBuffer *tlsBuffer = nullptr;
+thread_local ThreadBufferOwner tlsOwner;
+thread_local std::string tlsThreadName;
+int sNextTid = 1;
+
+/**
+ * @brief 已退出线程的缓冲超过上限时丢弃最早的，调用方持有registry锁
+ */
+void trimRetiredBuffers(std::vector<std::shared_ptr<ThreadBuffer>> &registry) {
+    size_t retired = std::count_if(registry.begin(), registry.end(), [](const std::shared_ptr<ThreadBuffer> &buffer) {
+        return buffer->retired.load(std::memory_order_acquire);
+    });
+    for (auto it = registry.begin(); it != registry.end() && retired > TR_MAX_RETIRED_BUFFERS;) {
+        if ((*it)->retired.load(std::memory_order_acquire)) {
+            it = registry.erase(it);
+            --retired;
+        } else {
+            ++it;
+        }
+    }
+}
+
+ThreadBuffer *getThreadBuffer() {
+    if (!tlsBuffer) {
+        auto buffer = std::make_shared<ThreadBuffer>();
+
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        auto &registry = getRegistry();
+        trimRetiredBuffers(registry);
+        buffer->tid = sNextTid++;
+        buffer->name = tlsThreadName.empty() ? "thread-" + std::to_string(buffer->tid) : tlsThreadName;
+        registry.emplace_back(buffer);
+        tlsOwner.buffer = buffer;
+        tlsBuffer = buffer.get();
+    }
+    return tlsBuffer;
+}
+
+void writeEscaped(FILE *file, const char *text) {
+    for (const char *p = text; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            fputc('\\', file);
+        }
+        fputc(*p, file);
+    }
+}
+
+}
+
+std::atomic<bool> XTrace::sEnabled(false);
+
+void XTrace::setEnabled(bool enable) {
+    sEnabled = enable;
+}
+
+void XTrace::setThreadName(const char *name) {
+    tlsThreadName = name ? name : "";
+    if (tlsBuffer) {
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        tlsBuffer->name = tlsThreadName;
+    }
+}
+
+void XTrace::record(const char *name, int64_t begin, int64_t end) {
+    ThreadBuffer *buffer = getThreadBuffer();
+    uint64_t count = buffer->count.load(std::memory_order_relaxed);
+    TraceSlot &slot = buffer->events[count % TR_BUFFER_CAPACITY];
+    slot.name.store(name, std::memory_order_relaxed);
+    slot.begin.store(begin, std::memory_order_relaxed);
+    slot.end.store(end, std::memory_order_relaxed);
+    buffer->count.store(count + 1, std::memory_order_release);
+}
+
+int XTrace::dump(const std::string &path) {
+    FILE *file = fopen(path.data(), "w");
+    if (!file) {
+        return -1;
+    }
+
+    struct Snapshot {
+        int tid;
+        std::string name;
+        std::vector<TraceEvent> events;
+    };
+
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        buffers = getRegistry();
+    }
+
+    // 先把每个缓冲复制出来，丢掉复制期间被覆盖的记录；时间戳相对于最早的一条记录，单位us
+    std::vector<Snapshot> snapshots;
+    int64_t origin = INT64_MAX;
+    for (const auto &buffer : buffers) {
+        Snapshot snapshot;
+        snapshot.tid = buffer->tid;
+        {
+            std::lock_guard<std::mutex> lock(getRegistryMutex());
+            snapshot.name = buffer->name;
+        }
+        uint64_t count = buffer->count.load(std::memory_order_acquire);
+        uint64_t first = count > TR_BUFFER_CAPACITY ? count - TR_BUFFER_CAPACITY : 0;
+        snapshot.events.reserve(count - first);
+        TraceEvent event = {};
+        for (uint64_t i = first; i < count; ++i) {
+            if (buffer->read(i, event)) {
+                snapshot.events.push_back(event);
+                origin = std::min(origin, event.begin);
+            }
+        }
+        snapshots.emplace_back(std::move(snapshot));
+    }
+
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    bool firstEvent = true;
+    for (const auto &snapshot : snapshots) {
+        fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": \"",
+                firstEvent ? "" : ",\n", snapshot.tid);
+        writeEscaped(file, snapshot.name.data());
+        fprintf(file, "\"}}");
+        firstEvent = false;
+
+        for (const TraceEvent &event : snapshot.events) {
+            fprintf(file, ",\n{\"name\": \"");
+            writeEscaped(file, event.name);
+            fprintf(file, "\", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", snapshot.tid,
+                    (event.begin - origin) / 1000.0, (event.end - event.begin) / 1000.0);
+        }
+    }
+    fprintf(file, "\n]}\n");
+
+    int ret = ferror(file) ? -1 : 0;
+    fclose(file);
+
+    // 已退出线程的记录已经写出，缓冲不再需要
+    if (ret == 0) {
+        std::lock_guard<std::mutex> lock(getRegistryMutex());
+        auto &registry = getRegistry();
+        for (const auto &buffer : buffers) {
+            if (buffer->retired.load(std::memory_order_acquire)) {
+                registry.erase(std::remove(registry.begin(), registry.end(), buffer), registry.end());
+            }
+        }
+    }
+    return ret;
+}
+
+void XTrace::clear() {
+    std::lock_guard<std::mutex> lock(getRegistryMutex());
+    auto &registry = getRegistry();
+    registry.erase(std::remove_if(registry.begin(), registry.end(), [](const std::shared_ptr<ThreadBuffer> &buffer) {
+        return buffer->retired.load(std::memory_order_acquire);
+    }), registry.end());
+    for (auto &buffer : registry) {
+        buffer->count.store(0, std::memory_order_release);
+    }
+}
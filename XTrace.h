@@ -0,0 +1,87 @@
+//
+//  XTrace.h
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#ifndef XEXPORTER_XTRACE_H
+#define XEXPORTER_XTRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief 轻量的耗时追踪：每个线程把span写入自己的环形缓冲（写满后覆盖最早的记录），
+ * 记录时不加锁；dump()输出Chrome trace-event格式的JSON，可直接用Perfetto / chrome://tracing打开，
+ * 线程按XThreadUtils::configThreadName设置的名字显示
+ * @note 默认关闭，关闭时一个span只有一次原子读
+ */
+class XTrace {
+public:
+    static void setEnabled(bool enable);
+
+    static inline bool isEnabled() {
+        return sEnabled.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief 设置当前线程在trace中显示的名字
+     */
+    static void setThreadName(const char* name);
+
+    /**
+     * @param name 必须是字符串常量，只保存指针
+     * @param begin/end 由now()取得，单位ns
+     */
+    static void record(const char* name, int64_t begin, int64_t end);
+
+    /**
+     * @brief 把所有线程的记录写成Chrome trace JSON，被追踪的线程可以继续记录，复制期间被覆盖的记录会丢弃；
+     * 已退出线程的记录写出后释放其缓冲
+     * @return 0表示成功，文件无法写入时返回-1
+     */
+    static int dump(const std::string& path);
+
+    /**
+     * @brief 丢弃已有的记录，同样需在被追踪的线程都空闲后调用
+     */
+    static void clear();
+
+    static inline int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+private:
+    static std::atomic<bool> sEnabled;
+};
+
+/**
+ * @brief RAII span：构造时开始计时，析构时写入当前线程的缓冲
+ */
+class XTraceSpan {
+public:
+    explicit XTraceSpan(const char* name) : mName(name), mBegin(XTrace::isEnabled() ? XTrace::now() : 0) {
+
+    }
+
+    ~XTraceSpan() {
+        if (mBegin > 0) {
+            XTrace::record(mName, mBegin, XTrace::now());
+        }
+    }
+
+    XTraceSpan(const XTraceSpan&) = delete;
+
+    XTraceSpan& operator=(const XTraceSpan&) = delete;
+
+private:
+    const char* mName;
+    int64_t mBegin;
+};
+
+#endif //XEXPORTER_XTRACE_H
@@ -0,0 +1,359 @@
+//
+//  XExportBench.cpp
+//  XExporter
+//
+//  Created by Oogh on 2020/3/19.
+//  Copyright © 2020 Oogh. All rights reserved.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <sys/resource.h>
+#include "XExporter.h"
+#include "XHistogram.h"
+#include "XTimeCounter.h"
+
+/**
+ * 导出吞吐量基准：用合成画面驱动XExporter，遍历分辨率 x 帧率 x 编码线程数，结果以JSON输出
+ * 用法：XExportBench [--output-dir DIR] [--duration MS] [--json FILE] [--convert-threads N] [--quick] [--keep]
+ */
+
+enum PatternType {
+    PATTERN_GRADIENT = 0, // 随时间平移的渐变，编码器容易预测
+    PATTERN_NOISE,        // 每帧不同的随机噪声，最难压缩
+    PATTERN_MOVING,       // 静止背景上移动的方块，接近真实的运动画面
+};
+
+struct BenchCase {
+    int width;
+    int height;
+    int fps;
+    int threads;
+    PatternType pattern;
+};
+
+struct BenchResult {
+    BenchCase config;
+    long frames = 0;
+    long elapsed = 0;            // 从start()到stop()返回，单位ms
+    double framesPerSecond = 0;
+    double realtimeFactor = 0;   // 媒体时长 / 导出耗时
+    long peakRss = 0;            // 峰值常驻内存，单位KB
+    bool peakRssPerCase = false; // true表示peakRss只统计本用例，false表示进程至今的峰值
+    long outputBytes = 0;
+    XHistogramSummary encodeFrame; // encodeFrame调用耗时，单位us
+    XExportStats stats;
+};
+
+static const char* getPatternName(PatternType pattern) {
+    switch (pattern) {
+        case PATTERN_GRADIENT:
+            return "gradient";
+        case PATTERN_NOISE:
+            return "noise";
+        case PATTERN_MOVING:
+            return "moving";
+    }
+    return "unknown";
+}
+
+class PatternGenerator {
+public:
+    PatternGenerator(PatternType pattern, int width, int height)
+            : mPattern(pattern), mWidth(width), mHeight(height), mSeed(20200319),
+              mPixels(static_cast<size_t>(width) * height * 4) {
+        if (mPattern == PATTERN_MOVING) {
+            // 背景只画一次，之后每帧擦掉上一帧的方块再画新的位置
+            fillGradient(0);
+            mBackground = mPixels;
+        }
+    }
+
+    uint8_t* generate(long index) {
+        switch (mPattern) {
+            case PATTERN_GRADIENT:
+                fillGradient(index);
+                break;
+            case PATTERN_NOISE:
+                fillNoise();
+                break;
+            case PATTERN_MOVING:
+                fillMoving(index);
+                break;
+        }
+        return mPixels.data();
+    }
+
+private:
+    void fillGradient(long index) {
+        for (int y = 0; y < mHeight; ++y) {
+            uint8_t* row = mPixels.data() + static_cast<size_t>(y) * mWidth * 4;
+            for (int x = 0; x < mWidth; ++x) {
+                row[x * 4 + 0] = static_cast<uint8_t>((x + index * 2) * 255 / mWidth);
+                row[x * 4 + 1] = static_cast<uint8_t>(y * 255 / mHeight);
+                row[x * 4 + 2] = static_cast<uint8_t>((x + y + index) & 0xFF);
+                row[x * 4 + 3] = 0xFF;
+            }
+        }
+    }
+
+    void fillNoise() {
+        // xorshift，比rand()快得多，不让画面生成成为瓶颈
+        auto* words = reinterpret_cast<uint32_t*>(mPixels.data());
+        size_t count = mPixels.size() / 4;
+        uint32_t seed = mSeed;
+        for (size_t i = 0; i < count; ++i) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            words[i] = seed | 0xFF000000u;
+        }
+        mSeed = seed;
+    }
+
+    void fillMoving(long index) {
+        int size = std::max(16, std::min(mWidth, mHeight) / 6);
+        int rangeX = std::max(1, mWidth - size);
+        int rangeY = std::max(1, mHeight - size);
+        int x = static_cast<int>((index * 7) % (2 * rangeX));
+        int y = static_cast<int>((index * 5) % (2 * rangeY));
+        x = x < rangeX ? x : 2 * rangeX - x;
+        y = y < rangeY ? y : 2 * rangeY - y;
+
+        restoreBlock(mLastX, mLastY, size);
+        for (int row = y; row < std::min(mHeight, y + size); ++row) {
+            uint8_t* dst = mPixels.data() + (static_cast<size_t>(row) * mWidth + x) * 4;
+            for (int col = 0; col < std::min(size, mWidth - x); ++col) {
+                dst[col * 4 + 0] = 0xFF;
+                dst[col * 4 + 1] = static_cast<uint8_t>(index & 0xFF);
+                dst[col * 4 + 2] = 0x20;
+                dst[col * 4 + 3] = 0xFF;
+            }
+        }
+        mLastX = x;
+        mLastY = y;
+    }
+
+    void restoreBlock(int x, int y, int size) {
+        if (x < 0 || y < 0) {
+            return;
+        }
+        int bytes = std::min(size, mWidth - x) * 4;
+        for (int row = y; row < std::min(mHeight, y + size); ++row) {
+            size_t offset = (static_cast<size_t>(row) * mWidth + x) * 4;
+            memcpy(mPixels.data() + offset, mBackground.data() + offset, bytes);
+        }
+    }
+
+private:
+    PatternType mPattern;
+    int mWidth;
+    int mHeight;
+    uint32_t mSeed;
+    std::vector<uint8_t> mPixels;
+    std::vector<uint8_t> mBackground;
+    int mLastX = -1;
+    int mLastY = -1;
+};
+
+/**
+ * 把峰值常驻内存（VmHWM）重置为当前常驻内存，让每个用例单独统计峰值；只有Linux支持
+ * @return false表示不支持，getPeakRss返回的是进程至今的峰值
+ */
+static bool resetPeakRss() {
+#if __linux__
+    std::ofstream refs("/proc/self/clear_refs");
+    refs << "5";
+    refs.flush();
+    return static_cast<bool>(refs);
+#else
+    return false;
+#endif
+}
+
+static long getPeakRss() {
+#if __linux__
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, 6, "VmHWM:") == 0) {
+            return std::strtol(line.data() + 6, nullptr, 10);
+        }
+    }
+#endif
+    struct rusage usage = {};
+    getrusage(RUSAGE_SELF, &usage);
+#if __APPLE__
+    // macOS上ru_maxrss的单位是字节
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static long getFileSize(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    return file ? static_cast<long>(file.tellg()) : 0;
+}
+
+static BenchResult runCase(const BenchCase& config, const std::string& outputDir, long duration, int convertThreads,
+                           bool keep) {
+    BenchResult result;
+    result.config = config;
+
+    std::ostringstream name;
+    name << outputDir << "/bench_" << config.width << "x" << config.height << "_" << config.fps << "fps_"
+         << config.threads << "t_" << getPatternName(config.pattern) << ".mp4";
+    std::string outputPath = name.str();
+
+    auto exporter = std::make_unique<XExporter>(outputPath, config.width, config.height, config.fps, duration);
+    exporter->setAudioDisable(true);
+    XEncoderOptions options;
+    options.threadCount = config.threads;
+    exporter->setVideoEncoderOptions(options);
+    exporter->setConvertThreads(convertThreads);
+
+    PatternGenerator generator(config.pattern, config.width, config.height);
+    XHistogram latency;
+    long frames = duration * config.fps / 1000;
+
+    result.peakRssPerCase = resetPeakRss();
+    XTimeCounter counter;
+    counter.markStart();
+    exporter->start();
+    for (long i = 0; i < frames; ++i) {
+        // 画面生成不计入encodeFrame的耗时
+        uint8_t* pixels = generator.generate(i);
+        long start = XHistogram::now();
+        if (exporter->encodeFrame(pixels, config.width, config.height) < 0) {
+            std::cerr << "[XExportBench] encodeFrame failed: " << outputPath << std::endl;
+            break;
+        }
+        latency.record(XHistogram::now() - start);
+        result.frames++;
+    }
+    exporter->stop();
+    counter.markEnd();
+
+    result.elapsed = std::max(1L, counter.getRunDuration());
+    result.framesPerSecond = result.frames * 1000.0 / result.elapsed;
+    result.realtimeFactor = (result.frames * 1000.0 / config.fps) / result.elapsed;
+    result.peakRss = getPeakRss();
+    result.outputBytes = getFileSize(outputPath);
+    result.encodeFrame = latency.getSummary();
+    result.stats = exporter->getStats();
+
+    if (!keep) {
+        std::remove(outputPath.data());
+    }
+    return result;
+}
+
+static void writeSummary(std::ostream& out, const char* name, const XHistogramSummary& summary, bool last = false) {
+    out << "\"" << name << "\": {\"count\": " << summary.count << ", \"mean\": " << summary.mean
+        << ", \"p50\": " << summary.p50 << ", \"p99\": " << summary.p99 << ", \"max\": " << summary.max << "}"
+        << (last ? "" : ", ");
+}
+
+static void writeJson(std::ostream& out, const std::vector<BenchResult>& results, long duration,
+                      int convertThreads) {
+    out << "{\n  \"duration_ms\": " << duration << ",\n  \"convert_threads\": " << convertThreads
+        << ",\n  \"results\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const BenchResult& result = results[i];
+        const BenchCase& config = result.config;
+        out << "    {\"width\": " << config.width << ", \"height\": " << config.height
+            << ", \"fps\": " << config.fps << ", \"threads\": " << config.threads
+            << ", \"pattern\": \"" << getPatternName(config.pattern) << "\""
+            << ", \"frames\": " << result.frames << ", \"elapsed_ms\": " << result.elapsed
+            << ", \"frames_per_second\": " << result.framesPerSecond
+            << ", \"realtime_factor\": " << result.realtimeFactor
+            << ", \"peak_rss_kb\": " << result.peakRss
+            << ", \"peak_rss_scope\": \"" << (result.peakRssPerCase ? "case" : "process") << "\""
+            << ", \"output_bytes\": " << result.outputBytes
+            << ", \"video_bitrate\": " << result.stats.videoBitrate << ", \"latency_us\": {";
+        writeSummary(out, "encode_frame", result.encodeFrame);
+        writeSummary(out, "convert", result.stats.convert);
+        writeSummary(out, "queue_wait", result.stats.queueWait);
+        writeSummary(out, "encode_send", result.stats.encodeSend);
+        writeSummary(out, "encode_receive", result.stats.encodeReceive);
+        writeSummary(out, "mux_write", result.stats.muxWrite, true);
+        out << "}}" << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+}
+
+int main(int argc, char* argv[]) {
+    std::string outputDir = "/tmp";
+    std::string jsonPath;
+    long duration = 5000;
+    int convertThreads = 0;
+    bool quick = false;
+    bool keep = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--output-dir" && i + 1 < argc) {
+            outputDir = argv[++i];
+        } else if (arg == "--duration" && i + 1 < argc) {
+            duration = std::max(1L, atol(argv[++i]));
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--convert-threads" && i + 1 < argc) {
+            convertThreads = std::max(0, atoi(argv[++i]));
+        } else if (arg == "--quick") {
+            quick = true;
+        } else if (arg == "--keep") {
+            keep = true;
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--output-dir DIR] [--duration MS] [--json FILE] [--convert-threads N] [--quick] [--keep]"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    av_log_set_level(AV_LOG_ERROR);
+
+    std::vector<std::pair<int, int>> resolutions = {{640, 360}, {1280, 720}, {1920, 1080}};
+    std::vector<int> frameRates = {25, 30, 60};
+    std::vector<int> threadCounts = {1, 2, 4, 0}; // 0表示由编码器按核数决定
+    std::vector<PatternType> patterns = {PATTERN_GRADIENT, PATTERN_NOISE, PATTERN_MOVING};
+    if (quick) {
+        resolutions = {{1280, 720}};
+        frameRates = {30};
+        threadCounts = {0};
+        patterns = {PATTERN_MOVING};
+    }
+
+    std::vector<BenchResult> results;
+    for (const auto& resolution : resolutions) {
+        for (int fps : frameRates) {
+            for (int threads : threadCounts) {
+                for (PatternType pattern : patterns) {
+                    BenchCase config = {resolution.first, resolution.second, fps, threads, pattern};
+                    results.emplace_back(runCase(config, outputDir, duration, convertThreads, keep));
+                    const BenchResult& result = results.back();
+                    std::cerr << "[XExportBench] " << config.width << "x" << config.height << "@" << fps
+                              << " threads=" << threads << " " << getPatternName(pattern) << ": "
+                              << result.framesPerSecond << " fps, x" << result.realtimeFactor << " realtime"
+                              << std::endl;
+                }
+            }
+        }
+    }
+
+    if (jsonPath.empty()) {
+        writeJson(std::cout, results, duration, convertThreads);
+    } else {
+        std::ofstream out(jsonPath);
+        writeJson(out, results, duration, convertThreads);
+    }
+    return 0;
+}
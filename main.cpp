@@ -1,10 +1,28 @@
 #include <iostream>
 #include <vector>
 #include <string>
+#include <cstdlib>
+#include <algorithm>
+#include <cmath>
+#include <thread>
+#include <chrono>
+#include <fstream>
+#include <sstream>
 #include "XExporter.h"
+#include "XRenditionExporter.h"
+#include "XColorConvert.h"
+#include "XSample.h"
 #include "XFileProducer.h"
 #include "XFFProducer.h"
 #include "XTimeCounter.h"
+#include "XTrace.h"
+#include "XFrameQueue.h"
+#include "XFrameRingQueue.h"
+#include "XExportScheduler.h"
+#include "XMemoryBudget.h"
+#include "XAudioMixer.h"
+#include <unistd.h>
+#include <sys/wait.h>
 
 void testExport() {
     std::string outPath = "/Users/andy/export.mp4";
@@ -61,8 +79,169 @@ void testExport() {
     exporter.reset();
 }
 
-void testProducerOpen() {
-    std::vector<std::string> filenames = {
+void testExportAudio() {
+    std::string outPath = "/Users/andy/export_audio.mp4";
+    int width = 720;
+    int height = 1280;
+    int fps = 25;
+    long duration = 10 * 1000;
+    int sampleRate = 48000;
+    int channels = 2;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setAudioInputFormat(sampleRate, channels, SAMPLE_TYPE_S16);
+    exporter->start();
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4, 0x80);
+    // 每帧视频配一段440Hz正弦波，样本数不是1024的整数倍，由编码线程重新分帧
+    int frameSamples = sampleRate / fps;
+    XSample sample;
+    sample.allocBuffer(frameSamples, channels, SAMPLE_TYPE_S16);
+    sample.sampleRate = sampleRate;
+    long sampleIndex = 0;
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        auto pcm = reinterpret_cast<int16_t*>(sample.samples);
+        for (int i = 0; i < frameSamples; ++i, ++sampleIndex) {
+            auto value = static_cast<int16_t>(8000 * sin(2 * M_PI * 440 * sampleIndex / sampleRate));
+            for (int ch = 0; ch < channels; ++ch) {
+                pcm[i * channels + ch] = value;
+            }
+        }
+        exporter->encodeSample(sample);
+        exporter->encodeFrame(pixels.data(), width, height);
+    }
+    exporter->stop();
+    exporter->debug();
+}
+
+void testAudioMixer() {
+    // 背景音乐（立体声S16，淡入淡出）+ 第3秒开始的旁白（单声道FLT，增益较大会被限幅），每帧视频各送一段
+    std::string outPath = "/Users/andy/export_mixer.mp4";
+    int width = 720;
+    int height = 1280;
+    int fps = 25;
+    long duration = 10 * 1000;
+    int sampleRate = 48000;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    XAudioMixer mixer(sampleRate, 2);
+    XAudioSourceOptions music;
+    music.gain = 0.6f;
+    music.duration = duration;
+    music.fadeIn = 1000;
+    music.fadeOut = 2000;
+    XAudioSourceOptions voice;
+    voice.gain = 3.0f;
+    voice.startTime = 3000;
+    voice.duration = 4000;
+    int musicSource = mixer.addSource(music);
+    int voiceSource = mixer.addSource(voice);
+    mixer.setOutput(*exporter);
+    exporter->start();
+    mixer.start();
+
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4, 0x80);
+    int frameSamples = sampleRate / fps;
+    XSample musicSample;
+    musicSample.allocBuffer(frameSamples, 2, SAMPLE_TYPE_S16);
+    musicSample.sampleRate = sampleRate;
+    XSample voiceSample;
+    voiceSample.allocBuffer(frameSamples, 1, SAMPLE_TYPE_FLT);
+    voiceSample.sampleRate = sampleRate;
+    long sampleIndex = 0;
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        auto pcm = reinterpret_cast<int16_t*>(musicSample.samples);
+        auto speech = reinterpret_cast<float*>(voiceSample.samples);
+        for (int i = 0; i < frameSamples; ++i, ++sampleIndex) {
+            auto value = static_cast<int16_t>(16000 * sin(2 * M_PI * 440 * sampleIndex / sampleRate));
+            pcm[i * 2] = value;
+            pcm[i * 2 + 1] = value;
+            speech[i] = static_cast<float>(0.3 * sin(2 * M_PI * 220 * sampleIndex / sampleRate));
+        }
+        mixer.write(musicSource, musicSample);
+        if (clock >= voice.startTime && clock < voice.startTime + voice.duration) {
+            mixer.write(voiceSource, voiceSample);
+        }
+        if (clock == 6000) {
+            // 旁白最后一秒压低
+            mixer.setGain(voiceSource, 1.0f);
+        }
+        exporter->encodeFrame(pixels.data(), width, height);
+    }
+    int ret = mixer.stop();
+    exporter->stop();
+    exporter->debug();
+    std::cout << "[Application] testAudioMixer ret: " << ret << ", mixed: " << mixer.getMixedSamples()
+              << ", clipped: " << mixer.getClippedSamples() << ", kernel: " << XAudioMixer::getKernelName()
+              << std::endl;
+}
+
+void testCompositor() {
+    // 背景 + 半透明缩放的画中画 + 旋转的贴纸，直接合成进编码帧的YUV平面
+    std::string outPath = "/Users/andy/export_compositor.mp4";
+    int width = 720;
+    int height = 1280;
+    int fps = 25;
+    long duration = 10 * 1000;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setConvertMethod(CONVERT_METHOD_BUILTIN);
+    exporter->start();
+
+    auto background = std::make_shared<XImage>();
+    background->allocBuffer(width, height, IMG_TYPE_RGBA);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t* p = background->pixels + (static_cast<size_t>(y) * width + x) * 4;
+            p[0] = static_cast<uint8_t>(x * 255 / width);
+            p[1] = static_cast<uint8_t>(y * 255 / height);
+            p[2] = 0x80;
+            p[3] = 0xFF;
+        }
+    }
+    auto overlay = std::make_shared<XImage>();
+    overlay->allocBuffer(320, 180, IMG_TYPE_BGRA);
+    memset(overlay->pixels, 0xC0, overlay->getByteSize());
+    // 圆形贴纸，圆外透明
+    auto sticker = std::make_shared<XImage>();
+    int radius = 64;
+    sticker->allocBuffer(radius * 2, radius * 2, IMG_TYPE_RGBA);
+    for (int y = 0; y < radius * 2; ++y) {
+        for (int x = 0; x < radius * 2; ++x) {
+            uint8_t* p = sticker->pixels + (y * radius * 2 + x) * 4;
+            bool inside = (x - radius) * (x - radius) + (y - radius) * (y - radius) < radius * radius;
+            p[0] = 0xFF;
+            p[1] = static_cast<uint8_t>(x * 2);
+            p[2] = 0x20;
+            p[3] = inside ? 0xFF : 0x00;
+        }
+    }
+
+    XCompositor compositor(width, height);
+    std::vector<XCompositeLayer> layers(3);
+    layers[0].image = background;
+    layers[1].image = overlay;
+    layers[1].x = 40;
+    layers[1].y = 80;
+    layers[1].scaleX = 1.5f;
+    layers[1].scaleY = 1.5f;
+    layers[1].opacity = 0.6f;
+    layers[2].image = sticker;
+
+    XTimeCounter counter;
+    counter.markStart();
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        layers[2].x = static_cast<float>(clock * (width - radius * 2) / duration);
+        layers[2].y = static_cast<float>(height / 2);
+        layers[2].rotation = static_cast<float>(clock * 360 / 4000);
+        exporter->encodeLayers(compositor, layers, clock);
+    }
+    counter.markEnd();
+    exporter->stop();
+    exporter->debug();
+    std::cout << "[Application] testCompositor [" << counter.getRunDuration() << " ms], kernel: "
+              << XCompositor::getKernelName() << std::endl;
+}
+
+static const std::vector<std::string>& getProducerFiles() {
+    static const std::vector<std::string> filenames = {
         "/Users/andy/Movies/1553566650589.mp4",
         "/Users/andy/Movies/2.5D水墨Pre.mp4",
         "/Users/andy/Movies/8k.mp4",
@@ -85,6 +264,11 @@ void testProducerOpen() {
         "/Users/andy/Movies/背景视频.mp4",
         "/Users/andy/Movies/预览视频.mp4"
     };
+    return filenames;
+}
+
+void testProducerOpen() {
+    const std::vector<std::string>& filenames = getProducerFiles();
     
     std::vector<std::shared_ptr<XFFProducer>> producerList;
 
@@ -107,6 +291,57 @@ void testProducerOpen() {
     }
 }
 
+void testDecodeThroughput() {
+    // 对testProducerOpen的每个文件，分别用单线程、帧级多线程、片级多线程解码并转换成RGBA，尽快取完所有帧
+    struct DecodeConfig {
+        const char* name;
+        int threadCount;
+        int threadType;
+    };
+    std::vector<DecodeConfig> configs = {
+        {"single", 1, 0},
+        {"frame", 0, FF_THREAD_FRAME},
+        {"slice", 0, FF_THREAD_SLICE},
+    };
+
+    XTimeCounter counter;
+    for (const auto& filename : getProducerFiles()) {
+        for (const auto& config : configs) {
+            auto producer = std::make_shared<XFFProducer>();
+            producer->setDisableAudio(true);
+            producer->setDecodeThreads(config.threadCount, config.threadType);
+            try {
+                producer->setInput(filename);
+            } catch (std::exception& e) {
+                std::cout << "[Application] set input failed: " << e.what() << std::endl;
+                break;
+            }
+
+            counter.markStart();
+            producer->start();
+            long frames = 0;
+            long clock = 0;
+            long lastPts = -1;
+            for (;;) {
+                // 解码结束后一直返回最后一帧
+                auto image = producer->getImage(clock);
+                if (!image || image->pts == lastPts) {
+                    break;
+                }
+                lastPts = image->pts;
+                clock = image->pts + image->duration;
+                frames++;
+            }
+            counter.markEnd();
+            producer->stop();
+
+            long cost = std::max(1L, static_cast<long>(counter.getRunDuration()));
+            std::cout << "[Application] decode [" << config.name << "] " << frames << " frames, " << cost
+                      << " ms, " << frames * 1000.0 / cost << " fps: " << filename << std::endl;
+        }
+    }
+}
+
 void testProducerReadPacket() {
     auto producer = std::make_shared<XFFProducer>();
     try {
@@ -118,7 +353,734 @@ void testProducerReadPacket() {
     getchar();
 }
 
-int main() {
+static std::shared_ptr<Frame> allocYUVFrame(int width, int height) {
+    auto frame = std::make_shared<Frame>();
+    frame->avframe->width = width;
+    frame->avframe->height = height;
+    frame->avframe->format = AV_PIX_FMT_YUV420P;
+    if (av_frame_get_buffer(frame->avframe, 0) < 0) {
+        return nullptr;
+    }
+    return frame;
+}
+
+static std::vector<uint8_t> makeNoiseRGBA(int width, int height) {
+    std::vector<uint8_t> pixels(static_cast<size_t>(width) * height * 4);
+    srand(20200319);
+    for (auto& pixel : pixels) {
+        pixel = static_cast<uint8_t>(rand() & 0xFF);
+    }
+    return pixels;
+}
+
+void testConvertAccuracy() {
+    int width = 1280;
+    int height = 720;
+    auto rgba = makeNoiseRGBA(width, height);
+
+    // 与XExporter的swscale路径保持一致：SWS_AREA，BT.601 limited range
+    std::unique_ptr<SwsContext, SwsContextDeleter> sws(
+            sws_getContext(width, height, AV_PIX_FMT_RGBA, width, height, AV_PIX_FMT_YUV420P,
+                           SWS_AREA, nullptr, nullptr, nullptr));
+    auto swsFrame = allocYUVFrame(width, height);
+    auto kernelFrame = allocYUVFrame(width, height);
+    if (!sws || !swsFrame || !kernelFrame) {
+        std::cout << "[Application] testConvertAccuracy: init failed" << std::endl;
+        return;
+    }
+
+    const uint8_t* src[4] = {rgba.data(), nullptr};
+    int srcLinesize[4] = {width * 4, 0};
+    sws_scale(sws.get(), src, srcLinesize, 0, height, swsFrame->avframe->data, swsFrame->avframe->linesize);
+    XColorConvert::rgbaToYUV420P(rgba.data(), width * 4, kernelFrame->avframe->data,
+                                 kernelFrame->avframe->linesize, width, height, COLOR_MATRIX_BT601);
+
+    bool passed = true;
+    const char* planeNames[3] = {"Y", "U", "V"};
+    for (int plane = 0; plane < 3; ++plane) {
+        int planeWidth = plane ? (width + 1) / 2 : width;
+        int planeHeight = plane ? (height + 1) / 2 : height;
+        int maxDiff = 0;
+        for (int y = 0; y < planeHeight; ++y) {
+            const uint8_t* a = swsFrame->avframe->data[plane] + y * swsFrame->avframe->linesize[plane];
+            const uint8_t* b = kernelFrame->avframe->data[plane] + y * kernelFrame->avframe->linesize[plane];
+            for (int x = 0; x < planeWidth; ++x) {
+                maxDiff = std::max(maxDiff, std::abs(a[x] - b[x]));
+            }
+        }
+        passed = passed && maxDiff <= 1;
+        std::cout << "[Application] convert accuracy " << planeNames[plane] << " max diff: " << maxDiff << std::endl;
+    }
+    std::cout << "[Application] testConvertAccuracy (" << XColorConvert::getKernelName() << "): "
+              << (passed ? "PASSED" : "FAILED") << std::endl;
+}
+
+void benchConvert() {
+    int width = 1920;
+    int height = 1080;
+    int iterations = 200;
+    auto rgba = makeNoiseRGBA(width, height);
+    auto frame = allocYUVFrame(width, height);
+    std::unique_ptr<SwsContext, SwsContextDeleter> sws(
+            sws_getContext(width, height, AV_PIX_FMT_RGBA, width, height, AV_PIX_FMT_YUV420P,
+                           SWS_AREA, nullptr, nullptr, nullptr));
+    if (!sws || !frame) {
+        std::cout << "[Application] benchConvert: init failed" << std::endl;
+        return;
+    }
+
+    const uint8_t* src[4] = {rgba.data(), nullptr};
+    int srcLinesize[4] = {width * 4, 0};
+
+    XTimeCounter counter;
+    counter.markStart();
+    for (int i = 0; i < iterations; ++i) {
+        sws_scale(sws.get(), src, srcLinesize, 0, height, frame->avframe->data, frame->avframe->linesize);
+    }
+    counter.markEnd();
+    long swsDuration = counter.getRunDuration();
+
+    counter.markStart();
+    for (int i = 0; i < iterations; ++i) {
+        XColorConvert::rgbaToYUV420P(rgba.data(), width * 4, frame->avframe->data, frame->avframe->linesize,
+                                     width, height, COLOR_MATRIX_BT601);
+    }
+    counter.markEnd();
+    long kernelDuration = counter.getRunDuration();
+
+    std::cout << "[Application] benchConvert " << width << "x" << height << " x " << iterations
+              << "\nsws_scale: " << swsDuration << " ms (" << swsDuration / static_cast<double>(iterations) << " ms/frame)"
+              << "\n" << XColorConvert::getKernelName() << ": " << kernelDuration << " ms ("
+              << kernelDuration / static_cast<double>(iterations) << " ms/frame)"
+              << std::endl;
+}
+
+void testChunkedExport() {
+    std::string outPath = "/Users/andy/export_chunked.mp4";
+    int width = 1280;
+    int height = 720;
+    int fps = 25;
+    long duration = 60 * 1000;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setAudioDisable(true);
+    // 2秒一段，段数和每段编码线程数按CPU核数决定
+    exporter->setChunkedEncoding(2000);
+    exporter->start();
+
+    auto pixels = makeNoiseRGBA(width, height);
+    XTimeCounter counter;
+    counter.markStart();
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        // 每帧改动一行，避免编码器遇到完全静止的画面
+        long row = (clock * fps / 1000) % height;
+        memset(pixels.data() + row * width * 4, static_cast<int>(row & 0xFF), width * 4);
+        exporter->encodeFrame(pixels.data(), width, height);
+    }
+    exporter->stop();
+    counter.markEnd();
+    exporter->debug();
+    std::cout << "[Application] testChunkedExport: " << counter.getRunDuration() << " ms" << std::endl;
+}
+
+void testRenditionExport() {
+    int fps = 25;
+    long duration = 10 * 1000;
+    std::vector<XRendition> renditions(3);
+    renditions[0] = {"/Users/andy/export_1080p.mp4", 1080, 1920, 4000000};
+    renditions[1] = {"/Users/andy/export_720p.mp4", 720, 1280, 2000000};
+    renditions[2] = {"/Users/andy/export_360p.mp4", 360, 640, 600000};
+    auto exporter = std::make_unique<XRenditionExporter>(renditions, fps, duration);
+    exporter->setAudioDisable(true);
+    exporter->setResultCallback([](int index, ExportResult result) {
+        std::cout << "[Application] rendition " << index << " result: " << result << std::endl;
+    });
+    exporter->start();
+
+    auto pixels = makeNoiseRGBA(1080, 1920);
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        exporter->encodeFrame(pixels.data(), 1080, 1920);
+    }
+    exporter->stop();
+    exporter->debug();
+}
+
+void testRealtimeExport() {
+    std::string outPath = "/Users/andy/export_realtime.mp4";
+    int width = 1080;
+    int height = 1920;
+    int fps = 30;
+    long duration = 20 * 1000;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setAudioDisable(true);
+    exporter->setVariableFrameRate(true);
+    exporter->setOverloadPolicy(OVERLOAD_POLICY_DUPLICATE_LAST);
+    exporter->setExportStatsCallback([](const XExportStats& stats) {
+        std::cout << "[Application] convert p99: " << stats.convert.p99 << " us, queueWait p99: "
+                  << stats.queueWait.p99 << " us, queueDepth: " << stats.frameQueueDepth
+                  << ", bitrate: " << stats.videoBitrate << " bps" << std::endl;
+    });
+    exporter->start();
+
+    // 模拟渲染循环：按墙上时钟取时间戳，送帧不允许阻塞渲染
+    auto pixels = makeNoiseRGBA(width, height);
+    auto begin = std::chrono::steady_clock::now();
+    long accepted = 0;
+    for (;;) {
+        long clock = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - begin).count();
+        if (clock >= duration) {
+            break;
+        }
+        if (exporter->tryEncodeFrame(pixels.data(), width, height, clock, 0) == 0) {
+            accepted++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1000 / fps));
+    }
+    exporter->stop();
+    exporter->debug();
+
+    XOverloadStats stats = exporter->getOverloadStats();
+    std::cout << "[Application] testRealtimeExport: accepted: " << accepted
+              << ", duplicated: " << stats.duplicated << ", droppedNewest: " << stats.droppedNewest
+              << ", droppedDuplicates: " << stats.droppedDuplicates << std::endl;
+}
+
+void testPipelinedExport() {
+    std::string outPath = "/Users/andy/export_pipelined.mp4";
+    int width = 1920;
+    int height = 1080;
+    int fps = 30;
+    long duration = 10 * 1000;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setAudioDisable(true);
+    // encodeFrame只拷贝像素，3个转换线程并行转换，与编码同时进行
+    exporter->setConvertThreads(3);
+    exporter->start();
+
+    auto pixels = makeNoiseRGBA(width, height);
+    XTimeCounter counter;
+    counter.markStart();
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        exporter->encodeFrame(pixels.data(), width, height);
+    }
+    counter.markEnd();
+    long submitDuration = counter.getRunDuration();
+    exporter->stop();
+    exporter->debug();
+    std::cout << "[Application] testPipelinedExport submit: " << submitDuration << " ms" << std::endl;
+}
+
+void testMultiFormatExport() {
+    std::string outPath = "/Users/andy/export_multiformat.mp4";
+    int width = 1280;
+    int height = 720;
+    int fps = 25;
+    long duration = 6 * 1000;
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setAudioDisable(true);
+    exporter->start();
+
+    // 每2秒切换一种输入：同尺寸YUV420P（不转换）、半尺寸NV12、带行填充的BGRA
+    int halfWidth = width / 2;
+    int halfHeight = height / 2;
+    std::vector<uint8_t> yuv(width * height * 3 / 2, 128);
+    std::vector<uint8_t> nv12(halfWidth * halfHeight * 3 / 2, 96);
+    int bgraStride = width * 4 + 64;
+    std::vector<uint8_t> bgra(bgraStride * height, 200);
+
+    XTimeCounter counter;
+    counter.markStart();
+    int failed = 0;
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        int ret;
+        if (clock < 2000) {
+            uint8_t* data[4] = {yuv.data(), yuv.data() + width * height,
+                                yuv.data() + width * height * 5 / 4, nullptr};
+            int linesize[4] = {width, width / 2, width / 2, 0};
+            ret = exporter->encodeFrame(data, linesize, width, height, IMG_TYPE_YUV420P);
+        } else if (clock < 4000) {
+            uint8_t* data[4] = {nv12.data(), nv12.data() + halfWidth * halfHeight, nullptr, nullptr};
+            int linesize[4] = {halfWidth, halfWidth, 0, 0};
+            ret = exporter->encodeFrame(data, linesize, halfWidth, halfHeight, IMG_TYPE_NV12);
+        } else {
+            uint8_t* data[4] = {bgra.data(), nullptr, nullptr, nullptr};
+            int linesize[4] = {bgraStride, 0, 0, 0};
+            ret = exporter->encodeFrame(data, linesize, width, height, IMG_TYPE_BGRA);
+        }
+        if (ret < 0) {
+            failed++;
+        }
+    }
+    counter.markEnd();
+    exporter->stop();
+    exporter->debug();
+    std::cout << "[Application] testMultiFormatExport submit: " << counter.getRunDuration()
+              << " ms, failed: " << failed << std::endl;
+}
+
+void testTraceExport() {
+    std::string outPath = "/Users/andy/export_trace.mp4";
+    int width = 1280;
+    int height = 720;
+    int fps = 25;
+    long duration = 5 * 1000;
+    XTrace::setEnabled(true);
+    auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+    exporter->setAudioDisable(true);
+    exporter->setConvertBands(4);
+    exporter->start();
+
+    auto pixels = makeNoiseRGBA(width, height);
+    for (long clock = 0; clock < duration; clock += 1000 / fps) {
+        exporter->encodeFrame(pixels.data(), width, height);
+    }
+    exporter->stop();
+    XTrace::setEnabled(false);
+
+    // 用Perfetto打开，按线程查看送帧、转换、编码和写文件之间的空闲
+    int ret = XTrace::dump("/Users/andy/export_trace.json");
+    std::cout << "[Application] testTraceExport dump: " << ret << std::endl;
+}
+
+void testMemoryBudget() {
+    // 4K和360p同时导出，所有队列合计不超过64MB，4K的编码队列自身最多约2帧
+    XMemoryBudget::getInstance().setLimit(64L * 1024 * 1024);
+    struct Output {
+        std::string path;
+        int width;
+        int height;
+        long queueByteLimit;
+    };
+    std::vector<Output> outputs = {
+            {"/Users/andy/export_budget_4k.mp4", 3840, 2160, 3840L * 2160 * 3},
+            {"/Users/andy/export_budget_360p.mp4", 640, 360, 0},
+    };
+
+    std::vector<std::thread> threads;
+    for (const auto& output : outputs) {
+        threads.emplace_back([output] {
+            int fps = 25;
+            long duration = 5 * 1000;
+            auto exporter = std::make_unique<XExporter>(output.path, output.width, output.height, fps, duration);
+            exporter->setAudioDisable(true);
+            exporter->setConvertThreads(2);
+            exporter->setQueueByteLimit(output.queueByteLimit);
+            exporter->start();
+
+            auto pixels = makeNoiseRGBA(output.width, output.height);
+            for (long clock = 0; clock < duration; clock += 1000 / fps) {
+                exporter->encodeFrame(pixels.data(), output.width, output.height);
+            }
+            exporter->stop();
+            exporter->debug();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    XMemoryBudget& budget = XMemoryBudget::getInstance();
+    std::cout << "[Application] testMemoryBudget peak: " << budget.getPeak() / 1024 << " KB, waits: "
+              << budget.getWaitCount() << ", used after stop: " << budget.getUsed() << std::endl;
+
+    // MEMORY_POLICY_SHED：编码队列只放得下一帧4K，送帧比编码快时多出的帧被丢弃，送帧接口返回EAGAIN
+    {
+        int width = 3840;
+        int height = 2160;
+        int fps = 25;
+        long duration = 5 * 1000;
+        auto exporter = std::make_unique<XExporter>("/Users/andy/export_budget_shed.mp4", width, height, fps,
+                                                    duration);
+        exporter->setAudioDisable(true);
+        exporter->setQueueByteLimit(static_cast<long>(width) * height * 3 / 2);
+        exporter->setMemoryPolicy(MEMORY_POLICY_SHED);
+        exporter->start();
+
+        auto pixels = makeNoiseRGBA(width, height);
+        long accepted = 0;
+        long rejected = 0;
+        for (long clock = 0; clock < duration; clock += 1000 / fps) {
+            int ret = exporter->encodeFrame(pixels.data(), width, height, clock);
+            if (ret == 0) {
+                accepted++;
+            } else if (ret == AVERROR(EAGAIN)) {
+                rejected++;
+            }
+        }
+        exporter->stop();
+        long shed = exporter->getStats().shedFrames;
+        std::cout << "[Application] testMemoryBudget shed: accepted " << accepted << ", rejected " << rejected
+                  << ", shed " << shed << (shed == rejected ? " (match)" : " (MISMATCH)") << std::endl;
+    }
+
+    // 解码端：Packet队列和图像队列各自的字节上限，BLOCK时不丢帧，SHED时丢弃放不下的Packet和图像
+    for (MemoryPolicy policy : {MEMORY_POLICY_BLOCK, MEMORY_POLICY_SHED}) {
+        auto producer = std::make_shared<XFFProducer>();
+        producer->setDisableAudio(true);
+        producer->setQueueByteLimit(256L * 1024, 720L * 1280 * 4);
+        producer->setMemoryPolicy(policy);
+        try {
+            producer->setInput("/Users/andy/Movies/jieqian_720x1280.mp4");
+        } catch (std::exception& e) {
+            std::cout << "[Application] set input failed: " << e.what() << std::endl;
+            break;
+        }
+        producer->start();
+        long frames = 0;
+        long clock = 0;
+        long lastPts = -1;
+        for (;;) {
+            auto image = producer->getImage(clock);
+            if (!image || image->pts == lastPts) {
+                break;
+            }
+            lastPts = image->pts;
+            clock = image->pts + image->duration;
+            frames++;
+        }
+        long shed = producer->getShedCount();
+        producer->stop();
+        std::cout << "[Application] testMemoryBudget producer " << (policy == MEMORY_POLICY_SHED ? "shed" : "block")
+                  << ": " << frames << " frames, shed " << shed << ", used after stop: " << budget.getUsed()
+                  << std::endl;
+    }
+    budget.setLimit(0);
+}
+
+/**
+ * 检查输出文件中音频Packet首尾相接：续传点前后既没有重叠也没有空隙
+ */
+static bool checkAudioContinuity(const std::string& path) {
+    AVFormatContext* input = nullptr;
+    if (avformat_open_input(&input, path.data(), nullptr, nullptr) < 0) {
+        return false;
+    }
+    std::unique_ptr<AVFormatContext, InputFormatDeleter> ic(input);
+    int audioIndex = av_find_best_stream(ic.get(), AVMEDIA_TYPE_AUDIO, -1, -1, nullptr, 0);
+    if (audioIndex < 0) {
+        return false;
+    }
+
+    bool continuous = true;
+    int64_t nextPts = AV_NOPTS_VALUE;
+    AVPacket* pkt = av_packet_alloc();
+    while (av_read_frame(ic.get(), pkt) >= 0) {
+        if (pkt->stream_index == audioIndex) {
+            if (nextPts != AV_NOPTS_VALUE && pkt->pts != nextPts) {
+                std::cout << "[Application] audio gap at pts " << nextPts << ": " << pkt->pts - nextPts << std::endl;
+                continuous = false;
+            }
+            nextPts = pkt->pts + pkt->duration;
+        }
+        av_packet_unref(pkt);
+    }
+    av_packet_free(&pkt);
+    return continuous;
+}
+
+void testCheckpointExport() {
+    // 子进程导出到第7秒时直接退出模拟崩溃，父进程用相同参数重新导出，从已提交的段继续
+    std::string outPath = "/Users/andy/export_checkpoint.mp4";
+    std::string checkpointDir = "/Users/andy/export_checkpoint";
+    int width = 720;
+    int height = 1280;
+    int fps = 25;
+    long duration = 10 * 1000;
+    long segmentDuration = 2 * 1000;
+    int sampleRate = 48000;
+    int channels = 2;
+    auto pixels = makeNoiseRGBA(width, height);
+
+    auto runExport = [&](long crashTime) {
+        auto exporter = std::make_unique<XExporter>(outPath, width, height, fps, duration);
+        exporter->setAudioInputFormat(sampleRate, channels, SAMPLE_TYPE_S16);
+        exporter->setCheckpoint(checkpointDir, segmentDuration);
+        exporter->start();
+        long resumePts = exporter->getResumePts();
+        std::cout << "[Application] testCheckpointExport resume from: " << resumePts << " ms" << std::endl;
+
+        // 正弦波按绝对采样序号生成，续传前后是同一条波形，采样从resumePts开始送
+        int frameSamples = sampleRate / fps;
+        XSample sample;
+        sample.allocBuffer(frameSamples, channels, SAMPLE_TYPE_S16);
+        sample.sampleRate = sampleRate;
+        long sampleIndex = resumePts * sampleRate / 1000;
+        for (long clock = resumePts; clock < duration; clock += 1000 / fps) {
+            if (crashTime > 0 && clock >= crashTime) {
+                _exit(0);
+            }
+            auto pcm = reinterpret_cast<int16_t*>(sample.samples);
+            for (int i = 0; i < frameSamples; ++i, ++sampleIndex) {
+                auto value = static_cast<int16_t>(8000 * sin(2 * M_PI * 440 * sampleIndex / sampleRate));
+                for (int ch = 0; ch < channels; ++ch) {
+                    pcm[i * channels + ch] = value;
+                }
+            }
+            exporter->encodeSample(sample);
+            exporter->encodeFrame(pixels.data(), width, height, clock);
+        }
+        exporter->stop();
+        exporter->debug();
+    };
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        runExport(7 * 1000);
+    }
+    waitpid(pid, nullptr, 0);
+
+    XTimeCounter counter;
+    counter.markStart();
+    runExport(0);
+    counter.markEnd();
+    std::cout << "[Application] testCheckpointExport resumed export cost: " << counter.getRunDuration() << " ms"
+              << "\naudio continuous: " << (checkAudioContinuity(outPath) ? "yes" : "no") << std::endl;
+}
+
+template <typename Queue>
+static bool stressFrameQueue(const char* name, int count) {
+    // 帧按顺序循环使用，消费方按指针校验顺序；窗口远大于队列容量，乱序必然被发现
+    std::vector<std::shared_ptr<Frame>> frames(64);
+    for (auto& frame : frames) {
+        frame = std::make_shared<Frame>();
+    }
+
+    bool passed = true;
+    {
+        Queue queue;
+        std::thread producer([&] {
+            std::vector<std::shared_ptr<Frame>> batch;
+            for (int i = 0; i < count;) {
+                if (i % 3 == 0) {
+                    queue.put(frames[i % frames.size()]);
+                    i++;
+                    continue;
+                }
+                batch.clear();
+                for (int k = 0; k < 8 && i < count; ++k, ++i) {
+                    batch.emplace_back(frames[i % frames.size()]);
+                }
+                queue.putBatch(batch);
+            }
+            queue.put(nullptr);
+        });
+        int received = 0;
+        for (;;) {
+            auto frame = queue.get();
+            if (!frame) {
+                break;
+            }
+            passed = passed && frame == frames[received % frames.size()];
+            received++;
+        }
+        producer.join();
+        passed = passed && received == count;
+    }
+
+    // signal()必须唤醒阻塞在get和put上的线程
+    {
+        Queue queue(2);
+        std::thread consumer([&] {
+            passed = passed && !queue.get();
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.signal();
+        consumer.join();
+    }
+    {
+        Queue queue(2);
+        queue.put(frames[0]);
+        queue.put(frames[1]);
+        std::thread producer([&] {
+            queue.put(frames[2]);
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        queue.signal();
+        producer.join();
+    }
+
+    std::cout << "[Application] testFrameQueueStress " << name << ": " << (passed ? "PASSED" : "FAILED") << std::endl;
+    return passed;
+}
+
+void testFrameQueueStress() {
+    stressFrameQueue<XFrameQueue>("XFrameQueue", 200000);
+    stressFrameQueue<XFrameRingQueue>("XFrameRingQueue", 200000);
+}
+
+template <typename Queue>
+static long benchFrameQueueHandoff(int count) {
+    auto frame = std::make_shared<Frame>();
+    Queue queue;
+    XTimeCounter counter;
+    counter.markStart();
+    std::thread producer([&] {
+        for (int i = 0; i < count; ++i) {
+            queue.put(frame);
+        }
+        queue.put(nullptr);
+    });
+    while (queue.get()) {
+    }
+    producer.join();
+    counter.markEnd();
+    return counter.getRunDuration();
+}
+
+void benchFrameQueue() {
+    int count = 1000000;
+    long listDuration = benchFrameQueueHandoff<XFrameQueue>(count);
+    long ringDuration = benchFrameQueueHandoff<XFrameRingQueue>(count);
+    std::cout << "[Application] benchFrameQueue " << count << " frames"
+              << "\nXFrameQueue: " << listDuration << " ms (" << listDuration * 1e6 / count << " ns/frame)"
+              << "\nXFrameRingQueue: " << ringDuration << " ms (" << ringDuration * 1e6 / count << " ns/frame)"
+              << std::endl;
+}
+
+static ExportPriority parsePriority(const std::string& name) {
+    if (name == "low") {
+        return EXPORT_PRIORITY_LOW;
+    } else if (name == "high") {
+        return EXPORT_PRIORITY_HIGH;
+    }
+    return EXPORT_PRIORITY_NORMAL;
+}
+
+/**
+ * 作业列表每行一个作业，#开头为注释：
+ * output width height fps durationMs [low|normal|high] [input.rgba]
+ * 没有input时送入噪声图
+ */
+static std::vector<XExportJob> loadJobList(const std::string& path) {
+    std::vector<XExportJob> jobs;
+    std::ifstream stream(path);
+    if (stream.fail()) {
+        std::cout << "[Application] open job list failed: " << path << std::endl;
+        return jobs;
+    }
+
+    std::string line;
+    while (std::getline(stream, line)) {
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        XExportJob job;
+        std::string priority;
+        std::string input;
+        if (!(fields >> job.outputPath >> job.width >> job.height >> job.fps >> job.duration)) {
+            std::cout << "[Application] invalid job: " << line << std::endl;
+            continue;
+        }
+        // fps超过1000时1000 / fps为0，生产循环不会前进
+        if (job.width <= 0 || job.height <= 0 || job.fps <= 0 || job.fps > 1000 || job.duration <= 0) {
+            std::cout << "[Application] invalid job: " << line << std::endl;
+            continue;
+        }
+        fields >> priority >> input;
+        job.priority = parsePriority(priority);
+
+        int fps = job.fps;
+        long duration = job.duration;
+        int width = job.width;
+        int height = job.height;
+        job.configure = [](XExporter& exporter) {
+            exporter.setAudioDisable(true);
+        };
+        job.produce = [input, fps, duration, width, height](XExporter& exporter, const std::atomic<bool>& canceled) {
+            std::unique_ptr<XFileProducer> fileProducer;
+            if (!input.empty()) {
+                fileProducer = std::make_unique<XFileProducer>();
+                try {
+                    fileProducer->setInput(input);
+                } catch (std::exception& e) {
+                    std::cout << "[Application] " << e.what() << std::endl;
+                    return -1;
+                }
+            }
+
+            auto pixels = makeNoiseRGBA(width, height);
+            for (long clock = 0; clock < duration && !canceled; clock += 1000 / fps) {
+                int ret;
+                if (fileProducer) {
+                    auto image = fileProducer->getImage(clock);
+                    if (!image) {
+                        std::cout << "[Application] read image failed: " << input << std::endl;
+                        return -1;
+                    }
+                    ret = exporter.encodeFrame(image->pixels, image->width, image->height);
+                } else {
+                    ret = exporter.encodeFrame(pixels.data(), width, height);
+                }
+                if (ret < 0) {
+                    return ret;
+                }
+            }
+            return 0;
+        };
+        jobs.emplace_back(std::move(job));
+    }
+    return jobs;
+}
+
+/**
+ * 所有作业共享workers个线程，workers<=0表示CPU核数
+ */
+int runJobList(const std::string& path, int workers) {
+    auto jobs = loadJobList(path);
+    if (jobs.empty()) {
+        return -1;
+    }
+
+    XExportScheduler scheduler(workers);
+    scheduler.setProgressCallback([](const std::vector<XExportJobProgress>& progressList) {
+        for (const auto& progress : progressList) {
+            if (progress.state != EXPORT_JOB_RUNNING) {
+                continue;
+            }
+            std::cout << "[Application] job " << progress.id << " " << progress.outputPath
+                      << " threads: " << progress.threads
+                      << " progress: " << static_cast<int>(progress.progress * 100) << "%"
+                      << " elapsed: " << progress.elapsed << " ms" << std::endl;
+        }
+    });
+
+    XTimeCounter counter;
+    counter.markStart();
+    scheduler.submit(std::move(jobs));
+    scheduler.waitAll();
+    counter.markEnd();
+
+    int failed = 0;
+    for (const auto& progress : scheduler.getProgress()) {
+        if (progress.state != EXPORT_JOB_SUCCEED) {
+            failed++;
+        }
+        std::cout << "[Application] job " << progress.id << " " << progress.outputPath
+                  << " state: " << progress.state << " elapsed: " << progress.elapsed << " ms" << std::endl;
+    }
+    std::cout << "[Application] runJobList " << scheduler.getWorkers() << " workers, total: "
+              << counter.getRunDuration() << " ms, failed: " << failed << std::endl;
+    return failed > 0 ? -1 : 0;
+}
+
+int main(int argc, char* argv[]) {
+    // XExporter --jobs jobs.txt [--workers N]
+    std::string jobList;
+    int workers = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--jobs" && i + 1 < argc) {
+            jobList = argv[++i];
+        } else if (arg == "--workers" && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        }
+    }
+    if (!jobList.empty()) {
+        return runJobList(jobList, workers) < 0 ? 1 : 0;
+    }
+
     testProducerReadPacket();
     return 0;
 }